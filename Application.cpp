@@ -1,8 +1,35 @@
-#include <iostream>         // cout, cerr
+#include <string>           // string, to_string
 #include <cstdlib>          // EXIT_FAILURE
+#include <thread>           // render thread
+#include <atomic>
+#include <chrono>           // software renderer benchmark
+#include <sys/stat.h>       // scene file modification times
 #include <GL/glew.h>        // GLEW library
 #include <GLFW/glfw3.h> 
+#include "glcapture.h"       // GL call recording for the replay tool (before any header that calls GL)
 #include "camera.h"// GLFW library
+#include "cameratrack.h"    // Recorded camera paths for repeatable profiling runs
+#include "glstate.h"        // Redundant GL state filtering
+#include "renderqueue.h"    // Sorted draw submission
+#include "streambuffer.h"   // Persistent mapped per-frame data
+#include "lod.h"            // Mesh simplification and LOD selection
+#include "profiler.h"       // CPU/GPU frame timing
+#include "logger.h"         // Asynchronous logging
+#include "jobsystem.h"      // Work stealing jobs and the per-frame task graph
+#include "triplebuffer.h"   // Lock-free handoff between the main and render threads
+#include "softrast.h"       // CPU rasterizer for headless rendering
+#include "dynres.h"         // Render resolution driven by GPU frame time
+#include "framecapture.h"   // Screenshots and video through asynchronous readback
+#include "picking.h"        // Object picking from an ID buffer
+#include "scene.h"          // Scene file and its baked, memory mapped form
+#include "framegraph.h"     // Render passes and pooled render targets
+#include "occlusion.h"      // Occlusion queries and conditional rendering
+#include "terrain.h"        // Streamed heightmap terrain with continuous level of detail
+#include "water.h"          // Wave simulation in a compute shader
+#include "vtexture.h"       // Virtual textures streamed by page from render feedback
+#include "environment.h"    // Image based lighting from a prefiltered, disk cached environment
+#include "ssao.h"           // Half resolution screen space ambient occlusion
+#include "taa.h"            // Temporal anti-aliasing and upscaling
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <GL/stb_image.h>      // Image loading Utility functions
@@ -31,13 +58,12 @@ namespace
     // Stores the GL data relative to a given mesh
     struct GLMesh
     {
-        GLuint VAO[5];         // Handle for the vertex array object
-        GLuint VBO[10];         // Handle for the vertex buffer object
-        GLuint nMonumentIndices;    // Number of indices of the mesh
-        GLuint nPlaneIndices;
-        GLuint nBuildingIndices;
-        GLuint nColumnIndices;
-        GLuint nPoolIndices;
+        vector<GLuint> VAO;         // Handle for the vertex array object of each scene mesh
+        vector<GLuint> VBO;         // Vertex and index buffer of each mesh, one after the other
+        vector<glm::vec3> boundsMin;    // Object space bounding box of each VAO
+        vector<glm::vec3> boundsMax;
+        vector<LODChain> lods;      // Simplified index ranges of each VAO, finest first
+        vector<const BakedMesh*> data;  // vertices and every level's indices, in the mapped scene
     };
 
     // Main GLFW window
@@ -47,13 +73,224 @@ namespace
     // Shader programs
     GLuint gSunProgramId;
     GLuint gSpotProgramId;
+    GLuint gDepthProgramId;
+    GLuint gTerrainProgramId;
+    GLuint gWaterSimulateProgramId;
+    GLuint gWaterProgramId;
+
+    // Every GL state change goes through here so no-op transitions never reach the driver
+    GLState gGLState;
+    // Depth-only prepass so the lighting shader runs at most once per pixel
+    bool gDepthPrepass = true;
+    // Fragments shaded per pixel, printed once per second
+    OverdrawCounter gOverdraw;
+    float gLastOverdrawReport = 0.0f;
+    // Objects found hidden behind others last frame are drawn on their occlusion query; C toggles it
+    OcclusionCuller gOcclusion;
+    bool gOcclusionCulling = true;
+    // Ground around the scene, if the scene file has one; it draws with its material's texture
+    Terrain gTerrain;
+    GLuint gTerrainTexture = 0;
+    // The pool's water, if the scene file has any, with the mirror image it reflects at half resolution
+    Water gWater;
+    GLuint gWaterTexture = 0;
+    // Object materials are virtual textures: the feedback pass finds the pages on screen and only those are
+    // loaded, so texture memory follows the screen's resolution. Terrain and water keep regular textures
+    VirtualTextureCache gVirtualTextures;
+    GLuint gFeedbackProgramId;
+    // Sky and ambient light of the scene, if the scene file has an environment, computed on the first run
+    EnvironmentLighting gEnvironment;
+    GLuint gSkyProgramId;
+    // Ambient occlusion from the depth prepass at half resolution; N toggles it, M its temporal accumulation
+    AmbientOcclusion gAmbientOcclusion;
+    GLuint gOcclusionProgramId;
+    GLuint gOcclusionBlurProgramId;
+    bool gSSAO = true;
+    bool gSSAOTemporal = true;
+    // Jittered frames blended over time at the window's resolution, from a scene drawn below it; X toggles it
+    TemporalAntiAliasing gTemporalAA;
+    GLuint gVelocityProgramId;
+    GLuint gResolveProgramId;
+    bool gTemporalAAEnabled = true;
+    glm::mat4 gRenderProjection;    // of the frame being drawn, with the jitter
+    // Far enough for the terrain's horizon
+    const float FAR_PLANE = 1000.0f;
+
+    // Ring of persistently mapped memory for everything written per frame
+    StreamBuffer gStreamBuffer;
+    // Lamp markers and orbit, streamed through gStreamBuffer
+    GLuint gDebugLineVAO;
+    bool gShowDebugLines = false;
+
+    // Chooses each object's level of detail from its projected error
+    LODSelector gLODSelector;
+
+    // CPU and GPU scope timings, shown as bars and in the window title
+    Profiler gProfiler;
+    GLuint gOverlayProgramId;
+    GLuint gOverlayVAO;
+    bool gShowProfilerOverlay = false;
+    const char* const TRACE_FILENAME = "trace.json";
+
+    // Camera paths: R records one from live input, --playback flies it again at a fixed timestep and writes
+    // the timings of every frame next to the pose it was drawn from
+    CameraTrack gCameraTrack;
+    bool gRecordingCameraPath = false;
+    float gCameraPathStart = 0.0f;
+    const char* const CAMERA_PATH_FILENAME = "camera_path.txt";
+    const char* const CAMERA_TIMINGS_FILENAME = "camera_path_timings.csv";
+    const float PLAYBACK_TIMESTEP = 1.0f / 60.0f;
+    int gPlaybackFrames = 0;        // frames to play back, 0 when not playing back
+    int gPlaybackFrame = 0;         // next frame the main thread simulates
+
+    struct PlaybackTiming
+    {
+        CameraPose Pose;
+        double SimulateMs = 0.0;    // main thread: frame tasks and snapshot
+        double RenderMs = 0.0;      // render thread: submission through swap
+        double IntervalMs = 0.0;    // render thread: since the previous frame started
+        double GpuMs = -1.0;        // GPU scopes of the frame, -1 if its queries weren't ready in time
+    };
+    vector<PlaybackTiming> gPlaybackTimings;    // one per playback frame
+
+    // The scene is drawn offscreen at a fraction of the window's resolution that the controller picks from
+    // measured GPU time, then scaled up to the window with sharpening. V toggles it; off renders at full size,
+    // or at the temporal anti-aliasing's fixed scale while that is on
+    ResolutionController gResolution;
+    bool gDynamicResolution = true;
+    GLuint gUpscaleProgramId;
+    GLuint gEmptyVAO;               // the upscale triangle is generated from gl_VertexID
+
+    // What each render thread frame in flight was drawn with, looked up when its GPU times come back
+    struct RenderFrameInfo
+    {
+        int PlaybackFrame;
+        float Scale;
+    };
+    RenderFrameInfo gRenderFrames[Profiler::FRAME_LATENCY * 2];
+    float gRenderScale = 1.0f;      // of the frame being drawn
+
+    // F12 saves a screenshot, F9 starts and stops recording video. Files are numbered per run
+    FrameCapture gFrameCapture;
+    const int VIDEO_FPS = 60;
+    int gScreenshotCount = 0;
+    int gVideoCount = 0;
+
+    // Left click selects the object under the cursor. The opaque pass writes index + 1 of each object to the
+    // scene target's ID attachment, the render thread reads the clicked pixel back without waiting and hands
+    // the ID to the main thread, which owns the selection
+    ObjectPicker gPicker;
+    bool gPickRequested = false;
+    glm::vec2 gPickPosition;            // in the window, 0 to 1 from the bottom left
+    atomic<int> gPickResult{ -1 };      // ID of the last finished pick, -1 once taken
+    int gSelectedObject = -1;           // index into gObjects
+
+    // Every render pass and the targets it draws to are declared to the frame graph each frame; targets come
+    // from the pool, which shares them between passes whose targets are never alive at the same time
+    FrameGraph gFrameGraph;
+    RenderTargetPool gTargetPool;
+
+    // Transforms, culling, LOD selection and the draw list are built by tasks spread over every core;
+    // only the GL submission that follows stays on the main thread
+    JobSystem gJobs;
+    TaskGraph gFrameTasks;
+
+    // Scene objects as parallel arrays, so the frame tasks can split them into ranges
+    struct SceneObjects
+    {
+        vector<int> Mesh;               // index into the GLMesh arrays
+        vector<GLuint> Texture;
+        vector<int> Material;           // index into gMaterialTextures, also the material's sort key id
+        vector<glm::mat4> Model;
+        vector<glm::vec3> Center;       // world space bounding sphere, written by the transform task
+        vector<float> Radius;
+        vector<unsigned char> Visible;  // written by the culling task
+        vector<int> LODLevel;           // written by the LOD task, last frame's value gives hysteresis
+    };
+    SceneObjects gObjects;
+
+    // Everything the render thread needs to draw one frame. The main thread fills one in and publishes it,
+    // after which it is only read
+    struct FrameSnapshot
+    {
+        static const int MAX_MAIN_SCOPES = 8;
+
+        glm::mat4 View;
+        glm::mat4 Projection;
+        glm::vec3 CameraPosition;
+        glm::vec3 LightPosition1;
+        glm::vec3 LightPosition2;
+        RenderQueue Queue;              // opaque draws, sorted by 64 bit state/depth keys
+        int Width, Height;              // framebuffer size
+        float DeltaTime;                // seconds simulated since the last snapshot
+        bool DepthPrepass;
+        bool SSAO;                      // needs the depth prepass
+        bool SSAOTemporal;
+        bool TemporalAA;
+        bool OcclusionCulling;
+        bool ShowDebugLines;
+        bool ShowProfilerOverlay;
+        bool DynamicResolution;
+        bool ToggleTrace;               // start or stop the Chrome trace capture
+        bool Screenshot;                // save this frame
+        bool ToggleVideo;               // start or stop recording video
+        bool Pick;                      // read the object ID at PickPosition
+        glm::vec2 PickPosition;
+        GLuint SelectedObjectId;        // highlighted, 0 for none
+        int PlaybackFrame;              // index into gPlaybackTimings, -1 outside camera path playback
+        GLuint ObjectCount, VisibleObjects;
+        GLuint DrawnTriangles, FullTriangles;
+        int MainScopeCount;             // main thread timings, added to the render thread's profiler frame
+        Profiler::Scope MainScopes[MAX_MAIN_SCOPES];
+    };
+
+    // The main thread handles events, input and simulation while the render thread, which owns the GL
+    // context, draws the previous frame. Snapshots go one way and window titles the other, since GLFW
+    // only allows glfwSetWindowTitle on the main thread.
+    TripleBuffer<FrameSnapshot> gSnapshots;
+    TripleBuffer<string> gWindowTitles;
+    thread gRenderThread;
+    atomic<bool> gRenderThreadRunning{ false };
+
+    // Set by UResizeWindow, applied by the render thread through the snapshot
+    int gFramebufferWidth = 800;
+    int gFramebufferHeight = 600;
+    bool gToggleTraceRequested = false;
+    bool gScreenshotRequested = false;
+    bool gToggleVideoRequested = false;
+
+    // CPU rendering for machines without a GPU (--software); textures are indexed by the texture ids
+    SoftRasterizer gSoftRasterizer;
+    vector<SoftTexture> gSoftTextures;
+
+    // Everything the frame tasks read about the camera, set on the main thread before they run
+    struct FrameParameters
+    {
+        glm::mat4 View;
+        glm::mat4 Projection;
+        glm::vec3 CameraPosition;
+        float FieldOfView;      // vertical, in radians; perspective only
+        bool Perspective;
+        int ViewportHeight;
+        FrameSnapshot* Snapshot;    // receives the draw list
+    };
+    FrameParameters gFrame;
+
+    // Looked up once, the tasks can't call OpenGL
+    GLint gSunModelLocation;
+    GLint gSunObjectIdLocation;
+    GLint gDepthModelLocation;
 
 
     glm::vec2 gUVScale(2.0f, 2.0f); //tex scale
 
-    //Textures
-    const char* texFilename;
-    GLuint marbleTex, grassTex, waterTex, monumentTex;
+    // The scene comes from a text file, baked on first use into a binary snapshot that loads by mapping it
+    const char* const SCENE_FILENAME = "res/scene.txt";
+    const char* const BAKED_SCENE_FILENAME = "res/scene.bin";
+    MappedScene gScene;
+
+    //Textures, one per scene material
+    vector<GLuint> gMaterialTextures;
 
     // camera
     Camera gCamera(glm::vec3(0.0f, 0.0f, 3.0f));
@@ -66,7 +303,7 @@ namespace
     float gDeltaTime = 0.0f; // time between current frame and last frame
     float gLastFrame = 0.0f;
 
-    // lighting global variables
+    // lighting global variables, replaced by the scene's when it loads
     //--------------------------
     // light 1
     glm::vec3 gLightPosition1(10.0f, 0.0f, -20.0f);
@@ -97,12 +334,44 @@ void UProcessInput(GLFWwindow* window);
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
+bool ULoadScene();
+bool UBakeScene(const char* sourceFilename, const char* bakedFilename);
+bool UIsNewer(const char* filename, const char* thanFilename);
 void UCreateMesh(GLMesh& mesh);
 void UDestroyMesh(GLMesh& mesh);
-void URender();
+void USimulate(FrameSnapshot& snapshot);
+void URecordMainScope(FrameSnapshot& snapshot, const char* name, double startMs);
+bool UStartPlayback(const char* filename, int frames);
+void UWritePlaybackTimings();
+double UGpuFrameMs(const vector<Profiler::Scope>& scopes);
+void URenderThread();
+void URender(const FrameSnapshot& frame);
+void UDrawDepthPrepass(const FrameSnapshot& frame);
+void UDrawScene(const FrameSnapshot& frame, int width, int height, const FrameGraph& graph, RenderResource waterReflection,
+    RenderResource ambientOcclusion);
+void USetAmbientOcclusion(GLuint texture, int width, int height);
+void USetSceneUniforms(GLuint programId, const FrameSnapshot& frame, const glm::mat4& view, const glm::vec3& cameraPosition);
+void UDrawTerrain(const FrameSnapshot& frame, const glm::mat4& view, const glm::vec3& cameraPosition);
+void UDrawWaterReflection(const FrameSnapshot& frame);
+bool UCreateTerrain();
+bool UOpenTerrain(const char* path);
+bool UCreateWater();
+bool UCreateEnvironment();
+bool UCreateComputeProgram(const char* computeShaderSource, GLuint& programId);
+void UDrawDebugLines(const FrameSnapshot& frame);
+void UDrawProfilerOverlay();
 bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
 void UDestroyShaderProgram(GLuint programId);
 bool UCreateTexture(const char* filename, GLuint& textureId);
+bool UCreateVirtualTexture(const char* filename, GLuint& tableId);
+void flipImageVertically(unsigned char* image, int width, int height, int channels);
+int URenderSoftware(const char* filename, int frames);
+bool UCreateSoftwareTexture(const char* filename, SoftTexture& texture);
+void UCreateSceneObjects();
+void UCreateFrameTasks();
+void UUpdateLights(float deltaTime);
+void UExtractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6]);
+bool USphereInFrustum(const glm::vec4 planes[6], const glm::vec3& center, float radius);
 
 
 const GLchar* sunVertexShaderSource = GLSL(440,
@@ -114,15 +383,18 @@ layout(location = 2) in vec2 textureCoordinate;
 out vec3 vertexNormal; // For outgoing normals to fragment shader
 out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
 out vec2 vertexTextureCoordinate;
+invariant gl_Position; // Must match the depth prepass bit for bit so GL_LEQUAL passes
 
 //Uniform / Global variables for the  transform matrices
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform vec4 clipPlane; // world space; with GL_CLIP_DISTANCE0 on, only its positive side is drawn
 
 void main()
 {
     gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
+    gl_ClipDistance[0] = dot(model * vec4(position, 1.0f), clipPlane);
 
     vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
 
@@ -138,7 +410,8 @@ const GLchar* sunFragmentShaderSource = GLSL(440,
 in vec3 vertexFragmentPos; // For incoming fragment position
 in vec2 vertexTextureCoordinate;
 
-out vec4 fragmentColor; // For outgoing cube color to the GPU
+layout(location = 0) out vec4 fragmentColor; // For outgoing cube color to the GPU
+layout(location = 1) out uint fragmentObjectId; // For picking
 
 // Uniform / Global variables for object color, light color, light position, and camera/view position
 uniform vec3 lightPos1;
@@ -154,12 +427,94 @@ uniform sampler2D uTexture; // Useful when working with multiple textures
 uniform sampler2D uTextureExtra;
 uniform bool multipleTextures;
 uniform vec2 uvScale;
+uniform uint objectId;
+uniform uint selectedObject; // tinted to show the selection
+uniform bool virtualTexture; // uTexture is then the page table of a virtual texture whose pages are in pageCache
+uniform sampler2D pageCache;
+uniform bool environmentLighting; // the environment (see environment.h) replaces the constant ambient
+uniform vec4 irradiance[9]; // spherical harmonics of the cosine convolved environment, in rgb
+uniform samplerCube specularEnvironment; // prefiltered, roughness 0 to 1 over its mip levels
+uniform sampler2D brdfTable; // scale and bias of F0 by N.V and roughness
+uniform mat4 environmentFromWorld;
+uniform float environmentIntensity;
+uniform bool ambientOcclusion; // occlusion then holds the half resolution result of ssao.h
+uniform sampler2D occlusion; // r occlusion, g linear depth
+uniform vec2 occlusionMaxTexel; // last one drawn
+uniform mat4 view;
 //uniform vec3 objectColor;
 
+const float PAGE_SIZE = 128.0; // VirtualTextureCache::PAGE_SIZE and BORDER
+const float PAGE_BORDER = 1.0;
+const float ROUGHNESS = 0.47; // GGX roughness whose lobe is about as wide as the Phong highlight below
+const float F0 = 0.04; // reflectance head on, for dielectrics
+
+// Color of a virtual texture from the finest resident page at or above the level the derivatives ask for
+vec4 virtualTextureColor(vec2 uv)
+{
+    ivec2 pages = textureSize(uTexture, 0);
+    int levels = textureQueryLevels(uTexture);
+    vec2 texels = uv * vec2(pages) * PAGE_SIZE;
+    vec2 dx = dFdx(texels);
+    vec2 dy = dFdy(texels);
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8));
+    vec2 mirrored = 1.0 - abs(mod(uv, 2.0) - 1.0); // GL_MIRRORED_REPEAT, like the regular textures
+    vec2 cacheTexel = 1.0 / vec2(textureSize(pageCache, 0));
+    for (int level = clamp(int(floor(lod + 0.5)), 0, levels - 1); level < levels; ++level)
+    {
+        vec2 levelPages = vec2(max(pages >> level, ivec2(1)));
+        vec2 position = mirrored * levelPages;
+        ivec2 page = min(ivec2(position), ivec2(levelPages) - 1);
+        vec4 entry = texelFetch(uTexture, page, level);
+        if (entry.a > 0.5)
+        {
+            vec2 slot = floor(entry.rg * 255.0 + 0.5);
+            vec2 texel = slot * (PAGE_SIZE + 2.0 * PAGE_BORDER) + PAGE_BORDER + (position - vec2(page)) * PAGE_SIZE;
+            return textureLod(pageCache, texel * cacheTexel, 0.0);
+        }
+    }
+    return vec4(0.0); // the coarsest page is always resident
+}
+
+// Light arriving at a surface facing n from the whole environment, n in environment space
+vec3 environmentIrradiance(vec3 n)
+{
+    return (irradiance[0] * 0.282095
+        + irradiance[1] * 0.488603 * n.y + irradiance[2] * 0.488603 * n.z + irradiance[3] * 0.488603 * n.x
+        + irradiance[4] * 1.092548 * n.x * n.y + irradiance[5] * 1.092548 * n.y * n.z
+        + irradiance[6] * 0.315392 * (3.0 * n.z * n.z - 1.0)
+        + irradiance[7] * 1.092548 * n.x * n.z + irradiance[8] * 0.546274 * (n.x * n.x - n.y * n.y)).rgb;
+}
+
+// Joint bilateral upsampling of the occlusion: the four half resolution texels around the pixel, weighted
+// bilinearly and by how close their depth is to the fragment's
+float ambientOcclusionFactor()
+{
+    float linearDepth = -(view * vec4(vertexFragmentPos, 1.0)).z;
+    vec2 position = gl_FragCoord.xy * 0.5 - 0.5;
+    ivec2 base = ivec2(floor(position));
+    vec2 fraction = position - vec2(base);
+    float sum = 0.0;
+    float total = 0.0;
+    for (int i = 0; i < 4; ++i)
+    {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        vec2 value = texelFetch(occlusion, clamp(base + offset, ivec2(0), ivec2(occlusionMaxTexel)), 0).rg;
+        vec2 bilinear = mix(1.0 - fraction, fraction, vec2(offset));
+        float weight = bilinear.x * bilinear.y / (abs(value.g - linearDepth) / linearDepth + 0.01);
+        sum += value.r * weight;
+        total += weight;
+    }
+    return total > 0.0 ? sum / total : 1.0;
+}
+
 void main()
 {
     // Texture holds the color to be used for all three components of Phong lighting model
-    vec4 textureColor = texture(uTexture, vertexTextureCoordinate * uvScale);
+    vec4 textureColor;
+    if (virtualTexture)
+        textureColor = virtualTextureColor(vertexTextureCoordinate * uvScale);
+    else
+        textureColor = texture(uTexture, vertexTextureCoordinate * uvScale);
     // if there is a second image
     if (multipleTextures) {
         // find the color of the second texture based on this fragment's tex coord 
@@ -208,11 +563,68 @@ void main()
     // add first and second light speculars
     specular += light_2_strength * (specularIntensity * specularComponent * lightColor2);
 
+    // ENVIRONMENT:
+    //-------------
+    // irradiance instead of the ambient terms, and the split sum approximation of its specular reflection
+    vec3 environmentSpecular = vec3(0.0);
+    if (environmentLighting)
+    {
+        vec3 environmentNormal = normalize(mat3(environmentFromWorld) * norm);
+        vec3 environmentReflection = normalize(mat3(environmentFromWorld) * reflect(-viewDir, norm));
+        ambient = environmentIntensity * environmentIrradiance(environmentNormal);
+        float levels = float(textureQueryLevels(specularEnvironment));
+        vec3 prefiltered = textureLod(specularEnvironment, environmentReflection, ROUGHNESS * (levels - 1.0)).rgb;
+        vec2 brdf = texture(brdfTable, vec2(max(dot(norm, viewDir), 0.0), ROUGHNESS)).rg;
+        environmentSpecular = environmentIntensity * specularIntensity * prefiltered * (F0 * brdf.x + brdf.y);
+    }
+    if (ambientOcclusion)
+    {
+        float visibility = ambientOcclusionFactor();
+        ambient *= visibility;
+        environmentSpecular *= visibility;
+    }
+
     // CALCULATE PHONG RESULT
     //-----------------------
-    vec3 phong = (ambient + diffuse + specular) * textureColor.xyz;
+    vec3 phong = (ambient + diffuse + specular) * textureColor.xyz + environmentSpecular;
+    if (objectId != 0u && objectId == selectedObject)
+        phong = mix(phong, vec3(1.0f, 0.8f, 0.2f), 0.35f);
 
     fragmentColor = vec4(phong, 1.0); // Send lighting results to GPU
+    fragmentObjectId = objectId;
+}
+);
+
+
+/* Virtual texture feedback: the page and level of its virtual texture each pixel samples, packed like
+   VirtualTextureCache names pages. Drawn at a fraction of the resolution, which lodBias makes up for */
+const GLchar* feedbackFragmentShaderSource = GLSL(440,
+    in vec3 vertexNormal;
+in vec3 vertexFragmentPos;
+in vec2 vertexTextureCoordinate;
+
+layout(location = 0) out uint fragmentPage;
+
+uniform sampler2D pageTable;
+uniform vec2 uvScale;
+uniform uint textureIndex; // 1 based, 0 is left by the clear
+uniform float lodBias;
+
+const float PAGE_SIZE = 128.0; // VirtualTextureCache::PAGE_SIZE
+
+void main()
+{
+    vec2 uv = vertexTextureCoordinate * uvScale;
+    ivec2 pages = textureSize(pageTable, 0);
+    int levels = textureQueryLevels(pageTable);
+    vec2 texels = uv * vec2(pages) * PAGE_SIZE;
+    vec2 dx = dFdx(texels);
+    vec2 dy = dFdy(texels);
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8)) + lodBias;
+    int level = clamp(int(floor(lod + 0.5)), 0, levels - 1);
+    vec2 levelPages = vec2(max(pages >> level, ivec2(1)));
+    ivec2 page = min(ivec2((1.0 - abs(mod(uv, 2.0) - 1.0)) * levelPages), ivec2(levelPages) - 1);
+    fragmentPage = textureIndex << 28 | uint(level) << 24 | uint(page.y) << 12 | uint(page.x);
 }
 );
 
@@ -246,987 +658,2846 @@ void main()
 );
 
 
-int main(int argc, char* argv[])
+/* Depth Prepass Shader Source Code*/
+const GLchar* depthVertexShaderSource = GLSL(440,
+
+    layout(location = 0) in vec3 position; // VAP position 0 for vertex position data
+invariant gl_Position; // Same transform as the sun shader so depth values are identical
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+void main()
 {
-    if (!UInitialize(argc, argv, &gWindow))
-        return EXIT_FAILURE;
+    gl_Position = projection * view * model * vec4(position, 1.0f);
+}
+);
 
-    // Create the mesh
-    UCreateMesh(gMesh); // Calls the function to create the Vertex Buffer Object
 
-    // Create the shader program
-    if (!UCreateShaderProgram(sunVertexShaderSource, sunFragmentShaderSource, gSunProgramId))
-        return EXIT_FAILURE;
+const GLchar* depthFragmentShaderSource = GLSL(440,
 
-    if (!UCreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource, gSpotProgramId))
-        return EXIT_FAILURE;
+void main()
+{
+    // Depth only, color writes are masked off during the prepass
+}
+);
 
-    // Sets the background color of the window to black (it will be implicitely used by glClear)
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
-    texFilename = "res/marble.png";
-    if (!UCreateTexture(texFilename, marbleTex))
-    {
-        cout << "Failed to load texture " << texFilename << endl;
-        return EXIT_FAILURE;
-    }
-    else {
-        cout << "Texture created successfully" << endl;
-    }
+/* Terrain Vertex Shader Source Code*/
+// Draws one CDLOD node (see terrain.h) and lights it with the sun fragment shader
+const GLchar* terrainVertexShaderSource = GLSL(440,
 
-    texFilename = "res/grass.jpg";
-    if (!UCreateTexture(texFilename, grassTex))
-    {
-        cout << "Failed to load texture " << texFilename << endl;
-        return EXIT_FAILURE;
-    }
-    else {
-        cout << "Texture created successfully" << endl;
-    }
+    layout(location = 0) in vec2 gridPosition; // 0 to 1 across the node
 
-    texFilename = "res/water.png";
-    if (!UCreateTexture(texFilename, waterTex))
-    {
-        cout << "Failed to load texture " << texFilename << endl;
-        return EXIT_FAILURE;
-    }
-    else {
-        cout << "Texture created successfully" << endl;
-    }
+out vec3 vertexNormal;
+out vec3 vertexFragmentPos;
+out vec2 vertexTextureCoordinate;
 
-    texFilename = "res/offwhite.jpg";
-    if (!UCreateTexture(texFilename, monumentTex))
-    {
-        cout << "Failed to load texture " << texFilename << endl;
-        return EXIT_FAILURE;
-    }
-    else {
-        cout << "Texture created successfully" << endl;
-    }
+uniform mat4 model; // terrain space (x and y across, z up) to world
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec4 clipPlane; // as in the sun vertex shader
+uniform vec3 cameraPosition; // terrain space
+uniform vec2 nodeOrigin;
+uniform float nodeSize;
+uniform vec2 morphRange; // distances where the node starts and finishes morphing into the next level
+uniform float gridSize; // quads along a node edge
+uniform int tileLayer; // layer of the tile with the node's heights, -1 for the overview
+uniform vec2 tileOrigin;
+uniform vec2 terrainOrigin;
+uniform float spacing; // between height samples
+uniform float tileSamples;
+uniform float overviewStep;
+uniform float overviewSamples;
+uniform vec2 heightRange;
+uniform sampler2D overview;
+uniform sampler2DArray tiles;
+
+float Height(vec2 p)
+{
+    float value;
+    if (tileLayer >= 0)
+        value = textureLod(tiles, vec3(((p - tileOrigin) / spacing + 0.5) / tileSamples, float(tileLayer)), 0.0).r;
+    else
+        value = textureLod(overview, ((p - terrainOrigin) / (spacing * overviewStep) + 0.5) / overviewSamples, 0.0).r;
+    return mix(heightRange.x, heightRange.y, value);
+}
 
+void main()
+{
+    // Odd vertices slide onto the next level's grid as the distance approaches the end of this level's range
+    vec2 position = nodeOrigin + gridPosition * nodeSize;
+    float distanceToCamera = distance(vec3(position, Height(position)), cameraPosition);
+    float morph = clamp((distanceToCamera - morphRange.x) / (morphRange.y - morphRange.x), 0.0, 1.0);
+    vec2 odd = fract(gridPosition * gridSize * 0.5) * 2.0;
+    position -= odd * morph * nodeSize / gridSize;
+    float height = Height(position);
+
+    // Normal from the slope, over the node's vertex spacing
+    float step = max(spacing, nodeSize / gridSize);
+    float slopeX = Height(position + vec2(step, 0.0)) - Height(position - vec2(step, 0.0));
+    float slopeY = Height(position + vec2(0.0, step)) - Height(position - vec2(0.0, step));
+    vec3 normal = normalize(vec3(-slopeX, -slopeY, 2.0 * step));
+
+    vec4 world = model * vec4(position, height, 1.0);
+    gl_Position = projection * view * world;
+    gl_ClipDistance[0] = dot(world, clipPlane);
+    vertexFragmentPos = vec3(world);
+    vertexNormal = mat3(transpose(inverse(model))) * normal;
+    vertexTextureCoordinate = position / 30.0; // the old ground plane's texture density
+}
+);
 
-    // Tell OpenGL for each sampler which texture unit it belongs to (only has to be done once).
-    glUseProgram(gSunProgramId);
-    // We set the texture as texture unit 0.
-    glUniform1i(glGetUniformLocation(gSunProgramId, "marbleTex"), 0);
-    glUniform1i(glGetUniformLocation(gSunProgramId, "grassTex"), 1);
-    glUniform1i(glGetUniformLocation(gSunProgramId, "waterTex"), 2);
-    glUniform1i(glGetUniformLocation(gSunProgramId, "monumentTex"), 3);
 
+/* Water Simulation Compute Shader Source Code*/
+// One step of the wave equation per dispatch, see water.h. The local size matches Water::WORK_GROUP
+const GLchar* waterSimulateShaderSource = GLSL(440,
 
+    layout(local_size_x = 8, local_size_y = 8) in;
 
-    // render loop
-    // -----------
-    while (!glfwWindowShouldClose(gWindow))
-    {
-        // per-frame timing
-        // --------------------
-        float currentFrame = glfwGetTime();
-        gDeltaTime = currentFrame - gLastFrame;
-        gLastFrame = currentFrame;
+layout(rg32f, binding = 0) uniform readonly image2D previous; // r: height, g: height one step earlier
+layout(rg32f, binding = 1) uniform writeonly image2D next;
 
-        // input
-        // -----
-        UProcessInput(gWindow);
+uniform float courant; // (wave speed * step / cell size)^2
+uniform float damping;
+uniform vec3 drop; // cell and height of a raindrop landing this step, height 0 for none
+uniform float dropRadius; // in cells
 
-        // Render this frame
-        URender();
+float Height(ivec2 cell)
+{
+    // cells past the edge repeat the edge, which reflects the waves back like a wall
+    return imageLoad(previous, clamp(cell, ivec2(0), imageSize(previous) - 1)).r;
+}
 
-        glfwPollEvents();
-    }
+void main()
+{
+    ivec2 cell = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(previous);
+    if (cell.x >= size.x || cell.y >= size.y)
+        return;
 
-    // Release mesh data
-    UDestroyMesh(gMesh);
+    vec2 state = imageLoad(previous, cell).rg;
+    float neighbors = Height(cell + ivec2(1, 0)) + Height(cell - ivec2(1, 0)) + Height(cell + ivec2(0, 1)) + Height(cell - ivec2(0, 1));
+    float height = (2.0 * state.r - state.g + courant * (neighbors - 4.0 * state.r)) * damping;
 
-    // Release shader program
-    UDestroyShaderProgram(gSunProgramId);
+    // a smooth bump where the drop lands
+    float fromDrop = distance(vec2(cell), drop.xy) / dropRadius;
+    height += drop.z * max(1.0 - fromDrop * fromDrop, 0.0);
 
-    exit(EXIT_SUCCESS); // Terminates the program successfully
+    imageStore(next, cell, vec4(height, state.r, 0.0, 0.0));
 }
+);
 
 
-// Initialize GLFW, GLEW, and create a window
-bool UInitialize(int argc, char* argv[], GLFWwindow** window)
-{
-    // GLFW: initialize and configure
-    // ------------------------------
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+/* Water Vertex Shader Source Code*/
+// The surface grid comes from gl_VertexID, one vertex per simulation cell
+const GLchar* waterVertexShaderSource = GLSL(440,
 
-#ifdef __APPLE__
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-#endif
+    out vec3 vertexNormal;
+out vec3 vertexFragmentPos;
+out vec2 vertexTextureCoordinate;
+out vec2 waveSlope; // water space, for bending the reflection
 
-    // GLFW: window creation
-    // ---------------------
-    * window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
-    if (*window == NULL)
-    {
-        std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return false;
-    }
-    glfwMakeContextCurrent(*window);
-    glfwSetFramebufferSizeCallback(*window, UResizeWindow);
-    glfwSetCursorPosCallback(*window, UMousePositionCallback);
-    glfwSetScrollCallback(*window, UMouseScrollCallback);
-    glfwSetMouseButtonCallback(*window, UMouseButtonCallback);
+uniform mat4 model; // water space (x and y across, z up) to world
+uniform mat4 view;
+uniform mat4 projection;
+uniform sampler2D heights; // the latest simulation step
+uniform vec2 cells; // columns and rows
+uniform vec2 waterOrigin;
+uniform vec2 cellSize;
+uniform float waterHeight; // at rest
 
-    glewExperimental = GL_TRUE;
-    GLenum GlewInitResult = glewInit();
+// two triangles per quad of cells
+const ivec2 corners[6] = ivec2[6](ivec2(0, 0), ivec2(1, 0), ivec2(0, 1), ivec2(0, 1), ivec2(1, 0), ivec2(1, 1));
 
-    if (GLEW_OK != GlewInitResult)
-    {
-        std::cerr << glewGetErrorString(GlewInitResult) << std::endl;
-        return false;
-    }
+float Height(ivec2 cell)
+{
+    return texelFetch(heights, clamp(cell, ivec2(0), ivec2(cells) - 1), 0).r;
+}
 
-    return true;
+void main()
+{
+    int quadsPerRow = int(cells.x) - 1;
+    int quad = gl_VertexID / 6;
+    ivec2 cell = ivec2(quad % quadsPerRow, quad / quadsPerRow) + corners[gl_VertexID % 6];
+
+    float slopeX = (Height(cell + ivec2(1, 0)) - Height(cell - ivec2(1, 0))) / (2.0 * cellSize.x);
+    float slopeY = (Height(cell + ivec2(0, 1)) - Height(cell - ivec2(0, 1))) / (2.0 * cellSize.y);
+    vec3 position = vec3(waterOrigin + vec2(cell) * cellSize, waterHeight + Height(cell));
+
+    vec4 world = model * vec4(position, 1.0);
+    gl_Position = projection * view * world;
+    vertexFragmentPos = vec3(world);
+    vertexNormal = mat3(transpose(inverse(model))) * normalize(vec3(-slopeX, -slopeY, 1.0));
+    vertexTextureCoordinate = vec2(cell) / (cells - 1.0);
+    waveSlope = vec2(slopeX, slopeY);
 }
+);
 
 
-// process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
-void UProcessInput(GLFWwindow* window)
+/* Water Fragment Shader Source Code*/
+// Mixes the water's own color with the mirror image of the scene by the Fresnel term
+const GLchar* waterFragmentShaderSource = GLSL(440,
+    in vec3 vertexNormal;
+in vec3 vertexFragmentPos;
+in vec2 vertexTextureCoordinate;
+in vec2 waveSlope;
+
+layout(location = 0) out vec4 fragmentColor;
+layout(location = 1) out uint fragmentObjectId;
+
+uniform vec3 lightPos1;
+uniform vec3 lightColor1;
+uniform vec3 lightPos2;
+uniform vec3 lightColor2;
+uniform float light_2_strength;
+uniform vec3 ambientStrength;
+uniform float specularIntensity;
+uniform vec3 viewPosition;
+uniform sampler2D uTexture; // the water material, its color looking straight down
+uniform vec2 uvScale;
+uniform sampler2D reflection;
+uniform vec2 reflectionScale; // gl_FragCoord to reflection texture coordinates
+uniform vec2 reflectionMax; // the part of the reflection that was drawn
+
+void main()
 {
-    static const float cameraSpeed = 2.5f;
+    vec3 normal = normalize(vertexNormal);
+    vec3 viewDirection = normalize(viewPosition - vertexFragmentPos);
 
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
-        glfwSetWindowShouldClose(window, true);
+    // Schlick's approximation, with water reflecting 2% head on
+    float fresnel = 0.02 + 0.98 * pow(1.0 - max(dot(normal, viewDirection), 0.0), 5.0);
 
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(FORWARD, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(BACKWARD, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(LEFT, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(RIGHT, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(DOWN, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(UP, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
-        ortho = !ortho;
+    // the waves bend the reflection
+    vec2 uv = clamp(gl_FragCoord.xy * reflectionScale + waveSlope * 0.05, vec2(0.0), reflectionMax);
+    vec3 reflected = texture(reflection, uv).rgb;
 
-    static bool isLKeyDown = false;
-    if (glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS && !gIsLampOrbiting)
-        gIsLampOrbiting = true;
-    else if (glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS && gIsLampOrbiting)
-        gIsLampOrbiting = false;
-   
-}
+    vec3 lightDirection1 = normalize(lightPos1 - vertexFragmentPos);
+    vec3 lightDirection2 = normalize(lightPos2 - vertexFragmentPos);
+    vec3 diffuse = max(dot(normal, lightDirection1), 0.0) * lightColor1
+        + light_2_strength * max(dot(normal, lightDirection2), 0.0) * lightColor2;
+    vec3 body = texture(uTexture, vertexTextureCoordinate * uvScale).rgb * (ambientStrength + diffuse);
 
+    // water is much glossier than the other materials
+    float highlight1 = pow(max(dot(viewDirection, reflect(-lightDirection1, normal)), 0.0), 128.0);
+    float highlight2 = pow(max(dot(viewDirection, reflect(-lightDirection2, normal)), 0.0), 128.0);
+    vec3 specular = specularIntensity * (highlight1 * lightColor1 + light_2_strength * highlight2 * lightColor2);
 
-// glfw: whenever the window size changed (by OS or user resize) this callback function executes
-void UResizeWindow(GLFWwindow* window, int width, int height)
-{
-    glViewport(0, 0, width, height);
+    fragmentColor = vec4(mix(body, reflected, fresnel) + specular, 1.0);
+    fragmentObjectId = 0u; // not pickable
 }
+);
 
 
-// glfw: whenever the mouse moves, this callback is called
-// -------------------------------------------------------
-void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
-{
-    if (gFirstMouse)
-    {
-        gLastX = xpos;
-        gLastY = ypos;
-        gFirstMouse = false;
-    }
+/* Environment Sky Compute Shader Source Code*/
+// The sky cube map of the environment (see environment.h), one invocation per texel of a face, from the
+// equirectangular source or a procedural sky. The local size matches EnvironmentLighting::WORK_GROUP
+const GLchar* environmentSkyShaderSource = GLSL(440,
 
-    float xoffset = xpos - gLastX;
-    float yoffset = gLastY - ypos; // Reversed since y-coordinates go from bottom to top
+    layout(local_size_x = 8, local_size_y = 8) in;
 
-    gLastX = xpos;
-    gLastY = ypos;
+layout(rgba16f, binding = 0) uniform writeonly imageCube sky;
 
-    gCamera.ProcessMouseMovement(xoffset, yoffset);
+uniform sampler2D equirect; // zenith in the first row, longitude along the rows
+uniform bool procedural;
+
+const float PI = 3.14159265;
+const vec3 ZENITH = vec3(0.18, 0.36, 0.8);
+const vec3 HORIZON = vec3(0.75, 0.82, 0.9);
+const vec3 GROUND = vec3(0.3, 0.27, 0.24);
+const vec3 SUN = normalize(vec3(0.3, -0.6, 0.45));
+const vec3 SUN_COLOR = vec3(1.0, 0.9, 0.75);
+const float HALF_MAX = 60000.0; // below the largest half float
+
+// Environment space direction through the center of a cube map texel
+vec3 CubeDirection(ivec3 texel, int size)
+{
+    vec2 st = (vec2(texel.xy) + 0.5) / float(size) * 2.0 - 1.0;
+    vec3 directions[6] = vec3[6](vec3(1.0, -st.y, -st.x), vec3(-1.0, -st.y, st.x), vec3(st.x, 1.0, st.y),
+        vec3(st.x, -1.0, -st.y), vec3(st.x, -st.y, 1.0), vec3(-st.x, -st.y, -1.0));
+    return normalize(directions[texel.z]);
 }
 
+vec3 ProceduralSky(vec3 direction)
+{
+    vec3 color = direction.z >= 0.0 ? mix(HORIZON, ZENITH, sqrt(direction.z)) : mix(HORIZON, GROUND, min(-direction.z * 4.0, 1.0));
+    float toSun = max(dot(direction, SUN), 0.0);
+    return color + SUN_COLOR * (pow(toSun, 8.0) * 0.4 + pow(toSun, 3000.0) * 60.0);
+}
 
-// glfw: whenever the mouse scroll wheel scrolls, this callback is called
-// ----------------------------------------------------------------------
-void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
+void main()
 {
-    gCamera.ProcessMouseScroll(yoffset);
+    ivec3 texel = ivec3(gl_GlobalInvocationID);
+    int size = imageSize(sky).x;
+    if (texel.x >= size || texel.y >= size)
+        return;
+
+    vec3 direction = CubeDirection(texel, size);
+    vec3 color;
+    if (procedural)
+        color = ProceduralSky(direction);
+    else
+        color = textureLod(equirect, vec2(atan(direction.y, direction.x) / (2.0 * PI) + 0.5, acos(clamp(direction.z, -1.0, 1.0)) / PI), 0.0).rgb;
+    imageStore(sky, texel, vec4(min(color, vec3(HALF_MAX)), 1.0));
 }
+);
 
-// glfw: handle mouse button events
-// --------------------------------
-void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
+
+/* Environment Irradiance Compute Shader Source Code*/
+// Projects a small mip of the sky onto nine spherical harmonics in a single work group and convolves them
+// with the cosine lobe, divided by pi so they give what a white diffuse surface reflects
+const GLchar* environmentIrradianceShaderSource = GLSL(440,
+
+    layout(local_size_x = 16, local_size_y = 16) in;
+
+layout(std430, binding = 0) buffer Coefficients
 {
-    switch (button)
-    {
-    case GLFW_MOUSE_BUTTON_LEFT:
+    vec4 coefficients[9];
+};
+
+uniform samplerCube sky;
+uniform int level;
+
+const int INVOCATIONS = 256;
+const float BANDS[3] = float[3](1.0, 2.0 / 3.0, 0.25); // the cosine lobe's harmonics, over pi
+
+shared vec3 sums[INVOCATIONS];
+
+void main()
+{
+    int size = textureSize(sky, level).x;
+    int index = int(gl_LocalInvocationIndex);
+    vec3 sh[9];
+    for (int i = 0; i < 9; ++i)
+        sh[i] = vec3(0.0);
+
+    // every invocation takes every 256th texel of the six faces
+    for (int texelIndex = index; texelIndex < size * size * 6; texelIndex += INVOCATIONS)
     {
-        if (action == GLFW_PRESS)
-            cout << "Left mouse button pressed" << endl;
-        else
-            cout << "Left mouse button released" << endl;
+        int face = texelIndex / (size * size);
+        ivec2 texel = ivec2(texelIndex % size, texelIndex / size % size);
+        vec2 st = (vec2(texel) + 0.5) / float(size) * 2.0 - 1.0;
+        vec3 directions[6] = vec3[6](vec3(1.0, -st.y, -st.x), vec3(-1.0, -st.y, st.x), vec3(st.x, 1.0, st.y),
+            vec3(st.x, -1.0, -st.y), vec3(st.x, -st.y, 1.0), vec3(-st.x, -st.y, -1.0));
+        float extent = length(directions[face]);
+        vec3 n = directions[face] / extent;
+        // solid angle of the texel
+        float weight = 4.0 / (float(size * size) * extent * extent * extent);
+        vec3 radiance = textureLod(sky, n, float(level)).rgb * weight;
+
+        sh[0] += radiance * 0.282095;
+        sh[1] += radiance * 0.488603 * n.y;
+        sh[2] += radiance * 0.488603 * n.z;
+        sh[3] += radiance * 0.488603 * n.x;
+        sh[4] += radiance * 1.092548 * n.x * n.y;
+        sh[5] += radiance * 1.092548 * n.y * n.z;
+        sh[6] += radiance * 0.315392 * (3.0 * n.z * n.z - 1.0);
+        sh[7] += radiance * 1.092548 * n.x * n.z;
+        sh[8] += radiance * 0.546274 * (n.x * n.x - n.y * n.y);
     }
-    break;
 
-    case GLFW_MOUSE_BUTTON_MIDDLE:
+    for (int i = 0; i < 9; ++i)
+    {
+        sums[index] = sh[i];
+        barrier();
+        for (int stride = INVOCATIONS / 2; stride > 0; stride /= 2)
+        {
+            if (index < stride)
+                sums[index] += sums[index + stride];
+            barrier();
+        }
+        if (index == 0)
+            coefficients[i] = vec4(sums[0] * BANDS[i == 0 ? 0 : (i < 4 ? 1 : 2)], 0.0);
+        barrier();
+    }
+}
+);
+
+
+/* Environment Specular Compute Shader Source Code*/
+// One mip level of the prefiltered specular cube map: the sky convolved with the GGX lobe of the level's
+// roughness, taking normal = view = reflection. Samples come from the sky's mip whose texels are about as
+// large as the sample's share of the lobe, which keeps the result smooth with few samples
+const GLchar* environmentSpecularShaderSource = GLSL(440,
+
+    layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(rgba16f, binding = 0) uniform writeonly imageCube specular;
+
+uniform samplerCube sky;
+uniform float skySize; // texels across a face of its first level
+uniform float roughness;
+
+const float PI = 3.14159265;
+const int SAMPLES = 128;
+
+vec3 CubeDirection(ivec3 texel, int size)
+{
+    vec2 st = (vec2(texel.xy) + 0.5) / float(size) * 2.0 - 1.0;
+    vec3 directions[6] = vec3[6](vec3(1.0, -st.y, -st.x), vec3(-1.0, -st.y, st.x), vec3(st.x, 1.0, st.y),
+        vec3(st.x, -1.0, -st.y), vec3(st.x, -st.y, 1.0), vec3(-st.x, -st.y, -1.0));
+    return normalize(directions[texel.z]);
+}
+
+vec2 Hammersley(int i)
+{
+    return vec2((float(i) + 0.5) / float(SAMPLES), float(bitfieldReverse(uint(i))) * 2.3283064365386963e-10);
+}
+
+// half vector around n distributed like GGX with alpha a
+vec3 SampleGGX(vec2 xi, vec3 n, float a)
+{
+    float phi = 2.0 * PI * xi.x;
+    float cosTheta = sqrt((1.0 - xi.y) / (1.0 + (a * a - 1.0) * xi.y));
+    float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+    vec3 up = abs(n.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+    vec3 tangent = normalize(cross(up, n));
+    vec3 bitangent = cross(n, tangent);
+    return normalize(tangent * cos(phi) * sinTheta + bitangent * sin(phi) * sinTheta + n * cosTheta);
+}
+
+void main()
+{
+    ivec3 texel = ivec3(gl_GlobalInvocationID);
+    int size = imageSize(specular).x;
+    if (texel.x >= size || texel.y >= size)
+        return;
+
+    vec3 n = CubeDirection(texel, size);
+    if (roughness == 0.0)
+    {
+        imageStore(specular, texel, vec4(textureLod(sky, n, log2(skySize / float(size))).rgb, 1.0));
+        return;
+    }
+
+    float a = roughness * roughness;
+    float texelSolidAngle = 4.0 * PI / (6.0 * skySize * skySize);
+    vec3 color = vec3(0.0);
+    float weight = 0.0;
+    for (int i = 0; i < SAMPLES; ++i)
+    {
+        vec3 h = SampleGGX(Hammersley(i), n, a);
+        vec3 l = 2.0 * dot(n, h) * h - n;
+        float nDotL = dot(n, l);
+        if (nDotL <= 0.0)
+            continue;
+
+        // with n = v the pdf of l is D / 4
+        float nDotH = max(dot(n, h), 0.0);
+        float d = nDotH * nDotH * (a * a - 1.0) + 1.0;
+        float pdf = a * a / (PI * d * d) / 4.0;
+        float sampleSolidAngle = 1.0 / (float(SAMPLES) * pdf + 1e-4);
+        float lod = 0.5 * log2(sampleSolidAngle / texelSolidAngle) + 1.0;
+        color += textureLod(sky, l, max(lod, 0.0)).rgb * nDotL;
+        weight += nDotL;
+    }
+    imageStore(specular, texel, vec4(color / max(weight, 1e-4), 1.0));
+}
+);
+
+
+/* Environment BRDF Compute Shader Source Code*/
+// The split sum's second half: how much of F0 (x) and of 1 (y) GGX with Smith shadowing reflects under
+// uniform light, by N.V across and roughness up
+const GLchar* environmentBrdfShaderSource = GLSL(440,
+
+    layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(rg16f, binding = 0) uniform writeonly image2D table;
+
+const float PI = 3.14159265;
+const int SAMPLES = 256;
+
+vec2 Hammersley(int i)
+{
+    return vec2((float(i) + 0.5) / float(SAMPLES), float(bitfieldReverse(uint(i))) * 2.3283064365386963e-10);
+}
+
+float SmithG1(float nDotX, float k)
+{
+    return nDotX / (nDotX * (1.0 - k) + k);
+}
+
+void main()
+{
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(table);
+    if (texel.x >= size.x || texel.y >= size.y)
+        return;
+
+    float nDotV = (float(texel.x) + 0.5) / float(size.x);
+    float roughness = (float(texel.y) + 0.5) / float(size.y);
+    float a = roughness * roughness;
+    float k = a / 2.0;
+    vec3 v = vec3(sqrt(1.0 - nDotV * nDotV), 0.0, nDotV);
+
+    vec2 result = vec2(0.0);
+    for (int i = 0; i < SAMPLES; ++i)
+    {
+        // GGX half vectors around n = +z
+        vec2 xi = Hammersley(i);
+        float phi = 2.0 * PI * xi.x;
+        float cosTheta = sqrt((1.0 - xi.y) / (1.0 + (a * a - 1.0) * xi.y));
+        float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+        vec3 h = vec3(cos(phi) * sinTheta, sin(phi) * sinTheta, cosTheta);
+        vec3 l = 2.0 * dot(v, h) * h - v;
+        float nDotL = max(l.z, 0.0);
+        if (nDotL <= 0.0)
+            continue;
+
+        float vDotH = max(dot(v, h), 0.0);
+        float visibility = SmithG1(nDotV, k) * SmithG1(nDotL, k) * vDotH / (h.z * nDotV);
+        float fresnel = pow(1.0 - vDotH, 5.0);
+        result += vec2((1.0 - fresnel) * visibility, fresnel * visibility);
+    }
+    imageStore(table, texel, vec4(result / float(SAMPLES), 0.0, 0.0));
+}
+);
+
+
+/* Sky Vertex Shader Source Code*/
+// One triangle over the whole screen on the far plane, behind everything drawn
+const GLchar* skyVertexShaderSource = GLSL(440,
+
+    out vec2 vertexPosition; // normalized device coordinates
+
+void main()
+{
+    vertexPosition = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+    gl_Position = vec4(vertexPosition, 1.0, 1.0);
+}
+);
+
+
+/* Sky Fragment Shader Source Code*/
+const GLchar* skyFragmentShaderSource = GLSL(440,
+
+    in vec2 vertexPosition;
+
+layout(location = 0) out vec4 fragmentColor;
+layout(location = 1) out uint fragmentObjectId;
+
+uniform samplerCube sky;
+uniform mat4 inverseViewProjection;
+uniform mat4 environmentFromWorld;
+uniform float environmentIntensity;
+
+void main()
+{
+    // the view ray through the pixel, from its points on the near and far planes
+    vec4 nearPoint = inverseViewProjection * vec4(vertexPosition, -1.0, 1.0);
+    vec4 farPoint = inverseViewProjection * vec4(vertexPosition, 1.0, 1.0);
+    vec3 direction = mat3(environmentFromWorld) * (farPoint.xyz / farPoint.w - nearPoint.xyz / nearPoint.w);
+    fragmentColor = vec4(environmentIntensity * textureLod(sky, direction, 0.0).rgb, 1.0);
+    fragmentObjectId = 0u; // not pickable
+}
+);
+
+
+/* Ambient Occlusion Fragment Shader Source Code*/
+// Half resolution occlusion from the depth prepass, see ssao.h. Drawn with the upscale vertex shader's
+// fullscreen triangle; r is the occlusion (1 for none), g the linear depth the blur and upsampling compare
+const GLchar* occlusionFragmentShaderSource = GLSL(440,
+
+    layout(location = 0) out vec2 fragmentOcclusion;
+
+uniform sampler2D depth; // the scene's, drawn into its lower left renderSize pixels
+uniform sampler2D history; // last frame's output
+uniform mat4 projection;
+uniform mat4 inverseProjection;
+uniform vec2 renderSize;
+uniform float radius; // world units
+uniform float intensity;
+uniform float rotation; // of the sample spiral, turned every frame when accumulating
+uniform bool useHistory;
+uniform mat4 toPreviousView; // view space to last frame's
+uniform mat4 previousProjection;
+uniform float historyWeight;
+
+const int SAMPLES = 8;
+const float SPIRAL_TURNS = 7.0;
+const float MAX_RADIUS_PIXELS = 64.0; // bounds the texture cache misses of surfaces close to the camera
+const float BIAS = 0.01; // per unit of depth, against self occlusion on flat surfaces
+const float FAR_DEPTH = 65000.0; // linear depth written where nothing was drawn
+
+vec3 ViewPosition(ivec2 texel)
+{
+    texel = clamp(texel, ivec2(0), ivec2(renderSize) - 1);
+    vec2 ndc = (vec2(texel) + 0.5) / renderSize * 2.0 - 1.0;
+    vec4 position = inverseProjection * vec4(ndc, texelFetch(depth, texel, 0).r * 2.0 - 1.0, 1.0);
+    return position.xyz / position.w;
+}
+
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy) * 2;
+    if (texelFetch(depth, min(texel, ivec2(renderSize) - 1), 0).r >= 1.0)
+    {
+        fragmentOcclusion = vec2(1.0, FAR_DEPTH);
+        return;
+    }
+    vec3 position = ViewPosition(texel);
+    float linearDepth = -position.z;
+
+    // normal from the neighbors on the flatter side, so edges don't bend it
+    vec3 right = ViewPosition(texel + ivec2(2, 0)) - position;
+    vec3 left = position - ViewPosition(texel - ivec2(2, 0));
+    vec3 up = ViewPosition(texel + ivec2(0, 2)) - position;
+    vec3 down = position - ViewPosition(texel - ivec2(0, 2));
+    vec3 normal = normalize(cross(abs(right.z) < abs(left.z) ? right : left, abs(up.z) < abs(down.z) ? up : down));
+
+    // radius in pixels: clip w is the depth in perspective and 1 in orthographic projection
+    float w = projection[2][3] * position.z + projection[3][3];
+    float radiusPixels = min(radius * projection[1][1] * 0.5 * renderSize.y / w, MAX_RADIUS_PIXELS);
+
+    float occlusion = 1.0;
+    if (radiusPixels >= 1.0)
+    {
+        // interleaved gradient noise spreads the spiral's start over neighboring pixels, which the blur averages
+        float angle = 6.2831853 * fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715)))) + rotation;
+        float radius2 = radius * radius;
+        float sum = 0.0;
+        for (int i = 0; i < SAMPLES; ++i)
+        {
+            float t = (float(i) + 0.5) / float(SAMPLES);
+            float a = angle + t * SPIRAL_TURNS * 6.2831853;
+            vec3 v = ViewPosition(texel + ivec2(vec2(cos(a), sin(a)) * t * radiusPixels)) - position;
+            float vv = dot(v, v);
+            float f = max(radius2 - vv, 0.0);
+            sum += f * f * f * max((dot(v, normal) - BIAS * linearDepth) / (vv + 0.01), 0.0);
+        }
+        occlusion = max(1.0 - sum * intensity * 5.0 / (radius2 * radius2 * radius2 * float(SAMPLES)), 0.0);
+    }
+
+    // blend with last frame's result at the same surface point, unless it was hidden then
+    if (useHistory)
+    {
+        vec3 previous = (toPreviousView * vec4(position, 1.0)).xyz;
+        vec4 clip = previousProjection * vec4(previous, 1.0);
+        vec2 uv = clip.xy / clip.w * 0.5 + 0.5;
+        if (all(greaterThanEqual(uv, vec2(0.0))) && all(lessThan(uv, vec2(1.0))))
+        {
+            vec2 kept = texelFetch(history, ivec2(uv * renderSize * 0.5), 0).rg;
+            if (abs(kept.g + previous.z) < 0.05 * -previous.z)
+                occlusion = mix(occlusion, kept.r, historyWeight);
+        }
+    }
+    fragmentOcclusion = vec2(occlusion, linearDepth);
+}
+);
+
+
+/* Ambient Occlusion Blur Fragment Shader Source Code*/
+// One direction of the depth aware blur of the occlusion; neighbors at another depth count for less
+const GLchar* occlusionBlurFragmentShaderSource = GLSL(440,
+
+    layout(location = 0) out vec2 fragmentOcclusion;
+
+uniform sampler2D occlusion; // r occlusion, g linear depth
+uniform vec2 direction; // one texel across or up
+uniform vec2 maxTexel; // last one drawn
+
+const int RADIUS = 4;
+const float WEIGHTS[5] = float[5](0.153170, 0.144893, 0.122649, 0.092902, 0.062970); // gaussian
+const float DEPTH_TOLERANCE = 0.1; // relative difference at which a neighbor stops counting
+
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    vec2 center = texelFetch(occlusion, texel, 0).rg;
+    float sum = center.r * WEIGHTS[0];
+    float total = WEIGHTS[0];
+    for (int i = 1; i <= RADIUS; ++i)
+    {
+        for (int side = -1; side <= 1; side += 2)
+        {
+            ivec2 neighbor = clamp(texel + ivec2(direction) * i * side, ivec2(0), ivec2(maxTexel));
+            vec2 value = texelFetch(occlusion, neighbor, 0).rg;
+            float weight = WEIGHTS[i] * max(1.0 - abs(value.g - center.g) / (center.g * DEPTH_TOLERANCE), 0.0);
+            sum += value.r * weight;
+            total += weight;
+        }
+    }
+    fragmentOcclusion = vec2(sum / total, center.g);
+}
+);
+
+
+/* Velocity Fragment Shader Source Code*/
+// Motion on screen since last frame, in texture coordinates, from the scene's depth; see taa.h
+const GLchar* velocityFragmentShaderSource = GLSL(440,
+
+    layout(location = 0) out vec2 fragmentVelocity;
+
+uniform sampler2D depth; // the scene's, drawn into its lower left renderSize pixels
+uniform mat4 inverseViewProjection; // of the jittered view-projection the scene was drawn with
+uniform mat4 viewProjection; // unjittered
+uniform mat4 previousViewProjection; // unjittered
+uniform vec2 renderSize;
+
+void main()
+{
+    // the nearest surface around the pixel, so the edges of foreground objects move with them
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    ivec2 maxTexel = ivec2(renderSize) - 1;
+    ivec2 nearest = texel;
+    float nearestDepth = texelFetch(depth, texel, 0).r;
+    for (int y = -1; y <= 1; ++y)
+    {
+        for (int x = -1; x <= 1; ++x)
+        {
+            ivec2 neighbor = clamp(texel + ivec2(x, y), ivec2(0), maxTexel);
+            float d = texelFetch(depth, neighbor, 0).r;
+            if (d < nearestDepth)
+            {
+                nearestDepth = d;
+                nearest = neighbor;
+            }
+        }
+    }
+
+    vec2 ndc = (vec2(nearest) + 0.5) / renderSize * 2.0 - 1.0;
+    vec4 world = inverseViewProjection * vec4(ndc, nearestDepth * 2.0 - 1.0, 1.0);
+    vec4 current = viewProjection * world;
+    vec4 previous = previousViewProjection * world;
+    fragmentVelocity = (current.xy / current.w - previous.xy / previous.w) * 0.5;
+}
+);
+
+
+/* Temporal Resolve Fragment Shader Source Code*/
+// Blends this frame's jittered samples into last frame's result at the window's resolution; see taa.h
+const GLchar* resolveFragmentShaderSource = GLSL(440,
+
+    layout(location = 0) out vec4 fragmentColor;
+
+uniform sampler2D sceneColor; // drawn into its lower left renderSize pixels
+uniform sampler2D velocity; // same pixels
+uniform sampler2D history; // last frame's output, at outputSize
+uniform vec2 renderSize;
+uniform vec2 outputSize;
+uniform vec2 jitter; // of this frame's samples, in render pixels
+uniform float blend;
+uniform bool useHistory;
+
+// clipping in luma and chroma keeps the history's hue where a per channel clamp would shift it
+vec3 RGBToYCoCg(vec3 color)
+{
+    return vec3(dot(color, vec3(0.25, 0.5, 0.25)), dot(color, vec3(0.5, 0.0, -0.5)), dot(color, vec3(-0.25, 0.5, -0.25)));
+}
+
+vec3 YCoCgToRGB(vec3 color)
+{
+    return vec3(color.x + color.y - color.z, color.x + color.z, color.x - color.y - color.z);
+}
+
+void main()
+{
+    // the render pixel whose sample landed nearest this pixel's center; each was drawn jitter off its own
+    vec2 uv = gl_FragCoord.xy / outputSize;
+    vec2 position = uv * renderSize;
+    ivec2 maxTexel = ivec2(renderSize) - 1;
+    ivec2 texel = clamp(ivec2(floor(position + jitter)), ivec2(0), maxTexel);
+    vec2 offset = (vec2(texel) + 0.5 - jitter - position) * outputSize / renderSize; // in output pixels
+
+    // range of the current frame's colors around it
+    vec3 current = RGBToYCoCg(texelFetch(sceneColor, texel, 0).rgb);
+    vec3 low = current;
+    vec3 high = current;
+    for (int y = -1; y <= 1; ++y)
+    {
+        for (int x = -1; x <= 1; ++x)
+        {
+            vec3 neighbor = RGBToYCoCg(texelFetch(sceneColor, clamp(texel + ivec2(x, y), ivec2(0), maxTexel), 0).rgb);
+            low = min(low, neighbor);
+            high = max(high, neighbor);
+        }
+    }
+
+    vec3 result = current;
+    vec2 previousUV = uv - texelFetch(velocity, texel, 0).rg;
+    if (useHistory && all(greaterThanEqual(previousUV, vec2(0.0))) && all(lessThanEqual(previousUV, vec2(1.0))))
+    {
+        // pulled toward the middle of the range until it fits
+        vec3 kept = RGBToYCoCg(texture(history, previousUV).rgb);
+        vec3 center = (high + low) * 0.5;
+        vec3 extent = (high - low) * 0.5 + 0.0001;
+        vec3 units = abs(kept - center) / extent;
+        float outside = max(units.x, max(units.y, units.z));
+        if (outside > 1.0)
+            kept = center + (kept - center) / outside;
+
+        // a sample far from the pixel's center says less about it
+        result = mix(kept, current, blend * exp(-dot(offset, offset)));
+    }
+    fragmentColor = vec4(YCoCgToRGB(result), 1.0);
+}
+);
+
+
+/* Profiler Overlay Shader Source Code*/
+const GLchar* overlayVertexShaderSource = GLSL(440,
+
+    layout(location = 0) in vec2 position; // Already in normalized device coordinates
+layout(location = 1) in vec3 color;
+
+out vec3 vertexColor;
+
+void main()
+{
+    gl_Position = vec4(position, 0.0f, 1.0f);
+    vertexColor = color;
+}
+);
+
+
+const GLchar* overlayFragmentShaderSource = GLSL(440,
+
+    in vec3 vertexColor;
+
+out vec4 fragmentColor;
+
+void main()
+{
+    fragmentColor = vec4(vertexColor, 1.0f);
+}
+);
+
+
+/* Upscale Vertex Shader Source Code*/
+const GLchar* upscaleVertexShaderSource = GLSL(440,
+
+    out vec2 vertexUV;
+
+void main()
+{
+    // One triangle over the whole screen, corners from the vertex index
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    vertexUV = corner;
+    gl_Position = vec4(corner * 2.0f - 1.0f, 0.0f, 1.0f);
+}
+);
+
+
+/* Upscale Fragment Shader Source Code*/
+const GLchar* upscaleFragmentShaderSource = GLSL(440,
+
+    in vec2 vertexUV;
+
+out vec4 fragmentColor;
+
+uniform sampler2D sceneColor;
+uniform vec2 renderScale;   // rendered part of the target, in texture coordinates
+uniform vec2 texelSize;     // of the target
+uniform vec2 maxUV;         // center of the last rendered texel, so filtering never reaches past it
+uniform float sharpness;    // 0 is plain bilinear
+
+vec3 fetch(vec2 uv)
+{
+    return texture(sceneColor, clamp(uv, texelSize * 0.5f, maxUV)).rgb;
+}
+
+void main()
+{
+    vec2 uv = vertexUV * renderScale;
+    vec3 center = fetch(uv);
+    vec3 north = fetch(uv + vec2(0.0f, texelSize.y));
+    vec3 south = fetch(uv - vec2(0.0f, texelSize.y));
+    vec3 east = fetch(uv + vec2(texelSize.x, 0.0f));
+    vec3 west = fetch(uv - vec2(texelSize.x, 0.0f));
+
+    // Contrast adaptive sharpening: a negative lobe from the neighbours, weaker where the neighbourhood is
+    // already close to black or white so edges don't ring
+    vec3 low = min(center, min(min(north, south), min(east, west)));
+    vec3 high = max(center, max(max(north, south), max(east, west)));
+    vec3 amount = sqrt(clamp(min(low, 1.0f - high) / max(high, vec3(0.0001f)), 0.0f, 1.0f));
+    vec3 weight = -amount * 0.2f * sharpness;
+    vec3 color = (center + (north + south + east + west) * weight) / (1.0f + 4.0f * weight);
+    fragmentColor = vec4(clamp(color, 0.0f, 1.0f), 1.0f);
+}
+);
+
+
+int main(int argc, char* argv[])
+{
+    // All console output goes through the logger's writer thread
+    Logger::Instance().Start();
+
+    // One worker per core; this thread is worker 0 and joins in whenever it waits on the frame tasks
+    gJobs.Start();
+    LOG_INFO("Job system started with %u workers", gJobs.WorkerCount());
+
+    // --bake [scene.txt] [scene.bin] rebuilds the binary scene snapshot and exits
+    if (argc >= 2 && string(argv[1]) == "--bake")
+    {
+        bool baked = UBakeScene(argc >= 3 ? argv[2] : SCENE_FILENAME, argc >= 4 ? argv[3] : BAKED_SCENE_FILENAME);
+        gJobs.Stop();
+        Logger::Instance().Stop();
+        return baked ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // --software <image.ppm> [frames] renders on the CPU without a window, for thumbnails and benchmarks
+    if (argc >= 3 && string(argv[1]) == "--software")
+        return URenderSoftware(argv[2], argc >= 4 ? max(atoi(argv[3]), 1) : 1);
+
+    if (!UInitialize(argc, argv, &gWindow))
+        return EXIT_FAILURE;
+
+    // --capture <trace.bin> [frames] records every GL call from setup on, for benchmarking with the replay tool.
+    // --playback <path.txt> [frames] flies a recorded camera path; the two combine into a repeatable capture
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        string option = argv[i];
+        int frames = i + 2 < argc ? atoi(argv[i + 2]) : 0;     // 0 when the count is left out
+        if (option == "--capture")
+        {
+            int width, height;
+            glfwGetFramebufferSize(gWindow, &width, &height);
+            frames = frames > 0 ? frames : 300;
+            if (!GLCapture::Instance().Start(argv[i + 1], width, height, frames))
+            {
+                LOG_ERROR("Failed to open %s", argv[i + 1]);
+                return EXIT_FAILURE;
+            }
+            LOG_INFO("Capturing %d frames to %s", frames, argv[i + 1]);
+        }
+        else if (option == "--playback" && !UStartPlayback(argv[i + 1], frames))
+            return EXIT_FAILURE;
+    }
+
+    // Map the scene and create the meshes
+    if (!ULoadScene())
+        return EXIT_FAILURE;
+    UCreateMesh(gMesh); // Calls the function to create the Vertex Buffer Object
+
+    // Create the shader program
+    if (!UCreateShaderProgram(sunVertexShaderSource, sunFragmentShaderSource, gSunProgramId))
+        return EXIT_FAILURE;
+
+    if (!UCreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource, gSpotProgramId))
+        return EXIT_FAILURE;
+
+    if (!UCreateShaderProgram(depthVertexShaderSource, depthFragmentShaderSource, gDepthProgramId))
+        return EXIT_FAILURE;
+
+    if (!UCreateShaderProgram(sunVertexShaderSource, feedbackFragmentShaderSource, gFeedbackProgramId))
+        return EXIT_FAILURE;
+
+    if (!UCreateShaderProgram(terrainVertexShaderSource, sunFragmentShaderSource, gTerrainProgramId))
+        return EXIT_FAILURE;
+
+    if (!UCreateShaderProgram(skyVertexShaderSource, skyFragmentShaderSource, gSkyProgramId))
+        return EXIT_FAILURE;
+
+    if (!UCreateShaderProgram(upscaleVertexShaderSource, occlusionFragmentShaderSource, gOcclusionProgramId))
+        return EXIT_FAILURE;
+
+    if (!UCreateShaderProgram(upscaleVertexShaderSource, occlusionBlurFragmentShaderSource, gOcclusionBlurProgramId))
+        return EXIT_FAILURE;
+
+    if (!UCreateShaderProgram(upscaleVertexShaderSource, velocityFragmentShaderSource, gVelocityProgramId))
+        return EXIT_FAILURE;
+
+    if (!UCreateShaderProgram(upscaleVertexShaderSource, resolveFragmentShaderSource, gResolveProgramId))
+        return EXIT_FAILURE;
+
+    if (!UCreateComputeProgram(waterSimulateShaderSource, gWaterSimulateProgramId))
+        return EXIT_FAILURE;
+
+    if (!UCreateShaderProgram(waterVertexShaderSource, waterFragmentShaderSource, gWaterProgramId))
+        return EXIT_FAILURE;
+
+    if (!UCreateShaderProgram(overlayVertexShaderSource, overlayFragmentShaderSource, gOverlayProgramId))
+        return EXIT_FAILURE;
+
+    if (!UCreateShaderProgram(upscaleVertexShaderSource, upscaleFragmentShaderSource, gUpscaleProgramId))
+        return EXIT_FAILURE;
+
+    gOverdraw.Create();
+    gOcclusion.Create(gGLState);
+    gProfiler.Create();
+
+    if (!gStreamBuffer.Create(64 * 1024))
+        return EXIT_FAILURE;
+
+    // Debug lines are plain positions; the buffer offset changes every frame so the binding is set per draw
+    glGenVertexArrays(1, &gDebugLineVAO);
+    gGLState.BindVertexArray(gDebugLineVAO);
+    glVertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, 0);
+    glVertexAttribBinding(0, 0);
+    glEnableVertexAttribArray(0);
+    gGLState.BindVertexArray(0);
+
+    // Overlay bars: 2D position and color, streamed like the debug lines
+    glGenVertexArrays(1, &gOverlayVAO);
+    gGLState.BindVertexArray(gOverlayVAO);
+    glVertexAttribFormat(0, 2, GL_FLOAT, GL_FALSE, 0);
+    glVertexAttribBinding(0, 0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribFormat(1, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 2);
+    glVertexAttribBinding(1, 0);
+    glEnableVertexAttribArray(1);
+    gGLState.BindVertexArray(0);
+
+    // The upscale pass needs a vertex array bound even though it reads no attributes
+    glGenVertexArrays(1, &gEmptyVAO);
+
+    gFrameCapture.Create();
+    gPicker.Create();
+
+    // Sets the background color of the window to black (it will be implicitely used by glClear)
+    gGLState.ClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    // Materials objects use become virtual textures; the terrain and water load their own
+    const BakedArray<BakedMaterial>& materials = gScene.Scene->Materials;
+    gMaterialTextures.assign(materials.size(), 0);
+    for (const BakedInstance& instance : gScene.Scene->Instances)
+    {
+        const BakedMaterial& material = materials[instance.Material];
+        if (gMaterialTextures[instance.Material])
+            continue;
+        if (!UCreateVirtualTexture(material.Texture.begin(), gMaterialTextures[instance.Material]))
+        {
+            LOG_ERROR("Failed to load texture %s", material.Texture.begin());
+            return EXIT_FAILURE;
+        }
+        LOG_INFO("Virtual texture %s created successfully", material.Texture.begin());
+    }
+
+
+    // Tell OpenGL for each sampler which texture unit it belongs to (only has to be done once).
+    gGLState.UseProgram(gSunProgramId);
+    // We set the texture as texture unit 0.
+    glUniform1i(glGetUniformLocation(gSunProgramId, "uTexture"), 0);
+
+    gVirtualTextures.Create(gSunProgramId, gFeedbackProgramId, gFramebufferWidth, gFramebufferHeight, gGLState);
+    LOG_INFO("Virtual texture cache: %d pages of %d texels, %.1f MB", gVirtualTextures.Slots(),
+        VirtualTextureCache::PAGE_SIZE, gVirtualTextures.CacheBytes() / (1024.0 * 1024.0));
+
+    gSunModelLocation = glGetUniformLocation(gSunProgramId, "model");
+    gSunObjectIdLocation = glGetUniformLocation(gSunProgramId, "objectId");
+    gDepthModelLocation = glGetUniformLocation(gDepthProgramId, "model");
+
+    if (!UCreateTerrain() || !UCreateWater() || !UCreateEnvironment())
+        return EXIT_FAILURE;
+
+    // Both lit programs read the ambient occlusion on its own unit, while a frame turns it on
+    gAmbientOcclusion.Create(gOcclusionProgramId, gOcclusionBlurProgramId, gGLState);
+    for (GLuint program : { gSunProgramId, gTerrainProgramId })
+    {
+        gGLState.UseProgram(program);
+        glUniform1i(glGetUniformLocation(program, "occlusion"), AmbientOcclusion::OCCLUSION_UNIT);
+    }
+    gTemporalAA.Create(gVelocityProgramId, gResolveProgramId, gGLState);
+
+    UCreateSceneObjects();
+    UCreateFrameTasks();
+
+
+    // The render thread owns the context from here on
+    glfwGetFramebufferSize(gWindow, &gFramebufferWidth, &gFramebufferHeight);
+    glfwMakeContextCurrent(NULL);
+    gRenderThreadRunning = true;
+    gRenderThread = thread(URenderThread);
+
+    // simulation loop
+    // ---------------
+    while (!glfwWindowShouldClose(gWindow))
+    {
+        FrameSnapshot& snapshot = gSnapshots.WriteBuffer();
+        snapshot.MainScopeCount = 0;
+
+        // Handle events while the render thread picks up the last snapshot, so the simulation stays
+        // at most one frame ahead of what is on screen
+        double start = gProfiler.NowMs();
+        glfwPollEvents();
+        while (gSnapshots.Pending() && !glfwWindowShouldClose(gWindow))
+            glfwWaitEventsTimeout(0.001);
+        URecordMainScope(snapshot, "glfwPollEvents", start);
+
+        // per-frame timing
+        // --------------------
+        float currentFrame = glfwGetTime();
+        gDeltaTime = currentFrame - gLastFrame;
+        gLastFrame = currentFrame;
+        if (gPlaybackFrames > 0)
+            gDeltaTime = PLAYBACK_TIMESTEP;     // the same simulation steps on every run
+
+        // input
+        // -----
+        start = gProfiler.NowMs();
+        UProcessInput(gWindow);
+        URecordMainScope(snapshot, "UProcessInput", start);
+
+        // Camera path: playback overrides whatever the input did, recording samples the result
+        snapshot.PlaybackFrame = -1;
+        if (gPlaybackFrame < gPlaybackFrames)
+        {
+            CameraPose pose = gCameraTrack.Evaluate(gPlaybackFrame * PLAYBACK_TIMESTEP);
+            gCamera.SetPose(pose.Position, pose.Yaw, pose.Pitch, pose.Zoom);
+            gPlaybackTimings[gPlaybackFrame].Pose = pose;
+            snapshot.PlaybackFrame = gPlaybackFrame++;
+        }
+        else if (gRecordingCameraPath)
+            gCameraTrack.Record(currentFrame - gCameraPathStart, gCamera);
+
+        // Build this frame and hand it to the render thread
+        start = gProfiler.NowMs();
+        USimulate(snapshot);
+        if (snapshot.PlaybackFrame >= 0)
+            gPlaybackTimings[snapshot.PlaybackFrame].SimulateMs = gProfiler.NowMs() - start;
+        gSnapshots.Publish();
+
+        if (gWindowTitles.Consume())
+            glfwSetWindowTitle(gWindow, gWindowTitles.ReadBuffer().c_str());
+    }
+
+    gRenderThreadRunning = false;
+    gRenderThread.join();
+    glfwMakeContextCurrent(gWindow);
+
+    if (gProfiler.Tracing)
+        gProfiler.WriteTrace(TRACE_FILENAME);
+    if (gPlaybackFrames > 0)
+        UWritePlaybackTimings();
+
+    // Release mesh data
+    UDestroyMesh(gMesh);
+
+    gOverdraw.Destroy();
+    gOcclusion.Destroy();
+    gTerrain.Destroy();
+    gWater.Destroy();
+    gVirtualTextures.Destroy();
+    gEnvironment.Destroy();
+    gAmbientOcclusion.Destroy();
+    gTemporalAA.Destroy();
+    gProfiler.Destroy();
+    glDeleteVertexArrays(1, &gOverlayVAO);
+    glDeleteVertexArrays(1, &gDebugLineVAO);
+    gStreamBuffer.Destroy();
+
+    // Release shader program
+    UDestroyShaderProgram(gSunProgramId);
+    UDestroyShaderProgram(gDepthProgramId);
+    UDestroyShaderProgram(gFeedbackProgramId);
+    UDestroyShaderProgram(gTerrainProgramId);
+    UDestroyShaderProgram(gWaterSimulateProgramId);
+    UDestroyShaderProgram(gWaterProgramId);
+    UDestroyShaderProgram(gSkyProgramId);
+    UDestroyShaderProgram(gOcclusionProgramId);
+    UDestroyShaderProgram(gOcclusionBlurProgramId);
+    UDestroyShaderProgram(gVelocityProgramId);
+    UDestroyShaderProgram(gResolveProgramId);
+    UDestroyShaderProgram(gUpscaleProgramId);
+    glDeleteVertexArrays(1, &gEmptyVAO);
+    gTargetPool.Destroy();
+    gFrameCapture.Destroy();        // writes out whatever is still being read back or encoded
+    gPicker.Destroy();
+
+    gJobs.Stop();
+    Logger::Instance().Stop();
+
+    exit(EXIT_SUCCESS); // Terminates the program successfully
+}
+
+
+// Initialize GLFW, GLEW, and create a window
+bool UInitialize(int argc, char* argv[], GLFWwindow** window)
+{
+    // GLFW: initialize and configure
+    // ------------------------------
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+#ifdef __APPLE__
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+
+    // GLFW: window creation
+    // ---------------------
+    * window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
+    if (*window == NULL)
+    {
+        LOG_ERROR("Failed to create GLFW window");
+        glfwTerminate();
+        return false;
+    }
+    glfwMakeContextCurrent(*window);
+    glfwSetFramebufferSizeCallback(*window, UResizeWindow);
+    glfwSetCursorPosCallback(*window, UMousePositionCallback);
+    glfwSetScrollCallback(*window, UMouseScrollCallback);
+    glfwSetMouseButtonCallback(*window, UMouseButtonCallback);
+
+    glewExperimental = GL_TRUE;
+    GLenum GlewInitResult = glewInit();
+
+    if (GLEW_OK != GlewInitResult)
+    {
+        LOG_ERROR("%s", (const char*)glewGetErrorString(GlewInitResult));
+        return false;
+    }
+
+    return true;
+}
+
+
+// process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
+void UProcessInput(GLFWwindow* window)
+{
+    static const float cameraSpeed = 2.5f;
+
+    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+        glfwSetWindowShouldClose(window, true);
+
+    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+        gCamera.ProcessKeyboard(FORWARD, gDeltaTime);
+    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+        gCamera.ProcessKeyboard(BACKWARD, gDeltaTime);
+    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+        gCamera.ProcessKeyboard(LEFT, gDeltaTime);
+    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+        gCamera.ProcessKeyboard(RIGHT, gDeltaTime);
+    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
+        gCamera.ProcessKeyboard(DOWN, gDeltaTime);
+    if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
+        gCamera.ProcessKeyboard(UP, gDeltaTime);
+    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
+        ortho = !ortho;
+
+    static bool isLKeyDown = false;
+    if (glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS && !gIsLampOrbiting)
+        gIsLampOrbiting = true;
+    else if (glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS && gIsLampOrbiting)
+        gIsLampOrbiting = false;
+
+    // Z toggles the depth prepass (on key down only, so holding the key doesn't flicker)
+    static bool isZKeyDown = false;
+    bool zPressed = glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS;
+    if (zPressed && !isZKeyDown)
+        gDepthPrepass = !gDepthPrepass;
+    isZKeyDown = zPressed;
+
+    // N toggles the ambient occlusion, M its temporal accumulation, for timing them against each other
+    static bool isNKeyDown = false;
+    bool nPressed = glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS;
+    if (nPressed && !isNKeyDown)
+        gSSAO = !gSSAO;
+    isNKeyDown = nPressed;
+
+    static bool isMKeyDown = false;
+    bool mPressed = glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS;
+    if (mPressed && !isMKeyDown)
+        gSSAOTemporal = !gSSAOTemporal;
+    isMKeyDown = mPressed;
+
+    // X toggles temporal anti-aliasing
+    static bool isXKeyDown = false;
+    bool xPressed = glfwGetKey(window, GLFW_KEY_X) == GLFW_PRESS;
+    if (xPressed && !isXKeyDown)
+        gTemporalAAEnabled = !gTemporalAAEnabled;
+    isXKeyDown = xPressed;
+
+    // C toggles occlusion culling
+    static bool isCKeyDown = false;
+    bool cPressed = glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS;
+    if (cPressed && !isCKeyDown)
+        gOcclusionCulling = !gOcclusionCulling;
+    isCKeyDown = cPressed;
+
+    // G toggles the lamp debug lines
+    static bool isGKeyDown = false;
+    bool gPressed = glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS;
+    if (gPressed && !isGKeyDown)
+        gShowDebugLines = !gShowDebugLines;
+    isGKeyDown = gPressed;
+
+    // O toggles the profiler overlay, T starts and stops a Chrome trace capture
+    static bool isOKeyDown = false;
+    bool oPressed = glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS;
+    if (oPressed && !isOKeyDown)
+        gShowProfilerOverlay = !gShowProfilerOverlay;
+    isOKeyDown = oPressed;
+
+    static bool isTKeyDown = false;
+    bool tPressed = glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS;
+    if (tPressed && !isTKeyDown)
+        gToggleTraceRequested = true;   // the profiler lives on the render thread
+    isTKeyDown = tPressed;
+
+    // F12 takes a screenshot, F9 starts and stops recording video; both are read back on the render thread
+    static bool isF12KeyDown = false;
+    bool f12Pressed = glfwGetKey(window, GLFW_KEY_F12) == GLFW_PRESS;
+    if (f12Pressed && !isF12KeyDown)
+        gScreenshotRequested = true;
+    isF12KeyDown = f12Pressed;
+
+    static bool isF9KeyDown = false;
+    bool f9Pressed = glfwGetKey(window, GLFW_KEY_F9) == GLFW_PRESS;
+    if (f9Pressed && !isF9KeyDown)
+        gToggleVideoRequested = true;
+    isF9KeyDown = f9Pressed;
+
+    // V toggles dynamic resolution
+    static bool isVKeyDown = false;
+    bool vPressed = glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS;
+    if (vPressed && !isVKeyDown)
+        gDynamicResolution = !gDynamicResolution;
+    isVKeyDown = vPressed;
+
+    // R starts and stops recording the camera path, for --playback
+    static bool isRKeyDown = false;
+    bool rPressed = glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS;
+    if (rPressed && !isRKeyDown && gPlaybackFrames == 0)
+    {
+        if (!gRecordingCameraPath)
+        {
+            gCameraTrack.Clear();
+            gCameraPathStart = glfwGetTime();
+            gRecordingCameraPath = true;
+            LOG_INFO("Camera path recording started");
+        }
+        else
+        {
+            gRecordingCameraPath = false;
+            if (gCameraTrack.Save(CAMERA_PATH_FILENAME))
+                LOG_INFO("Camera path of %.1f s written to %s", gCameraTrack.Duration(), CAMERA_PATH_FILENAME);
+            else
+                LOG_ERROR("Failed to write %s", CAMERA_PATH_FILENAME);
+        }
+    }
+    isRKeyDown = rPressed;
+   
+}
+
+
+// glfw: whenever the window size changed (by OS or user resize) this callback function executes
+void UResizeWindow(GLFWwindow* window, int width, int height)
+{
+    // Runs on the main thread, which has no context; the render thread sets the viewport. The projection
+    // follows the window's aspect; a minimized window reports 0 and keeps the last one
+    gFramebufferWidth = width;
+    gFramebufferHeight = height;
+    if (width > 0 && height > 0)
+    {
+        WINDOW_WIDTH = width;
+        WINDOW_HEIGHT = height;
+    }
+}
+
+
+// glfw: whenever the mouse moves, this callback is called
+// -------------------------------------------------------
+void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
+{
+    if (gFirstMouse)
+    {
+        gLastX = xpos;
+        gLastY = ypos;
+        gFirstMouse = false;
+    }
+
+    float xoffset = xpos - gLastX;
+    float yoffset = gLastY - ypos; // Reversed since y-coordinates go from bottom to top
+
+    gLastX = xpos;
+    gLastY = ypos;
+
+    gCamera.ProcessMouseMovement(xoffset, yoffset);
+}
+
+
+// glfw: whenever the mouse scroll wheel scrolls, this callback is called
+// ----------------------------------------------------------------------
+void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
+{
+    gCamera.ProcessMouseScroll(yoffset);
+}
+
+// glfw: handle mouse button events
+// --------------------------------
+void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
+{
+    switch (button)
+    {
+    case GLFW_MOUSE_BUTTON_LEFT:
+    {
+        if (action == GLFW_PRESS)
+        {
+            // Picked on the render thread; the window may be scaled differently than its framebuffer
+            int width, height;
+            glfwGetWindowSize(window, &width, &height);
+            if (width > 0 && height > 0)
+            {
+                gPickPosition = glm::vec2(gLastX / width, 1.0f - gLastY / height);
+                gPickRequested = true;
+            }
+            LOG_DEBUG("Left mouse button pressed");
+        }
+        else
+            LOG_DEBUG("Left mouse button released");
+    }
+    break;
+
+    case GLFW_MOUSE_BUTTON_MIDDLE:
     {
         if (action == GLFW_PRESS)
-            cout << "Middle mouse button pressed" << endl;
+            LOG_DEBUG("Middle mouse button pressed");
         else
-            cout << "Middle mouse button released" << endl;
+            LOG_DEBUG("Middle mouse button released");
     }
     break;
 
     case GLFW_MOUSE_BUTTON_RIGHT:
     {
-        if (action == GLFW_PRESS)
-            cout << "Right mouse button pressed" << endl;
-        else
-            cout << "Right mouse button released" << endl;
+        if (action == GLFW_PRESS)
+            LOG_DEBUG("Right mouse button pressed");
+        else
+            LOG_DEBUG("Right mouse button released");
+    }
+    break;
+
+    default:
+        LOG_DEBUG("Unhandled mouse button event");
+        break;
+    }
+}
+
+
+// Builds the frame the render thread draws next: camera, lights and the sorted draw list
+void USimulate(FrameSnapshot& snapshot)
+{
+    // A pick finished on the render thread: select what was hit, or clear the selection on a miss
+    int picked = gPickResult.exchange(-1);
+    if (picked >= 0)
+    {
+        gSelectedObject = picked - 1;
+        if (gSelectedObject >= 0 && gSelectedObject < (int)gObjects.Mesh.size())
+        {
+            const glm::vec3& center = gObjects.Center[gSelectedObject];
+            LOG_INFO("Selected object %d (mesh %d) at (%.2f, %.2f, %.2f)", gSelectedObject, gObjects.Mesh[gSelectedObject], center.x, center.y, center.z);
+        }
+        else
+            gSelectedObject = -1;
+    }
+
+    glm::mat4 view = gCamera.GetViewMatrix();
+
+    glm::mat4 projection;
+    if (!ortho) {
+        GLfloat oWidth = (GLfloat)WINDOW_WIDTH * 0.01f; // 10% of width
+        GLfloat oHeight = (GLfloat)WINDOW_HEIGHT * 0.01f; // 10% of height
+        //projection = glm::ortho(-oWidth, oWidth, oHeight, -oHeight, 0.1f, 100.0f);
+        float scale = 100;
+        projection = glm::ortho(-((float)WINDOW_WIDTH / scale), (float)WINDOW_WIDTH / scale, -(float)WINDOW_HEIGHT / scale, ((float)WINDOW_HEIGHT / scale), -50.0f, 50.0f);
+    }
+    else {
+        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, FAR_PLANE);
+    }
+
+    // Run the CPU side of the frame across the job system: light orbit, transforms, culling, LOD and the sorted draw list
+    gFrame.View = view;
+    gFrame.Projection = projection;
+    gFrame.CameraPosition = gCamera.Position;
+    gFrame.FieldOfView = glm::radians(gCamera.Zoom);
+    gFrame.Perspective = ortho;
+    gFrame.ViewportHeight = WINDOW_HEIGHT;
+    gFrame.Snapshot = &snapshot;
+    double start = gProfiler.NowMs();
+    gFrameTasks.Run(gJobs);
+    URecordMainScope(snapshot, "Frame tasks", start);
+
+    snapshot.View = view;
+    snapshot.Projection = projection;
+    snapshot.CameraPosition = gCamera.Position;
+    snapshot.LightPosition1 = gLightPosition1;
+    snapshot.LightPosition2 = gLightPosition2;
+    snapshot.Width = gFramebufferWidth;
+    snapshot.Height = gFramebufferHeight;
+    snapshot.DepthPrepass = gDepthPrepass;
+    snapshot.SSAO = gSSAO;
+    snapshot.SSAOTemporal = gSSAOTemporal;
+    snapshot.TemporalAA = gTemporalAAEnabled;
+    snapshot.OcclusionCulling = gOcclusionCulling;
+    snapshot.DeltaTime = gDeltaTime;
+    snapshot.ShowDebugLines = gShowDebugLines;
+    snapshot.ShowProfilerOverlay = gShowProfilerOverlay;
+    snapshot.DynamicResolution = gDynamicResolution;
+    snapshot.ToggleTrace = gToggleTraceRequested;
+    snapshot.Screenshot = gScreenshotRequested;
+    snapshot.ToggleVideo = gToggleVideoRequested;
+    snapshot.Pick = gPickRequested;
+    snapshot.PickPosition = gPickPosition;
+    snapshot.SelectedObjectId = (GLuint)(gSelectedObject + 1);
+    snapshot.ObjectCount = (GLuint)gObjects.Mesh.size();
+    gToggleTraceRequested = false;
+    gScreenshotRequested = false;
+    gToggleVideoRequested = false;
+    gPickRequested = false;
+}
+
+
+// Adds a main thread timing to the snapshot; the render thread puts it in its profiler frame
+void URecordMainScope(FrameSnapshot& snapshot, const char* name, double startMs)
+{
+    if (snapshot.MainScopeCount < FrameSnapshot::MAX_MAIN_SCOPES)
+        snapshot.MainScopes[snapshot.MainScopeCount++] = { name, false, startMs, gProfiler.NowMs() - startMs, Profiler::TRACK_MAIN };
+}
+
+
+// Loads a camera path for --playback; frames 0 plays it once from start to end
+bool UStartPlayback(const char* filename, int frames)
+{
+    if (!gCameraTrack.Load(filename) || gCameraTrack.Poses.empty())
+    {
+        LOG_ERROR("Failed to load camera path %s", filename);
+        return false;
+    }
+    if (frames <= 0)
+        frames = (int)(gCameraTrack.Duration() / PLAYBACK_TIMESTEP) + 1;
+    gPlaybackFrames = frames;
+    gPlaybackTimings.assign(frames, PlaybackTiming());
+    LOG_INFO("Playing back %s: %d frames, %.2f ms apart", filename, frames, PLAYBACK_TIMESTEP * 1000.0f);
+    return true;
+}
+
+
+// GPU time of a frame, first GPU scope start to last GPU scope end; -1 if it has none
+double UGpuFrameMs(const vector<Profiler::Scope>& scopes)
+{
+    double gpuStart = 1e300, gpuEnd = -1e300;
+    for (const Profiler::Scope& scope : scopes)
+    {
+        if (!scope.Gpu)
+            continue;
+        gpuStart = min(gpuStart, scope.StartMs);
+        gpuEnd = max(gpuEnd, scope.StartMs + scope.DurationMs);
+    }
+    return gpuEnd >= gpuStart ? gpuEnd - gpuStart : -1.0;
+}
+
+
+// One line per playback frame: the pose it was drawn from and what it cost
+void UWritePlaybackTimings()
+{
+    FILE* file = fopen(CAMERA_TIMINGS_FILENAME, "w");
+    if (!file)
+    {
+        LOG_ERROR("Failed to write %s", CAMERA_TIMINGS_FILENAME);
+        return;
+    }
+    fprintf(file, "frame,time,x,y,z,yaw,pitch,zoom,simulate_ms,render_ms,interval_ms,gpu_ms\n");
+    for (int i = 0; i < gPlaybackFrames; ++i)
+    {
+        const PlaybackTiming& t = gPlaybackTimings[i];
+        fprintf(file, "%d,%.4f,%.4f,%.4f,%.4f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", i, i * PLAYBACK_TIMESTEP,
+            t.Pose.Position.x, t.Pose.Position.y, t.Pose.Position.z, t.Pose.Yaw, t.Pose.Pitch, t.Pose.Zoom,
+            t.SimulateMs, t.RenderMs, t.IntervalMs, t.GpuMs);
+    }
+    fclose(file);
+    LOG_INFO("Playback timings written to %s", CAMERA_TIMINGS_FILENAME);
+}
+
+
+// Owns the GL context: draws each snapshot the main thread publishes, skipping to the newest if it fell behind
+void URenderThread()
+{
+    glfwMakeContextCurrent(gWindow);
+    double lastFrameStart = gProfiler.NowMs();
+    int framesAfterPlayback = -1;     // counts down while the last playback frames' GPU times come in
+    int renderFrame = 0;
+    int lastResolvedFrame = -1;
+
+    while (gRenderThreadRunning.load(memory_order_acquire))
+    {
+        if (!gSnapshots.Consume())
+        {
+            this_thread::yield();
+            continue;
+        }
+        const FrameSnapshot& frame = gSnapshots.ReadBuffer();
+
+        if (frame.ToggleTrace)
+        {
+            if (!gProfiler.Tracing)
+            {
+                gProfiler.StartTrace();
+                LOG_INFO("Trace capture started");
+            }
+            else if (gProfiler.WriteTrace(TRACE_FILENAME))
+                LOG_INFO("Trace written to %s", TRACE_FILENAME);
+            else
+                LOG_ERROR("Failed to write %s", TRACE_FILENAME);
+        }
+
+        if (frame.Screenshot)
+            gFrameCapture.Screenshot("screenshot_" + to_string(gScreenshotCount++) + ".png");
+        if (frame.ToggleVideo)
+        {
+            if (!gFrameCapture.Recording())
+            {
+                string path = "capture_" + to_string(gVideoCount++) + ".y4m";
+                gFrameCapture.StartVideo(path, VIDEO_FPS);
+                LOG_INFO("Recording video to %s", path.c_str());
+            }
+            else
+            {
+                gFrameCapture.StopVideo();
+                LOG_INFO("Video recording stopped (%u frames dropped)", gFrameCapture.Dropped());
+            }
+        }
+
+        GLCapture::Instance().BeginFrame();
+        double frameStart = gProfiler.NowMs();
+        // Temporal anti-aliasing rebuilds the window's resolution from jittered frames drawn below it
+        float maxScale = frame.TemporalAA ? TemporalAntiAliasing::RENDER_SCALE : 1.0f;
+        gResolution.MaxScale = maxScale;
+        gResolution.Scale = min(gResolution.Scale, maxScale);
+        gRenderScale = frame.DynamicResolution ? gResolution.Scale : maxScale;
+        gRenderFrames[renderFrame % (Profiler::FRAME_LATENCY * 2)] = { frame.PlaybackFrame, gRenderScale };
+        gProfiler.BeginFrame(renderFrame++);
+        for (int i = 0; i < frame.MainScopeCount; ++i)
+        {
+            const Profiler::Scope& scope = frame.MainScopes[i];
+            gProfiler.AddCpu(scope.Name, scope.StartMs, scope.DurationMs);
+        }
+
+        // Render this frame
+        URender(frame);
+
+        // Picks come back a frame or two after the click
+        GLuint pickedId;
+        if (gPicker.Poll(pickedId))
+            gPickResult.store((int)pickedId);
+
+        gProfiler.EndFrame();
+
+        // Playback timings; GPU times show up a few frames later, once the profiler reads them back
+        if (frame.PlaybackFrame >= 0)
+        {
+            PlaybackTiming& timing = gPlaybackTimings[frame.PlaybackFrame];
+            timing.RenderMs = gProfiler.NowMs() - frameStart;
+            timing.IntervalMs = frameStart - lastFrameStart;
+            if (frame.PlaybackFrame == gPlaybackFrames - 1)
+                framesAfterPlayback = Profiler::FRAME_LATENCY;
+        }
+        lastFrameStart = frameStart;
+
+        // GPU time of a frame a few frames back drives the render resolution
+        if (gProfiler.ResultsId != lastResolvedFrame)
+        {
+            lastResolvedFrame = gProfiler.ResultsId;
+            const RenderFrameInfo& resolved = gRenderFrames[lastResolvedFrame % (Profiler::FRAME_LATENCY * 2)];
+            double gpuMs = UGpuFrameMs(gProfiler.Results);
+            if (resolved.PlaybackFrame >= 0)
+                gPlaybackTimings[resolved.PlaybackFrame].GpuMs = gpuMs;
+            if (frame.DynamicResolution)
+                gResolution.Update((float)gpuMs, resolved.Scale);
+            else
+                gResolution.Reset();
+        }
+        if (framesAfterPlayback >= 0 && framesAfterPlayback-- == 0)
+            glfwSetWindowShouldClose(gWindow, true);
+
+        // a capture closes itself after its last frame, and the app goes with it
+        if (GLCapture::Instance().EndFrame())
+        {
+            LOG_INFO("Captured %d frames", GLCapture::Instance().FramesCaptured());
+            glfwSetWindowShouldClose(gWindow, true);
+        }
+    }
+
+    glfwMakeContextCurrent(NULL);
+}
+
+
+// Function called to render a frame
+void URender(const FrameSnapshot& frame)
+{
+    // Reclaim this frame's slice of the streaming ring
+    gStreamBuffer.BeginFrame();
+
+    // The scene goes to offscreen targets at the window's size, drawn in their lower left corner at the
+    // resolution the controller picked
+    int renderWidth = max(1, (int)(frame.Width * gRenderScale + 0.5f));
+    int renderHeight = max(1, (int)(frame.Height * gRenderScale + 0.5f));
+    gFrameGraph.Reset();
+
+    // Everything drawn into the scene's targets moves by this frame's subpixel jitter; the feedback pass and
+    // culling keep the camera's own projection
+    if (frame.TemporalAA)
+        gRenderProjection = gTemporalAA.BeginFrame(frame.View, frame.Projection, glm::ivec2(renderWidth, renderHeight));
+    else
+    {
+        gRenderProjection = frame.Projection;
+        gTemporalAA.Reset();
+    }
+
+    // Object IDs run from 1 to ObjectCount; the passes below skip the objects last frame found hidden
+    gOcclusion.Enabled = frame.OcclusionCulling;
+    gOcclusion.BeginFrame(frame.ObjectCount + 1);
+
+    RenderResource backbuffer = gFrameGraph.ImportBackbuffer("Backbuffer", frame.Width, frame.Height);
+    RenderResource sceneColor = gFrameGraph.Create("Scene color", { frame.Width, frame.Height, GL_RGBA8 });
+    RenderResource objectIds = gFrameGraph.Create("Object IDs", { frame.Width, frame.Height, GL_R32UI });
+    RenderResource sceneDepth = gFrameGraph.Create("Scene depth", { frame.Width, frame.Height, GL_DEPTH_COMPONENT24 });
+
+    // Pages of the virtual textures the objects need, drawn at a fraction of the scene's resolution and read
+    // back a frame or two later. Pages asked for earlier are uploaded first, and the passes after this one
+    // sample the cache on its unit
+    RenderResource feedback = -1;
+    if (gVirtualTextures.Created())
+    {
+        gVirtualTextures.Resize(frame.Width, frame.Height, gGLState);
+        RenderTargetDesc desc = { max(1, frame.Width / VirtualTextureCache::FEEDBACK_SCALE),
+            max(1, frame.Height / VirtualTextureCache::FEEDBACK_SCALE), GL_R32UI };
+        feedback = gFrameGraph.Create("Texture feedback", desc);
+        desc.Format = GL_DEPTH_COMPONENT24;
+        RenderResource feedbackDepth = gFrameGraph.Create("Texture feedback depth", desc);
+        int feedbackPass = gFrameGraph.AddPass("Texture feedback", [&](const FrameGraph& graph)
+        {
+            GpuScope gpuScope(gProfiler, "Texture feedback");
+            gVirtualTextures.Update(gGLState);
+            gGLState.BindTexture(VirtualTextureCache::CACHE_UNIT, GL_TEXTURE_2D, gVirtualTextures.Cache());
+
+            int width = max(1, renderWidth / VirtualTextureCache::FEEDBACK_SCALE);
+            int height = max(1, renderHeight / VirtualTextureCache::FEEDBACK_SCALE);
+            gGLState.Viewport(0, 0, width, height);
+            gGLState.Enable(GL_DEPTH_TEST, true);
+            gGLState.DepthFunc(GL_LESS);
+            gGLState.DepthMask(true);
+            gVirtualTextures.DrawFeedback(frame.Queue, gGLState, frame.View, frame.Projection, gUVScale);
+            gVirtualTextures.ReadFeedback(graph.Texture(feedback), width, height);
+        });
+        gFrameGraph.WriteCleared(feedbackPass, feedback, glm::vec4(0.0f));
+        gFrameGraph.WriteCleared(feedbackPass, feedbackDepth, glm::vec4(1.0f));
+        gFrameGraph.SideEffect(feedbackPass);
+    }
+
+    // Mirror image of the scene above the water, at half the scene's resolution
+    RenderResource waterReflection = -1;
+    if (gWater.Created())
+    {
+        RenderTargetDesc desc = { max(1, frame.Width / 2), max(1, frame.Height / 2), GL_RGBA8 };
+        waterReflection = gFrameGraph.Create("Water reflection", desc);
+        desc.Format = GL_DEPTH_COMPONENT24;
+        RenderResource reflectionDepth = gFrameGraph.Create("Water reflection depth", desc);
+        int reflectionPass = gFrameGraph.AddPass("Water reflection", [&](const FrameGraph&)
+        {
+            GpuScope gpuScope(gProfiler, "Water reflection");
+            gGLState.Viewport(0, 0, max(1, renderWidth / 2), max(1, renderHeight / 2));
+            UDrawWaterReflection(frame);
+        });
+        gFrameGraph.WriteCleared(reflectionPass, waterReflection, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+        gFrameGraph.WriteCleared(reflectionPass, reflectionDepth, glm::vec4(1.0f));
+    }
+
+    // Depth of the objects and the terrain, so the lighting pass shades just the visible fragment of each pixel
+    // and the ambient occlusion has a depth buffer to work from before it
+    if (frame.DepthPrepass)
+    {
+        int prepass = gFrameGraph.AddPass("Depth prepass", [&](const FrameGraph&)
+        {
+            gGLState.Viewport(0, 0, renderWidth, renderHeight);
+            UDrawDepthPrepass(frame);
+        });
+        gFrameGraph.WriteCleared(prepass, sceneDepth, glm::vec4(1.0f));
+    }
+
+    // Ambient occlusion at half resolution, blurred across and then up; the lit programs upsample it
+    RenderResource rawOcclusion = -1, blurredOcclusion = -1, ambientOcclusion = -1;
+    int halfWidth = max(1, renderWidth / 2), halfHeight = max(1, renderHeight / 2);
+    if (frame.SSAO && frame.DepthPrepass)
+    {
+        RenderTargetDesc desc = { max(1, frame.Width / 2), max(1, frame.Height / 2), GL_RG16F };
+        rawOcclusion = gFrameGraph.Create("Ambient occlusion", desc);
+        blurredOcclusion = gFrameGraph.Create("Ambient occlusion blurred across", desc);
+        ambientOcclusion = gFrameGraph.Create("Ambient occlusion blurred", desc);
+        int occlusionPass = gFrameGraph.AddPass("Ambient occlusion", [&](const FrameGraph& graph)
+        {
+            GpuScope gpuScope(gProfiler, "Ambient occlusion");
+            gGLState.Enable(GL_DEPTH_TEST, false);
+            gGLState.Viewport(0, 0, halfWidth, halfHeight);
+            gAmbientOcclusion.Temporal = frame.SSAOTemporal;
+            const RenderTargetDesc& target = graph.Desc(rawOcclusion);
+            gAmbientOcclusion.Draw(graph.Texture(sceneDepth), graph.Texture(rawOcclusion), glm::ivec2(target.Width, target.Height),
+                glm::ivec2(renderWidth, renderHeight), frame.View, gRenderProjection, gGLState);
+        });
+        gFrameGraph.Read(occlusionPass, sceneDepth);
+        gFrameGraph.Write(occlusionPass, rawOcclusion);
+
+        int acrossPass = gFrameGraph.AddPass("Ambient occlusion blur across", [&](const FrameGraph& graph)
+        {
+            GpuScope gpuScope(gProfiler, "Occlusion blur across");
+            gGLState.Viewport(0, 0, halfWidth, halfHeight);
+            gAmbientOcclusion.Blur(graph.Texture(rawOcclusion), glm::ivec2(1, 0), glm::ivec2(renderWidth, renderHeight), gGLState);
+        });
+        gFrameGraph.Read(acrossPass, rawOcclusion);
+        gFrameGraph.Write(acrossPass, blurredOcclusion);
+
+        int upPass = gFrameGraph.AddPass("Ambient occlusion blur up", [&](const FrameGraph& graph)
+        {
+            GpuScope gpuScope(gProfiler, "Occlusion blur up");
+            gGLState.Viewport(0, 0, halfWidth, halfHeight);
+            gAmbientOcclusion.Blur(graph.Texture(blurredOcclusion), glm::ivec2(0, 1), glm::ivec2(renderWidth, renderHeight), gGLState);
+        });
+        gFrameGraph.Read(upPass, blurredOcclusion);
+        gFrameGraph.Write(upPass, ambientOcclusion);
+    }
+    else
+        gAmbientOcclusion.Reset();
+
+    // Lit scene, with the ID of each object next to its color (0 where nothing was drawn)
+    int scenePass = gFrameGraph.AddPass("Scene", [&](const FrameGraph& graph)
+    {
+        gGLState.Viewport(0, 0, renderWidth, renderHeight);
+        UDrawScene(frame, renderWidth, renderHeight, graph, waterReflection, ambientOcclusion);
+    });
+    if (gWater.Created())
+        gFrameGraph.Read(scenePass, waterReflection);
+    if (ambientOcclusion >= 0)
+        gFrameGraph.Read(scenePass, ambientOcclusion);
+    gFrameGraph.WriteCleared(scenePass, sceneColor, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    gFrameGraph.WriteCleared(scenePass, objectIds, glm::vec4(0.0f));
+    if (frame.DepthPrepass)
+        gFrameGraph.Write(scenePass, sceneDepth);
+    else
+        gFrameGraph.WriteCleared(scenePass, sceneDepth, glm::vec4(1.0f));
+
+    // Drawn without the ID attachment, which the line shader has no output for
+    if (frame.ShowDebugLines)
+    {
+        int debugPass = gFrameGraph.AddPass("Debug lines", [&](const FrameGraph&)
+        {
+            GpuScope gpuScope(gProfiler, "Debug lines");
+            gGLState.Viewport(0, 0, renderWidth, renderHeight);
+            UDrawDebugLines(frame);
+        });
+        gFrameGraph.Write(debugPass, sceneColor);
+        gFrameGraph.Write(debugPass, sceneDepth);
+    }
+
+    if (frame.Pick)
+    {
+        int pickPass = gFrameGraph.AddPass("Pick", [&](const FrameGraph& graph)
+        {
+            int x = glm::clamp((int)(frame.PickPosition.x * renderWidth), 0, renderWidth - 1);
+            int y = glm::clamp((int)(frame.PickPosition.y * renderHeight), 0, renderHeight - 1);
+            gPicker.Request(graph.Texture(objectIds), x, y);
+        });
+        gFrameGraph.Read(pickPass, objectIds);
+        gFrameGraph.SideEffect(pickPass);
+    }
+
+    // Each pixel's motion since last frame, then the jittered frames blended at the window's resolution
+    RenderResource velocity = -1, resolved = -1;
+    RenderResource upscaleSource = sceneColor;
+    if (frame.TemporalAA)
+    {
+        velocity = gFrameGraph.Create("Velocity", { frame.Width, frame.Height, GL_RG16F });
+        resolved = gFrameGraph.Create("Temporal resolve", { frame.Width, frame.Height, GL_RGBA16F });
+        int velocityPass = gFrameGraph.AddPass("Velocity", [&](const FrameGraph& graph)
+        {
+            GpuScope gpuScope(gProfiler, "Velocity");
+            gGLState.Enable(GL_DEPTH_TEST, false);
+            gGLState.Viewport(0, 0, renderWidth, renderHeight);
+            gTemporalAA.DrawVelocity(graph.Texture(sceneDepth), glm::ivec2(renderWidth, renderHeight), gGLState);
+        });
+        gFrameGraph.Read(velocityPass, sceneDepth);
+        gFrameGraph.Write(velocityPass, velocity);
+
+        int resolvePass = gFrameGraph.AddPass("Temporal resolve", [&](const FrameGraph& graph)
+        {
+            GpuScope gpuScope(gProfiler, "Temporal resolve");
+            gTemporalAA.Resolve(graph.Texture(sceneColor), graph.Texture(velocity), graph.Texture(resolved),
+                glm::ivec2(renderWidth, renderHeight), glm::ivec2(frame.Width, frame.Height), gGLState);
+        });
+        gFrameGraph.Read(resolvePass, sceneColor);
+        gFrameGraph.Read(resolvePass, velocity);
+        gFrameGraph.Write(resolvePass, resolved);
+        upscaleSource = resolved;
+    }
+
+    // Scale the scene up to the window. Sharpening makes up for the detail lost below full resolution, or
+    // for the softening of the temporal resolve, which is already at the window's resolution
+    int upscalePass = gFrameGraph.AddPass("Upscale", [&](const FrameGraph& graph)
+    {
+        GpuScope gpuScope(gProfiler, "Upscale");
+        const RenderTargetDesc& source = graph.Desc(upscaleSource);
+        int drawnWidth = frame.TemporalAA ? source.Width : renderWidth;
+        int drawnHeight = frame.TemporalAA ? source.Height : renderHeight;
+        float sharpness = frame.TemporalAA ? TemporalAntiAliasing::SHARPNESS : glm::clamp((1.0f - gRenderScale) * 2.0f, 0.0f, 1.0f);
+        gGLState.Enable(GL_DEPTH_TEST, false);
+        gGLState.UseProgram(gUpscaleProgramId);
+        gGLState.BindTexture(0, GL_TEXTURE_2D, graph.Texture(upscaleSource));
+        glm::vec2 texelSize(1.0f / source.Width, 1.0f / source.Height);
+        glm::vec2 renderScale(drawnWidth * texelSize.x, drawnHeight * texelSize.y);
+        glm::vec2 maxUV = renderScale - texelSize * 0.5f;
+        glUniform1i(glGetUniformLocation(gUpscaleProgramId, "sceneColor"), 0);
+        glUniform2fv(glGetUniformLocation(gUpscaleProgramId, "renderScale"), 1, glm::value_ptr(renderScale));
+        glUniform2fv(glGetUniformLocation(gUpscaleProgramId, "texelSize"), 1, glm::value_ptr(texelSize));
+        glUniform2fv(glGetUniformLocation(gUpscaleProgramId, "maxUV"), 1, glm::value_ptr(maxUV));
+        glUniform1f(glGetUniformLocation(gUpscaleProgramId, "sharpness"), sharpness);
+        gGLState.BindVertexArray(gEmptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    });
+    gFrameGraph.Read(upscalePass, upscaleSource);
+    gFrameGraph.Write(upscalePass, backbuffer);
+
+    // Screenshots and video take the upscaled frame, without the overlay
+    int capturePass = gFrameGraph.AddPass("Frame capture", [&](const FrameGraph&)
+    {
+        CpuScope cpuScope(gProfiler, "Frame capture");
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        gFrameCapture.Capture(frame.Width, frame.Height);
+    });
+    gFrameGraph.Read(capturePass, backbuffer);
+    gFrameGraph.SideEffect(capturePass);
+
+    if (frame.ShowProfilerOverlay)
+    {
+        int overlayPass = gFrameGraph.AddPass("Overlay", [&](const FrameGraph&)
+        {
+            UDrawProfilerOverlay();
+        });
+        gFrameGraph.Write(overlayPass, backbuffer);
+    }
+
+    int submitScope = gProfiler.BeginCpu("Submission");
+    gFrameGraph.Execute(gTargetPool, gGLState);
+    gProfiler.EndCpu(submitScope);
+
+    // Deactivate the Vertex Array Object
+    gGLState.BindVertexArray(0);
+
+    // Everything streamed this frame has been consumed by the draws above
+    gStreamBuffer.EndFrame();
+
+    float now = glfwGetTime();
+    if (now - gLastOverdrawReport >= 1.0f)
+    {
+        LOG_INFO("Overdraw: %.2f fragments/pixel (%u shaded, prepass %s)", gOverdraw.Overdraw, gOverdraw.ShadedFragments, frame.DepthPrepass ? "on" : "off");
+        LOG_INFO("Culling: %u of %u objects visible", frame.VisibleObjects, frame.ObjectCount);
+        LOG_INFO("Occlusion: %u of %u draws conditional on an occluded result, %u boxes tested (%s)", gOcclusion.ConditionalDraws,
+            frame.VisibleObjects, gOcclusion.Queries, frame.OcclusionCulling ? "on" : "off");
+        if (gTerrain.Created())
+            LOG_INFO("Terrain: %d nodes, %u triangles, %d of %d tiles resident, %.1f MB of heights", gTerrain.Nodes,
+                gTerrain.Triangles, gTerrain.ResidentTiles(), Terrain::RESIDENT_TILES, gTerrain.ResidentBytes() / (1024.0 * 1024.0));
+        if (gVirtualTextures.Created())
+            LOG_INFO("Virtual textures: %d of %d pages resident (%.1f MB), %d on screen, %d uploaded this frame, %zu waiting",
+                gVirtualTextures.ResidentPages(), gVirtualTextures.Slots(), gVirtualTextures.CacheBytes() / (1024.0 * 1024.0),
+                gVirtualTextures.FeedbackPages, gVirtualTextures.Uploads, gVirtualTextures.Waiting);
+        if (gWater.Created())
+            LOG_INFO("Water: %dx%d cells, %d triangles, %d simulation steps this frame", gWater.Columns(), gWater.Rows(),
+                gWater.Triangles(), gWater.Steps);
+        LOG_INFO("Ambient occlusion: %s, temporal accumulation %s", !frame.SSAO ? "off" : frame.DepthPrepass ? "on" : "off (needs the prepass)",
+            frame.SSAOTemporal ? "on" : "off");
+        LOG_INFO("LOD: %u of %u triangles drawn", frame.DrawnTriangles, frame.FullTriangles);
+        LOG_INFO("GL state calls: %u issued, %u skipped", gGLState.Issued, gGLState.Skipped);
+        LOG_INFO("Resolution: %dx%d (%.0f%% of %dx%d), temporal anti-aliasing %s", renderWidth, renderHeight, gRenderScale * 100.0f,
+            frame.Width, frame.Height, frame.TemporalAA ? "on" : "off");
+        LOG_INFO("Frame graph: %d passes (%d culled), %zu render targets in %.1f MB", gFrameGraph.LivePasses,
+            gFrameGraph.CulledPasses, gTargetPool.Textures(), gTargetPool.Bytes() / (1024.0 * 1024.0));
+        gLastOverdrawReport = now;
+
+        // Timings of the last resolved frame go in the title bar next to the overlay bars
+        string title = string(WINDOW_TITLE) + " | frame " + to_string(gProfiler.FrameMs).substr(0, 5) + " ms | scale "
+            + to_string((int)(gRenderScale * 100.0f + 0.5f)) + "%";
+        for (const Profiler::Scope& scope : gProfiler.Results)
+            title += string(" | ") + (scope.Gpu ? "GPU " : "") + scope.Name + " " + to_string(scope.DurationMs).substr(0, 5);
+        gWindowTitles.WriteBuffer() = title;
+        gWindowTitles.Publish();
     }
-    break;
+    gGLState.ResetCounters();
+    gGLState.EndFrame();
 
-    default:
-        cout << "Unhandled mouse button event" << endl;
-        break;
-    }
+    // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
+    CpuScope swapScope(gProfiler, "glfwSwapBuffers");
+    glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
 }
 
 
-// Function called to render a frame
-void URender()
+// Depth only, into the bound scene depth at the viewport's size; the lighting pass then shades just the
+// visible fragment of each pixel
+void UDrawDepthPrepass(const FrameSnapshot& frame)
 {
-    const float angularVelocity = glm::radians(45.0f);
-    if (gIsLampOrbiting)
+    GpuScope gpuScope(gProfiler, "Depth prepass");
+    gGLState.Enable(GL_DEPTH_TEST, true);
+    gGLState.DepthFunc(GL_LESS);
+    gGLState.DepthMask(true);
+
+    gGLState.UseProgram(gDepthProgramId);
+    glUniformMatrix4fv(glGetUniformLocation(gDepthProgramId, "view"), 1, GL_FALSE, glm::value_ptr(frame.View));
+    glUniformMatrix4fv(glGetUniformLocation(gDepthProgramId, "projection"), 1, GL_FALSE, glm::value_ptr(gRenderProjection));
+
+    gGLState.ColorMask(false);
+    frame.Queue.Flush(PASS_DEPTH, gGLState, &gOcclusion.Conditions());
+
+    // The terrain goes in with its own program, whose morphing the depth program can't do; the lit pass
+    // then draws it again against this depth. Its tiles stream here, so both draws see the same heights,
+    // and the occlusion isn't drawn yet, so it reads none
+    if (gTerrain.Created())
     {
-        glm::vec4 newPosition = glm::rotate(angularVelocity * gDeltaTime, glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(gLightPosition1, 1.0f);
-       gLightPosition1.x = newPosition.x;
-       gLightPosition1.y = newPosition.y;
-       gLightPosition1.z = newPosition.z;
-       // gLightPosition2.x = newPosition.x;
-       // gLightPosition2.y = newPosition.y;
-       // gLightPosition2.z = newPosition.z;
-
+        gTerrain.Update(frame.CameraPosition, gGLState);
+        USetAmbientOcclusion(0, 0, 0);
+        UDrawTerrain(frame, frame.View, frame.CameraPosition);
     }
+    gGLState.ColorMask(true);
+}
 
 
-    glEnable(GL_DEPTH_TEST);  //checks to make sure a fragment is supposed to be rendered (front) or not (behind other rendered fragments)
+// Lit scene, into the bound scene targets at width x height, on top of the depth prepass when there is one.
+// waterReflection is the output of UDrawWaterReflection, when there is water, and ambientOcclusion the
+// blurred occlusion at half resolution, when it was drawn
+void UDrawScene(const FrameSnapshot& frame, int width, int height, const FrameGraph& graph, RenderResource waterReflection,
+    RenderResource ambientOcclusion)
+{
+    gGLState.Enable(GL_DEPTH_TEST, true);  //checks to make sure a fragment is supposed to be rendered (front) or not (behind other rendered fragments)
+    if (gEnvironment.Created())
+        gEnvironment.Bind(gGLState);
+    USetAmbientOcclusion(ambientOcclusion >= 0 ? graph.Texture(ambientOcclusion) : 0, width, height);
 
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);  //depth buffer stores depth value generated after depth testing
+    // Set the shader to be used
+    gGLState.UseProgram(gSunProgramId);
+    USetSceneUniforms(gSunProgramId, frame, frame.View, frame.CameraPosition);
 
+    if (frame.DepthPrepass)
+    {
+        // Depth is final, so only test against it
+        gGLState.DepthFunc(GL_LEQUAL);
+        gGLState.DepthMask(false);
+    }
 
+    gOverdraw.Resolve(width * height);
+    {
+        GpuScope gpuScope(gProfiler, "Opaque pass");
+        gOverdraw.Begin();
+        frame.Queue.Flush(PASS_OPAQUE, gGLState, &gOcclusion.Conditions());
+        gOverdraw.End();
+    }
 
-    glm::mat4 scale = glm::scale(glm::vec3(-1.0f, -1.0f, -1.0f)); // scaling the matrix
+    // The terrain goes behind the objects, so their depth rejects what they cover before it is shaded. With
+    // the prepass its depth is already there (and its tiles updated), so it only tests against it
+    if (gTerrain.Created())
+    {
+        GpuScope gpuScope(gProfiler, "Terrain");
+        if (!frame.DepthPrepass)
+        {
+            gGLState.DepthFunc(GL_LESS);
+            gGLState.DepthMask(true);
+            gTerrain.Update(frame.CameraPosition, gGLState);
+        }
+        UDrawTerrain(frame, frame.View, frame.CameraPosition);
+    }
 
-    glm::mat4 rotation = glm::rotate(90.0f, glm::vec3(1.0f, 0.0f, 0.0f));  //first rotation around the x axis
+    // The sky fills whatever is still at the far plane, before the water that reflects it
+    if (gEnvironment.Created())
+    {
+        GpuScope gpuScope(gProfiler, "Sky");
+        gEnvironment.DrawSky(gSkyProgramId, frame.View, gRenderProjection, gGLState);
+    }
 
-    glm::mat4 rotation2 = glm::rotate(45.0f, glm::vec3(0.0f, 0.0f, 1.0f));  //second rotation around the z axis
+    if (gWater.Created())
+    {
+        GpuScope gpuScope(gProfiler, "Water");
+        gGLState.DepthFunc(GL_LESS);
+        gGLState.DepthMask(true);
+        gWater.Simulate(frame.DeltaTime, gGLState);
+
+        gGLState.UseProgram(gWaterProgramId);
+        USetSceneUniforms(gWaterProgramId, frame, frame.View, frame.CameraPosition);
+        gGLState.BindTexture(0, GL_TEXTURE_2D, gWaterTexture);
+        const RenderTargetDesc& reflection = graph.Desc(waterReflection);
+        gWater.Draw(gGLState, graph.Texture(waterReflection), glm::ivec2(max(1, width / 2), max(1, height / 2)),
+            glm::ivec2(reflection.Width, reflection.Height), glm::ivec2(width, height));
+    }
 
-    glm::mat4 translation = glm::translate(glm::vec3(0.0f, 0.0f, 0.0f));	//no translation	
+    // Boxes go against the finished depth buffer; their results decide next frame's draws
+    {
+        GpuScope gpuScope(gProfiler, "Occlusion tests");
+        gOcclusion.TestBoxes(frame.Queue, gGLState, gDepthProgramId, gDepthModelLocation, frame.View, gRenderProjection, frame.CameraPosition);
+    }
 
-    glm::mat4 model = translation * rotation * rotation2 * scale;  //combination the matrices to form the model
+    gGLState.DepthFunc(GL_LESS);
+    gGLState.DepthMask(true);
+}
 
 
-    glm::mat4 view = gCamera.GetViewMatrix();
+// Terrain seen through view from cameraPosition, lit like the rest of the scene
+void UDrawTerrain(const FrameSnapshot& frame, const glm::mat4& view, const glm::vec3& cameraPosition)
+{
+    glm::vec4 planes[6];
+    UExtractFrustumPlanes(frame.Projection * view, planes);
+    gGLState.UseProgram(gTerrainProgramId);
+    USetSceneUniforms(gTerrainProgramId, frame, view, cameraPosition);
+    glUniform1ui(glGetUniformLocation(gTerrainProgramId, "objectId"), 0);    // not pickable
+    gGLState.BindTexture(0, GL_TEXTURE_2D, gTerrainTexture);
+    gTerrain.Draw(gGLState, planes, cameraPosition);
+}
 
-    glm::mat4 projection;
-    if (!ortho) {
-        GLfloat oWidth = (GLfloat)WINDOW_WIDTH * 0.01f; // 10% of width
-        GLfloat oHeight = (GLfloat)WINDOW_HEIGHT * 0.01f; // 10% of height
-        //projection = glm::ortho(-oWidth, oWidth, oHeight, -oHeight, 0.1f, 100.0f);
-        float scale = 100;
-        projection = glm::ortho(-((float)WINDOW_WIDTH / scale), (float)WINDOW_WIDTH / scale, -(float)WINDOW_HEIGHT / scale, ((float)WINDOW_HEIGHT / scale), -50.0f, 50.0f);
-    }
-    else {
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+
+// The scene above the water seen in its mirror, for the water to reflect. The camera and view are mirrored
+// across the surface at rest and everything below it is clipped. It redraws the main view's draw list, so an
+// object seen only in the reflection is missing; from a pool at ground level that is rare
+void UDrawWaterReflection(const FrameSnapshot& frame)
+{
+    glm::mat4 mirror = gWater.Reflection();
+    glm::mat4 view = frame.View * mirror;
+    glm::vec3 cameraPosition = glm::vec3(mirror * glm::vec4(frame.CameraPosition, 1.0f));
+    glm::vec4 plane = gWater.Plane();
+
+    gGLState.Enable(GL_DEPTH_TEST, true);
+    gGLState.DepthFunc(GL_LESS);
+    gGLState.DepthMask(true);
+    gGLState.Enable(GL_CLIP_DISTANCE0, true);
+    if (gEnvironment.Created())
+        gEnvironment.Bind(gGLState);
+    // The occlusion is of the main view
+    USetAmbientOcclusion(0, 0, 0);
+
+    // Only this pass enables the clip distance, so the plane can stay set for the other passes
+    gGLState.UseProgram(gTerrainProgramId);
+    glUniform4fv(glGetUniformLocation(gTerrainProgramId, "clipPlane"), 1, glm::value_ptr(plane));
+    gGLState.UseProgram(gSunProgramId);
+    glUniform4fv(glGetUniformLocation(gSunProgramId, "clipPlane"), 1, glm::value_ptr(plane));
+
+    USetSceneUniforms(gSunProgramId, frame, view, cameraPosition);
+    frame.Queue.Flush(PASS_OPAQUE, gGLState);
+    if (gTerrain.Created())
+        UDrawTerrain(frame, view, cameraPosition);
+
+    // The sky shader writes no clip distance; it is all above the water anyway
+    gGLState.Enable(GL_CLIP_DISTANCE0, false);
+    if (gEnvironment.Created())
+        gEnvironment.DrawSky(gSkyProgramId, view, gRenderProjection, gGLState);
+    gGLState.DepthFunc(GL_LESS);
+    gGLState.DepthMask(true);
+}
+
+
+// Points the lit programs at the half resolution ambient occlusion of a width x height scene, or turns it off
+// with texture 0
+void USetAmbientOcclusion(GLuint texture, int width, int height)
+{
+    gGLState.BindTexture(AmbientOcclusion::OCCLUSION_UNIT, GL_TEXTURE_2D, texture);
+    glm::vec2 maxTexel(max(1, width / 2) - 1, max(1, height / 2) - 1);
+    for (GLuint program : { gSunProgramId, gTerrainProgramId })
+    {
+        gGLState.UseProgram(program);
+        glUniform1i(glGetUniformLocation(program, "ambientOcclusion"), texture != 0);
+        glUniform2fv(glGetUniformLocation(program, "occlusionMaxTexel"), 1, glm::value_ptr(maxTexel));
     }
+}
 
-    // Set the shader to be used
-    glUseProgram(gSunProgramId);
 
+// View, lighting and selection uniforms shared by the programs that light like the sun fragment shader,
+// seen through view from cameraPosition; the program must be in use
+void USetSceneUniforms(GLuint programId, const FrameSnapshot& frame, const glm::mat4& view, const glm::vec3& cameraPosition)
+{
     // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gSunProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gSunProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gSunProgramId, "projection");
+    GLint viewLoc = glGetUniformLocation(programId, "view");
+    GLint projLoc = glGetUniformLocation(programId, "projection");
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
     glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(gRenderProjection));
 
-    GLint UVScaleLoc = glGetUniformLocation(gSunProgramId, "uvScale");
+    GLint UVScaleLoc = glGetUniformLocation(programId, "uvScale");
     glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
 
     // Reference matrix uniforms from the shader program for the color, light color, light position, and camera position
-    GLint lightColor1Loc = glGetUniformLocation(gSunProgramId, "lightColor1");
-    GLint lightColor2Loc = glGetUniformLocation(gSunProgramId, "lightColor2");
-    GLint lightPosition1Loc = glGetUniformLocation(gSunProgramId, "lightPos1");
-    GLint lightPosition2Loc = glGetUniformLocation(gSunProgramId, "lightPos2");
-    GLint lightStrength1Loc = glGetUniformLocation(gSunProgramId, "light_1_strength");
-    GLint lightStrength2Loc = glGetUniformLocation(gSunProgramId, "light_2_strength");
-    GLint viewPositionLoc = glGetUniformLocation(gSunProgramId, "viewPosition");
-    GLint ambientStrengthLoc = glGetUniformLocation(gSunProgramId, "ambientStrength");
-    GLint diffuseStrengthLoc = glGetUniformLocation(gSunProgramId, "diffuseStrength");
-    GLint specularIntensityLoc = glGetUniformLocation(gSunProgramId, "specularIntensity");
+    GLint lightColor1Loc = glGetUniformLocation(programId, "lightColor1");
+    GLint lightColor2Loc = glGetUniformLocation(programId, "lightColor2");
+    GLint lightPosition1Loc = glGetUniformLocation(programId, "lightPos1");
+    GLint lightPosition2Loc = glGetUniformLocation(programId, "lightPos2");
+    GLint lightStrength1Loc = glGetUniformLocation(programId, "light_1_strength");
+    GLint lightStrength2Loc = glGetUniformLocation(programId, "light_2_strength");
+    GLint viewPositionLoc = glGetUniformLocation(programId, "viewPosition");
+    GLint ambientStrengthLoc = glGetUniformLocation(programId, "ambientStrength");
+    GLint diffuseStrengthLoc = glGetUniformLocation(programId, "diffuseStrength");
+    GLint specularIntensityLoc = glGetUniformLocation(programId, "specularIntensity");
 
     // Pass color, light, and camera data to the shader program's corresponding uniforms
     glUniform3f(lightColor1Loc, gLightColor1.r, gLightColor1.g, gLightColor1.b);
     glUniform3f(lightColor2Loc, gLightColor2.r, gLightColor2.g, gLightColor2.b);
-    glUniform3f(lightPosition1Loc, gLightPosition1.x, gLightPosition1.y, gLightPosition1.z);
-    glUniform3f(lightPosition2Loc, gLightPosition2.x, gLightPosition2.y, gLightPosition2.z);
+    glUniform3f(lightPosition1Loc, frame.LightPosition1.x, frame.LightPosition1.y, frame.LightPosition1.z);
+    glUniform3f(lightPosition2Loc, frame.LightPosition2.x, frame.LightPosition2.y, frame.LightPosition2.z);
     glUniform1f(lightStrength1Loc, light_1_strength);
     glUniform1f(lightStrength2Loc, light_2_strength);
     glUniform3f(ambientStrengthLoc, gAmbientStrength.r, gAmbientStrength.g, gAmbientStrength.b);
     glUniform3f(diffuseStrengthLoc, gDiffuseStrength.r, gAmbientStrength.g, gAmbientStrength.b);
     glUniform1f(specularIntensityLoc, gSpecularIntensity);;
-    const glm::vec3 cameraPosition = gCamera.Position;
     glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
 
     // tell fragment shader there is not multiple textures
-    GLuint multipleTexturesLoc = glGetUniformLocation(gSunProgramId, "multipleTextures");
+    GLuint multipleTexturesLoc = glGetUniformLocation(programId, "multipleTextures");
     glUniform1i(multipleTexturesLoc, false);
 
-    glBindTexture(GL_TEXTURE_2D, monumentTex);
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gMesh.VAO[0]);
-    glDrawElements(GL_TRIANGLES, gMesh.nMonumentIndices, GL_UNSIGNED_SHORT, NULL);
+    glUniform1ui(glGetUniformLocation(programId, "selectedObject"), frame.SelectedObjectId);
+}
+
+
+// Renders the scene on the CPU without a window or GPU and writes the last frame to an image. With more
+// than one frame it doubles as a benchmark; compare its frame time with the GL path on llvmpipe
+// (LIBGL_ALWAYS_SOFTWARE=1) through the profiler's window title.
+int URenderSoftware(const char* filename, int frames)
+{
+    if (!ULoadScene())
+        return EXIT_FAILURE;
+
+    // Texture ids index gSoftTextures here; 0 stays untextured
+    const BakedArray<BakedMaterial>& materials = gScene.Scene->Materials;
+    gSoftTextures.resize(materials.size() + 1);
+    for (size_t i = 0; i < materials.size(); ++i)
+    {
+        if (!UCreateSoftwareTexture(materials[i].Texture.begin(), gSoftTextures[i + 1]))
+        {
+            LOG_ERROR("Failed to load texture %s", materials[i].Texture.begin());
+            return EXIT_FAILURE;
+        }
+        gMaterialTextures.push_back((GLuint)i + 1);
+    }
 
+    UCreateSceneObjects();
+    UCreateFrameTasks();
+    gSoftRasterizer.Resize(WINDOW_WIDTH, WINDOW_HEIGHT);
 
-    glBindTexture(GL_TEXTURE_2D, grassTex);
-    glBindVertexArray(gMesh.VAO[1]);
-    glDrawElements(GL_TRIANGLES, gMesh.nPlaneIndices, GL_UNSIGNED_SHORT, NULL);
+    // The GL path streams the terrain's tiles; here it is one mesh built from the overview heights
+    const BakedTerrain& terrain = gScene.Scene->Terrain;
+    vector<GLfloat> terrainVertices;
+    vector<GLushort> terrainIndices;
+    if (terrain.Present)
+    {
+        if (!UOpenTerrain(terrain.Heightmap.begin()))
+            return EXIT_FAILURE;
+        gTerrain.BuildOverviewMesh(terrainVertices, terrainIndices);
+    }
+    SoftMesh terrainMesh = { terrainVertices.data(), terrainVertices.size() / SoftMesh::FLOATS_PER_VERTEX,
+        terrainIndices.data(), terrainIndices.size() };
 
+    // The lamp doesn't orbit between frames, so every frame is the same image
+    FrameSnapshot snapshot;
+    auto start = chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        USimulate(snapshot);
+
+        SoftShading shading;
+        shading.Lights[0] = { snapshot.LightPosition1, gLightColor1, light_1_strength };
+        shading.Lights[1] = { snapshot.LightPosition2, gLightColor2, light_2_strength };
+        shading.AmbientStrength = gAmbientStrength;
+        shading.SpecularIntensity = gSpecularIntensity;
+        shading.ViewPosition = snapshot.CameraPosition;
+        shading.UVScale = gUVScale;
+
+        // Same visible objects and levels of detail the GL path would draw
+        gSoftRasterizer.Clear(glm::vec3(0.0f));
+        for (size_t i = 0; i < gObjects.Mesh.size(); ++i)
+        {
+            if (!gObjects.Visible[i])
+                continue;
+            int mesh = gObjects.Mesh[i];
+            const LODLevel& level = gMesh.lods[mesh].Levels[gObjects.LODLevel[i]];
+            SoftMesh softMesh = { gMesh.data[mesh]->Vertices.begin(), gMesh.data[mesh]->VertexCount,
+                gMesh.data[mesh]->Indices.begin() + level.IndexOffset, level.IndexCount };
+            gSoftRasterizer.Draw(softMesh, gObjects.Model[i], &gSoftTextures[gObjects.Texture[i]]);
+        }
+        if (terrain.Present)
+            gSoftRasterizer.Draw(terrainMesh, terrain.Model, &gSoftTextures[gMaterialTextures[terrain.Material]]);
+        gSoftRasterizer.Render(gJobs, snapshot.View, snapshot.Projection, shading);
+    }
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    LOG_INFO("Software: %d frames of %dx%d in %.1f ms, %.2f ms/frame (%.1f fps), %u triangles, %u workers",
+        frames, WINDOW_WIDTH, WINDOW_HEIGHT, ms, ms / frames, 1000.0 * frames / ms, gSoftRasterizer.Triangles, gJobs.WorkerCount());
+
+    bool written = gSoftRasterizer.WritePPM(filename);
+    if (written)
+        LOG_INFO("Image written to %s", filename);
+    else
+        LOG_ERROR("Failed to write %s", filename);
+
+    gJobs.Stop();
+    Logger::Instance().Stop();
+    return written ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-    glBindTexture(GL_TEXTURE_2D, marbleTex);
-    glBindVertexArray(gMesh.VAO[2]);
-    glDrawElements(GL_TRIANGLES, gMesh.nBuildingIndices, GL_UNSIGNED_SHORT, NULL);
 
+// Loads an image for the software rasterizer, flipped like UCreateTexture does
+bool UCreateSoftwareTexture(const char* filename, SoftTexture& texture)
+{
+    int width, height, channels;
+    unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
+    if (!image)
+        return false;
 
-    glBindTexture(GL_TEXTURE_2D, marbleTex);
-    glBindVertexArray(gMesh.VAO[3]);
-    glDrawElements(GL_TRIANGLES, gMesh.nColumnIndices, GL_UNSIGNED_SHORT, NULL);
+    flipImageVertically(image, width, height, channels);
+    bool created = texture.Create(image, width, height, channels);
+    stbi_image_free(image);
+    return created;
+}
 
 
-    glBindTexture(GL_TEXTURE_2D, waterTex);
-    glBindVertexArray(gMesh.VAO[4]);
-    glDrawElements(GL_TRIANGLES, gMesh.nPoolIndices, GL_UNSIGNED_SHORT, NULL);
+// Orbits the first light around the y axis
+void UUpdateLights(float deltaTime)
+{
+    const float angularVelocity = glm::radians(45.0f);
+    if (gIsLampOrbiting)
+    {
+        glm::vec4 newPosition = glm::rotate(angularVelocity * deltaTime, glm::vec3(0.0f, 1.0f, 0.0f)) * glm::vec4(gLightPosition1, 1.0f);
+        gLightPosition1.x = newPosition.x;
+        gLightPosition1.y = newPosition.y;
+        gLightPosition1.z = newPosition.z;
+    }
+}
 
 
+// Places one object per scene instance
+void UCreateSceneObjects()
+{
+    const BakedArray<BakedInstance>& instances = gScene.Scene->Instances;
+    gObjects.Mesh.reserve(instances.size());
+    gObjects.Texture.reserve(instances.size());
+    gObjects.Material.reserve(instances.size());
+    gObjects.Model.reserve(instances.size());
+    for (const BakedInstance& instance : instances)
+    {
+        gObjects.Mesh.push_back(instance.Mesh);
+        gObjects.Texture.push_back(gMaterialTextures[instance.Material]);
+        gObjects.Material.push_back(instance.Material);
+        gObjects.Model.push_back(instance.Model);
+    }
 
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
+    size_t count = gObjects.Mesh.size();
+    gObjects.Center.resize(count);
+    gObjects.Radius.resize(count);
+    gObjects.Visible.resize(count);
+    gObjects.LODLevel.assign(count, 0);
 
-    // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-    glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
+    // Materials and meshes are numbered densely from 0, which is what the sort key holds
+    if (gMaterialTextures.size() > RenderQueue::MAX_MATERIALS || gMesh.lods.size() > RenderQueue::MAX_MESHES)
+        LOG_WARNING("%zu materials and %zu meshes exceed the sort key's %u and %u; draws will batch less well",
+            gMaterialTextures.size(), gMesh.lods.size(), RenderQueue::MAX_MATERIALS, RenderQueue::MAX_MESHES);
 }
 
 
-// Implements the UCreateMesh function
-void UCreateMesh(GLMesh& mesh)
+// Builds the graph of per-frame CPU tasks once. Transforms fan out over the objects, culling and LOD
+// selection both follow them and run side by side, and the draw list waits for everything else.
+void UCreateFrameTasks()
 {
-    GLfloat monumentVerts[] = {
+    const uint32_t grain = 1024;   // objects per job
 
-        //monument
-        // Vertex Positions    /0 Colors (r,g,b,a)
-        2.5f, 7.5f, 0.0f,	 0.0f, 0.0f, 1.0f,       1.0f, 1.0f,// 0
-       -2.5f, 7.5f, 0.0f,	 0.0f, 0.0f, 1.0f,       1.0f, 0.0f,// 1
-        2.5f, 12.5f, 0.0f,	 0.0f, 0.0f, 1.0f,       0.0f, 0.0f,// 2
-       -2.5f, 12.5f, 0.0f,	 0.0f, 0.0f, 1.0f,       0.0f, 1.0f,// 3
-        2.0f, 9.0f, 10.0f,	 0.0f, 0.0f, 1.0f,       1.0f, 1.0f,//  4  
-       -2.0f, 9.0f, 10.0f,	 0.0f, 0.0f, 1.0f,       1.0f, 0.0f,//  5
-        2.0f, 11.0f, 10.0f,	 0.0f, 0.0f, 1.0f,       0.0f, 0.0f,// 6
-       -2.0f, 11.0f, 10.0f,	 0.0f, 0.0f, 1.0f,       0.0f, 1.0f,// 7
-        0.0f, 10.0f, 12.0f,  0.0f, 0.0f, 1.0f,        0.0f, 0.0f,// 8
+    int lights = gFrameTasks.Add("Light orbit", []
+    {
+        UUpdateLights(gDeltaTime);
+    });
 
-    };
+    int transforms = gFrameTasks.Add("Transforms", []
+    {
+        gJobs.ParallelFor((uint32_t)gObjects.Mesh.size(), grain, [](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                // World space bounding sphere; the radius grows with the largest axis scale of the model matrix
+                int mesh = gObjects.Mesh[i];
+                const glm::mat4& model = gObjects.Model[i];
+                glm::vec3 center = (gMesh.boundsMin[mesh] + gMesh.boundsMax[mesh]) * 0.5f;
+                float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+                gObjects.Center[i] = glm::vec3(model * glm::vec4(center, 1.0f));
+                gObjects.Radius[i] = glm::length(gMesh.boundsMax[mesh] - gMesh.boundsMin[mesh]) * 0.5f * scale;
+            }
+        });
+    });
+
+    int culling = gFrameTasks.Add("Culling", []
+    {
+        glm::vec4 planes[6];
+        UExtractFrustumPlanes(gFrame.Projection * gFrame.View, planes);
+        gJobs.ParallelFor((uint32_t)gObjects.Mesh.size(), grain, [&planes](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; ++i)
+                gObjects.Visible[i] = USphereInFrustum(planes, gObjects.Center[i], gObjects.Radius[i]);
+        });
+    });
 
-    GLfloat planeVerts[] = {
-        -15.0f, 15.0f, 0.0f,    0.0f, 0.0f, -1.0f,  1.0f, 1.0f,// 0
-        -15.0f, -15.0f, 0.0f,   0.0f, 0.0f, -1.0f,  1.0f, 0.0f,// 1
-        15.0f, 15.0f, 0.0f,     0.0f, 0.0f, -1.0f,  0.0f, 0.0f,// 2
-        15.0f, -15.0f, 0.0f,    0.0f, 0.0f, -1.0f,  0.0f, 1.0f,// 3
-    };
+    int lod = gFrameTasks.Add("LOD selection", []
+    {
+        gJobs.ParallelFor((uint32_t)gObjects.Mesh.size(), grain, [](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                // Pixels covered by one world unit at the object's distance decide how much error is visible
+                float pixelsPerUnit;
+                if (!gFrame.Perspective)
+                    pixelsPerUnit = (float)gFrame.ViewportHeight / (2.0f * (float)gFrame.ViewportHeight / 100.0f);  // same scale as the glm::ortho call in URender
+                else
+                {
+                    float distance = glm::max(glm::length(gObjects.Center[i] - gFrame.CameraPosition) - gObjects.Radius[i], 0.1f);
+                    pixelsPerUnit = (float)gFrame.ViewportHeight / (2.0f * tan(gFrame.FieldOfView * 0.5f) * distance);
+                }
+                gObjects.LODLevel[i] = gLODSelector.Select(gMesh.lods[gObjects.Mesh[i]], gObjects.LODLevel[i], pixelsPerUnit);
+            }
+        });
+    });
+
+    int drawList = gFrameTasks.Add("Draw list", []
+    {
+        // Record the visible draws; the queue sorts them by pass, program, texture, mesh and depth
+        FrameSnapshot& snapshot = *gFrame.Snapshot;
+        DrawItem draw;
+        draw.Program = gSunProgramId;
+        draw.ProgramKey = 0;        // the only program of the opaque pass
+        draw.ModelLocation = gSunModelLocation;
+        draw.ObjectIdLocation = gSunObjectIdLocation;
+        snapshot.Queue.Clear();
+        snapshot.DrawnTriangles = snapshot.FullTriangles = snapshot.VisibleObjects = 0;
+        for (size_t i = 0; i < gObjects.Mesh.size(); ++i)
+        {
+            int mesh = gObjects.Mesh[i];
+            snapshot.FullTriangles += gMesh.lods[mesh].Levels[0].IndexCount / 3;
+            if (!gObjects.Visible[i])
+                continue;
+
+            const LODLevel& level = gMesh.lods[mesh].Levels[gObjects.LODLevel[i]];
+            draw.VAO = gMesh.VAO[mesh];
+            draw.MeshKey = (uint16_t)mesh;
+            draw.IndexCount = level.IndexCount;
+            draw.IndexOffset = level.IndexOffset * sizeof(GLushort);
+            draw.Texture = gObjects.Texture[i];
+            draw.MaterialKey = (uint16_t)gObjects.Material[i];
+            draw.Model = gObjects.Model[i];
+            draw.ObjectId = (GLuint)i + 1;
+            draw.BoundsMin = gMesh.boundsMin[mesh];
+            draw.BoundsMax = gMesh.boundsMax[mesh];
+            snapshot.Queue.Submit(draw, (gMesh.boundsMin[mesh] + gMesh.boundsMax[mesh]) * 0.5f);
+
+            snapshot.DrawnTriangles += level.IndexCount / 3;
+            ++snapshot.VisibleObjects;
+        }
+        snapshot.Queue.Sort(gFrame.View, FAR_PLANE, gDepthPrepass, gDepthProgramId, gDepthModelLocation);
+    });
+
+    gFrameTasks.Depend(culling, transforms);
+    gFrameTasks.Depend(lod, transforms);
+    gFrameTasks.Depend(drawList, culling);
+    gFrameTasks.Depend(drawList, lod);
+    gFrameTasks.Depend(drawList, lights);
+}
 
-    GLfloat buildingVerts[] = {
-        //building base
-        1.5f, -11.0f, 0.0f, 0.0f, 0.0f, 1.0f,  1.0f, 1.0f,//0
-        1.5f, -10.0f, 0.0f, 0.0f, 0.0f, 1.0f,  1.0f, 0.0f,//1
-        -1.5f, -10.0f, 0.0f,0.0f, 0.0f, 1.0f,  0.0f, 0.0f,//2
-        -1.5f, -11.0f, 0.0f,0.0f, 0.0f, 1.0f,  0.0f, 1.0f,//3
-        1.5f, -11.0f, 0.2f, 0.0f, 0.0f, 1.0f,  1.0f, 1.0f,//4
-        1.5f, -10.0f, 0.2f, 0.0f, 0.0f, 1.0f,  1.0f, 0.0f,//5
-        -1.5f, -10.0f, 0.2f,0.0f, 0.0f, 1.0f,  0.0f, 0.0f,//6
-        -1.5f, -11.0f, 0.2f,0.0f, 0.0f, 1.0f,  0.0f, 1.0f,//7
-                                                        //8
-                                                        //9
-        //building top                                  //10
-        1.5f, -11.0f, 2.0f,  0.0f, 0.0f, 1.0f,  1.0f, 1.0f,//11
-        1.5f, -10.0f, 2.0f,  0.0f, 0.0f, 1.0f,  1.0f, 0.0f,//12
-        -1.5f, -10.0f, 2.0f, 0.0f, 0.0f, 1.0f,  0.0f, 0.0f,//13
-        -1.5f, -11.0f, 2.0f, 0.0f, 0.0f, 1.0f,  0.0f, 1.0f,//14
-        1.5f, -11.0f, 2.2f,  0.0f, 0.0f, 1.0f,  1.0f, 1.0f,//15
-        1.5f, -10.0f, 2.2f,  0.0f, 0.0f, 1.0f,  1.0f, 0.0f,//16
-        -1.5f, -10.0f, 2.2f, 0.0f, 0.0f, 1.0f,  0.0f, 0.0f,//17
-        -1.5f, -11.0f, 2.2f, 0.0f, 0.0f, 1.0f,  0.0f, 1.0f,//18
-                                                        //19
-        //building center                               //20
-        0.7f, -10.25f, 0.2f,  0.0f, 0.0f, 1.0f,  1.0f, 1.0f,//21
-        0.7f, -10.75f, 0.2f,  0.0f, 0.0f, 1.0f,  1.0f, 0.0f,//22
-        -0.7f, -10.25f, 0.2f, 0.0f, 0.0f, 1.0f,  0.0f, 0.0f,//23
-        -0.7f, -10.75f, 0.2f, 0.0f, 0.0f, 1.0f,  0.0f, 1.0f,//24
-        0.7f, -10.25f, 2.0f,  0.0f, 0.0f, 1.0f,  1.0f, 1.0f,//25
-        0.7f, -10.75f, 2.0f,  0.0f, 0.0f, 1.0f,  1.0f, 0.0f,//26
-        -0.7f, -10.25f, 2.0f, 0.0f, 0.0f, 1.0f,  0.0f, 0.0f,//27
-        -0.7f, -10.75f, 2.0f, 0.0f, 0.0f, 1.0f,  0.0f, 1.0f,//28
 
-    };
+// Gets the six clip planes (left, right, bottom, top, near, far) from a view-projection matrix, normalized
+// so plane distances are in world units. Normals point into the frustum.
+void UExtractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6])
+{
+    glm::vec4 row[4];
+    for (int r = 0; r < 4; ++r)
+        row[r] = glm::vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
 
-    GLfloat columnVerts[] =
-    {
-        //column1
-        -1.5f, -11.0f, 0.2f,   0.0f, 0.0f, 1.0f,    1.0f, 1.0f,//37
-        -1.5f, -10.8f, 0.2f,   0.0f, 0.0f, 1.0f,    1.0f, 0.0f,
-        -1.3f, -11.0f, 0.2f,   0.0f, 0.0f, 1.0f,    0.0f, 0.0f,//39
-        -1.3f, -10.8f, 0.2f,   0.0f, 0.0f, 1.0f,    0.0f, 1.0f,//40
-        -1.5f, -11.0f, 2.0f,   0.0f, 0.0f, 1.0f,   1.0f, 1.0f,//41
-        -1.5f, -10.8f, 2.0f,   0.0f, 0.0f, 1.0f,   1.0f, 0.0f, //42
-        -1.3f, -11.0f, 2.0f,   0.0f, 0.0f, 1.0f,   0.0f, 0.0f,//43
-        -1.3f, -10.8f, 2.0f,   0.0f, 0.0f, 1.0f,   0.0f, 1.0f,//44
-
-        //column 2
-        -1.1f, -11.0f, 0.2f,   0.0f, 0.0f, 1.0f,  1.0f, 1.0f,//45
-        -1.1f, -10.8f, 0.2f,   0.0f, 0.0f, 1.0f,  1.0f, 0.0f,//46
-        -0.9f, -11.0f, 0.2f,   0.0f, 0.0f, 1.0f,  0.0f, 0.0f,//47
-        -0.9f, -10.8f, 0.2f,   0.0f, 0.0f, 1.0f,  0.0f, 1.0f,//48
-        -1.1f, -11.0f, 2.0f,   0.0f, 0.0f, 1.0f,  1.0f, 1.0f,//49
-        -1.1f, -10.8f, 2.0f,   0.0f, 0.0f, 1.0f,  1.0f, 0.0f,//50
-        -0.9f, -11.0f, 2.0f,   0.0f, 0.0f, 1.0f,  0.0f, 0.0f,//51
-        -0.9f, -10.8f, 2.0f,   0.0f, 0.0f, 1.0f,  0.0f, 1.0f,//52
-
-        //column 3
-        -0.7f, -11.0f, 0.2f,  0.0f, 0.0f, 1.0f,   1.0f, 1.0f,//53
-        -0.7f, -10.8f, 0.2f,  0.0f, 0.0f, 1.0f,   1.0f, 0.0f, //54
-        -0.5f, -11.0f, 0.2f,  0.0f, 0.0f, 1.0f,   0.0f, 0.0f,//55
-        -0.5f, -10.8f, 0.2f,  0.0f, 0.0f, 1.0f,   0.0f, 1.0f,//56
-        -0.7f, -11.0f, 2.0f,  0.0f, 0.0f, 1.0f,   1.0f, 1.0f,//57
-        -0.7f, -10.8f, 2.0f,  0.0f, 0.0f, 1.0f,   1.0f, 0.0f, //58
-        -0.5f, -11.0f, 2.0f,  0.0f, 0.0f, 1.0f,   0.0f, 0.0f,//59
-        -0.5f, -10.8f, 2.0f,  0.0f, 0.0f, 1.0f,   0.0f, 1.0f,//60
-
-        //column 4
-        -0.3f, -11.0f, 0.2f,  0.0f, 0.0f, 1.0f,  1.0f, 1.0f,//61
-        -0.3f, -10.8f, 0.2f,  0.0f, 0.0f, 1.0f,  1.0f, 0.0f, //62
-        -0.1f, -11.0f, 0.2f,  0.0f, 0.0f, 1.0f,  0.0f, 0.0f,//63
-        -0.1f, -10.8f, 0.2f,  0.0f, 0.0f, 1.0f,  0.0f, 1.0f,//64
-        -0.3f, -11.0f, 2.0f,  0.0f, 0.0f, 1.0f,  1.0f, 1.0f,//65
-        -0.3f, -10.8f, 2.0f,  0.0f, 0.0f, 1.0f,  1.0f, 0.0f, //66
-        -0.1f, -11.0f, 2.0f,  0.0f, 0.0f, 1.0f,  0.0f, 0.0f,//67
-        -0.1f, -10.8f, 2.0f,  0.0f, 0.0f, 1.0f,  0.0f, 1.0f,//68
-
-        //column 5
-        0.1f, -11.0f, 0.2f,  0.0f, 0.0f, 1.0f,  1.0f, 1.0f,//69
-        0.1f, -10.8f, 0.2f,  0.0f, 0.0f, 1.0f,  1.0f, 0.0f, //70
-        0.3f, -11.0f, 0.2f,  0.0f, 0.0f, 1.0f,  0.0f, 0.0f,//71
-        0.3f, -10.8f, 0.2f,  0.0f, 0.0f, 1.0f,  0.0f, 1.0f,//72
-        0.1f, -11.0f, 2.0f,  0.0f, 0.0f, 1.0f,  1.0f, 1.0f,//73
-        0.1f, -10.8f, 2.0f,  0.0f, 0.0f, 1.0f,  1.0f, 0.0f, //74
-        0.3f, -11.0f, 2.0f,  0.0f, 0.0f, 1.0f,  0.0f, 0.0f,//75
-        0.3f, -10.8f, 2.0f,  0.0f, 0.0f, 1.0f,  0.0f, 1.0f,//76
-
-        //column 6
-        0.5f, -11.0f, 0.2f,  0.0f, 0.0f, 1.0f,  1.0f, 1.0f,//77
-        0.5f, -10.8f, 0.2f,  0.0f, 0.0f, 1.0f,  1.0f, 0.0f, //78
-        0.7f, -11.0f, 0.2f,  0.0f, 0.0f, 1.0f,  0.0f, 0.0f,//79
-        0.7f, -10.8f, 0.2f,  0.0f, 0.0f, 1.0f,  0.0f, 1.0f,//80
-        0.5f, -11.0f, 2.0f,  0.0f, 0.0f, 1.0f,  1.0f, 1.0f,//81
-        0.5f, -10.8f, 2.0f,  0.0f, 0.0f, 1.0f,  1.0f, 0.0f, //82
-        0.7f, -11.0f, 2.0f,  0.0f, 0.0f, 1.0f,  0.0f, 0.0f,//83
-        0.7f, -10.8f, 2.0f,  0.0f, 0.0f, 1.0f,  0.0f, 1.0f,//84
-
-        //column 7
-        0.9f, -11.0f, 0.2f, 0.0f, 0.0f, 1.0f,    1.0f, 1.0f,//85
-        0.9f, -10.8f, 0.2f, 0.0f, 0.0f, 1.0f,    1.0f, 0.0f,//86
-        1.1f, -11.0f, 0.2f, 0.0f, 0.0f, 1.0f,    0.0f, 0.0f,//87
-        1.1f, -10.8f, 0.2f, 0.0f, 0.0f, 1.0f,    0.0f, 1.0f,//88
-        0.9f, -11.0f, 2.0f, 0.0f, 0.0f, 1.0f,    1.0f, 1.0f,//89
-        0.9f, -10.8f, 2.0f, 0.0f, 0.0f, 1.0f,    1.0f, 0.0f,//90
-        1.1f, -11.0f, 2.0f, 0.0f, 0.0f, 1.0f,    0.0f, 0.0f,//91
-        1.1f, -10.8f, 2.0f, 0.0f, 0.0f, 1.0f,    0.0f, 1.0f,//92
-
-
-        //column 8
-        1.3f, -11.0f, 0.2f,  0.0f, 0.0f, 1.0f,  1.0f, 1.0f, //93
-        1.3f, -10.8f, 0.2f,  0.0f, 0.0f, 1.0f,  1.0f, 0.0f, //94
-        1.5, -11.0f, 0.2f,   0.0f, 0.0f, 1.0f,  0.0f, 0.0f,//95
-        1.5, -10.8f, 0.2f,   0.0f, 0.0f, 1.0f,  0.0f, 1.0f,//96
-        1.3, -11.0f, 2.0f,   0.0f, 0.0f, 1.0f,  1.0f, 1.0f,//97
-        1.3, -10.8f, 2.0f,   0.0f, 0.0f, 1.0f,  1.0f, 0.0f,//98
-        1.5, -11.0f, 2.0f,   0.0f, 0.0f, 1.0f,  0.0f, 0.0f,//99
-        1.5, -10.8f, 2.0f,   0.0f, 0.0f, 1.0f,  0.0f, 1.0f,//100
-
-        //column9
-            -1.5f, -10.2f, 0.2f,  0.0f, 0.0f, 1.0f,   1.0f, 1.0f,//101
-            -1.5f, -10.0f, 0.2f,  0.0f, 0.0f, 1.0f,   1.0f, 0.0f,//102
-            -1.3f, -10.2f, 0.2f,  0.0f, 0.0f, 1.0f,   0.0f, 0.0f,//103
-            -1.3f, -10.0f, 0.2f,  0.0f, 0.0f, 1.0f,   0.0f, 1.0f,//104
-            -1.5f, -10.2f, 2.0f,  0.0f, 0.0f, 1.0f,   1.0f, 1.0f,//105
-            -1.5f, -10.0f, 2.0f,  0.0f, 0.0f, 1.0f,   1.0f, 0.0f,//106
-            -1.3f, -10.2f, 2.0f,  0.0f, 0.0f, 1.0f,   0.0f, 0.0f,//107
-            -1.3f, -10.0f, 2.0f,  0.0f, 0.0f, 1.0f,   0.0f, 1.0f,//108
-
-            //column10
-            -1.1f, -10.2f, 0.2f,  0.0f, 0.0f, 1.0f, 1.0f, 1.0f,//109
-            -1.1f, -10.0f, 0.2f,  0.0f, 0.0f, 1.0f, 1.0f, 0.0f,//110
-            -0.9f, -10.2f, 0.2f,  0.0f, 0.0f, 1.0f, 0.0f, 0.0f,//111
-            -0.9f, -10.0f, 0.2f,  0.0f, 0.0f, 1.0f, 0.0f, 1.0f,//112
-            -1.1f, -10.2f, 2.0f,  0.0f, 0.0f, 1.0f, 1.0f, 1.0f,//113
-            -1.1f, -10.0f, 2.0f,  0.0f, 0.0f, 1.0f, 1.0f, 0.0f,//114
-            -0.9f, -10.2f, 2.0f,  0.0f, 0.0f, 1.0f, 0.0f, 0.0f,//115
-            -0.9f, -10.0f, 2.0f,  0.0f, 0.0f, 1.0f, 0.0f, 1.0f,//116
-
-            //column11
-            -0.7f, -10.2f, 0.2f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f,//117
-            -0.7f, -10.0f, 0.2f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f,//118
-            -0.5f, -10.2f, 0.2f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f,//119
-            -0.5f, -10.0f, 0.2f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f,//120
-            -0.7f, -10.2f, 2.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f,//121
-            -0.7f, -10.0f, 2.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f,//122
-            -0.5f, -10.2f, 2.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f,//123
-            -0.5f, -10.0f, 2.0f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f,//124
-
-            //column12
-            -0.3f, -10.2f, 0.2f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f,//125
-            -0.3f, -10.0f, 0.2f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f,//126
-            -0.1f, -10.2f, 0.2f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f,//127
-            -0.1f, -10.0f, 0.2f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f,//128
-            -0.3f, -10.2f, 2.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f,//129
-            -0.3f, -10.0f, 2.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f,//130
-            -0.1f, -10.2f, 2.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f,//131
-            -0.1f, -10.0f, 2.0f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f,//132
-
-            //column 13
-            0.1f, -10.2f, 0.2f,  0.0f, 0.0f, 1.0f,   1.0f, 1.0f,//133
-            0.1f, -10.0f, 0.2f,  0.0f, 0.0f, 1.0f,   1.0f, 0.0f,//134
-            0.3f, -10.2f, 0.2f,  0.0f, 0.0f, 1.0f,   0.0f, 0.0f,//135
-            0.3f, -10.0f, 0.2f,  0.0f, 0.0f, 1.0f,   0.0f, 1.0f,//136
-            0.1f, -10.2f, 2.0f,  0.0f, 0.0f, 1.0f,   1.0f, 1.0f,//137
-            0.1f, -10.0f, 2.0f,  0.0f, 0.0f, 1.0f,   1.0f, 0.0f,//138
-            0.3f, -10.2f, 2.0f,  0.0f, 0.0f, 1.0f,   0.0f, 0.0f,//139
-            0.3f, -10.0f, 2.0f,  0.0f, 0.0f, 1.0f,   0.0f, 1.0f,//140
-
-            //column 14
-            0.5f, -10.2f, 0.2f, 0.0f, 0.0f, 1.0f,   1.0f, 1.0f,//141
-            0.5f, -10.0f, 0.2f, 0.0f, 0.0f, 1.0f,   1.0f, 0.0f,//142
-            0.7f, -10.2f, 0.2f, 0.0f, 0.0f, 1.0f,   0.0f, 0.0f,//143
-            0.7f, -10.0f, 0.2f, 0.0f, 0.0f, 1.0f,   0.0f, 1.0f,//144
-            0.5f, -10.2f, 2.0f, 0.0f, 0.0f, 1.0f,   1.0f, 1.0f,//145
-            0.5f, -10.0f, 2.0f, 0.0f, 0.0f, 1.0f,   1.0f, 0.0f,//146
-            0.7f, -10.2f, 2.0f, 0.0f, 0.0f, 1.0f,   0.0f, 0.0f,//147
-            0.7f, -10.0f, 2.0f, 0.0f, 0.0f, 1.0f,   0.0f, 1.0f,//148
-
-            //column 15
-            0.9f, -10.2f, 0.2f,   0.0f, 0.0f, 1.0f,    1.0f, 1.0f,//149
-            0.9f, -10.0f, 0.2f,   0.0f, 0.0f, 1.0f,    1.0f, 0.0f,//150
-            1.1f, -10.2f, 0.2f,   0.0f, 0.0f, 1.0f,    0.0f, 0.0f,//151
-            1.1f, -10.0f, 0.2f,   0.0f, 0.0f, 1.0f,    0.0f, 1.0f,//152
-            0.9f, -10.2f, 2.0f,   0.0f, 0.0f, 1.0f,    1.0f, 1.0f,//153
-            0.9f, -10.0f, 2.0f,   0.0f, 0.0f, 1.0f,    1.0f, 0.0f,//154
-            1.1f, -10.2f, 2.0f,   0.0f, 0.0f, 1.0f,    0.0f, 0.0f,//155
-            1.1f, -10.0f, 2.0f,   0.0f, 0.0f, 1.0f,    0.0f, 1.0f,//156
-
-
-            //column 16
-            1.3f, -10.2f, 0.2f, 0.0f, 0.0f, 1.0f,   1.0f, 1.0f,//157
-            1.3f, -10.0f, 0.2f, 0.0f, 0.0f, 1.0f,   1.0f, 0.0f,//158
-            1.5f, -10.2f, 0.2f, 0.0f, 0.0f, 1.0f,   0.0f, 0.0f,//159
-            1.5f, -10.0f, 0.2f, 0.0f, 0.0f, 1.0f,   0.0f, 1.0f,//160
-            1.3f, -10.2f, 2.0f, 0.0f, 0.0f, 1.0f,   1.0f, 1.0f,//161
-            1.3f, -10.0f, 2.0f, 0.0f, 0.0f, 1.0f,   1.0f, 0.0f,//162
-            1.5f, -10.2f, 2.0f, 0.0f, 0.0f, 1.0f,   0.0f, 0.0f,//163
-            1.5f, -10.0f, 2.0f, 0.0f, 0.0f, 1.0f,   0.0f, 1.0f,//164
+    for (int i = 0; i < 3; ++i)
+    {
+        planes[i * 2] = row[3] + row[i];
+        planes[i * 2 + 1] = row[3] - row[i];
+    }
+    for (int i = 0; i < 6; ++i)
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+}
 
-    };
 
-    GLfloat poolVerts[] = {
-        //reflection pool
-        2.25f, 5.25f, 0.0f,    0.0f, 0.0f, -1.0f,   1.0f, 1.0f,//165
-        -2.25f, 5.25f, 0.0f,   0.0f, 0.0f, -1.0f,  1.0f, 0.0f,// 166
-        -2.25f, -7.25f, 0.0f,  0.0f, 0.0f, -1.0f,  0.0f, 0.0f,// 167
-        2.25f, -7.25f, 0.0f,   0.0f, 0.0f, -1.0f,  0.0f, 1.0f,// 168
-        2.25f, 5.25f, 0.25f,   0.0f, 0.0f, -1.0f,  1.0f, 1.0f,// 169
-        -2.25f, 5.25f, 0.25f,  0.0f, 0.0f, -1.0f,  1.0f, 0.0f,// 170
-        -2.25f, -7.25f, 0.25f, 0.0f, 0.0f, -1.0f,  0.0f, 0.0f, // 171
-        2.25f, -7.25f, 0.25f,  0.0f, 0.0f, -1.0f,  0.0f, 1.0f,// 172
-
-
-        //reflection pool border
-        2.5f, 5.5f, 0.0f,    0.0f, 0.0f, 1.0f,  1.0f, 1.0f,//  173
-        -2.5f, 5.5f, 0.0f,   0.0f, 0.0f, 1.0f,  1.0f, 0.0f,//  174
-        -2.5f, -8.0f, 0.0f,  0.0f, 0.0f, 1.0f,  0.0f, 0.0f,//  175
-        2.5f, -8.0f, 0.0f,   0.0f, 0.0f, 1.0f,  0.0f, 1.0f,//  176
-        2.5f, 5.5f, 0.25f,   0.0f, 0.0f, 1.0f,  1.0f, 1.0f,//  177
-        -2.5f, 5.5f, 0.25f,  0.0f, 0.0f, 1.0f,  1.0f, 0.0f, // 178
-        -2.5f, -8.0f, 0.25f, 0.0f, 0.0f, 1.0f,    0.0f, 0.0f, // 179
-        2.5f, -8.0f, 0.25f,  0.0f, 0.0f, 1.0f,  0.0f, 1.0f, // 180
-    };
+// True unless the sphere lies entirely behind one of the planes
+bool USphereInFrustum(const glm::vec4 planes[6], const glm::vec3& center, float radius)
+{
+    for (int i = 0; i < 6; ++i)
+    {
+        if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+            return false;
+    }
+    return true;
+}
 
-    // If data to share position data
-    GLushort monumentIndices[] = {
-        0, 1, 3,
-        0, 1, 2,
-        0, 1, 5,
-        0, 4, 5,
-        0, 4, 6,
-        0, 2, 6,
-        1, 5, 7,
-        1, 3, 7,
-        2, 3, 7,
-        2, 6, 7,
-        4, 6, 5,
-        5, 6, 7,
-        4, 8, 6,
-        4, 8, 5,
-        5, 8, 7,
-        7, 8, 6,
-    };
 
-    GLushort planeIndices[] = {
-        0, 1, 2,
-        1, 2, 3
-    };
+// Streams a cross at each light and the orbit of the first light, and draws them with the lamp shader
+void UDrawDebugLines(const FrameSnapshot& frame)
+{
+    const int orbitSegments = 64;
+    const int vertexCount = 2 * 3 * 2 + orbitSegments * 2;   // two crosses of three lines, plus the orbit
 
-    GLushort buildingIndices[] = {
-    0, 1, 2,
-0, 2, 3,
-2, 3, 6,
-3, 6, 7,
-1, 2, 6,
-1, 5, 6,
-0, 1, 5,
-0, 1, 4,
-0, 3, 7,
-0, 4, 7,
-4, 5, 6,
-4, 6, 7,
-8, 9, 13,
-8, 12, 13,
-8, 11, 15,
-8, 12, 15,
-11, 10, 14,
-11, 14, 15,
-9, 10, 14,
-9, 13, 14,
-12, 14, 15,
-12, 13, 14,
-17, 18, 19,
-16, 18, 17,
-17, 19, 23,
-17, 21, 23,
-18, 22, 23,
-18, 19, 23,
-16, 18, 22,
-16, 20, 22,
-16, 17, 20,
-17, 20, 21,
-    };
+    StreamBuffer::Allocation lines = gStreamBuffer.Allocate(vertexCount * sizeof(glm::vec3));
+    if (!lines.Pointer)
+        return;
 
-    GLushort columnIndices[] =
-    {
-        0, 1, 5,
-0, 4, 5,
-1, 3, 7,
-1, 5, 7,
-3, 2, 6,
-3, 6, 7,
-0, 4, 6,
-0, 2, 6,
-8, 9, 13,
-8, 12, 13,
-9, 11, 15,
-9, 13, 15,
-11, 10, 14,
-11, 14, 15,
-8, 12, 14,
-8, 10, 14,
-16, 17, 21,
-16, 20, 21,
-17, 19, 23,
-17, 21, 23,
-19, 18, 22,
-19, 22, 23,
-16, 20, 22,
-16, 18, 22,
-24, 25, 29,
-24, 28, 29,
-25, 27, 31,
-25, 29, 31,
-27, 26, 30,
-27, 30, 31,
-24, 28, 30,
-24, 26, 30,
-32, 33, 37,
-32, 36, 37,
-33, 35, 39,
-33, 37, 39,
-35, 34, 38,
-35, 38, 39,
-32, 36, 38,
-32, 34, 38,
-40, 41, 45,
-40, 44, 45,
-41, 43, 47,
-41, 45, 47,
-43, 42, 46,
-43, 46, 47,
-40, 44, 46,
-40, 42, 46,
-48, 49, 53,
-48, 52, 53,
-49, 51, 55,
-49, 53, 55,
-51, 50, 54,
-51, 54, 55,
-48, 52, 54,
-48, 50, 54,
-56, 57, 61,
-56, 60, 61,
-57, 59, 63,
-57, 61, 63,
-59, 58, 62,
-59, 62, 63,
-56, 60, 62,
-56, 58, 62,
-64, 65, 69,
-64, 68, 69,
-65, 67, 71,
-65, 69, 71,
-67, 66, 70,
-67, 70, 71,
-64, 68, 70,
-64, 66, 70,
-72, 73, 77,
-72, 76, 77,
-73, 75, 79,
-73, 77, 79,
-75, 74, 78,
-75, 78, 79,
-72, 76, 78,
-72, 74, 78,
-80, 81, 85,
-80, 84, 85,
-81, 83, 87,
-81, 85, 87,
-83, 82, 86,
-83, 86, 87,
-80, 84, 86,
-80, 82, 86,
-88, 89, 93,
-88, 92, 93,
-89, 91, 95,
-89, 93, 95,
-91, 90, 94,
-91, 94, 95,
-88, 92, 94,
-88, 90, 94,
-96, 97, 101,
-96, 100, 101,
-97, 99, 103,
-97, 101, 103,
-99, 98, 102,
-99, 102, 103,
-96, 100, 102,
-96, 98, 102,
-104, 105, 109,
-104, 108, 109,
-105, 107, 111,
-105, 109, 111,
-107, 106, 110,
-107, 110, 111,
-104, 108, 110,
-104, 106, 110,
-112, 113, 117,
-112, 116, 117,
-113, 115, 119,
-113, 117, 119,
-115, 114, 118,
-115, 118, 119,
-112, 116, 118,
-112, 114, 118,
-120, 121, 125,
-120, 124, 125,
-121, 123, 127,
-121, 125, 127,
-123, 122, 126,
-123, 126, 127,
-120, 124, 126,
-120, 122, 126,
-128, 129, 133,
-128, 132, 133,
-129, 131, 135,
-129, 133, 135,
-131, 130, 134,
-131, 134, 135,
-128, 132, 134,
-128, 130, 134,
-    };
+    glm::vec3* v = (glm::vec3*)lines.Pointer;
+    const glm::vec3 lights[2] = { frame.LightPosition1, frame.LightPosition2 };
+    for (const glm::vec3& light : lights)
+    {
+        const float size = 0.5f;
+        *v++ = light - glm::vec3(size, 0.0f, 0.0f); *v++ = light + glm::vec3(size, 0.0f, 0.0f);
+        *v++ = light - glm::vec3(0.0f, size, 0.0f); *v++ = light + glm::vec3(0.0f, size, 0.0f);
+        *v++ = light - glm::vec3(0.0f, 0.0f, size); *v++ = light + glm::vec3(0.0f, 0.0f, size);
+    }
 
-    GLushort poolIndices[] = {
-
-        //reflection pool and border
-        1, 0, 3,
-        1, 2, 3,
-        1, 0, 4,
-        1, 5, 4,
-        1, 2, 6,
-        1, 5, 6,
-        2, 6, 7,
-        2, 3, 7,
-        0, 3, 7,
-        0, 4, 7,
-        5, 4, 6,
-        4, 6, 7,
-        5, 13, 12,
-        5, 4, 12,
-        4, 12, 15,
-        7, 4, 15,
-        6, 14, 15,
-        6, 7, 15,
-        14, 6, 13,
-        13, 5, 6,
-        9, 10, 14,
-        9, 13, 14,
-        10, 11, 14,
-        11, 14, 15,
-        8, 11, 15,
-        8, 12, 15,
-        8, 9, 13,
-        8, 13, 12,
-    };
+    // The first light orbits the y axis at a fixed radius and height
+    float radius = glm::length(glm::vec2(frame.LightPosition1.x, frame.LightPosition1.z));
+    for (int i = 0; i < orbitSegments; ++i)
+    {
+        float a0 = glm::radians(360.0f * i / orbitSegments);
+        float a1 = glm::radians(360.0f * (i + 1) / orbitSegments);
+        *v++ = glm::vec3(radius * cos(a0), frame.LightPosition1.y, radius * sin(a0));
+        *v++ = glm::vec3(radius * cos(a1), frame.LightPosition1.y, radius * sin(a1));
+    }
 
-    // Creates the Vertex Attribute Pointer for the screen coordinates
-    const GLuint floatsPerVertex = 3; // Number of coordinates per vertex
-    const GLuint floatsPerNormal = 3;  // (r, g, b, a)
-    const GLuint floatsPerUV = 2;
+    gGLState.UseProgram(gSpotProgramId);
+    glUniformMatrix4fv(glGetUniformLocation(gSpotProgramId, "model"), 1, GL_FALSE, glm::value_ptr(glm::mat4(1.0f)));
+    glUniformMatrix4fv(glGetUniformLocation(gSpotProgramId, "view"), 1, GL_FALSE, glm::value_ptr(frame.View));
+    glUniformMatrix4fv(glGetUniformLocation(gSpotProgramId, "projection"), 1, GL_FALSE, glm::value_ptr(gRenderProjection));
 
-    // Strides between vertex coordinates is 6 (x, y, r, g, b, a). A tightly packed stride is 0.
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
+    gGLState.BindVertexArray(gDebugLineVAO);
+    glBindVertexBuffer(0, gStreamBuffer.Buffer, lines.Offset, sizeof(glm::vec3));
+    glDrawArrays(GL_LINES, 0, vertexCount);
+}
 
-    glGenVertexArrays(5, mesh.VAO);  //generates 1 vertex array
-    glGenBuffers(10, mesh.VBO);	     // generates two VBOs
 
-    glBindVertexArray(mesh.VAO[0]);  //binds our VAO
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.VBO[0]);	//binds our first VBO
-    glBufferData(GL_ARRAY_BUFFER, sizeof(monumentVerts), monumentVerts, GL_STATIC_DRAW);	//sends the vertices to the buffer
+// Draws one bar per profiler scope of the last resolved frame in the top left corner (CPU blue, GPU orange).
+// A full bar width is one 60 Hz frame; the thin white line marks that budget.
+void UDrawProfilerOverlay()
+{
+    const vector<Profiler::Scope>& scopes = gProfiler.Results;
+    const int barCount = glm::min((int)scopes.size(), Profiler::MAX_SCOPES * 2);
+    const int vertexCount = (barCount + 1) * 6;
+    const float budgetMs = 1000.0f / 60.0f;
+    const float left = -0.95f, top = 0.95f, width = 0.6f, barHeight = 0.03f, gap = 0.01f;
+
+    StreamBuffer::Allocation bars = gStreamBuffer.Allocate(vertexCount * 5 * sizeof(float));
+    if (!bars.Pointer)
+        return;
+
+    float* v = (float*)bars.Pointer;
+    auto quad = [&v](float x0, float y0, float x1, float y1, glm::vec3 c)
+    {
+        const float corners[6][2] = { { x0, y0 }, { x1, y0 }, { x1, y1 }, { x0, y0 }, { x1, y1 }, { x0, y1 } };
+        for (const auto& p : corners)
+        {
+            *v++ = p[0]; *v++ = p[1];
+            *v++ = c.r; *v++ = c.g; *v++ = c.b;
+        }
+    };
 
-    mesh.nMonumentIndices = sizeof(monumentIndices) / sizeof(monumentIndices[0]);
+    for (int i = 0; i < barCount; ++i)
+    {
+        float y = top - i * (barHeight + gap);
+        float length = width * glm::min((float)scopes[i].DurationMs / budgetMs, 1.5f);
+        glm::vec3 color = scopes[i].Gpu ? glm::vec3(1.0f, 0.55f, 0.1f) : glm::vec3(0.2f, 0.5f, 1.0f);
+        quad(left, y - barHeight, left + length, y, color);
+    }
+    quad(left + width, top - barCount * (barHeight + gap), left + width + 0.003f, top, glm::vec3(1.0f));
+
+    gGLState.Enable(GL_DEPTH_TEST, false);
+    gGLState.UseProgram(gOverlayProgramId);
+    gGLState.BindVertexArray(gOverlayVAO);
+    glBindVertexBuffer(0, gStreamBuffer.Buffer, bars.Offset, 5 * sizeof(float));
+    glDrawArrays(GL_TRIANGLES, 0, vertexCount);
+    gGLState.Enable(GL_DEPTH_TEST, true);
+}
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.VBO[1]);  //binds second VBO
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(monumentIndices), monumentIndices, GL_STATIC_DRAW);  //sends the indices to the buffer
 
-    // Creates the Vertex Attribute Pointer
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
+// Maps the baked scene and takes the mesh data and lights from it. The bake is rebuilt first when it is missing,
+// older than the scene file or from an older version of the format. Needs no GL context
+bool ULoadScene()
+{
+    auto start = chrono::steady_clock::now();
+    if (UIsNewer(SCENE_FILENAME, BAKED_SCENE_FILENAME) || !gScene.Open(BAKED_SCENE_FILENAME))
+    {
+        if (!UBakeScene(SCENE_FILENAME, BAKED_SCENE_FILENAME) || !gScene.Open(BAKED_SCENE_FILENAME))
+        {
+            LOG_ERROR("Failed to load scene %s", BAKED_SCENE_FILENAME);
+            return false;
+        }
+        start = chrono::steady_clock::now();    // the bake reported its own time
+    }
+    const BakedScene& scene = *gScene.Scene;
+
+    // Only the small per mesh tables are copied; vertices and indices are used where they are mapped
+    size_t meshCount = scene.Meshes.size();
+    gMesh.boundsMin.resize(meshCount);
+    gMesh.boundsMax.resize(meshCount);
+    gMesh.lods.resize(meshCount);
+    gMesh.data.resize(meshCount);
+    for (size_t i = 0; i < meshCount; ++i)
+    {
+        const BakedMesh& mesh = scene.Meshes[i];
+        gMesh.boundsMin[i] = mesh.BoundsMin;
+        gMesh.boundsMax[i] = mesh.BoundsMax;
+        gMesh.lods[i].Levels.assign(mesh.Levels.begin(), mesh.Levels.end());
+        gMesh.data[i] = &mesh;
+    }
 
-    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
+    // The shaders light with two lights
+    if (scene.Lights.size() > 0)
+    {
+        gLightPosition1 = scene.Lights[0].Position;
+        gLightColor1 = scene.Lights[0].Color;
+        light_1_strength = scene.Lights[0].Strength;
+    }
+    if (scene.Lights.size() > 1)
+    {
+        gLightPosition2 = scene.Lights[1].Position;
+        gLightColor2 = scene.Lights[1].Color;
+        light_2_strength = scene.Lights[1].Strength;
+    }
+    if (scene.Lights.size() > 2)
+        LOG_WARNING("Scene has %zu lights, only the first two are used", scene.Lights.size());
+    gAmbientStrength = scene.Ambient;
+    gSpecularIntensity = scene.SpecularIntensity;
+
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    LOG_INFO("Scene %s: %zu meshes, %zu materials, %zu instances mapped in %.2f ms", BAKED_SCENE_FILENAME,
+        meshCount, scene.Materials.size(), scene.Instances.size(), ms);
+    return true;
+}
 
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
 
-    glBindVertexArray(0);
+// Opens the scene's terrain, generating its heightmap file the first time, and starts streaming it. A scene
+// without terrain is fine
+bool UCreateTerrain()
+{
+    const BakedTerrain& source = gScene.Scene->Terrain;
+    if (!source.Present)
+        return true;
 
-    glBindVertexArray(mesh.VAO[1]);  //binds our VAO
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.VBO[2]);	//binds our first VBO
-    glBufferData(GL_ARRAY_BUFFER, sizeof(planeVerts), planeVerts, GL_STATIC_DRAW);	//sends the vertices to the buffer
+    const char* path = source.Heightmap.begin();
+    if (!UOpenTerrain(path))
+        return false;
+    const char* texture = gScene.Scene->Materials[source.Material].Texture.begin();
+    if (!UCreateTexture(texture, gTerrainTexture))
+    {
+        LOG_ERROR("Failed to load texture %s", texture);
+        return false;
+    }
+    gTerrain.Model = source.Model;
+    gTerrain.Create(gTerrainProgramId, gGLState);
+    gGLState.UseProgram(gTerrainProgramId);
+    glUniform1i(glGetUniformLocation(gTerrainProgramId, "uTexture"), 0);
+    LOG_INFO("Terrain %s: %.0f units across, %.1f MB of heights resident", path, gTerrain.Size(), gTerrain.ResidentBytes() / (1024.0 * 1024.0));
+    return true;
+}
 
-    mesh.nPlaneIndices = sizeof(planeIndices) / sizeof(planeIndices[0]);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.VBO[3]);  //binds second VBO
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(planeIndices), planeIndices, GL_STATIC_DRAW);  //sends the indices to the buffer
+// Opens the terrain file the scene names, generating it first if it doesn't exist yet
+bool UOpenTerrain(const char* path)
+{
+    if (gTerrain.Open(path))
+        return true;
+    LOG_INFO("Generating terrain %s", path);
+    auto start = chrono::steady_clock::now();
+    if (!TerrainBaker::Bake(path) || !gTerrain.Open(path))
+    {
+        LOG_ERROR("Failed to create terrain %s", path);
+        return false;
+    }
+    LOG_INFO("Terrain generated in %.0f ms", chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+    return true;
+}
 
-    // Creates the Vertex Attribute Pointer
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
 
-    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
+// Sets up the scene's water, if it has any
+bool UCreateWater()
+{
+    const BakedWater& source = gScene.Scene->Water;
+    if (!source.Present)
+        return true;
 
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
+    const char* texture = gScene.Scene->Materials[source.Material].Texture.begin();
+    if (!UCreateTexture(texture, gWaterTexture))
+    {
+        LOG_ERROR("Failed to load texture %s", texture);
+        return false;
+    }
+    gWater.Model = source.Model;
+    gWater.Create(gWaterSimulateProgramId, gWaterProgramId, source.Min, source.Max, source.Height, gGLState);
+    glUniform1i(glGetUniformLocation(gWaterProgramId, "uTexture"), 0);
+    LOG_INFO("Water: %dx%d cells simulated on the GPU", gWater.Columns(), gWater.Rows());
+    return true;
+}
 
-    glBindVertexArray(0);
 
-    glBindVertexArray(mesh.VAO[2]);  //binds our VAO
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.VBO[4]);	//binds our first VBO
-    glBufferData(GL_ARRAY_BUFFER, sizeof(buildingVerts), buildingVerts, GL_STATIC_DRAW);	//sends the vertices to the buffer
+// Lights the scene from its environment, if it has one. The prefiltered maps are computed on the first run
+// and cached next to the image, under a key of the image and the shaders that filter it, so later runs only
+// upload them. A missing image falls back to the procedural sky rather than failing
+bool UCreateEnvironment()
+{
+    // The cube map sampler must not be left on unit 0 with the 2D ones even when it goes unused
+    for (GLuint program : { gSunProgramId, gTerrainProgramId })
+    {
+        gGLState.UseProgram(program);
+        glUniform1i(glGetUniformLocation(program, "specularEnvironment"), EnvironmentLighting::SPECULAR_UNIT);
+        glUniform1i(glGetUniformLocation(program, "brdfTable"), EnvironmentLighting::BRDF_UNIT);
+    }
 
-    mesh.nBuildingIndices = sizeof(buildingIndices) / sizeof(buildingIndices[0]);
+    const BakedEnvironment& source = gScene.Scene->Environment;
+    if (!source.Present)
+        return true;
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.VBO[5]);  //binds second VBO
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(buildingIndices), buildingIndices, GL_STATIC_DRAW);  //sends the indices to the buffer
+    const char* image = source.Image.begin();
+    string path = image;
+    size_t extension = path.find_last_of('.'), slash = path.find_last_of('/');
+    if (extension != string::npos && (slash == string::npos || slash < extension))
+        path.erase(extension);
+    path += ".ibl";
+
+    uint64_t key = EnvironmentLighting::HASH_SEED;
+    const char* shaders[] = { environmentSkyShaderSource, environmentIrradianceShaderSource, environmentSpecularShaderSource,
+        environmentBrdfShaderSource };
+    for (const char* shader : shaders)
+        key = EnvironmentLighting::Hash(shader, strlen(shader), key);
+    vector<unsigned char> bytes;
+    if (FILE* file = fopen(image, "rb"))
+    {
+        unsigned char buffer[64 * 1024];
+        for (size_t read; (read = fread(buffer, 1, sizeof(buffer), file)) > 0;)
+            bytes.insert(bytes.end(), buffer, buffer + read);
+        fclose(file);
+    }
+    const char PROCEDURAL[] = "procedural sky";
+    if (bytes.empty())
+        LOG_WARNING("Environment %s not found, lighting with a procedural sky", image);
+    key = bytes.empty() ? EnvironmentLighting::Hash(PROCEDURAL, sizeof(PROCEDURAL), key) : EnvironmentLighting::Hash(bytes.data(), bytes.size(), key);
+
+    gEnvironment.Model = source.Model;
+    gEnvironment.Intensity = source.Intensity;
+    auto start = chrono::steady_clock::now();
+    if (gEnvironment.Load(path, key, gGLState))
+        LOG_INFO("Environment %s loaded from its cache in %.0f ms", image, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+    else
+    {
+        float* pixels = nullptr;
+        int width = 0, height = 0, channels;
+        if (!bytes.empty())
+        {
+            pixels = stbi_loadf_from_memory(bytes.data(), (int)bytes.size(), &width, &height, &channels, 3);
+            if (!pixels)
+            {
+                LOG_ERROR("Failed to load environment %s", image);
+                return false;
+            }
+        }
 
-    // Creates the Vertex Attribute Pointer
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
+        // the filtering shaders are only needed this once
+        EnvironmentLighting::Programs programs = {};
+        bool compiled = UCreateComputeProgram(environmentSkyShaderSource, programs.Sky)
+            && UCreateComputeProgram(environmentIrradianceShaderSource, programs.Irradiance)
+            && UCreateComputeProgram(environmentSpecularShaderSource, programs.Specular)
+            && UCreateComputeProgram(environmentBrdfShaderSource, programs.Brdf);
+        if (compiled)
+            gEnvironment.Compute(programs, pixels, width, height, gGLState);
+        if (pixels)
+            stbi_image_free(pixels);
+        gGLState.UseProgram(0);
+        for (GLuint program : { programs.Sky, programs.Irradiance, programs.Specular, programs.Brdf })
+            UDestroyShaderProgram(program);
+        if (!compiled)
+            return false;
 
-    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
+        LOG_INFO("Environment %s prefiltered in %.0f ms", image, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+        if (!gEnvironment.Save(path, key, gGLState))
+            LOG_WARNING("Failed to cache environment in %s", path.c_str());
+    }
 
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
+    for (GLuint program : { gSunProgramId, gTerrainProgramId })
+    {
+        gGLState.UseProgram(program);
+        gEnvironment.SetUniforms(program);
+    }
+    LOG_INFO("Environment: %.1f MB of sky, specular and BRDF maps", gEnvironment.Bytes() / (1024.0 * 1024.0));
+    return true;
+}
 
-    glBindVertexArray(0);
 
-    glBindVertexArray(mesh.VAO[3]);  //binds our VAO
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.VBO[6]);	//binds our first VBO
-    glBufferData(GL_ARRAY_BUFFER, sizeof(columnVerts), columnVerts, GL_STATIC_DRAW);	//sends the vertices to the buffer
+// Parses the text scene and writes its baked form, with bounds and level of detail chains computed
+bool UBakeScene(const char* sourceFilename, const char* bakedFilename)
+{
+    auto start = chrono::steady_clock::now();
+    SceneDescription scene;
+    if (!scene.Load(sourceFilename))
+    {
+        LOG_ERROR("%s", scene.Error.c_str());
+        return false;
+    }
+    for (const string& warning : scene.Warnings)
+        LOG_WARNING("%s", warning.c_str());
+    if (scene.Generator.Generated > 0)
+        LOG_INFO("Generated %zu shapes, %zu more copied from the shape cache", scene.Generator.Generated, scene.Generator.Reused);
 
-    mesh.nColumnIndices = sizeof(columnIndices) / sizeof(columnIndices[0]);
+    if (!SceneBaker::Bake(scene, bakedFilename))
+    {
+        LOG_ERROR("Failed to write %s", bakedFilename);
+        return false;
+    }
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    LOG_INFO("Baked %s to %s in %.1f ms", sourceFilename, bakedFilename, ms);
+    return true;
+}
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.VBO[7]);  //binds second VBO
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(columnIndices), columnIndices, GL_STATIC_DRAW);  //sends the indices to the buffer
 
-    // Creates the Vertex Attribute Pointer
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
+// True if filename exists and thanFilename doesn't or was modified earlier
+bool UIsNewer(const char* filename, const char* thanFilename)
+{
+    struct stat file, than;
+    if (stat(filename, &file) != 0)
+        return false;
+    return stat(thanFilename, &than) != 0 || file.st_mtime > than.st_mtime;
+}
 
-    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
 
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
+// Implements the UCreateMesh function
+void UCreateMesh(GLMesh& mesh)
+{
+    // Creates the Vertex Attribute Pointer for the screen coordinates
+    const GLuint floatsPerVertex = 3; // Number of coordinates per vertex
+    const GLuint floatsPerNormal = 3;  // (r, g, b, a)
+    const GLuint floatsPerUV = 2;
+
+    // Strides between vertex coordinates is 6 (x, y, r, g, b, a). A tightly packed stride is 0.
+    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
 
-    glBindVertexArray(0);
+    size_t meshCount = mesh.data.size();
+    mesh.VAO.resize(meshCount);
+    mesh.VBO.resize(meshCount * 2);
+    glGenVertexArrays((GLsizei)meshCount, mesh.VAO.data());
+    glGenBuffers((GLsizei)meshCount * 2, mesh.VBO.data());
 
-    glBindVertexArray(mesh.VAO[4]);  //binds our VAO
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.VBO[8]);	//binds our first VBO
-    glBufferData(GL_ARRAY_BUFFER, sizeof(poolVerts), poolVerts, GL_STATIC_DRAW);	//sends the vertices to the buffer
+    for (size_t i = 0; i < meshCount; ++i)
+    {
+        // Uploaded straight from the mapped scene
+        const BakedMesh& data = *mesh.data[i];
 
-    mesh.nPoolIndices = sizeof(poolIndices) / sizeof(poolIndices[0]);
+        gGLState.BindVertexArray(mesh.VAO[i]);  //binds our VAO
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.VBO[i * 2]);	//binds our first VBO
+        glBufferData(GL_ARRAY_BUFFER, data.Vertices.size() * sizeof(GLfloat), data.Vertices.begin(), GL_STATIC_DRAW);	//sends the vertices to the buffer
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.VBO[9]);  //binds second VBO
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(poolIndices), poolIndices, GL_STATIC_DRAW);  //sends the indices to the buffer
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.VBO[i * 2 + 1]);  //binds second VBO
+        // sends the indices of every level of detail to the buffer
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, data.Indices.size() * sizeof(GLushort), data.Indices.begin(), GL_STATIC_DRAW);
 
-    // Creates the Vertex Attribute Pointer
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
+        // Creates the Vertex Attribute Pointer
+        glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
+        glEnableVertexAttribArray(0);
 
-    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * floatsPerVertex));
+        glEnableVertexAttribArray(1);
 
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
+        glEnableVertexAttribArray(2);
 
-    glBindVertexArray(0);
+        gGLState.BindVertexArray(0);
+    }
 
-    cout << "Mesh created" << endl;
+    LOG_INFO("Mesh created");
 }
 
 void UDestroyMesh(GLMesh& mesh)
 {
-    glDeleteVertexArrays(5, mesh.VAO);
-    glDeleteBuffers(10, mesh.VBO);
+    glDeleteVertexArrays((GLsizei)mesh.VAO.size(), mesh.VAO.data());
+    glDeleteBuffers((GLsizei)mesh.VBO.size(), mesh.VBO.data());
 }
 
 
@@ -1255,7 +3526,7 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
     if (!success)
     {
         glGetShaderInfoLog(vertexShaderId, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+        LOG_ERROR("ERROR::SHADER::VERTEX::COMPILATION_FAILED\n%s", infoLog);
 
         return false;
     }
@@ -1266,7 +3537,7 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
     if (!success)
     {
         glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+        LOG_ERROR("ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n%s", infoLog);
 
         return false;
     }
@@ -1281,12 +3552,47 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
     if (!success)
     {
         glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+        LOG_ERROR("ERROR::SHADER::PROGRAM::LINKING_FAILED\n%s", infoLog);
 
         return false;
     }
 
-    glUseProgram(programId);    // Uses the shader program
+    gGLState.UseProgram(programId);    // Uses the shader program
+
+    return true;
+}
+
+
+// Compute shader counterpart of UCreateShaderProgram
+bool UCreateComputeProgram(const char* computeShaderSource, GLuint& programId)
+{
+    int success = 0;
+    char infoLog[512];
+
+    programId = glCreateProgram();
+    GLuint computeShaderId = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(computeShaderId, 1, &computeShaderSource, NULL);
+
+    glCompileShader(computeShaderId);
+    glGetShaderiv(computeShaderId, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(computeShaderId, sizeof(infoLog), NULL, infoLog);
+        LOG_ERROR("ERROR::SHADER::COMPUTE::COMPILATION_FAILED\n%s", infoLog);
+
+        return false;
+    }
+
+    glAttachShader(programId, computeShaderId);
+    glLinkProgram(programId);
+    glGetProgramiv(programId, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
+        LOG_ERROR("ERROR::SHADER::PROGRAM::LINKING_FAILED\n%s", infoLog);
+
+        return false;
+    }
 
     return true;
 }
@@ -1324,16 +3630,16 @@ bool UCreateTexture(const char* filename, GLuint& textureId)
         flipImageVertically(image, width, height, channels);
 
         glGenTextures(1, &textureId);
-        glBindTexture(GL_TEXTURE_2D, textureId);
+        gGLState.BindTexture(0, GL_TEXTURE_2D, textureId);
 
         // Set the texture wrapping parameters.
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-        cout << "Tex parameters set" << endl;
+        LOG_DEBUG("Tex parameters set");
         // Set texture filtering parameters.
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        cout << "Filtering parameters set" << endl;
+        LOG_DEBUG("Filtering parameters set");
 
         if (channels == 3)
             glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
@@ -1341,15 +3647,15 @@ bool UCreateTexture(const char* filename, GLuint& textureId)
             glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
         else
         {
-            cout << "Not implemented to handle image with " << channels << " channels" << endl;
+            LOG_ERROR("Not implemented to handle image with %d channels", channels);
             return false;
         }
 
         glGenerateMipmap(GL_TEXTURE_2D);
-        cout << "Mipmaps generated" << endl;
+        LOG_DEBUG("Mipmaps generated");
 
         stbi_image_free(image);
-        glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture.
+        gGLState.BindTexture(0, GL_TEXTURE_2D, 0); // Unbind the texture.
 
         return true;
     }
@@ -1358,3 +3664,27 @@ bool UCreateTexture(const char* filename, GLuint& textureId)
     return false;
 }
 
+
+// Opens an image as a virtual texture, baking its page file next to it (.vt instead of the extension) the
+// first time and whenever the image is newer
+bool UCreateVirtualTexture(const char* filename, GLuint& tableId)
+{
+    string path = filename;
+    size_t extension = path.find_last_of('.'), slash = path.find_last_of('/');
+    if (extension != string::npos && (slash == string::npos || slash < extension))
+        path.erase(extension);
+    path += ".vt";
+    if (!UIsNewer(filename, path.c_str()) && gVirtualTextures.Open(path, tableId, gGLState))
+        return true;
+
+    int width, height, channels;
+    unsigned char* image = stbi_load(filename, &width, &height, &channels, 4);
+    if (!image)
+        return false;
+    LOG_INFO("Baking virtual texture %s", path.c_str());
+    flipImageVertically(image, width, height, 4);
+    bool baked = VirtualTextureBaker::Bake(image, width, height, VirtualTextureCache::PAGE_SIZE, VirtualTextureCache::BORDER, path);
+    stbi_image_free(image);
+    return baked && gVirtualTextures.Open(path, tableId, gGLState);
+}
+
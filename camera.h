@@ -129,6 +129,16 @@ public:
             Zoom = 45.0f;
     }
 
+    // places the camera directly, for playing back a recorded path
+    void SetPose(glm::vec3 position, float yaw, float pitch, float zoom)
+    {
+        Position = position;
+        Yaw = yaw;
+        Pitch = pitch;
+        Zoom = zoom;
+        updateCameraVectors();
+    }
+
 private:
     // calculates the front vector from the Camera's (updated) Euler Angles
     void updateCameraVectors()
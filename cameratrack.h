@@ -0,0 +1,161 @@
+#pragma once
+
+#ifndef CAMERA_TRACK_H
+#define CAMERA_TRACK_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "camera.h"
+
+// A camera pose at a point in time, in the Camera's own terms
+struct CameraPose
+{
+    float Time;             // seconds from the start of the track
+    glm::vec3 Position;
+    float Yaw, Pitch;       // degrees; yaw is not wrapped, so it interpolates the way the camera turned
+    float Zoom;             // vertical field of view in degrees
+};
+
+
+// Timestamped camera poses recorded from live input and played back along a spline, so a fly-through can be
+// repeated exactly for profiling. Playback is driven by time rather than by frames: sample it at a fixed
+// timestep and every run sees the same viewpoints in the same order.
+//
+// Tracks are saved as text, one pose per line ("time x y z yaw pitch zoom"), so they can be trimmed or
+// tweaked by hand; lines starting with # are ignored.
+class CameraTrack
+{
+public:
+    // poses closer together than this are not worth keeping
+    static constexpr float MIN_INTERVAL = 1.0f / 30.0f;
+
+    void Clear()
+    {
+        Poses.clear();
+    }
+
+    // appends the camera's pose; time must not go backwards
+    void Record(float time, const Camera& camera)
+    {
+        if (!Poses.empty() && time - Poses.back().Time < MIN_INTERVAL)
+            return;
+        Poses.push_back({ time, camera.Position, camera.Yaw, camera.Pitch, camera.Zoom });
+    }
+
+    float Duration() const
+    {
+        return Poses.empty() ? 0.0f : Poses.back().Time - Poses.front().Time;
+    }
+
+    // pose at time seconds from the start, on a Catmull-Rom spline through the recorded poses (tangents scaled
+    // for the uneven spacing of the samples). Times outside the track hold the first or last pose
+    CameraPose Evaluate(float time) const
+    {
+        if (Poses.empty())
+            return { time, glm::vec3(0.0f), -90.0f, 0.0f, 45.0f };
+
+        time += Poses.front().Time;
+        if (time <= Poses.front().Time)
+            return Poses.front();
+        if (time >= Poses.back().Time)
+            return Poses.back();
+
+        // segment [i, i + 1] holds time
+        size_t i = std::upper_bound(Poses.begin(), Poses.end(), time,
+            [](float t, const CameraPose& pose) { return t < pose.Time; }) - Poses.begin() - 1;
+        const CameraPose& p0 = Poses[i > 0 ? i - 1 : i];
+        const CameraPose& p1 = Poses[i];
+        const CameraPose& p2 = Poses[i + 1];
+        const CameraPose& p3 = Poses[std::min(i + 2, Poses.size() - 1)];
+
+        float a[CHANNELS], b[CHANNELS], c[CHANNELS], d[CHANNELS], out[CHANNELS];
+        unpack(p0, a);
+        unpack(p1, b);
+        unpack(p2, c);
+        unpack(p3, d);
+
+        float span = p2.Time - p1.Time;
+        float s = (time - p1.Time) / span;
+        float s2 = s * s, s3 = s2 * s;
+        float h00 = 2.0f * s3 - 3.0f * s2 + 1.0f;
+        float h10 = s3 - 2.0f * s2 + s;
+        float h01 = -2.0f * s3 + 3.0f * s2;
+        float h11 = s3 - s2;
+        float before = p2.Time - p0.Time;
+        float after = p3.Time - p1.Time;
+        for (int k = 0; k < CHANNELS; ++k)
+        {
+            float m1 = (c[k] - a[k]) / before * span;
+            float m2 = (d[k] - b[k]) / after * span;
+            out[k] = h00 * b[k] + h10 * m1 + h01 * c[k] + h11 * m2;
+        }
+
+        CameraPose pose;
+        pose.Time = time - Poses.front().Time;
+        pose.Position = glm::vec3(out[0], out[1], out[2]);
+        pose.Yaw = out[3];
+        pose.Pitch = out[4];
+        pose.Zoom = out[5];
+        return pose;
+    }
+
+    bool Save(const std::string& path) const
+    {
+        std::ofstream out(path);
+        if (!out)
+            return false;
+        out << "# time x y z yaw pitch zoom\n";
+        for (const CameraPose& pose : Poses)
+        {
+            out << pose.Time << ' ' << pose.Position.x << ' ' << pose.Position.y << ' ' << pose.Position.z << ' '
+                << pose.Yaw << ' ' << pose.Pitch << ' ' << pose.Zoom << '\n';
+        }
+        return (bool)out;
+    }
+
+    // replaces the track; false if the file can't be read or has a malformed line
+    bool Load(const std::string& path)
+    {
+        std::ifstream in(path);
+        if (!in)
+            return false;
+        std::vector<CameraPose> loaded;
+        std::string line;
+        while (std::getline(in, line))
+        {
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::istringstream fields(line);
+            CameraPose pose;
+            if (!(fields >> pose.Time >> pose.Position.x >> pose.Position.y >> pose.Position.z >> pose.Yaw >> pose.Pitch >> pose.Zoom))
+                return false;
+            if (!loaded.empty() && pose.Time <= loaded.back().Time)
+                return false;
+            loaded.push_back(pose);
+        }
+        Poses.swap(loaded);
+        return true;
+    }
+
+    std::vector<CameraPose> Poses;
+
+private:
+    static const int CHANNELS = 6;
+
+    static void unpack(const CameraPose& pose, float* channels)
+    {
+        channels[0] = pose.Position.x;
+        channels[1] = pose.Position.y;
+        channels[2] = pose.Position.z;
+        channels[3] = pose.Yaw;
+        channels[4] = pose.Pitch;
+        channels[5] = pose.Zoom;
+    }
+};
+#endif
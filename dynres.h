@@ -0,0 +1,58 @@
+#pragma once
+
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "logger.h"
+
+// Picks the fraction of the window's resolution (per axis) to render at so the GPU time of a frame stays
+// under a budget. GPU time is taken to grow with the pixel count, so the scale that would have hit the
+// target is the measured scale times sqrt(target / measured). The controller moves part of the way there
+// each frame: quickly down so a heavy view doesn't drop frames, slowly up so it doesn't oscillate, and not at
+// all inside a small dead band around the target.
+//
+// The scene is rendered into frame graph targets (framegraph.h) at the window's size and only uses their
+// lower left corner, so a new scale is just a different viewport and never reallocates.
+class ResolutionController
+{
+public:
+    float TargetMs = 14.0f;         // leaves some headroom under a 60 Hz frame
+    float MinScale = 0.5f;
+    float MaxScale = 1.0f;
+    float Scale = 1.0f;             // to use for the next frame
+
+    // gpuMs was measured for a frame rendered at renderedScale (results arrive a few frames late)
+    void Update(float gpuMs, float renderedScale)
+    {
+        if (gpuMs <= 0.0f || renderedScale <= 0.0f)
+            return;
+        float ratio = TargetMs / gpuMs;
+        if (ratio > 1.0f - DEAD_BAND && ratio < 1.0f + DEAD_BAND)
+            return;
+        float ideal = std::min(std::max(renderedScale * std::sqrt(ratio), MinScale), MaxScale);
+        bool rising = ideal > Scale;
+        float next = Scale + (ideal - Scale) * (rising ? UP_RATE : DOWN_RATE);
+
+        // small steps would only resize the viewport by a few pixels. Rounding away from the current scale
+        // moves it at least one step, so it can't stall short of the ideal once the steps get small
+        next = rising ? std::ceil(next * STEPS) / STEPS : std::floor(next * STEPS) / STEPS;
+        Scale = std::min(std::max(next, MinScale), MaxScale);
+    }
+
+    void Reset()
+    {
+        Scale = MaxScale;
+    }
+
+private:
+    static constexpr float DEAD_BAND = 0.08f;
+    static constexpr float DOWN_RATE = 0.5f;
+    static constexpr float UP_RATE = 0.1f;
+    static constexpr float STEPS = 64.0f;
+};
+#endif
@@ -0,0 +1,337 @@
+#pragma once
+
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "glstate.h"
+#include "logger.h"
+
+// The precomputed lighting of an environment as stored on disk, so it only has to be computed once per
+// source. Key hashes everything the results depend on (the source image and the shaders that filter it); a
+// cache whose key or sizes differ is computed again.
+//
+// File layout: the header, then the sky's faces (+X, -X, +Y, -Y, +Z, -Z) at full size, the specular map's
+// faces level by level from the sharpest, and the BRDF table, all as half floats (RGBA, the table RG).
+struct EnvironmentCacheHeader
+{
+    static const uint32_t MAGIC = 0x434C4249;   // "IBLC"
+    static const uint32_t VERSION = 1;
+
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t Key;
+    uint32_t SkySize;
+    uint32_t SpecularSize;
+    uint32_t SpecularLevels;
+    uint32_t BrdfSize;
+    float Irradiance[9 * 4];    // like the shader's vec4 irradiance[9]
+};
+
+
+// Image based lighting. An HDR environment map becomes four things, all computed by compute shaders:
+//   - the sky, a cube map drawn behind the scene,
+//   - irradiance, the light arriving from every direction convolved with the cosine lobe as nine spherical
+//     harmonics coefficients, which replace the constant ambient term,
+//   - a specular cube map prefiltered with the GGX distribution, roughness 0 to 1 over its mip levels,
+//   - the split sum BRDF table, scale and bias of F0 by N.V and roughness.
+// Together they are a few MB and take a while to compute, so they are cached to disk under a key of the
+// source and the shaders; a later run with the same key just uploads the cached results.
+//
+// The environment has z up in its own space; Model places it in the world, like the terrain's.
+class EnvironmentLighting
+{
+public:
+    static const int SKY_SIZE = 256;
+    static const int SPECULAR_SIZE = 128;
+    static const int SPECULAR_LEVELS = 5;
+    static const int BRDF_SIZE = 128;
+    static const int IRRADIANCE_LEVEL = 3;      // sky mip projected onto the harmonics, 32x32 a face
+    static const int WORK_GROUP = 8;            // local size of the per texel shaders in x and y
+    static const int SPECULAR_UNIT = 4;
+    static const int BRDF_UNIT = 5;
+    static const int SKY_UNIT = 6;
+    static const uint64_t HASH_SEED = 0xCBF29CE484222325ull;
+
+    // compute shaders of the precomputation, only needed when the cache misses
+    struct Programs
+    {
+        GLuint Sky;             // the source, or the procedural sky, into the sky cube map
+        GLuint Irradiance;
+        GLuint Specular;
+        GLuint Brdf;
+    };
+
+    glm::mat4 Model = glm::mat4(1.0f);  // environment space to world
+    float Intensity = 1.0f;
+
+    // FNV-1a, continuing from hash
+    static uint64_t Hash(const void* data, size_t size, uint64_t hash = HASH_SEED)
+    {
+        const unsigned char* bytes = (const unsigned char*)data;
+        for (size_t i = 0; i < size; ++i)
+            hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+        return hash;
+    }
+
+    // uploads the cached results if path holds them for key; false if it doesn't, with nothing created
+    bool Load(const std::string& path, uint64_t key, GLState& state)
+    {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file)
+            return false;
+        EnvironmentCacheHeader header;
+        bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.Magic == EnvironmentCacheHeader::MAGIC
+            && header.Version == EnvironmentCacheHeader::VERSION && header.Key == key && header.SkySize == SKY_SIZE
+            && header.SpecularSize == SPECULAR_SIZE && header.SpecularLevels == SPECULAR_LEVELS && header.BrdfSize == BRDF_SIZE;
+        std::vector<uint16_t> data(valid ? CacheHalfs() : 0);
+        valid = valid && fread(data.data(), sizeof(uint16_t), data.size(), file) == data.size();
+        fclose(file);
+        if (!valid)
+            return false;
+
+        CreateTextures(state);
+        const uint16_t* next = data.data();
+        state.BindTexture(SKY_UNIT, GL_TEXTURE_CUBE_MAP, sky);
+        for (int face = 0; face < 6; ++face, next += SKY_SIZE * SKY_SIZE * 4)
+            glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, 0, 0, SKY_SIZE, SKY_SIZE, GL_RGBA, GL_HALF_FLOAT, next);
+        glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+        state.BindTexture(SPECULAR_UNIT, GL_TEXTURE_CUBE_MAP, specular);
+        for (int level = 0; level < SPECULAR_LEVELS; ++level)
+        {
+            int size = SPECULAR_SIZE >> level;
+            for (int face = 0; face < 6; ++face, next += size * size * 4)
+                glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, 0, 0, size, size, GL_RGBA, GL_HALF_FLOAT, next);
+        }
+        state.BindTexture(BRDF_UNIT, GL_TEXTURE_2D, brdf);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, BRDF_SIZE, BRDF_SIZE, GL_RG, GL_HALF_FLOAT, next);
+        memcpy(irradiance, header.Irradiance, sizeof(irradiance));
+        return true;
+    }
+
+    // computes everything from an equirectangular RGB float image, zenith in the first row, or from the
+    // procedural sky in the sky shader when there is none
+    void Compute(const Programs& programs, const float* image, int width, int height, GLState& state)
+    {
+        CreateTextures(state);
+
+        GLuint source = 0;
+        if (image)
+        {
+            glGenTextures(1, &source);
+            state.BindTexture(0, GL_TEXTURE_2D, source);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, width, height, 0, GL_RGB, GL_FLOAT, image);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+        state.UseProgram(programs.Sky);
+        glUniform1i(glGetUniformLocation(programs.Sky, "procedural"), image == nullptr);
+        glUniform1i(glGetUniformLocation(programs.Sky, "equirect"), 0);
+        glBindImageTexture(0, sky, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+        glDispatchCompute(SKY_SIZE / WORK_GROUP, SKY_SIZE / WORK_GROUP, 6);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+        state.BindTexture(SKY_UNIT, GL_TEXTURE_CUBE_MAP, sky);
+        glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+        if (source)
+        {
+            state.BindTexture(0, GL_TEXTURE_2D, 0);
+            glDeleteTextures(1, &source);
+        }
+
+        // one work group sums the harmonics and leaves them in a buffer for the CPU
+        GLuint coefficients;
+        glGenBuffers(1, &coefficients);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, coefficients);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(irradiance), NULL, GL_STREAM_READ);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, coefficients);
+        state.UseProgram(programs.Irradiance);
+        glUniform1i(glGetUniformLocation(programs.Irradiance, "sky"), SKY_UNIT);
+        glUniform1i(glGetUniformLocation(programs.Irradiance, "level"), IRRADIANCE_LEVEL);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        const float* values = (const float*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof(irradiance), GL_MAP_READ_BIT);
+        if (values)
+        {
+            memcpy(irradiance, values, sizeof(irradiance));
+            glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glDeleteBuffers(1, &coefficients);
+
+        state.UseProgram(programs.Specular);
+        glUniform1i(glGetUniformLocation(programs.Specular, "sky"), SKY_UNIT);
+        glUniform1f(glGetUniformLocation(programs.Specular, "skySize"), (float)SKY_SIZE);
+        GLint roughnessLocation = glGetUniformLocation(programs.Specular, "roughness");
+        for (int level = 0; level < SPECULAR_LEVELS; ++level)
+        {
+            int groups = ((SPECULAR_SIZE >> level) + WORK_GROUP - 1) / WORK_GROUP;
+            glUniform1f(roughnessLocation, (float)level / (SPECULAR_LEVELS - 1));
+            glBindImageTexture(0, specular, level, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+            glDispatchCompute(groups, groups, 6);
+        }
+
+        state.UseProgram(programs.Brdf);
+        glBindImageTexture(0, brdf, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG16F);
+        glDispatchCompute(BRDF_SIZE / WORK_GROUP, BRDF_SIZE / WORK_GROUP, 1);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+    }
+
+    // reads the computed results back and writes them to path under key
+    bool Save(const std::string& path, uint64_t key, GLState& state)
+    {
+        EnvironmentCacheHeader header = {};
+        header.Magic = EnvironmentCacheHeader::MAGIC;
+        header.Version = EnvironmentCacheHeader::VERSION;
+        header.Key = key;
+        header.SkySize = SKY_SIZE;
+        header.SpecularSize = SPECULAR_SIZE;
+        header.SpecularLevels = SPECULAR_LEVELS;
+        header.BrdfSize = BRDF_SIZE;
+        memcpy(header.Irradiance, irradiance, sizeof(irradiance));
+
+        std::vector<uint16_t> data(CacheHalfs());
+        uint16_t* next = data.data();
+        state.BindTexture(SKY_UNIT, GL_TEXTURE_CUBE_MAP, sky);
+        for (int face = 0; face < 6; ++face, next += SKY_SIZE * SKY_SIZE * 4)
+            glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGBA, GL_HALF_FLOAT, next);
+        state.BindTexture(SPECULAR_UNIT, GL_TEXTURE_CUBE_MAP, specular);
+        for (int level = 0; level < SPECULAR_LEVELS; ++level)
+        {
+            int size = SPECULAR_SIZE >> level;
+            for (int face = 0; face < 6; ++face, next += size * size * 4)
+                glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGBA, GL_HALF_FLOAT, next);
+        }
+        state.BindTexture(BRDF_UNIT, GL_TEXTURE_2D, brdf);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RG, GL_HALF_FLOAT, next);
+
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file)
+            return false;
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(data.data(), sizeof(uint16_t), data.size(), file);
+        bool ok = !ferror(file);
+        return fclose(file) == 0 && ok;
+    }
+
+    // sets the lighting uniforms of a program lit like the sun fragment shader, whose samplers read
+    // SPECULAR_UNIT and BRDF_UNIT; the program must be in use
+    void SetUniforms(GLuint program) const
+    {
+        glm::mat4 fromWorld = glm::inverse(Model);
+        glUniform1i(glGetUniformLocation(program, "environmentLighting"), GL_TRUE);
+        glUniform4fv(glGetUniformLocation(program, "irradiance"), 9, irradiance);
+        glUniformMatrix4fv(glGetUniformLocation(program, "environmentFromWorld"), 1, GL_FALSE, glm::value_ptr(fromWorld));
+        glUniform1f(glGetUniformLocation(program, "environmentIntensity"), Intensity);
+    }
+
+    // the specular map and BRDF table on their units, for the lit programs
+    void Bind(GLState& state) const
+    {
+        state.BindTexture(SPECULAR_UNIT, GL_TEXTURE_CUBE_MAP, specular);
+        state.BindTexture(BRDF_UNIT, GL_TEXTURE_2D, brdf);
+    }
+
+    // draws the sky with skyProgram wherever the depth buffer is still clear, seen through view
+    void DrawSky(GLuint skyProgram, const glm::mat4& view, const glm::mat4& projection, GLState& state)
+    {
+        glm::mat4 inverseViewProjection = glm::inverse(projection * view);
+        glm::mat4 fromWorld = glm::inverse(Model);
+        state.UseProgram(skyProgram);
+        state.BindTexture(SKY_UNIT, GL_TEXTURE_CUBE_MAP, sky);
+        glUniform1i(glGetUniformLocation(skyProgram, "sky"), SKY_UNIT);
+        glUniformMatrix4fv(glGetUniformLocation(skyProgram, "inverseViewProjection"), 1, GL_FALSE, glm::value_ptr(inverseViewProjection));
+        glUniformMatrix4fv(glGetUniformLocation(skyProgram, "environmentFromWorld"), 1, GL_FALSE, glm::value_ptr(fromWorld));
+        glUniform1f(glGetUniformLocation(skyProgram, "environmentIntensity"), Intensity);
+        state.DepthFunc(GL_LEQUAL);
+        state.DepthMask(false);
+        state.BindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    void Destroy()
+    {
+        if (!Created())
+            return;
+        GLuint textures[3] = { sky, specular, brdf };
+        glDeleteTextures(3, textures);
+        glDeleteVertexArrays(1, &emptyVAO);
+        sky = specular = brdf = emptyVAO = 0;
+    }
+
+    bool Created() const
+    {
+        return sky != 0;
+    }
+
+    size_t Bytes() const
+    {
+        return CacheHalfs() * sizeof(uint16_t);
+    }
+
+private:
+    // half floats in a cache file after the header
+    static size_t CacheHalfs()
+    {
+        size_t halfs = (size_t)SKY_SIZE * SKY_SIZE * 4 * 6 + (size_t)BRDF_SIZE * BRDF_SIZE * 2;
+        for (int level = 0; level < SPECULAR_LEVELS; ++level)
+            halfs += (size_t)(SPECULAR_SIZE >> level) * (SPECULAR_SIZE >> level) * 4 * 6;
+        return halfs;
+    }
+
+    void CreateTextures(GLState& state)
+    {
+        // filtering across cube faces, for every cube map
+        state.Enable(GL_TEXTURE_CUBE_MAP_SEAMLESS, true);
+
+        GLuint textures[3];
+        glGenTextures(3, textures);
+        sky = textures[0];
+        specular = textures[1];
+        brdf = textures[2];
+
+        // the sky keeps its mips for the specular filtering to read from
+        int skyLevels = 1;
+        while ((SKY_SIZE >> skyLevels) > 0)
+            ++skyLevels;
+        state.BindTexture(SKY_UNIT, GL_TEXTURE_CUBE_MAP, sky);
+        for (int level = 0; level < skyLevels; ++level)
+            for (int face = 0; face < 6; ++face)
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGBA16F, SKY_SIZE >> level, SKY_SIZE >> level, 0, GL_RGBA, GL_HALF_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        state.BindTexture(SPECULAR_UNIT, GL_TEXTURE_CUBE_MAP, specular);
+        for (int level = 0; level < SPECULAR_LEVELS; ++level)
+            for (int face = 0; face < 6; ++face)
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGBA16F, SPECULAR_SIZE >> level, SPECULAR_SIZE >> level, 0, GL_RGBA, GL_HALF_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, SPECULAR_LEVELS - 1);
+
+        state.BindTexture(BRDF_UNIT, GL_TEXTURE_2D, brdf);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, BRDF_SIZE, BRDF_SIZE, 0, GL_RG, GL_HALF_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        // the sky is generated from gl_VertexID, but a draw still needs a vertex array bound
+        glGenVertexArrays(1, &emptyVAO);
+    }
+
+    GLuint sky = 0, specular = 0, brdf = 0;
+    GLuint emptyVAO = 0;
+    float irradiance[9 * 4] = {};
+};
+#endif
@@ -0,0 +1,446 @@
+#pragma once
+
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <GL/glew.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+#include "logger.h"
+
+// Screenshots and video without stalling the frame. glReadPixels goes into a pixel pack buffer, so it only
+// queues a copy on the GPU; the buffer is fenced and mapped RING_SIZE - 1 frames later, when the copy has
+// long finished. The pixels are then handed to an encoder thread that does the conversion and the file I/O.
+// If the encoder falls behind, video frames are dropped (and counted) instead of slowing down rendering.
+//
+// Screenshots are written as PNG, video as raw YUV4MPEG2 (.y4m), which players and ffmpeg read directly.
+// Everything except the encoder belongs to the thread that owns the GL context.
+class FrameCapture
+{
+public:
+    static const int RING_SIZE = 3;
+    static const size_t MAX_QUEUED = 8;     // frames waiting for the encoder
+
+    void Create()
+    {
+        glGenBuffers(RING_SIZE, buffers);
+        encoderRunning = true;
+        encoder = std::thread([this] { Encode(); });
+    }
+
+    // finishes every pending readback and waits for the encoder to write it out
+    void Destroy()
+    {
+        if (!encoder.joinable())
+            return;
+        if (Recording())
+            StopVideo();
+        Flush();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            encoderRunning = false;
+        }
+        wake.notify_one();
+        encoder.join();
+        glDeleteBuffers(RING_SIZE, buffers);
+    }
+
+    // the next captured frame is saved to path
+    void Screenshot(const std::string& path)
+    {
+        screenshotPath = path;
+    }
+
+    // every frame from the next one on is appended to a .y4m file, stamped with fps
+    void StartVideo(const std::string& path, int fps)
+    {
+        if (Recording())
+            StopVideo();
+        Job job;
+        job.Type = JOB_OPEN_VIDEO;
+        job.Path = path;
+        job.Width = fps;
+        Queue(std::move(job), false);
+        recording = true;
+    }
+
+    // waits for the frames still in flight so they all end up in the file
+    void StopVideo()
+    {
+        if (!recording)
+            return;
+        Flush();
+        recording = false;
+        Job job;
+        job.Type = JOB_CLOSE_VIDEO;
+        Queue(std::move(job), false);
+    }
+
+    bool Recording() const
+    {
+        return recording;
+    }
+
+    // call once per frame with the finished image in the bound read framebuffer
+    void Capture(int width, int height)
+    {
+        // the slot about to be reused was read back RING_SIZE - 1 frames ago
+        Slot& slot = slots[next];
+        if (slot.Fence)
+            Collect(slot, 0);
+
+        if (!recording && screenshotPath.empty())
+            return;
+
+        size_t size = (size_t)width * height * 4;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[next]);
+        if (slot.Capacity < size)
+        {
+            glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+            slot.Capacity = size;
+        }
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        slot.Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.Width = width;
+        slot.Height = height;
+        slot.Video = recording;
+        slot.ScreenshotPath.swap(screenshotPath);
+        screenshotPath.clear();
+        next = (next + 1) % RING_SIZE;
+    }
+
+    unsigned int Dropped() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return dropped;
+    }
+
+private:
+    enum JobType { JOB_SCREENSHOT, JOB_VIDEO_FRAME, JOB_OPEN_VIDEO, JOB_CLOSE_VIDEO };
+
+    struct Job
+    {
+        JobType Type;
+        std::vector<uint8_t> Pixels;    // RGBA, bottom row first as GL returns it
+        int Width = 0, Height = 0;      // JOB_OPEN_VIDEO keeps the frame rate in Width
+        std::string Path;
+    };
+
+    struct Slot
+    {
+        GLsync Fence = 0;
+        size_t Capacity = 0;
+        int Width = 0, Height = 0;
+        bool Video = false;
+        std::string ScreenshotPath;
+    };
+
+    // every slot still in flight, oldest first, waiting as long as it takes
+    void Flush()
+    {
+        for (int i = 0; i < RING_SIZE; ++i)
+        {
+            Slot& slot = slots[(next + i) % RING_SIZE];
+            if (slot.Fence)
+                Collect(slot, 1000000000);
+        }
+    }
+
+    // maps a finished readback and queues its pixels for the encoder
+    void Collect(Slot& slot, GLuint64 timeout)
+    {
+        GLenum status = glClientWaitSync(slot.Fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+        if (status == GL_TIMEOUT_EXPIRED)
+        {
+            // still not done after RING_SIZE - 1 frames: wait now rather than lose a screenshot
+            status = glClientWaitSync(slot.Fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        }
+        glDeleteSync(slot.Fence);
+        slot.Fence = 0;
+        if (status == GL_WAIT_FAILED || status == GL_TIMEOUT_EXPIRED)
+            return;
+
+        bool wantVideo = slot.Video && !Full();
+        if (slot.Video && !wantVideo)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++dropped;
+        }
+        if (!wantVideo && slot.ScreenshotPath.empty())
+            return;
+
+        size_t size = (size_t)slot.Width * slot.Height * 4;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[&slot - slots]);
+        const uint8_t* pixels = (const uint8_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+        if (pixels)
+        {
+            if (!slot.ScreenshotPath.empty())
+                Queue(MakeFrame(JOB_SCREENSHOT, pixels, slot, slot.ScreenshotPath), false);
+            if (wantVideo)
+                Queue(MakeFrame(JOB_VIDEO_FRAME, pixels, slot, std::string()), true);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        slot.ScreenshotPath.clear();
+    }
+
+    Job MakeFrame(JobType type, const uint8_t* pixels, const Slot& slot, const std::string& path)
+    {
+        Job job;
+        job.Type = type;
+        job.Width = slot.Width;
+        job.Height = slot.Height;
+        job.Path = path;
+        {
+            // reuse the storage of a frame the encoder is done with
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!pool.empty())
+            {
+                job.Pixels.swap(pool.back());
+                pool.pop_back();
+            }
+        }
+        job.Pixels.assign(pixels, pixels + (size_t)slot.Width * slot.Height * 4);
+        return job;
+    }
+
+    bool Full() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return jobs.size() >= MAX_QUEUED;
+    }
+
+    void Queue(Job&& job, bool droppable)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (droppable && jobs.size() >= MAX_QUEUED)
+            {
+                ++dropped;
+                return;
+            }
+            jobs.push_back(std::move(job));
+        }
+        wake.notify_one();
+    }
+
+    // ---- encoder thread ----
+
+    void Encode()
+    {
+        FILE* video = nullptr;
+        std::string videoPath;
+        int fps = 60;
+        int videoWidth = 0, videoHeight = 0;
+        unsigned int frames = 0;
+        std::vector<uint8_t> yuv;
+
+        for (;;)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return !jobs.empty() || !encoderRunning; });
+                if (jobs.empty())
+                    break;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+
+            switch (job.Type)
+            {
+            case JOB_SCREENSHOT:
+                if (WritePNG(job.Path, job.Pixels.data(), job.Width, job.Height))
+                    LOG_INFO("Screenshot written to %s", job.Path.c_str());
+                else
+                    LOG_ERROR("Failed to write %s", job.Path.c_str());
+                break;
+            case JOB_OPEN_VIDEO:
+                video = fopen(job.Path.c_str(), "wb");
+                if (!video)
+                    LOG_ERROR("Failed to open %s", job.Path.c_str());
+                videoPath = job.Path;
+                fps = job.Width;
+                videoWidth = videoHeight = 0;
+                frames = 0;
+                break;
+            case JOB_VIDEO_FRAME:
+                if (!video)
+                    break;
+                if (videoWidth == 0)
+                {
+                    // 4:2:0 needs even dimensions; an odd last row or column is cut off
+                    videoWidth = job.Width & ~1;
+                    videoHeight = job.Height & ~1;
+                    fprintf(video, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", videoWidth, videoHeight, fps);
+                }
+                if (job.Width < videoWidth || job.Height < videoHeight)
+                    break;      // the window shrank mid recording, the stream can't change size
+                ToYUV420(job.Pixels.data(), job.Width, videoWidth, videoHeight, yuv);
+                fputs("FRAME\n", video);
+                fwrite(yuv.data(), 1, yuv.size(), video);
+                ++frames;
+                break;
+            case JOB_CLOSE_VIDEO:
+                if (video)
+                {
+                    bool ok = !ferror(video);
+                    ok = fclose(video) == 0 && ok;
+                    video = nullptr;
+                    if (ok)
+                        LOG_INFO("Video of %u frames written to %s", frames, videoPath.c_str());
+                    else
+                        LOG_ERROR("Failed to write %s", videoPath.c_str());
+                }
+                break;
+            }
+
+            if (!job.Pixels.empty())
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (pool.size() < MAX_QUEUED)
+                    pool.push_back(std::move(job.Pixels));
+            }
+        }
+        if (video)
+            fclose(video);
+    }
+
+    // full range BT.601 (what C420jpeg means), flipped to top row first; chroma from 2x2 averages
+    static void ToYUV420(const uint8_t* rgba, int stride, int width, int height, std::vector<uint8_t>& out)
+    {
+        size_t lumaSize = (size_t)width * height;
+        out.resize(lumaSize + lumaSize / 2);
+        uint8_t* yPlane = out.data();
+        uint8_t* uPlane = yPlane + lumaSize;
+        uint8_t* vPlane = uPlane + lumaSize / 4;
+
+        for (int y = 0; y < height; ++y)
+        {
+            const uint8_t* row = rgba + (size_t)(height - 1 - y) * stride * 4;
+            for (int x = 0; x < width; ++x)
+            {
+                const uint8_t* p = row + x * 4;
+                yPlane[(size_t)y * width + x] = (uint8_t)((77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8);
+            }
+        }
+        for (int y = 0; y < height / 2; ++y)
+        {
+            const uint8_t* row0 = rgba + (size_t)(height - 1 - 2 * y) * stride * 4;
+            const uint8_t* row1 = row0 - (size_t)stride * 4;
+            for (int x = 0; x < width / 2; ++x)
+            {
+                int r = row0[x * 8] + row0[x * 8 + 4] + row1[x * 8] + row1[x * 8 + 4];
+                int g = row0[x * 8 + 1] + row0[x * 8 + 5] + row1[x * 8 + 1] + row1[x * 8 + 5];
+                int b = row0[x * 8 + 2] + row0[x * 8 + 6] + row1[x * 8 + 2] + row1[x * 8 + 6];
+                // sums of four samples, so the usual coefficients are divided by 4 * 256
+                int u = (-43 * r - 85 * g + 128 * b + 512) / 1024 + 128;
+                int v = (128 * r - 107 * g - 21 * b + 512) / 1024 + 128;
+                uPlane[(size_t)y * (width / 2) + x] = (uint8_t)std::min(std::max(u, 0), 255);
+                vPlane[(size_t)y * (width / 2) + x] = (uint8_t)std::min(std::max(v, 0), 255);
+            }
+        }
+    }
+
+    // RGB PNG with stored (uncompressed) deflate blocks: larger files, but no compression on the encoder
+    // thread and no library needed
+    static bool WritePNG(const std::string& path, const uint8_t* rgba, int width, int height)
+    {
+        std::vector<uint8_t> raw;
+        raw.reserve((size_t)(width * 3 + 1) * height);
+        for (int y = height - 1; y >= 0; --y)
+        {
+            raw.push_back(0);   // no filter
+            const uint8_t* row = rgba + (size_t)y * width * 4;
+            for (int x = 0; x < width; ++x)
+                raw.insert(raw.end(), row + x * 4, row + x * 4 + 3);
+        }
+
+        std::vector<uint8_t> zlib = { 0x78, 0x01 };
+        size_t offset = 0;
+        do
+        {
+            size_t block = std::min(raw.size() - offset, (size_t)65535);
+            bool last = offset + block == raw.size();
+            zlib.push_back(last ? 1 : 0);
+            zlib.push_back((uint8_t)block);
+            zlib.push_back((uint8_t)(block >> 8));
+            zlib.push_back((uint8_t)~block);
+            zlib.push_back((uint8_t)(~block >> 8));
+            zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + block);
+            offset += block;
+        } while (offset < raw.size());
+        uint32_t a = 1, b = 0;
+        for (uint8_t byte : raw)
+        {
+            a = (a + byte) % 65521;
+            b = (b + a) % 65521;
+        }
+        PutBE(zlib, b << 16 | a);
+
+        std::vector<uint8_t> header;
+        PutBE(header, (uint32_t)width);
+        PutBE(header, (uint32_t)height);
+        header.insert(header.end(), { 8, 2, 0, 0, 0 });    // 8 bit RGB, no interlace
+
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file)
+            return false;
+        static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+        fwrite(signature, 1, 8, file);
+        WriteChunk(file, "IHDR", header);
+        WriteChunk(file, "IDAT", zlib);
+        WriteChunk(file, "IEND", std::vector<uint8_t>());
+        bool ok = !ferror(file);
+        return fclose(file) == 0 && ok;
+    }
+
+    static void PutBE(std::vector<uint8_t>& out, uint32_t value)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            out.push_back((uint8_t)(value >> shift));
+    }
+
+    static void WriteChunk(FILE* file, const char* type, const std::vector<uint8_t>& data)
+    {
+        std::vector<uint8_t> chunk;
+        PutBE(chunk, (uint32_t)data.size());
+        chunk.insert(chunk.end(), type, type + 4);
+        chunk.insert(chunk.end(), data.begin(), data.end());
+        uint32_t crc = 0xffffffffu;
+        for (size_t i = 4; i < chunk.size(); ++i)
+        {
+            crc ^= chunk[i];
+            for (int k = 0; k < 8; ++k)
+                crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1)));
+        }
+        PutBE(chunk, ~crc);
+        fwrite(chunk.data(), 1, chunk.size(), file);
+    }
+
+    GLuint buffers[RING_SIZE] = {};
+    Slot slots[RING_SIZE];
+    int next = 0;
+    std::string screenshotPath;
+    bool recording = false;
+
+    std::thread encoder;
+    mutable std::mutex mutex;           // guards everything below
+    std::condition_variable wake;
+    std::deque<Job> jobs;
+    std::vector<std::vector<uint8_t>> pool;
+    unsigned int dropped = 0;
+    bool encoderRunning = false;
+};
+#endif
@@ -0,0 +1,472 @@
+#pragma once
+
+#ifndef FRAME_GRAPH_H
+#define FRAME_GRAPH_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <vector>
+#include <functional>
+#include <algorithm>
+
+#include "glstate.h"
+#include "logger.h"
+
+// Size and format of a render target texture
+struct RenderTargetDesc
+{
+    int Width, Height;
+    GLenum Format;          // sized internal format, e.g. GL_RGBA8, GL_R32UI, GL_DEPTH_COMPONENT24
+
+    bool operator==(const RenderTargetDesc& other) const
+    {
+        return Width == other.Width && Height == other.Height && Format == other.Format;
+    }
+};
+
+
+// Render target textures kept across frames and handed out by description. Within a frame, a texture
+// released after its last use goes straight to the next request with the same description, so resources
+// whose lifetimes don't overlap share one texture. OpenGL has no way to place two textures in the same
+// memory, so sharing the texture object is how transient targets alias here. Framebuffers are cached per
+// set of attachments, which stays the same from frame to frame once the pool has settled.
+class RenderTargetPool
+{
+public:
+    static const int MAX_ATTACHMENTS = 5;   // color attachments plus depth
+    static const int MAX_IDLE_FRAMES = 3;   // unused this long (after a resize, say) and the texture goes
+
+    // a free texture matching desc, or a new one (created through state, on unit 0)
+    GLuint Acquire(const RenderTargetDesc& desc, GLState& state)
+    {
+        for (Entry& entry : entries)
+        {
+            if (!entry.InUse && entry.Desc == desc)
+            {
+                entry.InUse = true;
+                entry.IdleFrames = 0;
+                return entry.Texture;
+            }
+        }
+
+        Entry entry = { desc, 0, true, 0 };
+        GLenum format, type;
+        bool filterable = PixelFormat(desc.Format, format, type);
+        glGenTextures(1, &entry.Texture);
+        state.BindTexture(0, GL_TEXTURE_2D, entry.Texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, desc.Format, desc.Width, desc.Height, 0, format, type, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filterable ? GL_LINEAR : GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filterable ? GL_LINEAR : GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        entries.push_back(entry);
+        return entry.Texture;
+    }
+
+    void Release(GLuint texture)
+    {
+        for (Entry& entry : entries)
+            if (entry.Texture == texture)
+                entry.InUse = false;
+    }
+
+    // framebuffer with the given color attachments (in draw buffer order) and depth, 0 for none
+    GLuint Framebuffer(const GLuint* colors, int colorCount, GLuint depth)
+    {
+        GLuint key[MAX_ATTACHMENTS] = {};
+        std::copy(colors, colors + colorCount, key);
+        key[MAX_ATTACHMENTS - 1] = depth;
+        for (const CachedFramebuffer& cached : framebuffers)
+            if (std::equal(key, key + MAX_ATTACHMENTS, cached.Attachments))
+                return cached.Framebuffer;
+
+        CachedFramebuffer cached;
+        std::copy(key, key + MAX_ATTACHMENTS, cached.Attachments);
+        glGenFramebuffers(1, &cached.Framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, cached.Framebuffer);
+        GLenum drawBuffers[MAX_ATTACHMENTS - 1];
+        for (int i = 0; i < colorCount; ++i)
+        {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, colors[i], 0);
+            drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+        }
+        if (depth)
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+        glDrawBuffers(colorCount, drawBuffers);
+        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        if (status != GL_FRAMEBUFFER_COMPLETE)
+            LOG_ERROR("RenderTargetPool: framebuffer incomplete (0x%x)", status);
+        framebuffers.push_back(cached);
+        return cached.Framebuffer;
+    }
+
+    // ages the free textures and deletes those idle too long, with every framebuffer that used them. True if
+    // any were deleted: GL unbinds deleted textures, so cached texture bindings may be stale
+    bool EndFrame()
+    {
+        bool deleted = false;
+        for (size_t i = 0; i < entries.size();)
+        {
+            Entry& entry = entries[i];
+            if (entry.InUse || ++entry.IdleFrames <= MAX_IDLE_FRAMES)
+            {
+                ++i;
+                continue;
+            }
+            DeleteFramebuffersUsing(entry.Texture);
+            glDeleteTextures(1, &entry.Texture);
+            entries.erase(entries.begin() + i);
+            deleted = true;
+        }
+        return deleted;
+    }
+
+    void Destroy()
+    {
+        for (const CachedFramebuffer& cached : framebuffers)
+            glDeleteFramebuffers(1, &cached.Framebuffer);
+        for (const Entry& entry : entries)
+            glDeleteTextures(1, &entry.Texture);
+        framebuffers.clear();
+        entries.clear();
+    }
+
+    size_t Textures() const
+    {
+        return entries.size();
+    }
+
+    size_t Bytes() const
+    {
+        size_t bytes = 0;
+        for (const Entry& entry : entries)
+            bytes += (size_t)entry.Desc.Width * entry.Desc.Height * TexelBytes(entry.Desc.Format);
+        return bytes;
+    }
+
+    // size of one texel of an internal format, as the driver is likely to store it (24 bit depth takes 4)
+    static size_t TexelBytes(GLenum internalFormat)
+    {
+        switch (internalFormat)
+        {
+        case GL_R8: return 1;
+        case GL_RG8: case GL_R16F: case GL_DEPTH_COMPONENT16: return 2;
+        case GL_RGBA8: case GL_RG16F: case GL_R32F: case GL_R32UI: case GL_DEPTH_COMPONENT24: case GL_DEPTH_COMPONENT32F: return 4;
+        case GL_RGBA16F: case GL_RG32F: case GL_RG32UI: return 8;
+        case GL_RGBA32F: case GL_RGBA32UI: return 16;
+        default: return 4;
+        }
+    }
+
+    static bool IsDepth(GLenum internalFormat)
+    {
+        return internalFormat == GL_DEPTH_COMPONENT16 || internalFormat == GL_DEPTH_COMPONENT24
+            || internalFormat == GL_DEPTH_COMPONENT32F;
+    }
+
+    static bool IsInteger(GLenum internalFormat)
+    {
+        return internalFormat == GL_R32UI || internalFormat == GL_RG32UI || internalFormat == GL_RGBA32UI;
+    }
+
+private:
+    struct Entry
+    {
+        RenderTargetDesc Desc;
+        GLuint Texture;
+        bool InUse;
+        int IdleFrames;
+    };
+
+    struct CachedFramebuffer
+    {
+        GLuint Attachments[MAX_ATTACHMENTS];
+        GLuint Framebuffer;
+    };
+
+    // the format and type glTexImage2D wants with an internal format; false if it can't be filtered
+    static bool PixelFormat(GLenum internalFormat, GLenum& format, GLenum& type)
+    {
+        if (IsDepth(internalFormat))
+        {
+            format = GL_DEPTH_COMPONENT;
+            type = internalFormat == GL_DEPTH_COMPONENT32F ? GL_FLOAT : GL_UNSIGNED_INT;
+            return false;
+        }
+        if (IsInteger(internalFormat))
+        {
+            format = internalFormat == GL_R32UI ? GL_RED_INTEGER : internalFormat == GL_RG32UI ? GL_RG_INTEGER : GL_RGBA_INTEGER;
+            type = GL_UNSIGNED_INT;
+            return false;
+        }
+        format = internalFormat == GL_R8 || internalFormat == GL_R16F || internalFormat == GL_R32F ? GL_RED
+            : internalFormat == GL_RG8 || internalFormat == GL_RG16F || internalFormat == GL_RG32F ? GL_RG : GL_RGBA;
+        type = internalFormat == GL_R16F || internalFormat == GL_RG16F || internalFormat == GL_RGBA16F
+            || internalFormat == GL_R32F || internalFormat == GL_RG32F || internalFormat == GL_RGBA32F ? GL_FLOAT : GL_UNSIGNED_BYTE;
+        return true;
+    }
+
+    void DeleteFramebuffersUsing(GLuint texture)
+    {
+        for (size_t i = 0; i < framebuffers.size();)
+        {
+            const GLuint* attachments = framebuffers[i].Attachments;
+            if (std::find(attachments, attachments + MAX_ATTACHMENTS, texture) == attachments + MAX_ATTACHMENTS)
+            {
+                ++i;
+                continue;
+            }
+            glDeleteFramebuffers(1, &framebuffers[i].Framebuffer);
+            framebuffers.erase(framebuffers.begin() + i);
+        }
+    }
+
+    std::vector<Entry> entries;
+    std::vector<CachedFramebuffer> framebuffers;
+};
+
+
+typedef int RenderResource;     // handle of a frame graph resource, valid for the frame it was declared in
+
+
+// The frame's passes, declared every frame with the targets each one reads and writes. Execute then
+//   - culls passes whose results nothing reads (unless they have side effects, like readbacks),
+//   - takes a pool texture for each transient target right before its first use and gives it back after
+//     its last, so targets that are never alive at the same time share memory,
+//   - binds each pass's attachments (creating and resizing targets as the declarations change), clears
+//     those declared cleared, sets the viewport to their size and runs the pass.
+// Passes run in the order they were added; declaring a write to a target another pass wrote earlier keeps
+// that earlier pass, since the later one draws on top of its contents.
+class FrameGraph
+{
+public:
+    typedef std::function<void(const FrameGraph&)> Execution;
+
+    // forgets last frame's declarations; the pool keeps its textures
+    void Reset()
+    {
+        resources.clear();
+        passes.clear();
+    }
+
+    // a target that lives only within this frame
+    RenderResource Create(const char* name, const RenderTargetDesc& desc)
+    {
+        resources.push_back({ name, desc, false, false, 0, -1, -1 });
+        return (RenderResource)resources.size() - 1;
+    }
+
+    // the window's framebuffer; always an output
+    RenderResource ImportBackbuffer(const char* name, int width, int height)
+    {
+        resources.push_back({ name, { width, height, GL_RGBA8 }, true, true, 0, -1, -1 });
+        return (RenderResource)resources.size() - 1;
+    }
+
+    int AddPass(const char* name, Execution execute)
+    {
+        Pass pass;
+        pass.Name = name;
+        pass.Execute = execute;
+        passes.push_back(pass);
+        return (int)passes.size() - 1;
+    }
+
+    // pass renders into resource, keeping what is there
+    void Write(int pass, RenderResource resource)
+    {
+        passes[pass].Writes.push_back({ resource, false, glm::vec4(0.0f) });
+    }
+
+    // pass renders into resource after clearing it to value (depth takes value.x, integer formats truncate)
+    void WriteCleared(int pass, RenderResource resource, const glm::vec4& value)
+    {
+        passes[pass].Writes.push_back({ resource, true, value });
+    }
+
+    // pass samples or reads back resource
+    void Read(int pass, RenderResource resource)
+    {
+        passes[pass].Reads.push_back(resource);
+    }
+
+    // pass runs even if nothing reads what it writes
+    void SideEffect(int pass)
+    {
+        passes[pass].SideEffect = true;
+    }
+
+    void Execute(RenderTargetPool& pool, GLState& state)
+    {
+        Cull();
+        ComputeLifetimes();
+
+        LivePasses = CulledPasses = 0;
+        for (size_t p = 0; p < passes.size(); ++p)
+        {
+            Pass& pass = passes[p];
+            if (!pass.Live)
+            {
+                ++CulledPasses;
+                continue;
+            }
+            ++LivePasses;
+
+            for (Resource& resource : resources)
+                if (!resource.Imported && resource.FirstPass == (int)p)
+                    resource.Texture = pool.Acquire(resource.Desc, state);
+
+            if (!pass.Writes.empty())
+                BindAttachments(pass, pool, state);
+            pass.Execute(*this);
+
+            for (Resource& resource : resources)
+                if (!resource.Imported && resource.LastPass == (int)p)
+                    pool.Release(resource.Texture);
+        }
+
+        if (pool.EndFrame())
+            state.Invalidate();
+    }
+
+    // texture behind a resource, for the passes that use it while they run
+    GLuint Texture(RenderResource resource) const
+    {
+        return resources[resource].Texture;
+    }
+
+    const RenderTargetDesc& Desc(RenderResource resource) const
+    {
+        return resources[resource].Desc;
+    }
+
+    int LivePasses = 0, CulledPasses = 0;     // of the last Execute
+
+private:
+    struct Resource
+    {
+        const char* Name;
+        RenderTargetDesc Desc;
+        bool Imported;
+        bool Output;
+        GLuint Texture;
+        int FirstPass, LastPass;    // live passes that use it, -1 if none
+    };
+
+    struct Attachment
+    {
+        RenderResource Resource;
+        bool Clear;
+        glm::vec4 Value;
+    };
+
+    struct Pass
+    {
+        const char* Name;
+        Execution Execute;
+        std::vector<Attachment> Writes;
+        std::vector<RenderResource> Reads;
+        bool SideEffect = false;
+        bool Live = false;
+    };
+
+    // walks back from the outputs: a pass is live if it has side effects or writes something a later live
+    // pass or an output needs, and then everything it reads, and the contents it draws over, are needed too
+    void Cull()
+    {
+        std::vector<bool> needed(resources.size(), false);
+        for (size_t r = 0; r < resources.size(); ++r)
+            needed[r] = resources[r].Output;
+
+        for (size_t p = passes.size(); p-- > 0;)
+        {
+            Pass& pass = passes[p];
+            pass.Live = pass.SideEffect;
+            for (const Attachment& write : pass.Writes)
+                pass.Live = pass.Live || needed[write.Resource];
+            if (!pass.Live)
+                continue;
+
+            // a cleared target doesn't need what earlier passes left in it
+            for (const Attachment& write : pass.Writes)
+                needed[write.Resource] = !write.Clear;
+            for (RenderResource read : pass.Reads)
+                needed[read] = true;
+        }
+    }
+
+    void ComputeLifetimes()
+    {
+        for (Resource& resource : resources)
+            resource.FirstPass = resource.LastPass = -1;
+        for (size_t p = 0; p < passes.size(); ++p)
+        {
+            if (!passes[p].Live)
+                continue;
+            auto use = [this, p](RenderResource r)
+            {
+                if (resources[r].FirstPass < 0)
+                    resources[r].FirstPass = (int)p;
+                resources[r].LastPass = (int)p;
+            };
+            for (const Attachment& write : passes[p].Writes)
+                use(write.Resource);
+            for (RenderResource read : passes[p].Reads)
+                use(read);
+        }
+    }
+
+    void BindAttachments(const Pass& pass, RenderTargetPool& pool, GLState& state)
+    {
+        GLuint colors[RenderTargetPool::MAX_ATTACHMENTS - 1];
+        int colorCount = 0;
+        GLuint depth = 0;
+        bool backbuffer = false;
+        const RenderTargetDesc& size = resources[pass.Writes[0].Resource].Desc;
+        for (const Attachment& write : pass.Writes)
+        {
+            const Resource& resource = resources[write.Resource];
+            if (resource.Imported)
+                backbuffer = true;
+            else if (RenderTargetPool::IsDepth(resource.Desc.Format))
+                depth = resource.Texture;
+            else if (colorCount < RenderTargetPool::MAX_ATTACHMENTS - 1)
+                colors[colorCount++] = resource.Texture;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, backbuffer ? 0 : pool.Framebuffer(colors, colorCount, depth));
+        state.Viewport(0, 0, size.Width, size.Height);
+
+        // clears respect the write masks, which a previous pass may have left off
+        int colorIndex = 0;
+        for (const Attachment& write : pass.Writes)
+        {
+            GLenum format = resources[write.Resource].Desc.Format;
+            bool isDepth = RenderTargetPool::IsDepth(format);
+            int drawBuffer = isDepth ? 0 : colorIndex++;
+            if (!write.Clear)
+                continue;
+            if (isDepth)
+            {
+                state.DepthMask(true);
+                glClearBufferfv(GL_DEPTH, 0, &write.Value.x);
+            }
+            else if (RenderTargetPool::IsInteger(format))
+            {
+                const GLuint value[4] = { (GLuint)write.Value.x, (GLuint)write.Value.y, (GLuint)write.Value.z, (GLuint)write.Value.w };
+                state.ColorMask(true);
+                glClearBufferuiv(GL_COLOR, drawBuffer, value);
+            }
+            else
+            {
+                state.ColorMask(true);
+                glClearBufferfv(GL_COLOR, drawBuffer, glm::value_ptr(write.Value));
+            }
+        }
+    }
+
+    std::vector<Resource> resources;
+    std::vector<Pass> passes;
+};
+#endif
@@ -0,0 +1,910 @@
+#pragma once
+
+#ifndef GL_CAPTURE_H
+#define GL_CAPTURE_H
+
+#include <GL/glew.h>
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <unordered_map>
+
+#include "gltrace.h"
+#include "logger.h"
+
+// Records every GL call the renderer makes into a trace file (format in gltrace.h) that the replay tool can
+// run again without the app. Include this right after GLEW and before any other header that calls GL: each
+// GL entry point the renderer uses is redefined below as a macro that goes through a recording wrapper, so no
+// call site changes. While no capture is running a wrapper costs one branch.
+//
+// Buffer and texture contents are recorded with the calls that upload them. Persistently mapped memory (the
+// stream buffer) is written by the CPU without any GL call, so a shadow copy of each mapping is kept and the
+// bytes that changed are recorded as a MappedWrite in front of every draw.
+//
+// The recorder is not locked; GL calls come from whichever thread holds the context, one at a time.
+class GLCapture
+{
+public:
+    static GLCapture& Instance()
+    {
+        static GLCapture capture;
+        return capture;
+    }
+
+    // starts recording to path; call right after the context is created so no setup call is missed.
+    // Recording stops by itself after frames frames (see EndFrame)
+    bool Start(const char* path, int width, int height, int frames)
+    {
+        file = fopen(path, "wb");
+        if (!file)
+            return false;
+        setvbuf(file, nullptr, _IOFBF, 1 << 20);
+        GLTraceHeader header = { GL_TRACE_MAGIC, GL_TRACE_VERSION, (uint32_t)width, (uint32_t)height };
+        fwrite(&header, sizeof(header), 1, file);
+        frameLimit = frames;
+        framesCaptured = 0;
+        Active = true;
+        return true;
+    }
+
+    // closes the trace; true if everything was written
+    bool Stop()
+    {
+        if (!file)
+            return false;
+        Active = false;
+        bool ok = !ferror(file);
+        ok = fclose(file) == 0 && ok;
+        file = nullptr;
+        if (!ok)
+            LOG_ERROR("GLCapture: failed to write the trace");
+        mappings.clear();
+        boundBuffers.clear();
+        return ok;
+    }
+
+    void BeginFrame()
+    {
+        if (Active)
+            Op(OP_BeginFrame);
+    }
+
+    // true once the requested number of frames is in the trace; the trace is closed at that point
+    bool EndFrame()
+    {
+        if (!Active)
+            return false;
+        Op(OP_EndFrame);
+        if (++framesCaptured < frameLimit)
+            return false;
+        Stop();
+        return true;
+    }
+
+    int FramesCaptured() const { return framesCaptured; }
+
+    bool Active = false;
+
+    // ---- used by the wrappers ----
+
+    void Op(GLTraceOp op)
+    {
+        uint8_t b = op;
+        fwrite(&b, 1, 1, file);
+    }
+
+    // one overload per argument width; everything 32 bit and narrower is widened to 4 bytes
+    template <class T>
+    void Arg(T value)
+    {
+        if (sizeof(T) == 8)
+        {
+            uint64_t v = (uint64_t)value;
+            fwrite(&v, 8, 1, file);
+        }
+        else
+        {
+            uint32_t v = (uint32_t)value;
+            fwrite(&v, 4, 1, file);
+        }
+    }
+
+    void Arg(float value)
+    {
+        fwrite(&value, 4, 1, file);
+    }
+
+    void Arg(const void* pointer)
+    {
+        uint64_t v = (uint64_t)(uintptr_t)pointer;
+        fwrite(&v, 8, 1, file);
+    }
+
+    template <class T, class... Rest>
+    void Args(T first, Rest... rest)
+    {
+        Arg(first);
+        Args(rest...);
+    }
+
+    void Args() {}
+
+    void Data(const void* data, size_t size)
+    {
+        if (size)
+            fwrite(data, 1, size, file);
+    }
+
+    void Bind(GLenum target, GLuint buffer)
+    {
+        boundBuffers[target] = buffer;
+    }
+
+    GLuint Bound(GLenum target)
+    {
+        auto it = boundBuffers.find(target);
+        return it == boundBuffers.end() ? 0 : it->second;
+    }
+
+    // remembers a mapping and records its current contents, so the replay's copy starts out identical
+    void Map(GLuint buffer, void* pointer, GLsizeiptr length)
+    {
+        Mapping& mapping = mappings[buffer];
+        mapping.Pointer = (const char*)pointer;
+        mapping.Shadow.assign(mapping.Pointer, mapping.Pointer + length);
+        MappedWrite(buffer, 0, (size_t)length, mapping.Pointer);
+    }
+
+    void Unmap(GLuint buffer)
+    {
+        FlushMappedWrites();
+        mappings.erase(buffer);
+    }
+
+    // records the bytes written to mapped memory since the last call, as one span per mapping rounded out
+    // to whole pages so the comparison stays cheap
+    void FlushMappedWrites()
+    {
+        const size_t page = 4096;
+        for (auto& entry : mappings)
+        {
+            Mapping& mapping = entry.second;
+            size_t size = mapping.Shadow.size();
+            size_t first = size, last = 0;
+            for (size_t offset = 0; offset < size; offset += page)
+            {
+                size_t count = std::min(page, size - offset);
+                if (memcmp(mapping.Pointer + offset, mapping.Shadow.data() + offset, count) != 0)
+                {
+                    first = std::min(first, offset);
+                    last = offset + count;
+                }
+            }
+            if (first >= last)
+                continue;
+            memcpy(mapping.Shadow.data() + first, mapping.Pointer + first, last - first);
+            MappedWrite(entry.first, first, last - first, mapping.Shadow.data() + first);
+        }
+    }
+
+private:
+    struct Mapping
+    {
+        const char* Pointer;
+        std::vector<char> Shadow;
+    };
+
+    void MappedWrite(GLuint buffer, size_t offset, size_t size, const char* bytes)
+    {
+        Op(OP_MappedWrite);
+        Args(buffer, (uint64_t)offset, (uint64_t)size);
+        Data(bytes, size);
+    }
+
+    FILE* file = nullptr;
+    int frameLimit = 0;
+    int framesCaptured = 0;
+    std::unordered_map<GLenum, GLuint> boundBuffers;     // buffer bound to each target, to know what gets mapped
+    std::unordered_map<GLuint, Mapping> mappings;        // persistently mapped buffers by name
+};
+
+
+// Call straight through to the driver. These have to be defined while the gl* names still mean GLEW's
+// function pointers, before the macros below take them over.
+#define GL_CAPTURE_REAL(ret, name, params, args) inline ret real_##name params { return name args; }
+GL_CAPTURE_REAL(void, glActiveTexture, (GLenum texture), (texture))
+GL_CAPTURE_REAL(void, glAttachShader, (GLuint program, GLuint shader), (program, shader))
+GL_CAPTURE_REAL(void, glBeginQuery, (GLenum target, GLuint id), (target, id))
+GL_CAPTURE_REAL(void, glBindBuffer, (GLenum target, GLuint buffer), (target, buffer))
+GL_CAPTURE_REAL(void, glBindBufferBase, (GLenum target, GLuint index, GLuint buffer), (target, index, buffer))
+GL_CAPTURE_REAL(void, glBindTexture, (GLenum target, GLuint texture), (target, texture))
+GL_CAPTURE_REAL(void, glBindVertexArray, (GLuint array), (array))
+GL_CAPTURE_REAL(void, glBindVertexBuffer, (GLuint binding, GLuint buffer, GLintptr offset, GLsizei stride), (binding, buffer, offset, stride))
+GL_CAPTURE_REAL(void, glBlendFunc, (GLenum sfactor, GLenum dfactor), (sfactor, dfactor))
+GL_CAPTURE_REAL(void, glBufferData, (GLenum target, GLsizeiptr size, const void* data, GLenum usage), (target, size, data, usage))
+GL_CAPTURE_REAL(void, glBufferStorage, (GLenum target, GLsizeiptr size, const void* data, GLbitfield flags), (target, size, data, flags))
+GL_CAPTURE_REAL(void, glClear, (GLbitfield mask), (mask))
+GL_CAPTURE_REAL(void, glClearColor, (GLfloat r, GLfloat g, GLfloat b, GLfloat a), (r, g, b, a))
+GL_CAPTURE_REAL(GLenum, glClientWaitSync, (GLsync sync, GLbitfield flags, GLuint64 timeout), (sync, flags, timeout))
+GL_CAPTURE_REAL(void, glColorMask, (GLboolean r, GLboolean g, GLboolean b, GLboolean a), (r, g, b, a))
+GL_CAPTURE_REAL(void, glCompileShader, (GLuint shader), (shader))
+GL_CAPTURE_REAL(GLuint, glCreateProgram, (), ())
+GL_CAPTURE_REAL(GLuint, glCreateShader, (GLenum type), (type))
+GL_CAPTURE_REAL(void, glCullFace, (GLenum mode), (mode))
+GL_CAPTURE_REAL(void, glDeleteBuffers, (GLsizei n, const GLuint* buffers), (n, buffers))
+GL_CAPTURE_REAL(void, glDeleteProgram, (GLuint program), (program))
+GL_CAPTURE_REAL(void, glDeleteQueries, (GLsizei n, const GLuint* ids), (n, ids))
+GL_CAPTURE_REAL(void, glDeleteSync, (GLsync sync), (sync))
+GL_CAPTURE_REAL(void, glDeleteVertexArrays, (GLsizei n, const GLuint* arrays), (n, arrays))
+GL_CAPTURE_REAL(void, glDepthFunc, (GLenum func), (func))
+GL_CAPTURE_REAL(void, glDepthMask, (GLboolean flag), (flag))
+GL_CAPTURE_REAL(void, glDisable, (GLenum cap), (cap))
+GL_CAPTURE_REAL(void, glDrawArrays, (GLenum mode, GLint first, GLsizei count), (mode, first, count))
+GL_CAPTURE_REAL(void, glDrawElements, (GLenum mode, GLsizei count, GLenum type, const void* indices), (mode, count, type, indices))
+GL_CAPTURE_REAL(void, glEnable, (GLenum cap), (cap))
+GL_CAPTURE_REAL(void, glEnableVertexAttribArray, (GLuint index), (index))
+GL_CAPTURE_REAL(void, glEndQuery, (GLenum target), (target))
+GL_CAPTURE_REAL(GLsync, glFenceSync, (GLenum condition, GLbitfield flags), (condition, flags))
+GL_CAPTURE_REAL(void, glGenBuffers, (GLsizei n, GLuint* buffers), (n, buffers))
+GL_CAPTURE_REAL(void, glGenerateMipmap, (GLenum target), (target))
+GL_CAPTURE_REAL(void, glGenQueries, (GLsizei n, GLuint* ids), (n, ids))
+GL_CAPTURE_REAL(void, glGenTextures, (GLsizei n, GLuint* textures), (n, textures))
+GL_CAPTURE_REAL(void, glGenVertexArrays, (GLsizei n, GLuint* arrays), (n, arrays))
+GL_CAPTURE_REAL(void, glGetInteger64v, (GLenum pname, GLint64* data), (pname, data))
+GL_CAPTURE_REAL(void, glGetProgramInfoLog, (GLuint program, GLsizei bufSize, GLsizei* length, GLchar* infoLog), (program, bufSize, length, infoLog))
+GL_CAPTURE_REAL(void, glGetProgramiv, (GLuint program, GLenum pname, GLint* params), (program, pname, params))
+GL_CAPTURE_REAL(void, glGetQueryObjectiv, (GLuint id, GLenum pname, GLint* params), (id, pname, params))
+GL_CAPTURE_REAL(void, glGetQueryObjectui64v, (GLuint id, GLenum pname, GLuint64* params), (id, pname, params))
+GL_CAPTURE_REAL(void, glGetQueryObjectuiv, (GLuint id, GLenum pname, GLuint* params), (id, pname, params))
+GL_CAPTURE_REAL(void, glGetShaderInfoLog, (GLuint shader, GLsizei bufSize, GLsizei* length, GLchar* infoLog), (shader, bufSize, length, infoLog))
+GL_CAPTURE_REAL(void, glGetShaderiv, (GLuint shader, GLenum pname, GLint* params), (shader, pname, params))
+GL_CAPTURE_REAL(GLint, glGetUniformLocation, (GLuint program, const GLchar* name), (program, name))
+GL_CAPTURE_REAL(void, glLinkProgram, (GLuint program), (program))
+GL_CAPTURE_REAL(void*, glMapBufferRange, (GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access), (target, offset, length, access))
+GL_CAPTURE_REAL(void, glQueryCounter, (GLuint id, GLenum target), (id, target))
+GL_CAPTURE_REAL(void, glShaderSource, (GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length), (shader, count, string, length))
+GL_CAPTURE_REAL(void, glTexImage2D, (GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels), (target, level, internalformat, width, height, border, format, type, pixels))
+GL_CAPTURE_REAL(void, glTexParameteri, (GLenum target, GLenum pname, GLint param), (target, pname, param))
+GL_CAPTURE_REAL(void, glUniform1f, (GLint location, GLfloat v0), (location, v0))
+GL_CAPTURE_REAL(void, glUniform1i, (GLint location, GLint v0), (location, v0))
+GL_CAPTURE_REAL(void, glUniform2fv, (GLint location, GLsizei count, const GLfloat* value), (location, count, value))
+GL_CAPTURE_REAL(void, glUniform3f, (GLint location, GLfloat v0, GLfloat v1, GLfloat v2), (location, v0, v1, v2))
+GL_CAPTURE_REAL(void, glUniformMatrix4fv, (GLint location, GLsizei count, GLboolean transpose, const GLfloat* value), (location, count, transpose, value))
+GL_CAPTURE_REAL(GLboolean, glUnmapBuffer, (GLenum target), (target))
+GL_CAPTURE_REAL(void, glUseProgram, (GLuint program), (program))
+GL_CAPTURE_REAL(void, glVertexAttribBinding, (GLuint attribindex, GLuint bindingindex), (attribindex, bindingindex))
+GL_CAPTURE_REAL(void, glVertexAttribFormat, (GLuint attribindex, GLint size, GLenum type, GLboolean normalized, GLuint relativeoffset), (attribindex, size, type, normalized, relativeoffset))
+GL_CAPTURE_REAL(void, glVertexAttribPointer, (GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer), (index, size, type, normalized, stride, pointer))
+GL_CAPTURE_REAL(void, glViewport, (GLint x, GLint y, GLsizei width, GLsizei height), (x, y, width, height))
+GL_CAPTURE_REAL(void, glBindFramebuffer, (GLenum target, GLuint framebuffer), (target, framebuffer))
+GL_CAPTURE_REAL(GLenum, glCheckFramebufferStatus, (GLenum target), (target))
+GL_CAPTURE_REAL(void, glDeleteFramebuffers, (GLsizei n, const GLuint* framebuffers), (n, framebuffers))
+GL_CAPTURE_REAL(void, glDeleteTextures, (GLsizei n, const GLuint* textures), (n, textures))
+GL_CAPTURE_REAL(void, glFramebufferTexture2D, (GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level), (target, attachment, textarget, texture, level))
+GL_CAPTURE_REAL(void, glGenFramebuffers, (GLsizei n, GLuint* framebuffers), (n, framebuffers))
+GL_CAPTURE_REAL(void, glReadPixels, (GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, void* pixels), (x, y, width, height, format, type, pixels))
+GL_CAPTURE_REAL(void, glClearBufferuiv, (GLenum buffer, GLint drawbuffer, const GLuint* value), (buffer, drawbuffer, value))
+GL_CAPTURE_REAL(void, glDrawBuffers, (GLsizei n, const GLenum* bufs), (n, bufs))
+GL_CAPTURE_REAL(void, glReadBuffer, (GLenum src), (src))
+GL_CAPTURE_REAL(void, glUniform1ui, (GLint location, GLuint v0), (location, v0))
+GL_CAPTURE_REAL(void, glClearBufferfv, (GLenum buffer, GLint drawbuffer, const GLfloat* value), (buffer, drawbuffer, value))
+GL_CAPTURE_REAL(void, glBeginConditionalRender, (GLuint id, GLenum mode), (id, mode))
+GL_CAPTURE_REAL(void, glEndConditionalRender, (), ())
+GL_CAPTURE_REAL(void, glTexImage3D, (GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLsizei depth, GLint border, GLenum format, GLenum type, const void* pixels), (target, level, internalformat, width, height, depth, border, format, type, pixels))
+GL_CAPTURE_REAL(void, glUniform2f, (GLint location, GLfloat v0, GLfloat v1), (location, v0, v1))
+GL_CAPTURE_REAL(void, glTexSubImage3D, (GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint zoffset, GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, const void* pixels), (target, level, xoffset, yoffset, zoffset, width, height, depth, format, type, pixels))
+GL_CAPTURE_REAL(void, glDispatchCompute, (GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z), (num_groups_x, num_groups_y, num_groups_z))
+GL_CAPTURE_REAL(void, glBindImageTexture, (GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format), (unit, texture, level, layered, layer, access, format))
+GL_CAPTURE_REAL(void, glMemoryBarrier, (GLbitfield barriers), (barriers))
+GL_CAPTURE_REAL(void, glUniform4fv, (GLint location, GLsizei count, const GLfloat* value), (location, count, value))
+GL_CAPTURE_REAL(void, glTexSubImage2D, (GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const void* pixels), (target, level, xoffset, yoffset, width, height, format, type, pixels))
+GL_CAPTURE_REAL(void, glGetTexImage, (GLenum target, GLint level, GLenum format, GLenum type, void* pixels), (target, level, format, type, pixels))
+GL_CAPTURE_REAL(void, glCopyImageSubData, (GLuint srcName, GLenum srcTarget, GLint srcLevel, GLint srcX, GLint srcY, GLint srcZ, GLuint dstName, GLenum dstTarget, GLint dstLevel, GLint dstX, GLint dstY, GLint dstZ, GLsizei srcWidth, GLsizei srcHeight, GLsizei srcDepth), (srcName, srcTarget, srcLevel, srcX, srcY, srcZ, dstName, dstTarget, dstLevel, dstX, dstY, dstZ, srcWidth, srcHeight, srcDepth))
+#undef GL_CAPTURE_REAL
+
+
+// Recording wrappers. Most calls are recorded as their plain arguments; the rest need the data behind a
+// pointer or the value the driver returned.
+// calls whose arguments are all plain values
+#define GL_CAPTURE_PLAIN(name, params, args) \
+    inline void capture_##name params \
+    { \
+        GLCapture& c = GLCapture::Instance(); \
+        if (c.Active) { c.Op(OP_##name); c.Args args; } \
+        real_##name args; \
+    }
+GL_CAPTURE_PLAIN(glActiveTexture, (GLenum texture), (texture))
+GL_CAPTURE_PLAIN(glAttachShader, (GLuint program, GLuint shader), (program, shader))
+GL_CAPTURE_PLAIN(glBeginQuery, (GLenum target, GLuint id), (target, id))
+GL_CAPTURE_PLAIN(glBindBufferBase, (GLenum target, GLuint index, GLuint buffer), (target, index, buffer))
+GL_CAPTURE_PLAIN(glBindTexture, (GLenum target, GLuint texture), (target, texture))
+GL_CAPTURE_PLAIN(glBindVertexArray, (GLuint array), (array))
+GL_CAPTURE_PLAIN(glBindVertexBuffer, (GLuint binding, GLuint buffer, GLintptr offset, GLsizei stride), (binding, buffer, offset, stride))
+GL_CAPTURE_PLAIN(glBlendFunc, (GLenum sfactor, GLenum dfactor), (sfactor, dfactor))
+GL_CAPTURE_PLAIN(glClear, (GLbitfield mask), (mask))
+GL_CAPTURE_PLAIN(glClearColor, (GLfloat r, GLfloat g, GLfloat b, GLfloat a), (r, g, b, a))
+GL_CAPTURE_PLAIN(glColorMask, (GLboolean r, GLboolean g, GLboolean b, GLboolean a), (r, g, b, a))
+GL_CAPTURE_PLAIN(glCompileShader, (GLuint shader), (shader))
+GL_CAPTURE_PLAIN(glCullFace, (GLenum mode), (mode))
+GL_CAPTURE_PLAIN(glDeleteProgram, (GLuint program), (program))
+GL_CAPTURE_PLAIN(glDepthFunc, (GLenum func), (func))
+GL_CAPTURE_PLAIN(glDepthMask, (GLboolean flag), (flag))
+GL_CAPTURE_PLAIN(glDisable, (GLenum cap), (cap))
+GL_CAPTURE_PLAIN(glEnable, (GLenum cap), (cap))
+GL_CAPTURE_PLAIN(glEnableVertexAttribArray, (GLuint index), (index))
+GL_CAPTURE_PLAIN(glEndQuery, (GLenum target), (target))
+GL_CAPTURE_PLAIN(glGenerateMipmap, (GLenum target), (target))
+GL_CAPTURE_PLAIN(glLinkProgram, (GLuint program), (program))
+GL_CAPTURE_PLAIN(glQueryCounter, (GLuint id, GLenum target), (id, target))
+GL_CAPTURE_PLAIN(glTexParameteri, (GLenum target, GLenum pname, GLint param), (target, pname, param))
+GL_CAPTURE_PLAIN(glUniform1f, (GLint location, GLfloat v0), (location, v0))
+GL_CAPTURE_PLAIN(glUniform1i, (GLint location, GLint v0), (location, v0))
+GL_CAPTURE_PLAIN(glUniform3f, (GLint location, GLfloat v0, GLfloat v1, GLfloat v2), (location, v0, v1, v2))
+GL_CAPTURE_PLAIN(glUseProgram, (GLuint program), (program))
+GL_CAPTURE_PLAIN(glVertexAttribBinding, (GLuint attribindex, GLuint bindingindex), (attribindex, bindingindex))
+GL_CAPTURE_PLAIN(glVertexAttribFormat, (GLuint attribindex, GLint size, GLenum type, GLboolean normalized, GLuint relativeoffset), (attribindex, size, type, normalized, relativeoffset))
+GL_CAPTURE_PLAIN(glVertexAttribPointer, (GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer), (index, size, type, normalized, stride, pointer))
+GL_CAPTURE_PLAIN(glViewport, (GLint x, GLint y, GLsizei width, GLsizei height), (x, y, width, height))
+GL_CAPTURE_PLAIN(glBindFramebuffer, (GLenum target, GLuint framebuffer), (target, framebuffer))
+GL_CAPTURE_PLAIN(glFramebufferTexture2D, (GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level), (target, attachment, textarget, texture, level))
+GL_CAPTURE_PLAIN(glReadBuffer, (GLenum src), (src))
+GL_CAPTURE_PLAIN(glUniform1ui, (GLint location, GLuint v0), (location, v0))
+GL_CAPTURE_PLAIN(glBeginConditionalRender, (GLuint id, GLenum mode), (id, mode))
+GL_CAPTURE_PLAIN(glEndConditionalRender, (), ())
+GL_CAPTURE_PLAIN(glUniform2f, (GLint location, GLfloat v0, GLfloat v1), (location, v0, v1))
+GL_CAPTURE_PLAIN(glDispatchCompute, (GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z), (num_groups_x, num_groups_y, num_groups_z))
+GL_CAPTURE_PLAIN(glBindImageTexture, (GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format), (unit, texture, level, layered, layer, access, format))
+GL_CAPTURE_PLAIN(glMemoryBarrier, (GLbitfield barriers), (barriers))
+GL_CAPTURE_PLAIN(glCopyImageSubData, (GLuint srcName, GLenum srcTarget, GLint srcLevel, GLint srcX, GLint srcY, GLint srcZ, GLuint dstName, GLenum dstTarget, GLint dstLevel, GLint dstX, GLint dstY, GLint dstZ, GLsizei srcWidth, GLsizei srcHeight, GLsizei srcDepth), (srcName, srcTarget, srcLevel, srcX, srcY, srcZ, dstName, dstTarget, dstLevel, dstX, dstY, dstZ, srcWidth, srcHeight, srcDepth))
+#undef GL_CAPTURE_PLAIN
+
+// queries: the call is recorded so the replay pays for it too, the result is not
+#define GL_CAPTURE_QUERY(name, params, recorded, args) \
+    inline void capture_##name params \
+    { \
+        GLCapture& c = GLCapture::Instance(); \
+        if (c.Active) { c.Op(OP_##name); c.Args recorded; } \
+        real_##name args; \
+    }
+GL_CAPTURE_QUERY(glGetInteger64v, (GLenum pname, GLint64* data), (pname), (pname, data))
+GL_CAPTURE_QUERY(glGetProgramInfoLog, (GLuint program, GLsizei bufSize, GLsizei* length, GLchar* infoLog), (program, bufSize), (program, bufSize, length, infoLog))
+GL_CAPTURE_QUERY(glGetProgramiv, (GLuint program, GLenum pname, GLint* params), (program, pname), (program, pname, params))
+GL_CAPTURE_QUERY(glGetQueryObjectiv, (GLuint id, GLenum pname, GLint* params), (id, pname), (id, pname, params))
+GL_CAPTURE_QUERY(glGetQueryObjectui64v, (GLuint id, GLenum pname, GLuint64* params), (id, pname), (id, pname, params))
+GL_CAPTURE_QUERY(glGetQueryObjectuiv, (GLuint id, GLenum pname, GLuint* params), (id, pname), (id, pname, params))
+GL_CAPTURE_QUERY(glGetShaderInfoLog, (GLuint shader, GLsizei bufSize, GLsizei* length, GLchar* infoLog), (shader, bufSize), (shader, bufSize, length, infoLog))
+GL_CAPTURE_QUERY(glGetShaderiv, (GLuint shader, GLenum pname, GLint* params), (shader, pname), (shader, pname, params))
+#undef GL_CAPTURE_QUERY
+
+// glGen*: the names are recorded after the driver picked them
+#define GL_CAPTURE_GEN(name) \
+    inline void capture_##name(GLsizei n, GLuint* names) \
+    { \
+        real_##name(n, names); \
+        GLCapture& c = GLCapture::Instance(); \
+        if (c.Active) { c.Op(OP_##name); c.Arg(n); c.Data(names, sizeof(GLuint) * n); } \
+    }
+GL_CAPTURE_GEN(glGenBuffers)
+GL_CAPTURE_GEN(glGenQueries)
+GL_CAPTURE_GEN(glGenTextures)
+GL_CAPTURE_GEN(glGenVertexArrays)
+GL_CAPTURE_GEN(glGenFramebuffers)
+#undef GL_CAPTURE_GEN
+
+#define GL_CAPTURE_DELETE(name) \
+    inline void capture_##name(GLsizei n, const GLuint* names) \
+    { \
+        GLCapture& c = GLCapture::Instance(); \
+        if (c.Active) { c.Op(OP_##name); c.Arg(n); c.Data(names, sizeof(GLuint) * n); } \
+        real_##name(n, names); \
+    }
+GL_CAPTURE_DELETE(glDeleteBuffers)
+GL_CAPTURE_DELETE(glDeleteQueries)
+GL_CAPTURE_DELETE(glDeleteVertexArrays)
+GL_CAPTURE_DELETE(glDeleteFramebuffers)
+GL_CAPTURE_DELETE(glDeleteTextures)
+#undef GL_CAPTURE_DELETE
+
+inline void capture_glBindBuffer(GLenum target, GLuint buffer)
+{
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active)
+    {
+        c.Op(OP_glBindBuffer);
+        c.Args(target, buffer);
+        c.Bind(target, buffer);
+    }
+    real_glBindBuffer(target, buffer);
+}
+
+inline void capture_glBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+{
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active)
+    {
+        c.Op(OP_glBufferData);
+        c.Args(target, (uint64_t)size, (uint32_t)(data != nullptr), usage);
+        if (data)
+            c.Data(data, (size_t)size);
+    }
+    real_glBufferData(target, size, data, usage);
+}
+
+inline void capture_glBufferStorage(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags)
+{
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active)
+    {
+        c.Op(OP_glBufferStorage);
+        c.Args(target, (uint64_t)size, (uint32_t)(data != nullptr), flags);
+        if (data)
+            c.Data(data, (size_t)size);
+    }
+    real_glBufferStorage(target, size, data, flags);
+}
+
+inline void* capture_glMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access)
+{
+    void* pointer = real_glMapBufferRange(target, offset, length, access);
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active && pointer)
+    {
+        // the buffer name goes with it so MappedWrite can refer to the mapping
+        GLuint buffer = c.Bound(target);
+        c.Op(OP_glMapBufferRange);
+        c.Args(target, (uint64_t)offset, (uint64_t)length, access, buffer);
+        if (access & GL_MAP_WRITE_BIT)
+            c.Map(buffer, pointer, length);
+    }
+    return pointer;
+}
+
+inline GLboolean capture_glUnmapBuffer(GLenum target)
+{
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active)
+    {
+        GLuint buffer = c.Bound(target);
+        c.Unmap(buffer);
+        c.Op(OP_glUnmapBuffer);
+        c.Args(target, buffer);
+    }
+    return real_glUnmapBuffer(target);
+}
+
+inline void capture_glDrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active)
+    {
+        c.FlushMappedWrites();
+        c.Op(OP_glDrawArrays);
+        c.Args(mode, first, count);
+    }
+    real_glDrawArrays(mode, first, count);
+}
+
+inline void capture_glDrawElements(GLenum mode, GLsizei count, GLenum type, const void* indices)
+{
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active)
+    {
+        c.FlushMappedWrites();
+        c.Op(OP_glDrawElements);
+        c.Args(mode, count, type, indices);
+    }
+    real_glDrawElements(mode, count, type, indices);
+}
+
+inline GLenum capture_glCheckFramebufferStatus(GLenum target)
+{
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active) { c.Op(OP_glCheckFramebufferStatus); c.Arg(target); }
+    return real_glCheckFramebufferStatus(target);
+}
+
+// color clears take four values, depth and stencil one
+inline void capture_glClearBufferuiv(GLenum buffer, GLint drawbuffer, const GLuint* value)
+{
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active)
+    {
+        c.Op(OP_glClearBufferuiv);
+        c.Args(buffer, drawbuffer);
+        c.Data(value, sizeof(GLuint) * (buffer == GL_COLOR ? 4 : 1));
+    }
+    real_glClearBufferuiv(buffer, drawbuffer, value);
+}
+
+inline void capture_glClearBufferfv(GLenum buffer, GLint drawbuffer, const GLfloat* value)
+{
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active)
+    {
+        c.Op(OP_glClearBufferfv);
+        c.Args(buffer, drawbuffer);
+        c.Data(value, sizeof(GLfloat) * (buffer == GL_COLOR ? 4 : 1));
+    }
+    real_glClearBufferfv(buffer, drawbuffer, value);
+}
+
+inline void capture_glDrawBuffers(GLsizei n, const GLenum* bufs)
+{
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active)
+    {
+        c.Op(OP_glDrawBuffers);
+        c.Arg(n);
+        c.Data(bufs, sizeof(GLenum) * n);
+    }
+    real_glDrawBuffers(n, bufs);
+}
+
+// only reads into a pixel pack buffer are supported, so pixels is an offset into it
+inline void capture_glReadPixels(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, void* pixels)
+{
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active)
+    {
+        c.Op(OP_glReadPixels);
+        c.Args(x, y, width, height, format, type, (uint64_t)(uintptr_t)pixels);
+    }
+    real_glReadPixels(x, y, width, height, format, type, pixels);
+}
+
+inline GLuint capture_glCreateProgram()
+{
+    GLuint program = real_glCreateProgram();
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active) { c.Op(OP_glCreateProgram); c.Arg(program); }
+    return program;
+}
+
+inline GLuint capture_glCreateShader(GLenum type)
+{
+    GLuint shader = real_glCreateShader(type);
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active) { c.Op(OP_glCreateShader); c.Args(type, shader); }
+    return shader;
+}
+
+// the strings are joined and recorded as one source of known length
+inline void capture_glShaderSource(GLuint shader, GLsizei count, const GLchar* const* string, const GLint* length)
+{
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active)
+    {
+        std::string source;
+        for (GLsizei i = 0; i < count; ++i)
+        {
+            if (length && length[i] >= 0)
+                source.append(string[i], length[i]);
+            else
+                source.append(string[i]);
+        }
+        c.Op(OP_glShaderSource);
+        c.Args(shader, (uint32_t)source.size());
+        c.Data(source.data(), source.size());
+    }
+    real_glShaderSource(shader, count, string, length);
+}
+
+inline GLint capture_glGetUniformLocation(GLuint program, const GLchar* name)
+{
+    GLint location = real_glGetUniformLocation(program, name);
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active)
+    {
+        uint32_t size = (uint32_t)strlen(name);
+        c.Op(OP_glGetUniformLocation);
+        c.Args(program, location, size);
+        c.Data(name, size);
+    }
+    return location;
+}
+
+inline void capture_glUniform2fv(GLint location, GLsizei count, const GLfloat* value)
+{
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active)
+    {
+        c.Op(OP_glUniform2fv);
+        c.Args(location, count);
+        c.Data(value, sizeof(GLfloat) * 2 * count);
+    }
+    real_glUniform2fv(location, count, value);
+}
+
+inline void capture_glUniform4fv(GLint location, GLsizei count, const GLfloat* value)
+{
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active)
+    {
+        c.Op(OP_glUniform4fv);
+        c.Args(location, count);
+        c.Data(value, sizeof(GLfloat) * 4 * count);
+    }
+    real_glUniform4fv(location, count, value);
+}
+
+inline void capture_glUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value)
+{
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active)
+    {
+        c.Op(OP_glUniformMatrix4fv);
+        c.Args(location, count, transpose);
+        c.Data(value, sizeof(GLfloat) * 16 * count);
+    }
+    real_glUniformMatrix4fv(location, count, transpose, value);
+}
+
+inline void capture_glTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels)
+{
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active)
+    {
+        uint64_t size = pixels ? GLTraceImageSize(format, type, width, height) : 0;
+        c.Op(OP_glTexImage2D);
+        c.Args(target, level, internalformat, width, height, border, format, type, size);
+        c.Data(pixels, (size_t)size);
+    }
+    real_glTexImage2D(target, level, internalformat, width, height, border, format, type, pixels);
+}
+
+inline void capture_glTexImage3D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLsizei depth, GLint border, GLenum format, GLenum type, const void* pixels)
+{
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active)
+    {
+        uint64_t size = pixels ? GLTraceVolumeSize(format, type, width, height, depth) : 0;
+        c.Op(OP_glTexImage3D);
+        c.Args(target, level, internalformat, width, height, depth, border, format, type, size);
+        c.Data(pixels, (size_t)size);
+    }
+    real_glTexImage3D(target, level, internalformat, width, height, depth, border, format, type, pixels);
+}
+
+inline void capture_glTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const void* pixels)
+{
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active)
+    {
+        uint64_t size = GLTraceImageSize(format, type, width, height);
+        c.Op(OP_glTexSubImage2D);
+        c.Args(target, level, xoffset, yoffset, width, height, format, type, size);
+        c.Data(pixels, (size_t)size);
+    }
+    real_glTexSubImage2D(target, level, xoffset, yoffset, width, height, format, type, pixels);
+}
+
+// reads into client memory, which the trace doesn't keep; the replay reads the level into scratch memory
+inline void capture_glGetTexImage(GLenum target, GLint level, GLenum format, GLenum type, void* pixels)
+{
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active)
+    {
+        c.Op(OP_glGetTexImage);
+        c.Args(target, level, format, type);
+    }
+    real_glGetTexImage(target, level, format, type, pixels);
+}
+
+inline void capture_glTexSubImage3D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint zoffset, GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, const void* pixels)
+{
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active)
+    {
+        uint64_t size = GLTraceVolumeSize(format, type, width, height, depth);
+        c.Op(OP_glTexSubImage3D);
+        c.Args(target, level, xoffset, yoffset, zoffset, width, height, depth, format, type, size);
+        c.Data(pixels, (size_t)size);
+    }
+    real_glTexSubImage3D(target, level, xoffset, yoffset, zoffset, width, height, depth, format, type, pixels);
+}
+
+inline GLsync capture_glFenceSync(GLenum condition, GLbitfield flags)
+{
+    GLsync sync = real_glFenceSync(condition, flags);
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active) { c.Op(OP_glFenceSync); c.Args(condition, flags, (const void*)sync); }
+    return sync;
+}
+
+inline GLenum capture_glClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout)
+{
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active) { c.Op(OP_glClientWaitSync); c.Args((const void*)sync, flags, timeout); }
+    return real_glClientWaitSync(sync, flags, timeout);
+}
+
+inline void capture_glDeleteSync(GLsync sync)
+{
+    GLCapture& c = GLCapture::Instance();
+    if (c.Active) { c.Op(OP_glDeleteSync); c.Arg((const void*)sync); }
+    real_glDeleteSync(sync);
+}
+
+
+// Route the renderer's calls through the wrappers. Most of these are GLEW macros for its function pointers;
+// the real_ functions above were compiled against them.
+#undef glActiveTexture
+#define glActiveTexture capture_glActiveTexture
+#undef glAttachShader
+#define glAttachShader capture_glAttachShader
+#undef glBeginQuery
+#define glBeginQuery capture_glBeginQuery
+#undef glBindBuffer
+#define glBindBuffer capture_glBindBuffer
+#undef glBindBufferBase
+#define glBindBufferBase capture_glBindBufferBase
+#undef glBindTexture
+#define glBindTexture capture_glBindTexture
+#undef glBindVertexArray
+#define glBindVertexArray capture_glBindVertexArray
+#undef glBindVertexBuffer
+#define glBindVertexBuffer capture_glBindVertexBuffer
+#undef glBlendFunc
+#define glBlendFunc capture_glBlendFunc
+#undef glBufferData
+#define glBufferData capture_glBufferData
+#undef glBufferStorage
+#define glBufferStorage capture_glBufferStorage
+#undef glClear
+#define glClear capture_glClear
+#undef glClearColor
+#define glClearColor capture_glClearColor
+#undef glClientWaitSync
+#define glClientWaitSync capture_glClientWaitSync
+#undef glColorMask
+#define glColorMask capture_glColorMask
+#undef glCompileShader
+#define glCompileShader capture_glCompileShader
+#undef glCreateProgram
+#define glCreateProgram capture_glCreateProgram
+#undef glCreateShader
+#define glCreateShader capture_glCreateShader
+#undef glCullFace
+#define glCullFace capture_glCullFace
+#undef glDeleteBuffers
+#define glDeleteBuffers capture_glDeleteBuffers
+#undef glDeleteProgram
+#define glDeleteProgram capture_glDeleteProgram
+#undef glDeleteQueries
+#define glDeleteQueries capture_glDeleteQueries
+#undef glDeleteSync
+#define glDeleteSync capture_glDeleteSync
+#undef glDeleteVertexArrays
+#define glDeleteVertexArrays capture_glDeleteVertexArrays
+#undef glDepthFunc
+#define glDepthFunc capture_glDepthFunc
+#undef glDepthMask
+#define glDepthMask capture_glDepthMask
+#undef glDisable
+#define glDisable capture_glDisable
+#undef glDrawArrays
+#define glDrawArrays capture_glDrawArrays
+#undef glDrawElements
+#define glDrawElements capture_glDrawElements
+#undef glEnable
+#define glEnable capture_glEnable
+#undef glEnableVertexAttribArray
+#define glEnableVertexAttribArray capture_glEnableVertexAttribArray
+#undef glEndQuery
+#define glEndQuery capture_glEndQuery
+#undef glFenceSync
+#define glFenceSync capture_glFenceSync
+#undef glGenBuffers
+#define glGenBuffers capture_glGenBuffers
+#undef glGenerateMipmap
+#define glGenerateMipmap capture_glGenerateMipmap
+#undef glGenQueries
+#define glGenQueries capture_glGenQueries
+#undef glGenTextures
+#define glGenTextures capture_glGenTextures
+#undef glGenVertexArrays
+#define glGenVertexArrays capture_glGenVertexArrays
+#undef glGetInteger64v
+#define glGetInteger64v capture_glGetInteger64v
+#undef glGetProgramInfoLog
+#define glGetProgramInfoLog capture_glGetProgramInfoLog
+#undef glGetProgramiv
+#define glGetProgramiv capture_glGetProgramiv
+#undef glGetQueryObjectiv
+#define glGetQueryObjectiv capture_glGetQueryObjectiv
+#undef glGetQueryObjectui64v
+#define glGetQueryObjectui64v capture_glGetQueryObjectui64v
+#undef glGetQueryObjectuiv
+#define glGetQueryObjectuiv capture_glGetQueryObjectuiv
+#undef glGetShaderInfoLog
+#define glGetShaderInfoLog capture_glGetShaderInfoLog
+#undef glGetShaderiv
+#define glGetShaderiv capture_glGetShaderiv
+#undef glGetUniformLocation
+#define glGetUniformLocation capture_glGetUniformLocation
+#undef glLinkProgram
+#define glLinkProgram capture_glLinkProgram
+#undef glMapBufferRange
+#define glMapBufferRange capture_glMapBufferRange
+#undef glQueryCounter
+#define glQueryCounter capture_glQueryCounter
+#undef glShaderSource
+#define glShaderSource capture_glShaderSource
+#undef glTexImage2D
+#define glTexImage2D capture_glTexImage2D
+#undef glTexParameteri
+#define glTexParameteri capture_glTexParameteri
+#undef glUniform1f
+#define glUniform1f capture_glUniform1f
+#undef glUniform1i
+#define glUniform1i capture_glUniform1i
+#undef glUniform2fv
+#define glUniform2fv capture_glUniform2fv
+#undef glUniform3f
+#define glUniform3f capture_glUniform3f
+#undef glUniformMatrix4fv
+#define glUniformMatrix4fv capture_glUniformMatrix4fv
+#undef glUnmapBuffer
+#define glUnmapBuffer capture_glUnmapBuffer
+#undef glUseProgram
+#define glUseProgram capture_glUseProgram
+#undef glVertexAttribBinding
+#define glVertexAttribBinding capture_glVertexAttribBinding
+#undef glVertexAttribFormat
+#define glVertexAttribFormat capture_glVertexAttribFormat
+#undef glVertexAttribPointer
+#define glVertexAttribPointer capture_glVertexAttribPointer
+#undef glViewport
+#define glViewport capture_glViewport
+#undef glBindFramebuffer
+#define glBindFramebuffer capture_glBindFramebuffer
+#undef glCheckFramebufferStatus
+#define glCheckFramebufferStatus capture_glCheckFramebufferStatus
+#undef glDeleteFramebuffers
+#define glDeleteFramebuffers capture_glDeleteFramebuffers
+#undef glDeleteTextures
+#define glDeleteTextures capture_glDeleteTextures
+#undef glFramebufferTexture2D
+#define glFramebufferTexture2D capture_glFramebufferTexture2D
+#undef glGenFramebuffers
+#define glGenFramebuffers capture_glGenFramebuffers
+#undef glReadPixels
+#define glReadPixels capture_glReadPixels
+#undef glClearBufferuiv
+#define glClearBufferuiv capture_glClearBufferuiv
+#undef glDrawBuffers
+#define glDrawBuffers capture_glDrawBuffers
+#undef glReadBuffer
+#define glReadBuffer capture_glReadBuffer
+#undef glUniform1ui
+#define glUniform1ui capture_glUniform1ui
+#undef glClearBufferfv
+#define glClearBufferfv capture_glClearBufferfv
+#undef glBeginConditionalRender
+#define glBeginConditionalRender capture_glBeginConditionalRender
+#undef glEndConditionalRender
+#define glEndConditionalRender capture_glEndConditionalRender
+#undef glTexImage3D
+#define glTexImage3D capture_glTexImage3D
+#undef glTexSubImage3D
+#define glTexSubImage3D capture_glTexSubImage3D
+#undef glUniform2f
+#define glUniform2f capture_glUniform2f
+#undef glDispatchCompute
+#define glDispatchCompute capture_glDispatchCompute
+#undef glBindImageTexture
+#define glBindImageTexture capture_glBindImageTexture
+#undef glMemoryBarrier
+#define glMemoryBarrier capture_glMemoryBarrier
+#undef glUniform4fv
+#define glUniform4fv capture_glUniform4fv
+#undef glTexSubImage2D
+#define glTexSubImage2D capture_glTexSubImage2D
+#undef glGetTexImage
+#define glGetTexImage capture_glGetTexImage
+#undef glCopyImageSubData
+#define glCopyImageSubData capture_glCopyImageSubData
+#endif
@@ -0,0 +1,228 @@
+#pragma once
+
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <GL/glew.h>
+
+#include "logger.h"
+
+// Thin tracker of the OpenGL state the renderer touches. Every call compares against the last value set and
+// only reaches the driver when something actually changes. All render code should go through it, because a
+// change made behind its back leaves the cached value stale (call Invalidate if that can't be avoided).
+class GLState
+{
+public:
+    static const int MAX_TEXTURE_UNITS = 16;
+    static const int MAX_UNIFORM_BUFFERS = 16;
+
+    GLState()
+    {
+        Invalidate();
+    }
+
+    void UseProgram(GLuint program)
+    {
+        if (program == currentProgram) { skip(); return; }
+        glUseProgram(program);
+        currentProgram = program;
+        ++Issued;
+    }
+
+    void BindVertexArray(GLuint vao)
+    {
+        if (vao == currentVAO) { skip(); return; }
+        glBindVertexArray(vao);
+        currentVAO = vao;
+        ++Issued;
+    }
+
+    // binds texture to target on the given unit, switching the active unit only when needed
+    void BindTexture(GLuint unit, GLenum target, GLuint texture)
+    {
+        if (unit >= MAX_TEXTURE_UNITS)
+            return;
+        if (textures[unit] == texture && textureTargets[unit] == target) { skip(); return; }
+        ActiveTexture(unit);
+        glBindTexture(target, texture);
+        textures[unit] = texture;
+        textureTargets[unit] = target;
+        ++Issued;
+    }
+
+    void BindUniformBuffer(GLuint index, GLuint buffer)
+    {
+        if (index >= MAX_UNIFORM_BUFFERS)
+            return;
+        if (uniformBuffers[index] == buffer) { skip(); return; }
+        glBindBufferBase(GL_UNIFORM_BUFFER, index, buffer);
+        uniformBuffers[index] = buffer;
+        ++Issued;
+    }
+
+    // glEnable / glDisable for GL_DEPTH_TEST, GL_BLEND, GL_CULL_FACE and GL_CLIP_DISTANCE0
+    void Enable(GLenum cap, bool enabled)
+    {
+        int* state = capState(cap);
+        if (state == nullptr)
+        {
+            // not tracked, pass straight through
+            enabled ? glEnable(cap) : glDisable(cap);
+            ++Issued;
+            return;
+        }
+        if (*state == (int)enabled) { skip(); return; }
+        enabled ? glEnable(cap) : glDisable(cap);
+        *state = enabled;
+        ++Issued;
+    }
+
+    void BlendFunc(GLenum src, GLenum dst)
+    {
+        if (src == blendSrc && dst == blendDst) { skip(); return; }
+        glBlendFunc(src, dst);
+        blendSrc = src;
+        blendDst = dst;
+        ++Issued;
+    }
+
+    void DepthFunc(GLenum func)
+    {
+        if (func == depthFunc) { skip(); return; }
+        glDepthFunc(func);
+        depthFunc = func;
+        ++Issued;
+    }
+
+    void DepthMask(bool write)
+    {
+        if ((int)write == depthMask) { skip(); return; }
+        glDepthMask(write ? GL_TRUE : GL_FALSE);
+        depthMask = write;
+        ++Issued;
+    }
+
+    void ColorMask(bool write)
+    {
+        if ((int)write == colorMask) { skip(); return; }
+        GLboolean w = write ? GL_TRUE : GL_FALSE;
+        glColorMask(w, w, w, w);
+        colorMask = write;
+        ++Issued;
+    }
+
+    void CullFace(GLenum mode)
+    {
+        if (mode == cullFace) { skip(); return; }
+        glCullFace(mode);
+        cullFace = mode;
+        ++Issued;
+    }
+
+    void ClearColor(float r, float g, float b, float a)
+    {
+        if (r == clearColor[0] && g == clearColor[1] && b == clearColor[2] && a == clearColor[3]) { skip(); return; }
+        glClearColor(r, g, b, a);
+        clearColor[0] = r; clearColor[1] = g; clearColor[2] = b; clearColor[3] = a;
+        ++Issued;
+    }
+
+    void Viewport(int x, int y, int width, int height)
+    {
+        if (x == viewport[0] && y == viewport[1] && width == viewport[2] && height == viewport[3]) { skip(); return; }
+        glViewport(x, y, width, height);
+        viewport[0] = x; viewport[1] = y; viewport[2] = width; viewport[3] = height;
+        ++Issued;
+    }
+
+    // forget everything so the next call of each kind always reaches the driver
+    void Invalidate()
+    {
+        currentProgram = currentVAO = ~0u;
+        activeUnit = ~0u;
+        for (int i = 0; i < MAX_TEXTURE_UNITS; ++i)
+        {
+            textures[i] = ~0u;
+            textureTargets[i] = 0;
+        }
+        for (int i = 0; i < MAX_UNIFORM_BUFFERS; ++i)
+            uniformBuffers[i] = ~0u;
+        for (int i = 0; i < CAP_COUNT; ++i)
+            caps[i] = -1;
+        blendSrc = blendDst = depthFunc = cullFace = 0;
+        depthMask = colorMask = -1;
+        clearColor[0] = clearColor[1] = clearColor[2] = clearColor[3] = -1.0f;
+        viewport[0] = viewport[1] = viewport[2] = viewport[3] = -1;
+    }
+
+    // call once per frame after the last GL call. Debug builds log the number of dropped calls whenever it changes
+    void EndFrame()
+    {
+#ifndef NDEBUG
+        if (frameSkipped != lastFrameSkipped)
+            LOG_DEBUG("GLState: %u redundant calls dropped this frame", frameSkipped);
+        lastFrameSkipped = frameSkipped;
+        frameSkipped = 0;
+#endif
+    }
+
+    void ResetCounters()
+    {
+        Issued = Skipped = 0;
+    }
+
+    unsigned int Issued = 0;    // calls sent to OpenGL
+    unsigned int Skipped = 0;   // calls dropped because the state was already set
+
+private:
+    enum { CAP_DEPTH_TEST, CAP_BLEND, CAP_CULL_FACE, CAP_CLIP_DISTANCE0, CAP_COUNT };
+
+    int* capState(GLenum cap)
+    {
+        switch (cap)
+        {
+        case GL_DEPTH_TEST: return &caps[CAP_DEPTH_TEST];
+        case GL_BLEND: return &caps[CAP_BLEND];
+        case GL_CULL_FACE: return &caps[CAP_CULL_FACE];
+        case GL_CLIP_DISTANCE0: return &caps[CAP_CLIP_DISTANCE0];
+        default: return nullptr;
+        }
+    }
+
+    void ActiveTexture(GLuint unit)
+    {
+        if (unit == activeUnit)
+            return;
+        glActiveTexture(GL_TEXTURE0 + unit);
+        activeUnit = unit;
+    }
+
+    void skip()
+    {
+        ++Skipped;
+#ifndef NDEBUG
+        ++frameSkipped;
+#endif
+    }
+
+    GLuint currentProgram;
+    GLuint currentVAO;
+    GLuint activeUnit;
+    GLuint textures[MAX_TEXTURE_UNITS];
+    GLenum textureTargets[MAX_TEXTURE_UNITS];
+    GLuint uniformBuffers[MAX_UNIFORM_BUFFERS];
+    int caps[CAP_COUNT];
+    GLenum blendSrc, blendDst;
+    GLenum depthFunc;
+    GLenum cullFace;
+    int depthMask;
+    int colorMask;
+    float clearColor[4];
+    int viewport[4];
+
+#ifndef NDEBUG
+    unsigned int frameSkipped = 0;
+    unsigned int lastFrameSkipped = 0;
+#endif
+};
+#endif
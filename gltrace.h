@@ -0,0 +1,158 @@
+#pragma once
+
+#ifndef GL_TRACE_H
+#define GL_TRACE_H
+
+#include <cstdint>
+#include <cstring>
+
+// Binary format shared by the capture layer (glcapture.h) and the replay tool (replay.cpp).
+//
+// A trace is a header followed by a flat stream of commands. Each command is a one byte opcode and then its
+// arguments, written in call order: integers, enums and object names as 4 bytes, sizes, offsets and sync
+// handles as 8 bytes, floats as 4 bytes, and data (buffer contents, pixels, shader source, uniform arrays)
+// as raw bytes whose length follows from the arguments before it. Object names and uniform locations are the
+// values the capturing driver returned; the replay maps them to its own. Everything is little endian.
+//
+// Commands between BeginFrame and EndFrame belong to one rendered frame. Whatever comes before the first
+// frame is setup (meshes, textures, shaders) and is replayed once; the frames are replayed in a loop.
+
+static const uint32_t GL_TRACE_MAGIC = 0x52544c47;     // "GLTR"
+static const uint32_t GL_TRACE_VERSION = 1;
+
+struct GLTraceHeader
+{
+    uint32_t Magic;
+    uint32_t Version;
+    uint32_t Width, Height;     // framebuffer size at capture time
+};
+
+// One entry per GL entry point the renderer uses, plus the frame markers and MappedWrite, which carries the
+// bytes the CPU wrote into persistently mapped buffer memory since the previous draw. New entries go at the
+// end so traces already recorded keep their opcodes
+#define GL_TRACE_OPS(OP) \
+    OP(BeginFrame) OP(EndFrame) OP(MappedWrite) \
+    OP(glActiveTexture) OP(glAttachShader) OP(glBeginQuery) OP(glBindBuffer) OP(glBindBufferBase) \
+    OP(glBindTexture) OP(glBindVertexArray) OP(glBindVertexBuffer) OP(glBlendFunc) OP(glBufferData) \
+    OP(glBufferStorage) OP(glClear) OP(glClearColor) OP(glClientWaitSync) OP(glColorMask) OP(glCompileShader) \
+    OP(glCreateProgram) OP(glCreateShader) OP(glCullFace) OP(glDeleteBuffers) OP(glDeleteProgram) \
+    OP(glDeleteQueries) OP(glDeleteSync) OP(glDeleteVertexArrays) OP(glDepthFunc) OP(glDepthMask) \
+    OP(glDisable) OP(glDrawArrays) OP(glDrawElements) OP(glEnable) OP(glEnableVertexAttribArray) \
+    OP(glEndQuery) OP(glFenceSync) OP(glGenBuffers) OP(glGenerateMipmap) OP(glGenQueries) OP(glGenTextures) \
+    OP(glGenVertexArrays) OP(glGetInteger64v) OP(glGetProgramInfoLog) OP(glGetProgramiv) \
+    OP(glGetQueryObjectiv) OP(glGetQueryObjectui64v) OP(glGetQueryObjectuiv) OP(glGetShaderInfoLog) \
+    OP(glGetShaderiv) OP(glGetUniformLocation) OP(glLinkProgram) OP(glMapBufferRange) OP(glQueryCounter) \
+    OP(glShaderSource) OP(glTexImage2D) OP(glTexParameteri) OP(glUniform1f) OP(glUniform1i) \
+    OP(glUniform2fv) OP(glUniform3f) OP(glUniformMatrix4fv) OP(glUnmapBuffer) OP(glUseProgram) \
+    OP(glVertexAttribBinding) OP(glVertexAttribFormat) OP(glVertexAttribPointer) OP(glViewport) \
+    OP(glBindFramebuffer) OP(glCheckFramebufferStatus) OP(glDeleteFramebuffers) OP(glDeleteTextures) \
+    OP(glFramebufferTexture2D) OP(glGenFramebuffers) OP(glReadPixels) OP(glClearBufferuiv) OP(glDrawBuffers) \
+    OP(glReadBuffer) OP(glUniform1ui) OP(glClearBufferfv) \
+    OP(glBeginConditionalRender) OP(glEndConditionalRender) OP(glTexImage3D) OP(glTexSubImage3D) \
+    OP(glUniform2f) OP(glDispatchCompute) OP(glBindImageTexture) OP(glMemoryBarrier) OP(glUniform4fv) \
+    OP(glTexSubImage2D) OP(glGetTexImage) OP(glCopyImageSubData)
+
+#define GL_TRACE_ENUM(name) OP_##name,
+#define GL_TRACE_NAME(name) #name,
+
+enum GLTraceOp : uint8_t
+{
+    GL_TRACE_OPS(GL_TRACE_ENUM)
+    OP_COUNT
+};
+
+inline const char* GLTraceOpName(int op)
+{
+    static const char* names[] = { GL_TRACE_OPS(GL_TRACE_NAME) };
+    return op >= 0 && op < OP_COUNT ? names[op] : "?";
+}
+
+#undef GL_TRACE_ENUM
+#undef GL_TRACE_NAME
+
+
+// Bytes of client memory glTexImage2D reads for an image, with the default unpack alignment of 4 (the
+// renderer never changes it). Returns 0 for formats the trace doesn't know how to size.
+inline size_t GLTraceImageSize(uint32_t format, uint32_t type, int width, int height)
+{
+    size_t components = 0;
+    switch (format)
+    {
+    case 0x1903: case 0x1902: components = 1; break;     // GL_RED, GL_DEPTH_COMPONENT
+    case 0x8227: components = 2; break;                  // GL_RG
+    case 0x1907: case 0x80E0: components = 3; break;     // GL_RGB, GL_BGR
+    case 0x1908: case 0x80E1: components = 4; break;     // GL_RGBA, GL_BGRA
+    }
+    size_t typeSize = 0;
+    switch (type)
+    {
+    case 0x1401: typeSize = 1; break;                    // GL_UNSIGNED_BYTE
+    case 0x1403: case 0x140B: typeSize = 2; break;       // GL_UNSIGNED_SHORT, GL_HALF_FLOAT
+    case 0x1405: case 0x1406: typeSize = 4; break;       // GL_UNSIGNED_INT, GL_FLOAT
+    }
+    if (components == 0 || typeSize == 0 || width <= 0 || height <= 0)
+        return 0;
+    size_t row = components * typeSize * width;
+    size_t stride = (row + 3) & ~(size_t)3;
+    return stride * (height - 1) + row;
+}
+
+// The same for a stack of depth such images (glTexImage3D). Under the unpack alignment every row is padded,
+// including the last row of each layer but the final one
+inline size_t GLTraceVolumeSize(uint32_t format, uint32_t type, int width, int height, int depth)
+{
+    size_t image = GLTraceImageSize(format, type, width, height);
+    if (image == 0 || depth <= 0)
+        return 0;
+    size_t stride = GLTraceImageSize(format, type, width, 2) - GLTraceImageSize(format, type, width, 1);
+    return stride * height * (depth - 1) + image;
+}
+
+
+// Sequential decoder over a trace loaded into memory. Data arguments are returned as pointers into the
+// trace itself, so the memory must outlive them.
+class GLTraceReader
+{
+public:
+    GLTraceReader(const char* data, size_t size) : data(data), size(size) {}
+
+    bool AtEnd() const { return position >= size; }
+    size_t Position() const { return position; }
+    void Seek(size_t offset) { position = offset; }
+
+    // false if the stream ended in the middle of a command
+    bool Ok() const { return !overrun; }
+
+    uint8_t U8() { uint8_t v = 0; Read(&v, 1); return v; }
+    uint32_t U32() { uint32_t v = 0; Read(&v, 4); return v; }
+    int32_t I32() { return (int32_t)U32(); }
+    uint64_t U64() { uint64_t v = 0; Read(&v, 8); return v; }
+    float F32() { float v = 0.0f; Read(&v, 4); return v; }
+
+    const char* Bytes(size_t count)
+    {
+        if (count > size - position)
+        {
+            overrun = true;
+            position = size;
+            return nullptr;
+        }
+        const char* p = data + position;
+        position += count;
+        return p;
+    }
+
+private:
+    void Read(void* out, size_t count)
+    {
+        const char* p = Bytes(count);
+        if (p)
+            memcpy(out, p, count);
+    }
+
+    const char* data;
+    size_t size;
+    size_t position = 0;
+    bool overrun = false;
+};
+#endif
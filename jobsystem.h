@@ -0,0 +1,310 @@
+#pragma once
+
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+
+struct Job;
+
+// Counts unfinished jobs; JobSystem::Wait returns once it reaches zero
+typedef std::atomic<int> JobCounter;
+
+// A unit of work. Jobs are never allocated by the job system: they live in the caller's stack frame
+// (ParallelFor) or in a TaskGraph, both of which wait for them before going away.
+struct Job
+{
+    void (*Function)(Job*);
+    void* Data;
+    uint32_t Begin, End;        // index range for ParallelFor chunks
+    JobCounter* Counter;        // decremented when the job has run
+};
+
+
+// Chase-Lev work stealing deque with a fixed capacity. The owning thread pushes and pops at the bottom,
+// other threads steal from the top.
+class WorkStealingDeque
+{
+public:
+    static const int64_t CAPACITY = 4096;   // power of two
+
+    bool Push(Job* job)
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        if (b - t >= CAPACITY)
+            return false;
+        buffer[b & (CAPACITY - 1)].store(job, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_release);     // publishes the job to thieves
+        return true;
+    }
+
+    Job* Pop()
+    {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+
+        if (t > b)
+        {
+            bottom.store(b + 1, std::memory_order_relaxed);     // empty
+            return nullptr;
+        }
+
+        Job* job = buffer[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+        if (t == b)
+        {
+            // last job, race the thieves for it
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                job = nullptr;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    Job* Steal()
+    {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return nullptr;
+
+        Job* job = buffer[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;
+        return job;
+    }
+
+private:
+    alignas(64) std::atomic<int64_t> top{ 0 };
+    alignas(64) std::atomic<int64_t> bottom{ 0 };
+    std::atomic<Job*> buffer[CAPACITY];
+};
+
+
+// Work stealing scheduler with one deque per thread. The thread that calls Start becomes worker 0 and only
+// runs jobs while it waits on a counter, so it stays free for OpenGL; the others run jobs continuously and
+// steal from each other's deques when their own is empty.
+class JobSystem
+{
+public:
+    // workerCount 0 uses one thread per hardware core
+    void Start(unsigned int workerCount = 0)
+    {
+        if (workerCount == 0)
+            workerCount = std::max(1u, std::thread::hardware_concurrency());
+        deques = std::vector<WorkStealingDeque>(workerCount);
+        running = true;
+        WorkerIndex() = 0;
+        for (unsigned int i = 1; i < workerCount; ++i)
+            threads.emplace_back([this, i] { WorkerIndex() = (int)i; Work(); });
+    }
+
+    // safe to call more than once; the destructor calls it, so early exits don't leave joinable threads behind
+    void Stop()
+    {
+        running = false;
+        for (std::thread& thread : threads)
+            if (thread.joinable())
+                thread.join();
+        threads.clear();
+    }
+
+    ~JobSystem()
+    {
+        Stop();
+    }
+
+    unsigned int WorkerCount() const
+    {
+        return (unsigned int)deques.size();
+    }
+
+    // queues a job on the calling thread's deque, or runs it right away if the deque is full
+    void Schedule(Job* job)
+    {
+        if (job->Counter)
+            job->Counter->fetch_add(1, std::memory_order_relaxed);
+        if (!deques[WorkerIndex()].Push(job))
+            Execute(job);
+    }
+
+    // runs queued jobs (its own first, then stolen ones) until the counter reaches zero
+    void Wait(const JobCounter& counter)
+    {
+        while (counter.load(std::memory_order_acquire) > 0)
+        {
+            Job* job = Next();
+            if (job)
+                Execute(job);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    // calls body(begin, end) over [0, count) in chunks of at least grain indices and returns when all are done
+    template <class F>
+    void ParallelFor(uint32_t count, uint32_t grain, const F& body)
+    {
+        const uint32_t maxChunks = 256;
+        if (count == 0)
+            return;
+        grain = std::max(grain, (count + maxChunks - 1) / maxChunks);
+        if (count <= grain || WorkerCount() == 1)
+        {
+            body(0u, count);
+            return;
+        }
+
+        Job jobs[maxChunks];
+        JobCounter counter{ 0 };
+        uint32_t chunk = 0;
+        for (uint32_t begin = 0; begin < count; begin += grain, ++chunk)
+        {
+            jobs[chunk] = { &RunRange<F>, (void*)&body, begin, std::min(begin + grain, count), &counter };
+            Schedule(&jobs[chunk]);
+        }
+        Wait(counter);
+    }
+
+private:
+    template <class F>
+    static void RunRange(Job* job)
+    {
+        (*(const F*)job->Data)(job->Begin, job->End);
+    }
+
+    static int& WorkerIndex()
+    {
+        static thread_local int index = 0;
+        return index;
+    }
+
+    static void Execute(Job* job)
+    {
+        JobCounter* counter = job->Counter;     // the job may be reused once the counter drops
+        job->Function(job);
+        if (counter)
+            counter->fetch_sub(1, std::memory_order_release);
+    }
+
+    Job* Next()
+    {
+        int self = WorkerIndex();
+        if (Job* job = deques[self].Pop())
+            return job;
+
+        int count = (int)deques.size();
+        for (int i = 1; i < count; ++i)
+        {
+            if (Job* job = deques[(self + i) % count].Steal())
+                return job;
+        }
+        return nullptr;
+    }
+
+    void Work()
+    {
+        int idle = 0;
+        while (running.load(std::memory_order_relaxed))
+        {
+            Job* job = Next();
+            if (job)
+            {
+                Execute(job);
+                idle = 0;
+            }
+            else if (++idle < 64)
+                std::this_thread::yield();
+            else
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+    std::vector<WorkStealingDeque> deques;
+    std::vector<std::thread> threads;
+    std::atomic<bool> running{ false };
+};
+
+
+// A fixed graph of tasks run once per frame. Each task starts as soon as all the tasks it depends on have
+// finished; tasks may fan out further with ParallelFor. Build the graph once, then call Run every frame.
+class TaskGraph
+{
+public:
+    int Add(const char* name, std::function<void()> function)
+    {
+        tasks.push_back(Task{ name, std::move(function), {}, 0 });
+        return (int)tasks.size() - 1;
+    }
+
+    // task will not start before dependency has finished
+    void Depend(int task, int dependency)
+    {
+        tasks[dependency].Successors.push_back(task);
+        ++tasks[task].Dependencies;
+    }
+
+    // runs every task and returns when all of them are done
+    void Run(JobSystem& jobs)
+    {
+        if (nodes.size() != tasks.size())
+            nodes = std::vector<Node>(tasks.size());
+
+        JobCounter remaining{ 0 };
+        system = &jobs;
+        for (size_t i = 0; i < tasks.size(); ++i)
+        {
+            nodes[i].Pending.store(tasks[i].Dependencies, std::memory_order_relaxed);
+            nodes[i].TaskJob = { &RunTask, this, (uint32_t)i, (uint32_t)i + 1, &remaining };
+        }
+        for (size_t i = 0; i < tasks.size(); ++i)
+        {
+            if (tasks[i].Dependencies == 0)
+                jobs.Schedule(&nodes[i].TaskJob);
+        }
+        jobs.Wait(remaining);
+    }
+
+private:
+    struct Task
+    {
+        const char* Name;
+        std::function<void()> Function;
+        std::vector<int> Successors;
+        int Dependencies;
+    };
+
+    struct Node
+    {
+        std::atomic<int> Pending{ 0 };
+        Job TaskJob;
+    };
+
+    static void RunTask(Job* job)
+    {
+        TaskGraph* graph = (TaskGraph*)job->Data;
+        Task& task = graph->tasks[job->Begin];
+        task.Function();
+
+        // successors are scheduled before this job's counter drops, so Run can't return early
+        for (int successor : task.Successors)
+        {
+            if (graph->nodes[successor].Pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                graph->system->Schedule(&graph->nodes[successor].TaskJob);
+        }
+    }
+
+    std::vector<Task> tasks;
+    std::vector<Node> nodes;
+    JobSystem* system = nullptr;
+};
+#endif
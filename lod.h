@@ -0,0 +1,338 @@
+#pragma once
+
+#ifndef LOD_H
+#define LOD_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <map>
+#include <queue>
+#include <tuple>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+
+// One level of detail: a range of the mesh's shared index buffer plus the geometric error it introduces
+struct LODLevel
+{
+    GLuint IndexOffset;     // first index of this level inside the element buffer
+    GLuint IndexCount;
+    float Error;            // object space error in world units (0 for the full resolution level)
+};
+
+// Levels of one mesh, finest first. All levels index the same vertex buffer.
+struct LODChain
+{
+    std::vector<LODLevel> Levels;
+};
+
+
+// Quadric error (Garland-Heckbert) mesh simplification by half-edge collapse. Vertices are never moved or
+// created, a collapse just redirects one vertex onto a neighbour, so every level can share the original
+// vertex buffer and only needs its own index list. Vertices at the same position (texture or normal seams)
+// are welded while simplifying so seams don't tear open.
+class MeshSimplifier
+{
+public:
+    // verts is interleaved with the position in the first three floats of each vertex. Returns the
+    // simplified index list and the largest collapse error (roughly a distance in object units).
+    static std::vector<GLushort> Simplify(const GLfloat* verts, size_t vertexCount, GLuint floatsPerVertex,
+        const GLushort* indices, size_t indexCount, size_t targetTriangles, float& error)
+    {
+        error = 0.0f;
+
+        std::vector<glm::vec3> pos(vertexCount);
+        for (size_t i = 0; i < vertexCount; ++i)
+            pos[i] = glm::vec3(verts[i * floatsPerVertex], verts[i * floatsPerVertex + 1], verts[i * floatsPerVertex + 2]);
+
+        // weld vertices with identical positions; rep[i] is the first vertex at i's position
+        std::vector<int> rep(vertexCount);
+        std::map<std::tuple<float, float, float>, int> welded;
+        for (size_t i = 0; i < vertexCount; ++i)
+        {
+            auto key = std::make_tuple(pos[i].x, pos[i].y, pos[i].z);
+            auto found = welded.find(key);
+            rep[i] = found == welded.end() ? (welded[key] = (int)i) : found->second;
+        }
+
+        // parent[c] != c once position class c has been collapsed into another one
+        std::vector<int> parent(vertexCount);
+        for (size_t i = 0; i < vertexCount; ++i)
+            parent[i] = (int)i;
+        auto find = [&parent](int c) { while (parent[c] != c) c = parent[c] = parent[parent[c]]; return c; };
+
+        size_t triangleCount = indexCount / 3;
+        std::vector<bool> dead(triangleCount, false);
+        std::vector<std::vector<int>> adjacent(vertexCount);
+        std::vector<Quadric> quadrics(vertexCount);
+        std::map<std::pair<int, int>, int> edgeUse;
+
+        for (size_t t = 0; t < triangleCount; ++t)
+        {
+            // triangles that reference vertices past the end of the buffer can't be simplified, drop them
+            if (indices[t * 3] >= vertexCount || indices[t * 3 + 1] >= vertexCount || indices[t * 3 + 2] >= vertexCount)
+            {
+                dead[t] = true;
+                continue;
+            }
+            int a = rep[indices[t * 3]], b = rep[indices[t * 3 + 1]], c = rep[indices[t * 3 + 2]];
+            if (a == b || b == c || a == c)
+            {
+                dead[t] = true;
+                continue;
+            }
+            glm::vec3 n = glm::cross(pos[b] - pos[a], pos[c] - pos[a]);
+            if (glm::length(n) > 0.0f)
+            {
+                Quadric q = Quadric::FromPlane(glm::normalize(n), pos[a]);
+                quadrics[a].Add(q); quadrics[b].Add(q); quadrics[c].Add(q);
+            }
+            adjacent[a].push_back((int)t); adjacent[b].push_back((int)t); adjacent[c].push_back((int)t);
+            ++edgeUse[std::minmax(a, b)]; ++edgeUse[std::minmax(b, c)]; ++edgeUse[std::minmax(a, c)];
+        }
+
+        // open edges get a heavily weighted plane perpendicular to their triangle so borders keep their shape
+        for (size_t t = 0; t < triangleCount; ++t)
+        {
+            if (dead[t])
+                continue;
+            int corner[3] = { rep[indices[t * 3]], rep[indices[t * 3 + 1]], rep[indices[t * 3 + 2]] };
+            glm::vec3 n = glm::cross(pos[corner[1]] - pos[corner[0]], pos[corner[2]] - pos[corner[0]]);
+            if (glm::length(n) == 0.0f)
+                continue;
+            n = glm::normalize(n);
+            for (int e = 0; e < 3; ++e)
+            {
+                int u = corner[e], v = corner[(e + 1) % 3];
+                if (edgeUse[std::minmax(u, v)] != 1)
+                    continue;
+                glm::vec3 m = glm::cross(pos[v] - pos[u], n);
+                if (glm::length(m) == 0.0f)
+                    continue;
+                Quadric q = Quadric::FromPlane(glm::normalize(m), pos[u]);
+                q.Scale(BOUNDARY_WEIGHT);
+                quadrics[u].Add(q); quadrics[v].Add(q);
+            }
+        }
+
+        // candidate collapses, cheapest first; entries go stale when either end's version changes
+        std::vector<unsigned int> version(vertexCount, 0);
+        std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+        auto push = [&](int a, int b)
+        {
+            Quadric q = quadrics[a];
+            q.Add(quadrics[b]);
+            double costAB = q.Evaluate(pos[b]);     // a moves onto b
+            double costBA = q.Evaluate(pos[a]);     // b moves onto a
+            if (costAB <= costBA)
+                heap.push({ costAB, a, b, version[a], version[b] });
+            else
+                heap.push({ costBA, b, a, version[b], version[a] });
+        };
+        for (const auto& edge : edgeUse)
+            push(edge.first.first, edge.first.second);
+
+        size_t liveTriangles = 0;
+        for (size_t t = 0; t < triangleCount; ++t)
+            liveTriangles += dead[t] ? 0 : 1;
+
+        auto corners = [&](size_t t, int out[3]) { for (int k = 0; k < 3; ++k) out[k] = find(rep[indices[t * 3 + k]]); };
+
+        while (liveTriangles > targetTriangles && !heap.empty())
+        {
+            Collapse collapse = heap.top();
+            heap.pop();
+            int from = collapse.From, to = collapse.To;
+            if (find(from) != from || find(to) != to || version[from] != collapse.FromVersion || version[to] != collapse.ToVersion)
+                continue;
+
+            // reject collapses that would flip a surviving triangle
+            bool flips = false;
+            for (int t : adjacent[from])
+            {
+                if (dead[t])
+                    continue;
+                int c[3];
+                corners(t, c);
+                if (c[0] == to || c[1] == to || c[2] == to)
+                    continue;
+                glm::vec3 before = glm::cross(pos[c[1]] - pos[c[0]], pos[c[2]] - pos[c[0]]);
+                glm::vec3 p[3] = { pos[c[0]], pos[c[1]], pos[c[2]] };
+                for (int k = 0; k < 3; ++k)
+                    if (c[k] == from)
+                        p[k] = pos[to];
+                glm::vec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+                if (glm::dot(before, after) <= 0.0f)
+                {
+                    flips = true;
+                    break;
+                }
+            }
+            if (flips)
+                continue;
+
+            parent[from] = to;
+            quadrics[to].Add(quadrics[from]);
+            ++version[to];
+            error = std::fmax(error, (float)std::sqrt(std::fmax(collapse.Cost, 0.0)));
+
+            for (int t : adjacent[from])
+            {
+                if (dead[t])
+                    continue;
+                int c[3];
+                corners(t, c);
+                if (c[0] == c[1] || c[1] == c[2] || c[0] == c[2])
+                {
+                    dead[t] = true;
+                    --liveTriangles;
+                }
+                else
+                    adjacent[to].push_back(t);
+            }
+            adjacent[from].clear();
+
+            for (int t : adjacent[to])
+            {
+                if (dead[t])
+                    continue;
+                int c[3];
+                corners(t, c);
+                for (int k = 0; k < 3; ++k)
+                    if (c[k] != to)
+                        push(to, c[k]);
+            }
+        }
+
+        // vertices whose class survived keep their own attributes, collapsed ones take the target's vertex
+        std::vector<GLushort> result;
+        result.reserve(liveTriangles * 3);
+        for (size_t t = 0; t < triangleCount; ++t)
+        {
+            if (dead[t])
+                continue;
+            for (int k = 0; k < 3; ++k)
+            {
+                int v = indices[t * 3 + k];
+                int c = find(rep[v]);
+                result.push_back((GLushort)(c == rep[v] ? v : c));
+            }
+        }
+        return result;
+    }
+
+    // Builds up to maxLevels levels, each with about half the triangles of the previous one, and appends
+    // their indices to allIndices (level 0 is the original list).
+    static void BuildChain(const GLfloat* verts, size_t vertexCount, GLuint floatsPerVertex,
+        const GLushort* indices, size_t indexCount, int maxLevels, std::vector<GLushort>& allIndices, LODChain& chain)
+    {
+        chain.Levels.clear();
+        chain.Levels.push_back({ (GLuint)allIndices.size(), (GLuint)indexCount, 0.0f });
+        allIndices.insert(allIndices.end(), indices, indices + indexCount);
+
+        size_t previous = indexCount / 3;
+        while ((int)chain.Levels.size() < maxLevels && previous >= MIN_TRIANGLES * 2)
+        {
+            float error = 0.0f;
+            // always simplify from the original so each level's error is measured against full detail
+            std::vector<GLushort> level = Simplify(verts, vertexCount, floatsPerVertex, indices, indexCount, previous / 2, error);
+            size_t triangles = level.size() / 3;
+            if (triangles * 10 >= previous * 9)
+                break;  // less than 10% fewer triangles, simplification has run out of safe collapses
+
+            chain.Levels.push_back({ (GLuint)allIndices.size(), (GLuint)level.size(), error });
+            allIndices.insert(allIndices.end(), level.begin(), level.end());
+            previous = triangles;
+        }
+    }
+
+private:
+    static constexpr double BOUNDARY_WEIGHT = 10.0;
+    static const size_t MIN_TRIANGLES = 4;
+
+    // symmetric 4x4 matrix stored as its upper triangle
+    struct Quadric
+    {
+        double m[10] = { 0 };
+
+        static Quadric FromPlane(const glm::vec3& n, const glm::vec3& point)
+        {
+            double a = n.x, b = n.y, c = n.z, d = -glm::dot(n, point);
+            Quadric q;
+            q.m[0] = a * a; q.m[1] = a * b; q.m[2] = a * c; q.m[3] = a * d;
+            q.m[4] = b * b; q.m[5] = b * c; q.m[6] = b * d;
+            q.m[7] = c * c; q.m[8] = c * d;
+            q.m[9] = d * d;
+            return q;
+        }
+
+        void Add(const Quadric& other)
+        {
+            for (int i = 0; i < 10; ++i)
+                m[i] += other.m[i];
+        }
+
+        void Scale(double s)
+        {
+            for (int i = 0; i < 10; ++i)
+                m[i] *= s;
+        }
+
+        // squared distance sum of p to the accumulated planes
+        double Evaluate(const glm::vec3& p) const
+        {
+            double x = p.x, y = p.y, z = p.z;
+            return m[0] * x * x + 2 * m[1] * x * y + 2 * m[2] * x * z + 2 * m[3] * x
+                + m[4] * y * y + 2 * m[5] * y * z + 2 * m[6] * y
+                + m[7] * z * z + 2 * m[8] * z
+                + m[9];
+        }
+    };
+
+    struct Collapse
+    {
+        double Cost;
+        int From, To;
+        unsigned int FromVersion, ToVersion;
+
+        bool operator>(const Collapse& other) const { return Cost > other.Cost; }
+    };
+};
+
+
+// Picks a level per object from its projected error, with hysteresis so objects near a switching distance
+// don't pop back and forth every frame.
+class LODSelector
+{
+public:
+    float PixelThreshold = 1.0f;    // largest acceptable error on screen, in pixels
+    float Hysteresis = 0.25f;       // a coarser level must be this fraction below the threshold to be picked
+
+    // pixelsPerUnit is how many pixels one world unit covers at the object's distance
+    int Select(const LODChain& chain, int current, float pixelsPerUnit) const
+    {
+        int count = (int)chain.Levels.size();
+        if (count == 0)
+            return 0;
+        if (current >= count)
+            current = count - 1;
+
+        int best = 0;
+        for (int i = count - 1; i > 0; --i)
+        {
+            if (chain.Levels[i].Error * pixelsPerUnit <= PixelThreshold)
+            {
+                best = i;
+                break;
+            }
+        }
+
+        // moving to a coarser level requires a margin; moving finer happens as soon as the error is visible
+        while (best > current && chain.Levels[best].Error * pixelsPerUnit > PixelThreshold * (1.0f - Hysteresis))
+            --best;
+        return best;
+    }
+};
+#endif
@@ -0,0 +1,193 @@
+#pragma once
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstdarg>
+#include <cstddef>
+
+// Severity of a log message
+enum LogLevel
+{
+    LEVEL_DEBUG = 0,
+    LEVEL_INFO = 1,
+    LEVEL_WARNING = 2,
+    LEVEL_ERROR = 3,
+};
+
+// Messages below this level are compiled out entirely. Release builds drop debug messages by default.
+#ifndef LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define LOG_MIN_LEVEL 1
+#else
+#define LOG_MIN_LEVEL 0
+#endif
+#endif
+
+
+// Asynchronous logger. Any thread formats its message into a slot of a fixed size lock-free ring (a bounded
+// multi-producer, single-consumer queue with a sequence number per slot) and returns immediately; a
+// background thread takes messages off the ring and does all the I/O. When the ring is full the message is
+// dropped and counted rather than making the caller wait.
+class Logger
+{
+public:
+    static const size_t CAPACITY = 1024;          // must be a power of two
+    static const size_t MESSAGE_SIZE = 240;
+
+    static Logger& Instance()
+    {
+        static Logger logger;
+        return logger;
+    }
+
+    // starts the writer thread; messages logged before this are kept in the ring until then
+    void Start(FILE* output = stdout)
+    {
+        if (writer.joinable())
+            return;
+        this->output = output;
+        running = true;
+        writer = std::thread([this] { Run(); });
+    }
+
+    // writes out everything still queued and stops the writer thread
+    void Stop()
+    {
+        if (!writer.joinable())
+            return;
+        running = false;
+        writer.join();
+    }
+
+    // printf style; safe to call from any thread
+    void Write(LogLevel level, const char* format, ...)
+    {
+        size_t position = enqueuePosition.load(std::memory_order_relaxed);
+        Slot* slot;
+        for (;;)
+        {
+            slot = &slots[position & (CAPACITY - 1)];
+            size_t sequence = slot->Sequence.load(std::memory_order_acquire);
+            ptrdiff_t difference = (ptrdiff_t)sequence - (ptrdiff_t)position;
+            if (difference == 0)
+            {
+                if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (difference < 0)
+            {
+                Dropped.fetch_add(1, std::memory_order_relaxed);    // full, never block the caller
+                return;
+            }
+            else
+                position = enqueuePosition.load(std::memory_order_relaxed);
+        }
+
+        slot->Level = level;
+        slot->Time = std::chrono::duration<double>(std::chrono::steady_clock::now() - epoch).count();
+        va_list args;
+        va_start(args, format);
+        vsnprintf(slot->Text, MESSAGE_SIZE, format, args);
+        va_end(args);
+        slot->Sequence.store(position + 1, std::memory_order_release);
+    }
+
+    std::atomic<unsigned int> Dropped{ 0 };    // messages lost because the ring was full
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> Sequence;
+        LogLevel Level;
+        double Time;
+        char Text[MESSAGE_SIZE];
+    };
+
+    Logger() : epoch(std::chrono::steady_clock::now())
+    {
+        for (size_t i = 0; i < CAPACITY; ++i)
+            slots[i].Sequence.store(i, std::memory_order_relaxed);
+    }
+
+    ~Logger()
+    {
+        Stop();
+    }
+
+    // takes one message off the ring and writes it; false when the ring is empty
+    bool WriteNext()
+    {
+        Slot& slot = slots[dequeuePosition & (CAPACITY - 1)];
+        if (slot.Sequence.load(std::memory_order_acquire) != dequeuePosition + 1)
+            return false;
+
+        static const char* const names[] = { "DEBUG", "INFO", "WARNING", "ERROR" };
+        fprintf(output, "[%9.3f] %-7s %s\n", slot.Time, names[slot.Level], slot.Text);
+
+        slot.Sequence.store(dequeuePosition + CAPACITY, std::memory_order_release);
+        ++dequeuePosition;
+        return true;
+    }
+
+    void Run()
+    {
+        unsigned int reportedDrops = 0;
+        for (;;)
+        {
+            bool stopping = !running;
+            bool wrote = false;
+            while (WriteNext())
+                wrote = true;
+
+            unsigned int dropped = Dropped.load(std::memory_order_relaxed);
+            if (dropped != reportedDrops)
+            {
+                fprintf(output, "[logger] %u messages dropped\n", dropped - reportedDrops);
+                reportedDrops = dropped;
+                wrote = true;
+            }
+
+            if (wrote)
+                fflush(output);
+            if (stopping)
+                break;
+            if (!wrote)
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    }
+
+    Slot slots[CAPACITY];
+    alignas(64) std::atomic<size_t> enqueuePosition{ 0 };
+    alignas(64) size_t dequeuePosition = 0;
+    std::atomic<bool> running{ false };
+    std::thread writer;
+    FILE* output = stdout;
+    std::chrono::steady_clock::time_point epoch;
+};
+
+
+#if LOG_MIN_LEVEL <= 0
+#define LOG_DEBUG(...) Logger::Instance().Write(LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+
+#if LOG_MIN_LEVEL <= 1
+#define LOG_INFO(...) Logger::Instance().Write(LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+
+#if LOG_MIN_LEVEL <= 2
+#define LOG_WARNING(...) Logger::Instance().Write(LEVEL_WARNING, __VA_ARGS__)
+#else
+#define LOG_WARNING(...) ((void)0)
+#endif
+
+#define LOG_ERROR(...) Logger::Instance().Write(LEVEL_ERROR, __VA_ARGS__)
+#endif
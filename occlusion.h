@@ -0,0 +1,194 @@
+#pragma once
+
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <vector>
+
+#include "glstate.h"
+#include "renderqueue.h"
+
+// Skips the draws of objects hidden behind others, the large ones in particular, without the CPU ever
+// waiting on the GPU. After the opaque pass the bounding box of each drawn object is rasterized against the
+// finished depth buffer inside a GL_ANY_SAMPLES_PASSED_CONSERVATIVE query, with color and depth writes off.
+// The next frame draws the object inside glBeginConditionalRender on that query, so the GPU drops the draws
+// if no sample of the box passed. GL_QUERY_NO_WAIT draws anyway when the result isn't in yet.
+//
+// Temporal coherence keeps the queries cheap: results are read back whenever they are ready (never waited
+// for), and an object last seen visible is drawn unconditionally and retested only every few frames,
+// staggered by ID. An object last seen occluded is drawn conditionally and retested every frame. An object
+// coming out from behind an occluder still shows up a frame late, so the boxes are inflated a little to
+// start drawing it just before. Objects whose box holds the camera are always drawn, since the near plane
+// would clip their box away.
+//
+// Everything is indexed by the object IDs of the draw items; 0 is unused.
+class OcclusionCuller
+{
+public:
+    static const int VISIBLE_RETEST_INTERVAL = 4;
+
+    bool Enabled = true;
+    float Inflation = 0.05f;    // the box grows by this fraction of its size on each side
+
+    void Create(GLState& state)
+    {
+        // unit cube, counterclockwise seen from outside
+        static const GLfloat corners[8 * 3] = {
+            0, 0, 0,  1, 0, 0,  1, 1, 0,  0, 1, 0,
+            0, 0, 1,  1, 0, 1,  1, 1, 1,  0, 1, 1,
+        };
+        static const GLushort indices[BOX_INDEX_COUNT] = {
+            0, 3, 2,  2, 1, 0,      // -z
+            4, 5, 6,  6, 7, 4,      // +z
+            0, 4, 7,  7, 3, 0,      // -x
+            1, 2, 6,  6, 5, 1,      // +x
+            0, 1, 5,  5, 4, 0,      // -y
+            3, 7, 6,  6, 2, 3,      // +y
+        };
+        glGenVertexArrays(1, &boxVAO);
+        state.BindVertexArray(boxVAO);
+        glGenBuffers(2, boxBuffers);
+        glBindBuffer(GL_ARRAY_BUFFER, boxBuffers[0]);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, boxBuffers[1]);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0);
+        glEnableVertexAttribArray(0);
+        state.BindVertexArray(0);
+    }
+
+    void Destroy()
+    {
+        if (!queries.empty())
+            glDeleteQueries((GLsizei)queries.size(), queries.data());
+        glDeleteBuffers(2, boxBuffers);
+        glDeleteVertexArrays(1, &boxVAO);
+        queries.clear();
+    }
+
+    // before the frame's draws: picks up the results that are ready and decides which draws are
+    // conditional. objectCount is one past the highest object ID
+    void BeginFrame(GLuint objectCount)
+    {
+        ++frame;
+        if (objectCount > queries.size())
+        {
+            size_t first = queries.size();
+            queries.resize(objectCount);
+            glGenQueries((GLsizei)(objectCount - first), queries.data() + first);
+            state.resize(objectCount);
+            conditions.resize(objectCount, 0);
+        }
+
+        for (size_t id = 1; id < queries.size(); ++id)
+        {
+            ObjectState& object = state[id];
+            if (object.Pending)
+            {
+                GLuint available = 0;
+                glGetQueryObjectuiv(queries[id], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (available)
+                {
+                    GLuint anySamples = 0;
+                    glGetQueryObjectuiv(queries[id], GL_QUERY_RESULT, &anySamples);
+                    object.Visible = anySamples != 0;
+                    object.Pending = false;
+                }
+            }
+            // a result from before the object last left the view is too old to go by
+            bool recent = object.LastQueuedFrame + 1 == frame;
+            conditions[id] = Enabled && object.Tested && recent && !object.Visible ? queries[id] : 0;
+        }
+    }
+
+    // queries to draw each object ID on, 0 for unconditional; pass to RenderQueue::Flush
+    const std::vector<GLuint>& Conditions() const
+    {
+        return conditions;
+    }
+
+    // after the opaque pass, with its depth buffer bound: tests the box of every queued object that is due.
+    // program is the depth-only program, whose model uniform is at modelLocation
+    void TestBoxes(const RenderQueue& queue, GLState& glState, GLuint program, GLint modelLocation,
+        const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPosition)
+    {
+        Queries = ConditionalDraws = 0;
+        if (!Enabled)
+            return;
+
+        glState.UseProgram(program);
+        glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        glState.ColorMask(false);
+        glState.DepthMask(false);
+        glState.DepthFunc(GL_LEQUAL);
+        glState.BindVertexArray(boxVAO);
+
+        for (const DrawItem& item : queue.Items)
+        {
+            GLuint id = item.ObjectId;
+            if (id == 0 || id >= queries.size())
+                continue;
+            ObjectState& object = state[id];
+            object.LastQueuedFrame = frame;
+            if (conditions[id])
+                ++ConditionalDraws;
+
+            glm::vec3 margin = (item.BoundsMax - item.BoundsMin) * Inflation;
+            glm::vec3 boxMin = item.BoundsMin - margin;
+            glm::vec3 boxMax = item.BoundsMax + margin;
+            glm::vec3 camera = glm::vec3(glm::inverse(item.Model) * glm::vec4(cameraPosition, 1.0f));
+            bool inside = camera.x >= boxMin.x && camera.y >= boxMin.y && camera.z >= boxMin.z
+                && camera.x <= boxMax.x && camera.y <= boxMax.y && camera.z <= boxMax.z;
+            if (inside)
+            {
+                object.Visible = true;
+                continue;
+            }
+
+            // a query still in flight can't be reissued, and visible objects only need an occasional check
+            if (object.Pending || (object.Tested && object.Visible && (frame + id) % VISIBLE_RETEST_INTERVAL != 0))
+                continue;
+
+            glm::mat4 box = item.Model;
+            box[3] += box[0] * boxMin.x + box[1] * boxMin.y + box[2] * boxMin.z;
+            box[0] *= boxMax.x - boxMin.x;
+            box[1] *= boxMax.y - boxMin.y;
+            box[2] *= boxMax.z - boxMin.z;
+            glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(box));
+            glBeginQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE, queries[id]);
+            glDrawElements(GL_TRIANGLES, BOX_INDEX_COUNT, GL_UNSIGNED_SHORT, (const void*)0);
+            glEndQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE);
+            object.Pending = object.Tested = true;
+            ++Queries;
+        }
+        glState.ColorMask(true);
+    }
+
+    GLuint Queries = 0;             // boxes tested this frame
+    GLuint ConditionalDraws = 0;    // objects drawn conditionally on an occluded result this frame; the GPU
+                                    // drops those whose query still finds them hidden, which the CPU never learns
+
+private:
+    static const int BOX_INDEX_COUNT = 36;
+
+    struct ObjectState
+    {
+        bool Tested = false;    // a query was issued at least once
+        bool Pending = false;   // the last one's result hasn't been read back yet
+        bool Visible = true;    // as of the last result read back
+        unsigned int LastQueuedFrame = 0;
+    };
+
+    std::vector<GLuint> queries;
+    std::vector<ObjectState> state;
+    std::vector<GLuint> conditions;
+    GLuint boxVAO = 0;
+    GLuint boxBuffers[2] = { 0, 0 };
+    unsigned int frame = 0;
+};
+#endif
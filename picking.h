@@ -0,0 +1,96 @@
+#pragma once
+
+#ifndef PICKING_H
+#define PICKING_H
+
+#include <GL/glew.h>
+
+#include <cstdint>
+
+// Finds what is under a pixel by reading the object ID buffer the opaque pass writes next to its color. The
+// read goes into a pixel pack buffer and is fenced, and the result is collected once the fence has passed,
+// a frame or two later, so a click never waits for the GPU to catch up. A few picks can be in flight.
+//
+// IDs are whatever the draws wrote; 0 is left by the clear, so it means nothing was hit.
+class ObjectPicker
+{
+public:
+    static const int MAX_PENDING = 4;
+
+    void Create()
+    {
+        glGenBuffers(MAX_PENDING, buffers);
+        for (int i = 0; i < MAX_PENDING; ++i)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(GLuint), NULL, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glGenFramebuffers(1, &readFramebuffer);
+    }
+
+    void Destroy()
+    {
+        for (int i = 0; i < MAX_PENDING; ++i)
+        {
+            if (fences[i])
+                glDeleteSync(fences[i]);
+            fences[i] = 0;
+        }
+        glDeleteBuffers(MAX_PENDING, buffers);
+        glDeleteFramebuffers(1, &readFramebuffer);
+    }
+
+    // queues a read of the ID at (x, y) in the R32UI texture ids. The texture goes on a read framebuffer of
+    // the picker's own, which is left bound for reading. With every slot still in flight the click is
+    // ignored; that takes several clicks within a frame or two
+    bool Request(GLuint ids, int x, int y)
+    {
+        int slot = (first + pending) % MAX_PENDING;
+        if (pending == MAX_PENDING)
+            return false;
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, ids, 0);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[slot]);
+        glReadPixels(x, y, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, (void*)0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        ++pending;
+        return true;
+    }
+
+    // true with the oldest pick's ID once the GPU has written it; never blocks
+    bool Poll(GLuint& id)
+    {
+        if (pending == 0)
+            return false;
+        GLenum status = glClientWaitSync(fences[first], 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED)
+            return false;
+        glDeleteSync(fences[first]);
+        fences[first] = 0;
+
+        id = 0;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[first]);
+        const GLuint* value = (const GLuint*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sizeof(GLuint), GL_MAP_READ_BIT);
+        if (value)
+        {
+            id = *value;
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        first = (first + 1) % MAX_PENDING;
+        --pending;
+        return status != GL_WAIT_FAILED && value;
+    }
+
+private:
+    GLuint buffers[MAX_PENDING] = {};
+    GLsync fences[MAX_PENDING] = {};
+    GLuint readFramebuffer = 0;
+    int first = 0;          // oldest pick in flight
+    int pending = 0;
+};
+#endif
@@ -0,0 +1,342 @@
+#pragma once
+
+#ifndef PROCMESH_H
+#define PROCMESH_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <unordered_map>
+#include <vector>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Indexed geometry in the scene's vertex layout: position, normal, texture coordinate, 8 floats per vertex
+struct ProceduralMesh
+{
+    std::vector<GLfloat> Vertices;
+    std::vector<GLushort> Indices;      // triangle list, counterclockwise from outside
+};
+
+// Architectural primitives at any tessellation: boxes, capped cylinders, fluted columns, stairs and
+// pediments. Each shape is built once per set of parameters at the origin and cached by a hash of them;
+// Append then copies it into place, so a colonnade of identical columns costs one column plus a copy each.
+//
+// Surfaces of revolution are built a ring at a time from a template ring at unit radius. Every vertex of a
+// ring is the template vertex times one 8 float scale plus one 8 float offset, which also places positions
+// and normals on copy. A vertex is exactly one AVX register, so with AVX2 that is a multiply and an add per
+// vertex.
+class MeshGenerator
+{
+public:
+    static const int FLOATS_PER_VERTEX = 8;
+    static const int MIN_SEGMENTS = 3;
+    static const int MAX_SEGMENTS = 1024;
+    static const int MAX_FLUTES = 64;
+    static const int SAMPLES_PER_FLUTE = 4;     // around the column, per flute
+    static const int SHAFT_RINGS = 8;           // up the column, for the taper
+    static const int MAX_STEPS = 64;
+    static constexpr float COLUMN_TAPER = 0.15f;        // the top of a shaft is this much narrower
+    static constexpr float FLUTE_DEPTH = 0.12f;         // of the radius
+    static constexpr float PLINTH_SIZE = 2.5f;          // square base and top of a column, in radii across
+    static constexpr float PLINTH_HEIGHT = 0.5f;        // in radii
+
+    size_t Generated = 0;   // shapes built
+    size_t Reused = 0;      // shapes taken from the cache
+
+    // size is the extent from the min corner, which goes at the origin
+    const ProceduralMesh& Box(const glm::vec3& size)
+    {
+        return shape(SHAPE_BOX, { size.x, size.y, size.z });
+    }
+
+    // along z from the center of the base
+    const ProceduralMesh& Cylinder(float radius, float height, int segments)
+    {
+        return shape(SHAPE_CYLINDER, { radius, height, (float)segments });
+    }
+
+    // fluted, tapering shaft between a square plinth and top, along z from the center of the base. height
+    // includes the plinth and top
+    const ProceduralMesh& Column(float radius, float height, int flutes)
+    {
+        return shape(SHAPE_COLUMN, { radius, height, (float)flutes });
+    }
+
+    // steps climbing toward +y, from the min corner
+    const ProceduralMesh& Stairs(float width, float depth, float height, int steps)
+    {
+        return shape(SHAPE_STAIRS, { width, depth, height, (float)steps });
+    }
+
+    // triangular gable along x with its ridge halfway, extruded along y, from the min corner
+    const ProceduralMesh& Pediment(float width, float depth, float height)
+    {
+        return shape(SHAPE_PEDIMENT, { width, depth, height });
+    }
+
+    // copies mesh to position at the end of vertices and indices. False, with nothing added, if the
+    // vertices would no longer fit 16 bit indices
+    static bool Append(const ProceduralMesh& mesh, const glm::vec3& position, std::vector<GLfloat>& vertices, std::vector<GLushort>& indices)
+    {
+        size_t base = vertices.size() / FLOATS_PER_VERTEX;
+        size_t count = mesh.Vertices.size() / FLOATS_PER_VERTEX;
+        if (base + count > 0x10000)
+            return false;
+
+        const GLfloat scale[FLOATS_PER_VERTEX] = { 1, 1, 1, 1, 1, 1, 1, 1 };
+        const GLfloat offset[FLOATS_PER_VERTEX] = { position.x, position.y, position.z, 0, 0, 0, 0, 0 };
+        vertices.resize(vertices.size() + mesh.Vertices.size());
+        transform(mesh.Vertices.data(), count, scale, offset, vertices.data() + base * FLOATS_PER_VERTEX);
+
+        size_t first = indices.size();
+        indices.resize(first + mesh.Indices.size());
+        for (size_t i = 0; i < mesh.Indices.size(); ++i)
+            indices[first + i] = (GLushort)(mesh.Indices[i] + base);
+        return true;
+    }
+
+private:
+    static_assert(FLOATS_PER_VERTEX == 8, "a vertex is one AVX register");
+
+    enum ShapeKind { SHAPE_BOX, SHAPE_CYLINDER, SHAPE_COLUMN, SHAPE_STAIRS, SHAPE_PEDIMENT };
+
+    struct CacheEntry
+    {
+        std::vector<float> Key;     // kind and parameters, to tell hash collisions apart
+        ProceduralMesh Mesh;
+    };
+
+    std::unordered_map<uint64_t, CacheEntry> cache;
+
+    const ProceduralMesh& shape(ShapeKind kind, std::initializer_list<float> parameters)
+    {
+        std::vector<float> key(1, (float)kind);
+        key.insert(key.end(), parameters.begin(), parameters.end());
+
+        // FNV-1a over the bits of the key
+        uint64_t hash = 14695981039346656037ull;
+        for (float value : key)
+        {
+            uint32_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            for (int byte = 0; byte < 4; ++byte)
+                hash = (hash ^ ((bits >> (byte * 8)) & 0xFF)) * 1099511628211ull;
+        }
+
+        CacheEntry& entry = cache[hash];
+        if (entry.Key == key)
+        {
+            ++Reused;
+            return entry.Mesh;
+        }
+        entry.Key = key;
+        entry.Mesh = ProceduralMesh();
+        const float* p = key.data() + 1;
+        switch (kind)
+        {
+        case SHAPE_BOX: addBox(entry.Mesh, glm::vec3(0.0f), glm::vec3(p[0], p[1], p[2])); break;
+        case SHAPE_CYLINDER: buildCylinder(entry.Mesh, p[0], p[1], (int)p[2]); break;
+        case SHAPE_COLUMN: buildColumn(entry.Mesh, p[0], p[1], (int)p[2]); break;
+        case SHAPE_STAIRS: buildStairs(entry.Mesh, p[0], p[1], p[2], (int)p[3]); break;
+        case SHAPE_PEDIMENT: buildPediment(entry.Mesh, p[0], p[1], p[2]); break;
+        }
+        ++Generated;
+        return entry.Mesh;
+    }
+
+    // out[v] = vertices[v] * scale + offset, elementwise over the 8 floats of each of count vertices
+    static void transform(const GLfloat* vertices, size_t count, const GLfloat scale[FLOATS_PER_VERTEX],
+        const GLfloat offset[FLOATS_PER_VERTEX], GLfloat* out)
+    {
+#if defined(__AVX2__)
+        const __m256 s = _mm256_loadu_ps(scale);
+        const __m256 o = _mm256_loadu_ps(offset);
+        for (size_t v = 0; v < count; ++v)
+            _mm256_storeu_ps(out + v * FLOATS_PER_VERTEX, _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(vertices + v * FLOATS_PER_VERTEX), s), o));
+#else
+        for (size_t v = 0; v < count; ++v)
+            for (int k = 0; k < FLOATS_PER_VERTEX; ++k)
+                out[v * FLOATS_PER_VERTEX + k] = vertices[v * FLOATS_PER_VERTEX + k] * scale[k] + offset[k];
+#endif
+    }
+
+    static void addVertex(ProceduralMesh& mesh, const glm::vec3& position, const glm::vec3& normal, float u, float v)
+    {
+        const GLfloat vertex[FLOATS_PER_VERTEX] = { position.x, position.y, position.z, normal.x, normal.y, normal.z, u, v };
+        mesh.Vertices.insert(mesh.Vertices.end(), vertex, vertex + FLOATS_PER_VERTEX);
+    }
+
+    static GLushort vertexCount(const ProceduralMesh& mesh)
+    {
+        return (GLushort)(mesh.Vertices.size() / FLOATS_PER_VERTEX);
+    }
+
+    // a, b, c, d counterclockwise seen from where normal points
+    static void addQuad(ProceduralMesh& mesh, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const glm::vec3& d, const glm::vec3& normal)
+    {
+        GLushort first = vertexCount(mesh);
+        addVertex(mesh, a, normal, 0.0f, 0.0f);
+        addVertex(mesh, b, normal, 1.0f, 0.0f);
+        addVertex(mesh, c, normal, 1.0f, 1.0f);
+        addVertex(mesh, d, normal, 0.0f, 1.0f);
+        const GLushort quad[6] = { first, (GLushort)(first + 1), (GLushort)(first + 2), (GLushort)(first + 2), (GLushort)(first + 3), first };
+        mesh.Indices.insert(mesh.Indices.end(), quad, quad + 6);
+    }
+
+    // flat shaded, each face textured 0 to 1
+    static void addBox(ProceduralMesh& mesh, const glm::vec3& min, const glm::vec3& max)
+    {
+        glm::vec3 p[8];
+        for (int i = 0; i < 8; ++i)
+            p[i] = glm::vec3(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z);
+        addQuad(mesh, p[0], p[2], p[3], p[1], glm::vec3(0, 0, -1));
+        addQuad(mesh, p[4], p[5], p[7], p[6], glm::vec3(0, 0, 1));
+        addQuad(mesh, p[0], p[1], p[5], p[4], glm::vec3(0, -1, 0));
+        addQuad(mesh, p[3], p[2], p[6], p[7], glm::vec3(0, 1, 0));
+        addQuad(mesh, p[2], p[0], p[4], p[6], glm::vec3(-1, 0, 0));
+        addQuad(mesh, p[1], p[3], p[7], p[5], glm::vec3(1, 0, 0));
+    }
+
+    // unit radius ring of segments + 1 vertices, the last repeating the first with u = 1. flutes > 0 cuts that
+    // many rounded grooves, FLUTE_DEPTH deep. Positions and normals lie in the xy plane; z and v are 0
+    static std::vector<GLfloat> ringTemplate(int segments, int flutes)
+    {
+        std::vector<GLfloat> ring((size_t)(segments + 1) * FLOATS_PER_VERTEX, 0.0f);
+        const float twoPi = 6.28318530718f;
+        for (int i = 0; i <= segments; ++i)
+        {
+            float angle = twoPi * (i % segments) / segments;
+            float c = std::cos(angle), s = std::sin(angle);
+            // r(angle) and its derivative; the normal of the curve r(angle) * (c, s) is (r c + r' s, r s - r' c)
+            float r = 1.0f, dr = 0.0f;
+            if (flutes > 0)
+            {
+                r = 1.0f - FLUTE_DEPTH * (0.5f + 0.5f * std::cos(flutes * angle));
+                dr = 0.5f * FLUTE_DEPTH * flutes * std::sin(flutes * angle);
+            }
+            glm::vec2 normal = glm::normalize(glm::vec2(r * c + dr * s, r * s - dr * c));
+            GLfloat* v = &ring[(size_t)i * FLOATS_PER_VERTEX];
+            v[0] = r * c;
+            v[1] = r * s;
+            v[3] = normal.x;
+            v[4] = normal.y;
+            v[6] = (float)i / segments;
+        }
+        return ring;
+    }
+
+    // one ring of template at radius and height z, its normals tilted up by slope (radius lost per unit of
+    // height) and textured at v
+    static void addRing(ProceduralMesh& mesh, const std::vector<GLfloat>& ring, float radius, float z, float slope, float v)
+    {
+        float tilt = 1.0f / std::sqrt(1.0f + slope * slope);
+        const GLfloat scale[FLOATS_PER_VERTEX] = { radius, radius, 0, tilt, tilt, 0, 1, 0 };
+        const GLfloat offset[FLOATS_PER_VERTEX] = { 0, 0, z, 0, 0, slope * tilt, 0, v };
+        size_t first = mesh.Vertices.size();
+        mesh.Vertices.resize(first + ring.size());
+        transform(ring.data(), ring.size() / FLOATS_PER_VERTEX, scale, offset, mesh.Vertices.data() + first);
+    }
+
+    // quads between rings of count vertices starting at first, each ring after the last
+    static void connectRings(ProceduralMesh& mesh, GLushort first, int count, int rings)
+    {
+        for (int ring = 0; ring + 1 < rings; ++ring)
+            for (int i = 0; i + 1 < count; ++i)
+            {
+                GLushort a = (GLushort)(first + ring * count + i), b = (GLushort)(a + 1);
+                GLushort c = (GLushort)(b + count), d = (GLushort)(a + count);
+                const GLushort quad[6] = { a, b, c, c, d, a };
+                mesh.Indices.insert(mesh.Indices.end(), quad, quad + 6);
+            }
+    }
+
+    // disk at height z facing up or down, fanned from its center
+    static void addCap(ProceduralMesh& mesh, const std::vector<GLfloat>& ring, float radius, float z, bool up)
+    {
+        GLushort center = vertexCount(mesh);
+        glm::vec3 normal(0.0f, 0.0f, up ? 1.0f : -1.0f);
+        addVertex(mesh, glm::vec3(0.0f, 0.0f, z), normal, 0.5f, 0.5f);
+        int count = (int)(ring.size() / FLOATS_PER_VERTEX) - 1;
+        for (int i = 0; i < count; ++i)
+        {
+            const GLfloat* t = &ring[(size_t)i * FLOATS_PER_VERTEX];
+            addVertex(mesh, glm::vec3(t[0] * radius, t[1] * radius, z), normal, 0.5f + 0.5f * t[0], 0.5f + 0.5f * t[1]);
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            GLushort a = (GLushort)(center + 1 + i), b = (GLushort)(center + 1 + (i + 1) % count);
+            const GLushort triangle[3] = { center, up ? a : b, up ? b : a };
+            mesh.Indices.insert(mesh.Indices.end(), triangle, triangle + 3);
+        }
+    }
+
+    static void buildCylinder(ProceduralMesh& mesh, float radius, float height, int segments)
+    {
+        std::vector<GLfloat> ring = ringTemplate(segments, 0);
+        addRing(mesh, ring, radius, 0.0f, 0.0f, 0.0f);
+        addRing(mesh, ring, radius, height, 0.0f, 1.0f);
+        connectRings(mesh, 0, segments + 1, 2);
+        addCap(mesh, ring, radius, 0.0f, false);
+        addCap(mesh, ring, radius, height, true);
+    }
+
+    static void buildColumn(ProceduralMesh& mesh, float radius, float height, int flutes)
+    {
+        float half = radius * PLINTH_SIZE * 0.5f;
+        float plinth = std::min(radius * PLINTH_HEIGHT, height * 0.25f);
+        addBox(mesh, glm::vec3(-half, -half, 0.0f), glm::vec3(half, half, plinth));
+        addBox(mesh, glm::vec3(-half, -half, height - plinth), glm::vec3(half, half, height));
+
+        // r(t) = radius * (1 - COLUMN_TAPER * t^2) from t = 0 at the plinth to 1 at the top
+        std::vector<GLfloat> ring = ringTemplate(flutes * SAMPLES_PER_FLUTE, flutes);
+        GLushort first = vertexCount(mesh);
+        float shaft = height - 2.0f * plinth;
+        for (int i = 0; i < SHAFT_RINGS; ++i)
+        {
+            float t = (float)i / (SHAFT_RINGS - 1);
+            float slope = 2.0f * COLUMN_TAPER * t * radius / shaft;
+            addRing(mesh, ring, radius * (1.0f - COLUMN_TAPER * t * t), plinth + t * shaft, slope, t);
+        }
+        connectRings(mesh, first, flutes * SAMPLES_PER_FLUTE + 1, SHAFT_RINGS);
+    }
+
+    // a stack of slabs, each one step shorter toward -y than the one below
+    static void buildStairs(ProceduralMesh& mesh, float width, float depth, float height, int steps)
+    {
+        for (int step = 0; step < steps; ++step)
+            addBox(mesh, glm::vec3(0.0f, depth * step / steps, height * step / steps), glm::vec3(width, depth, height * (step + 1) / steps));
+    }
+
+    static void buildPediment(ProceduralMesh& mesh, float width, float depth, float height)
+    {
+        glm::vec3 left(0.0f, 0.0f, 0.0f), right(width, 0.0f, 0.0f), ridge(width * 0.5f, 0.0f, height);
+        glm::vec3 back(0.0f, depth, 0.0f);
+
+        // gable ends
+        GLushort first = vertexCount(mesh);
+        addVertex(mesh, left, glm::vec3(0, -1, 0), 0.0f, 0.0f);
+        addVertex(mesh, right, glm::vec3(0, -1, 0), 1.0f, 0.0f);
+        addVertex(mesh, ridge, glm::vec3(0, -1, 0), 0.5f, 1.0f);
+        addVertex(mesh, left + back, glm::vec3(0, 1, 0), 1.0f, 0.0f);
+        addVertex(mesh, right + back, glm::vec3(0, 1, 0), 0.0f, 0.0f);
+        addVertex(mesh, ridge + back, glm::vec3(0, 1, 0), 0.5f, 1.0f);
+        const GLushort ends[6] = { first, (GLushort)(first + 1), (GLushort)(first + 2),
+            (GLushort)(first + 4), (GLushort)(first + 3), (GLushort)(first + 5) };
+        mesh.Indices.insert(mesh.Indices.end(), ends, ends + 6);
+
+        // roof slopes and underside
+        glm::vec3 leftNormal = glm::normalize(glm::vec3(-height, 0.0f, width * 0.5f));
+        glm::vec3 rightNormal = glm::normalize(glm::vec3(height, 0.0f, width * 0.5f));
+        addQuad(mesh, ridge, ridge + back, left + back, left, leftNormal);
+        addQuad(mesh, right, right + back, ridge + back, ridge, rightNormal);
+        addQuad(mesh, left, left + back, right + back, right, glm::vec3(0, 0, -1));
+    }
+};
+#endif
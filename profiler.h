@@ -0,0 +1,256 @@
+#pragma once
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <GL/glew.h>
+
+#include <chrono>
+#include <vector>
+#include <string>
+#include <fstream>
+
+// Frame profiler with CPU scopes (std::chrono) and GPU scopes (GL_TIMESTAMP queries). Every frame has its
+// own set of query objects in a ring FRAME_LATENCY frames deep, and a frame is only read back once all of
+// its queries are available, so collecting GPU times never stalls the pipeline. The last resolved frame is
+// kept in Results for an overlay, and while a trace is running every scope is also recorded for export as
+// Chrome trace_event JSON (load it in chrome://tracing or Perfetto).
+// The profiler belongs to the render thread. Other threads time themselves with NowMs and hand the results
+// over for AddCpu, which puts them on their own row of the trace.
+class Profiler
+{
+public:
+    static const int FRAME_LATENCY = 4;
+    static const int MAX_SCOPES = 32;
+
+    // trace rows
+    enum Track
+    {
+        TRACK_RENDER = 1,
+        TRACK_GPU = 2,
+        TRACK_MAIN = 3,
+    };
+
+    struct Scope
+    {
+        const char* Name;
+        bool Gpu;
+        double StartMs;         // relative to the profiler's creation
+        double DurationMs;
+        int Thread = TRACK_RENDER;
+    };
+
+    void Create()
+    {
+        epoch = std::chrono::high_resolution_clock::now();
+        for (Frame& frame : frames)
+        {
+            glGenQueries(MAX_SCOPES * 2, frame.Queries);
+            frame.Scopes.reserve(MAX_SCOPES * 2);
+        }
+        Calibrate();
+    }
+
+    void Destroy()
+    {
+        for (Frame& frame : frames)
+            glDeleteQueries(MAX_SCOPES * 2, frame.Queries);
+    }
+
+    // reads back the oldest frame in the ring if the GPU is done with it, then starts recording a new one.
+    // id comes back as ResultsId once this frame's results are in
+    void BeginFrame(int id = -1)
+    {
+        Frame& oldest = frames[current];
+        if (oldest.Pending)
+            Resolve(oldest);
+
+        oldest.Scopes.clear();
+        oldest.GpuScopeCount = 0;
+        oldest.Pending = true;
+        oldest.StartMs = NowMs();
+        oldest.Id = id;
+    }
+
+    // moves to the next frame of the ring
+    void EndFrame()
+    {
+        Frame& frame = frames[current];
+        frame.DurationMs = NowMs() - frame.StartMs;
+        current = (current + 1) % FRAME_LATENCY;
+    }
+
+    int BeginCpu(const char* name)
+    {
+        Frame& frame = frames[current];
+        frame.Scopes.push_back({ name, false, NowMs(), 0.0 });
+        return (int)frame.Scopes.size() - 1;
+    }
+
+    void EndCpu(int scope)
+    {
+        Scope& s = frames[current].Scopes[scope];
+        s.DurationMs = NowMs() - s.StartMs;
+    }
+
+    // records a scope another thread timed itself with NowMs
+    void AddCpu(const char* name, double startMs, double durationMs, int thread = TRACK_MAIN)
+    {
+        frames[current].Scopes.push_back({ name, false, startMs, durationMs, thread });
+    }
+
+    // returns -1 when the frame has run out of queries; EndGpu ignores that
+    int BeginGpu(const char* name)
+    {
+        Frame& frame = frames[current];
+        if (frame.GpuScopeCount >= MAX_SCOPES)
+            return -1;
+        int query = frame.GpuScopeCount++;
+        glQueryCounter(frame.Queries[query * 2], GL_TIMESTAMP);
+        frame.Scopes.push_back({ name, true, 0.0, 0.0 });
+        frame.GpuScope[query] = (int)frame.Scopes.size() - 1;
+        return query;
+    }
+
+    void EndGpu(int query)
+    {
+        if (query < 0)
+            return;
+        glQueryCounter(frames[current].Queries[query * 2 + 1], GL_TIMESTAMP);
+    }
+
+    // starts collecting every resolved scope for WriteTrace
+    void StartTrace()
+    {
+        trace.clear();
+        Calibrate();
+        Tracing = true;
+    }
+
+    // stops collecting and writes the collected scopes as Chrome trace_event JSON
+    bool WriteTrace(const std::string& path)
+    {
+        Tracing = false;
+        std::ofstream out(path);
+        if (!out)
+            return false;
+
+        out << "{\"traceEvents\":[\n";
+        for (size_t i = 0; i < trace.size(); ++i)
+        {
+            const Scope& s = trace[i];
+            out << "{\"name\":\"" << s.Name << "\",\"cat\":\"" << (s.Gpu ? "gpu" : "cpu")
+                << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << (s.Gpu ? (int)TRACK_GPU : s.Thread)
+                << ",\"ts\":" << s.StartMs * 1000.0 << ",\"dur\":" << s.DurationMs * 1000.0 << "}"
+                << (i + 1 < trace.size() ? ",\n" : "\n");
+        }
+        out << "],\n\"displayTimeUnit\":\"ms\"}\n";
+        trace.clear();
+        return true;
+    }
+
+    // milliseconds since Create; only reads state set before any thread starts, so any thread may call it
+    double NowMs() const
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - epoch).count();
+    }
+
+    std::vector<Scope> Results;     // scopes of the most recently resolved frame, in recording order
+    double FrameMs = 0.0;           // CPU time between BeginFrame and EndFrame of that frame
+    int ResultsId = -1;             // the id that frame was started with
+    bool Tracing = false;
+
+private:
+    static const size_t MAX_TRACE_SCOPES = 1 << 20;
+
+    struct Frame
+    {
+        GLuint Queries[MAX_SCOPES * 2];
+        int GpuScope[MAX_SCOPES];   // index into Scopes of each GPU query pair
+        int GpuScopeCount = 0;
+        std::vector<Scope> Scopes;
+        double StartMs = 0.0;
+        double DurationMs = 0.0;
+        int Id = -1;
+        bool Pending = false;
+    };
+
+    void Resolve(Frame& frame)
+    {
+        // the last query written is the last to complete, if it isn't ready skip this frame's results
+        if (frame.GpuScopeCount > 0)
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(frame.Queries[frame.GpuScopeCount * 2 - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+            {
+                frame.Pending = false;
+                return;
+            }
+        }
+
+        for (int i = 0; i < frame.GpuScopeCount; ++i)
+        {
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(frame.Queries[i * 2], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(frame.Queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+            Scope& s = frame.Scopes[frame.GpuScope[i]];
+            s.StartMs = (double)(GLint64)(begin - gpuEpoch) / 1.0e6 + cpuAtGpuEpoch;
+            s.DurationMs = (double)(end - begin) / 1.0e6;
+        }
+
+        Results = frame.Scopes;
+        FrameMs = frame.DurationMs;
+        ResultsId = frame.Id;
+        frame.Pending = false;
+
+        if (Tracing && trace.size() + frame.Scopes.size() <= MAX_TRACE_SCOPES)
+        {
+            trace.push_back({ "Frame", false, frame.StartMs, frame.DurationMs });
+            trace.insert(trace.end(), frame.Scopes.begin(), frame.Scopes.end());
+        }
+    }
+
+    // pairs a GPU timestamp with the CPU clock so GPU scopes line up with CPU scopes in the trace
+    void Calibrate()
+    {
+        GLint64 gpuNow = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+        gpuEpoch = (GLuint64)gpuNow;
+        cpuAtGpuEpoch = NowMs();
+    }
+
+    Frame frames[FRAME_LATENCY];
+    int current = 0;
+    std::vector<Scope> trace;
+    std::chrono::high_resolution_clock::time_point epoch;
+    GLuint64 gpuEpoch = 0;
+    double cpuAtGpuEpoch = 0.0;
+};
+
+
+// Times the enclosing block on the CPU
+class CpuScope
+{
+public:
+    CpuScope(Profiler& profiler, const char* name) : profiler(profiler), scope(profiler.BeginCpu(name)) {}
+    ~CpuScope() { profiler.EndCpu(scope); }
+
+private:
+    Profiler& profiler;
+    int scope;
+};
+
+
+// Times the GL commands issued in the enclosing block on the GPU
+class GpuScope
+{
+public:
+    GpuScope(Profiler& profiler, const char* name) : profiler(profiler), query(profiler.BeginGpu(name)) {}
+    ~GpuScope() { profiler.EndGpu(query); }
+
+private:
+    Profiler& profiler;
+    int query;
+};
+#endif
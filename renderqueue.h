@@ -0,0 +1,231 @@
+#pragma once
+
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <vector>
+#include <cstdint>
+
+#include "glstate.h"
+
+// Passes are the most significant part of the sort key, so every draw of one pass is submitted before the next
+enum RenderPass
+{
+    PASS_DEPTH = 0,     // depth-only prepass, sorted purely front-to-back
+    PASS_OPAQUE = 1,    // lit opaque geometry, sorted by state with depth breaking ties
+};
+
+// Everything needed to issue one draw. Programs, textures and VAOs are GL names; the sort key uses the
+// dense IDs next to them instead, since GL names outgrow the key's fields once render targets and streamed
+// textures are allocated
+struct DrawItem
+{
+    uint16_t ProgramKey;    // below RenderQueue::MAX_PROGRAMS
+    uint16_t MaterialKey;   // below RenderQueue::MAX_MATERIALS
+    uint16_t MeshKey;       // below RenderQueue::MAX_MESHES
+    GLuint Program;
+    GLint ModelLocation;    // location of the "model" uniform in Program
+    GLuint VAO;
+    GLsizei IndexCount;
+    size_t IndexOffset;     // byte offset of the first index in the VAO's element buffer
+    GLuint Texture;
+    GLint ObjectIdLocation; // location of the "objectId" uniform in Program, written to the picking buffer
+    GLuint ObjectId;
+    glm::mat4 Model;
+    glm::vec3 Center;       // world space center of the mesh bounds, used for depth sorting
+    glm::vec3 BoundsMin;    // object space mesh bounds, for occlusion tests
+    glm::vec3 BoundsMax;
+};
+
+// One entry of the command bucket: the 64 bit sort key and the draw it refers to
+struct DrawCommand
+{
+    uint64_t Key;
+    uint32_t Item;
+};
+
+
+// Command bucket of the frame's draws. Each draw is recorded with a 64 bit key laid out (high to low) as
+//   pass:4 | program:8 | material:12 | mesh:12 | depth:28
+// so a single radix sort groups draws by pass, then by state, then front-to-back.
+class RenderQueue
+{
+public:
+    static const uint32_t MAX_PROGRAMS = 1 << 8;
+    static const uint32_t MAX_MATERIALS = 1 << 12;
+    static const uint32_t MAX_MESHES = 1 << 12;
+
+    // forgets the draws recorded last frame (keeps the allocations)
+    void Clear()
+    {
+        Items.clear();
+        Commands.clear();
+    }
+
+    // records a draw; center is the object space center of the mesh bounds
+    void Submit(const DrawItem& draw, const glm::vec3& center)
+    {
+        DrawItem item = draw;
+        item.Center = glm::vec3(draw.Model * glm::vec4(center, 1.0f));
+        Items.push_back(item);
+    }
+
+    // builds the keys for every recorded draw and sorts them. The prepass draws use depthProgram and ignore
+    // material and mesh, so they come out strictly nearest first.
+    void Sort(const glm::mat4& view, float farPlane, bool depthPrepass, GLuint depthProgram, GLint depthModelLocation)
+    {
+        prepassProgram = depthProgram;
+        prepassModelLocation = depthModelLocation;
+        Commands.clear();
+        for (uint32_t i = 0; i < (uint32_t)Items.size(); ++i)
+        {
+            const DrawItem& item = Items[i];
+            float depth = -(view * glm::vec4(item.Center, 1.0f)).z;   // camera looks down -z in view space
+            if (depthPrepass)
+                Commands.push_back({ MakeKey(PASS_DEPTH, depthProgram, 0, 0, depth / farPlane), i });
+            Commands.push_back({ MakeKey(PASS_OPAQUE, item.ProgramKey, item.MaterialKey, item.MeshKey, depth / farPlane), i });
+        }
+        RadixSort(Commands, scratch);
+    }
+
+    // issues every draw of one pass in key order through the state tracker. The caller sets up pass state
+    // (color mask, depth func, per-frame uniforms) beforehand. conditions, indexed by object ID, holds the
+    // query each object is drawn conditionally on, 0 to draw it regardless
+    void Flush(RenderPass pass, GLState& state, const std::vector<GLuint>* conditions = nullptr) const
+    {
+        for (const DrawCommand& command : Commands)
+        {
+            if ((command.Key >> 60) != (uint64_t)pass)
+                continue;
+
+            const DrawItem& item = Items[command.Item];
+            if (pass == PASS_DEPTH)
+            {
+                state.UseProgram(prepassProgram);
+                glUniformMatrix4fv(prepassModelLocation, 1, GL_FALSE, glm::value_ptr(item.Model));
+            }
+            else
+            {
+                state.UseProgram(item.Program);
+                state.BindTexture(0, GL_TEXTURE_2D, item.Texture);
+                glUniformMatrix4fv(item.ModelLocation, 1, GL_FALSE, glm::value_ptr(item.Model));
+                glUniform1ui(item.ObjectIdLocation, item.ObjectId);
+            }
+            state.BindVertexArray(item.VAO);
+            GLuint condition = conditions && item.ObjectId < conditions->size() ? (*conditions)[item.ObjectId] : 0;
+            if (condition)
+                glBeginConditionalRender(condition, GL_QUERY_NO_WAIT);
+            glDrawElements(GL_TRIANGLES, item.IndexCount, GL_UNSIGNED_SHORT, (const void*)item.IndexOffset);
+            if (condition)
+                glEndConditionalRender();
+        }
+    }
+
+    // packs the fields into a key. The ids are the dense ones of DrawItem; past the MAX_ limits they would
+    // alias and draws with different state would sort as if they shared it
+    static uint64_t MakeKey(RenderPass pass, uint32_t program, uint32_t material, uint32_t mesh, float depth01)
+    {
+        if (depth01 < 0.0f) depth01 = 0.0f;
+        if (depth01 > 1.0f) depth01 = 1.0f;
+        uint64_t depthBits = (uint64_t)(depth01 * (float)0x0FFFFFFF);
+
+        return ((uint64_t)pass & 0xF) << 60
+            | ((uint64_t)program & (MAX_PROGRAMS - 1)) << 52
+            | ((uint64_t)material & (MAX_MATERIALS - 1)) << 40
+            | ((uint64_t)mesh & (MAX_MESHES - 1)) << 28
+            | depthBits;
+    }
+
+    // LSD radix sort, one byte per pass. Bytes that are equal in every key are skipped.
+    static void RadixSort(std::vector<DrawCommand>& commands, std::vector<DrawCommand>& scratch)
+    {
+        scratch.resize(commands.size());
+        for (int shift = 0; shift < 64; shift += 8)
+        {
+            size_t counts[256] = { 0 };
+            for (const DrawCommand& command : commands)
+                ++counts[(command.Key >> shift) & 0xFF];
+
+            if (commands.empty() || counts[(commands[0].Key >> shift) & 0xFF] == commands.size())
+                continue;
+
+            size_t offset = 0;
+            for (size_t& count : counts)
+            {
+                size_t c = count;
+                count = offset;
+                offset += c;
+            }
+            for (const DrawCommand& command : commands)
+                scratch[counts[(command.Key >> shift) & 0xFF]++] = command;
+            commands.swap(scratch);
+        }
+    }
+
+    std::vector<DrawItem> Items;
+    std::vector<DrawCommand> Commands;
+
+private:
+    std::vector<DrawCommand> scratch;
+    GLuint prepassProgram = 0;
+    GLint prepassModelLocation = -1;
+};
+
+
+// Counts the fragments that pass the depth test in the color pass with GL_SAMPLES_PASSED queries.
+// Two queries are alternated and each result is read just before its query is reused, so the CPU never waits for the GPU.
+class OverdrawCounter
+{
+public:
+    void Create()
+    {
+        glGenQueries(2, queries);
+    }
+
+    void Destroy()
+    {
+        glDeleteQueries(2, queries);
+    }
+
+    void Begin()
+    {
+        glBeginQuery(GL_SAMPLES_PASSED, queries[frame % 2]);
+    }
+
+    void End()
+    {
+        glEndQuery(GL_SAMPLES_PASSED);
+        ++frame;
+    }
+
+    // call before Begin: picks up the result from two frames ago if the GPU has finished with it.
+    // pixels is the size of the render target
+    void Resolve(int pixels)
+    {
+        if (frame < 2)
+            return;
+
+        GLuint query = queries[frame % 2];   // the query Begin is about to reuse
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+
+        GLuint samples = 0;
+        glGetQueryObjectuiv(query, GL_QUERY_RESULT, &samples);
+        ShadedFragments = samples;
+        Overdraw = pixels > 0 ? (float)samples / (float)pixels : 0.0f;
+    }
+
+    GLuint ShadedFragments = 0;     // fragments that ran the lighting shader last frame
+    float Overdraw = 0.0f;          // shaded fragments per pixel of the window
+
+private:
+    GLuint queries[2] = { 0, 0 };
+    unsigned int frame = 0;
+};
+#endif
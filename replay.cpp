@@ -0,0 +1,845 @@
+// Standalone replay of a GL trace recorded with "Application --capture <trace.bin> [frames]".
+//
+//     replay <trace.bin> [loops]
+//
+// Creates a hidden window with the same context version and framebuffer size as the app, runs the setup part
+// of the trace once, then re-runs its frames loops times as fast as possible (no vsync) and prints the frame
+// times and how long each GL entry point took. Every run issues exactly the same calls with the same data, so
+// two builds, drivers or machines can be compared on an identical workload.
+//
+// Call times are CPU side: the time the driver took to accept the call. GPU work shows up where the driver
+// blocks on it, usually in the swap (EndFrame) or in query and fence waits.
+
+#include <cstdlib>          // EXIT_FAILURE
+#include <cstdio>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <chrono>
+#include <algorithm>
+#include <GL/glew.h>        // GLEW library
+#include <GLFW/glfw3.h>     // GLFW library
+#include "gltrace.h"        // Trace format
+#include "logger.h"         // Asynchronous logging
+
+using namespace std; // Standard namespace
+
+// Unnamed namespace
+namespace
+{
+    const char* const WINDOW_TITLE = "Trace replay";
+
+    // Object names in the trace mapped to the ones created by this context
+    unordered_map<GLuint, GLuint> gBuffers, gVertexArrays, gTextures, gQueries, gPrograms, gShaders, gFramebuffers;
+    unordered_map<uint64_t, GLsync> gSyncs;
+    unordered_map<uint64_t, GLint> gUniformLocations;     // by captured program << 32 | captured location
+    unordered_map<GLuint, char*> gMappings;               // persistently mapped memory by captured buffer name
+    GLuint gCurrentProgram = 0;                            // captured name of the program in use
+
+    // Time spent in each kind of call while replaying frames
+    struct CallTiming
+    {
+        uint64_t Calls = 0;
+        double Ms = 0.0;
+    };
+    CallTiming gTimings[OP_COUNT];
+
+    vector<char> gTrace;
+    vector<float> gUniformData;
+}
+
+/* User-defined Function prototypes to:
+ * load the trace, run one command of it, and map captured names to replay names
+ */
+bool ULoadTrace(const char* filename, GLTraceHeader& header);
+int UExecute(GLTraceReader& reader, GLFWwindow* window);
+GLuint UName(const unordered_map<GLuint, GLuint>& names, GLuint captured);
+GLint ULocation(GLint captured);
+void UGenNames(GLTraceReader& reader, unordered_map<GLuint, GLuint>& names, PFNGLGENBUFFERSPROC gen);
+void UDeleteNames(GLTraceReader& reader, unordered_map<GLuint, GLuint>& names, PFNGLDELETEBUFFERSPROC del);
+const GLfloat* UFloats(GLTraceReader& reader, size_t count);
+
+
+int main(int argc, char* argv[])
+{
+    Logger::Instance().Start();
+
+    if (argc < 2)
+    {
+        LOG_ERROR("usage: replay <trace.bin> [loops]");
+        Logger::Instance().Stop();
+        return EXIT_FAILURE;
+    }
+    int loops = argc >= 3 ? max(atoi(argv[2]), 1) : 10;
+
+    GLTraceHeader header;
+    if (!ULoadTrace(argv[1], header))
+    {
+        Logger::Instance().Stop();
+        return EXIT_FAILURE;
+    }
+
+    // Same context as the app, in a window that never shows
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#ifdef __APPLE__
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+    GLFWwindow* window = glfwCreateWindow((int)header.Width, (int)header.Height, WINDOW_TITLE, NULL, NULL);
+    if (window == NULL)
+    {
+        LOG_ERROR("Failed to create GLFW window");
+        glfwTerminate();
+        Logger::Instance().Stop();
+        return EXIT_FAILURE;
+    }
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(0);
+
+    glewExperimental = GL_TRUE;
+    GLenum GlewInitResult = glewInit();
+    if (GLEW_OK != GlewInitResult)
+    {
+        LOG_ERROR("%s", (const char*)glewGetErrorString(GlewInitResult));
+        glfwTerminate();
+        Logger::Instance().Stop();
+        return EXIT_FAILURE;
+    }
+
+    GLTraceReader reader(gTrace.data() + sizeof(header), gTrace.size() - sizeof(header));
+
+    // Setup: everything up to the first frame, replayed once and not timed
+    size_t framesBegin = 0;
+    bool failed = false;
+    while (!reader.AtEnd())
+    {
+        size_t position = reader.Position();
+        int op = UExecute(reader, window);
+        if (op < 0)
+        {
+            failed = true;
+            break;
+        }
+        if (op == OP_BeginFrame)
+        {
+            framesBegin = position;
+            break;
+        }
+    }
+    if (!failed && reader.AtEnd())
+    {
+        LOG_ERROR("%s has no frames", argv[1]);
+        failed = true;
+    }
+
+    // Frames: the rest of the trace, looped
+    vector<double> frameMs;
+    typedef chrono::steady_clock Clock;
+    Clock::time_point frameStart = Clock::now();
+    for (int loop = 0; loop < loops && !failed; ++loop)
+    {
+        reader.Seek(framesBegin);
+        while (!reader.AtEnd())
+        {
+            Clock::time_point start = Clock::now();
+            int op = UExecute(reader, window);
+            Clock::time_point end = Clock::now();
+            if (op < 0)
+            {
+                failed = true;
+                break;
+            }
+
+            gTimings[op].Calls++;
+            gTimings[op].Ms += chrono::duration<double, milli>(end - start).count();
+            if (op == OP_BeginFrame)
+                frameStart = start;
+            else if (op == OP_EndFrame)
+                frameMs.push_back(chrono::duration<double, milli>(end - frameStart).count());
+        }
+    }
+    glFinish();
+
+    if (!frameMs.empty())
+    {
+        double total = 0.0;
+        for (double ms : frameMs)
+            total += ms;
+        sort(frameMs.begin(), frameMs.end());
+        LOG_INFO("%d frames x %d loops at %ux%u: %.3f ms average, %.3f median, %.3f min, %.3f max",
+            (int)frameMs.size() / loops, loops, header.Width, header.Height, total / frameMs.size(),
+            frameMs[frameMs.size() / 2], frameMs.front(), frameMs.back());
+
+        // Slowest calls first
+        int order[OP_COUNT];
+        for (int i = 0; i < OP_COUNT; ++i)
+            order[i] = i;
+        sort(order, order + OP_COUNT, [](int a, int b) { return gTimings[a].Ms > gTimings[b].Ms; });
+
+        LOG_INFO("%-26s %10s %12s %10s", "call", "count", "total ms", "avg us");
+        for (int i = 0; i < OP_COUNT; ++i)
+        {
+            const CallTiming& timing = gTimings[order[i]];
+            if (timing.Calls == 0)
+                continue;
+            LOG_INFO("%-26s %10llu %12.3f %10.3f", GLTraceOpName(order[i]), (unsigned long long)timing.Calls,
+                timing.Ms, timing.Ms * 1000.0 / timing.Calls);
+        }
+    }
+
+    glfwTerminate();
+    Logger::Instance().Stop();
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+// Reads the whole trace into gTrace and checks its header
+bool ULoadTrace(const char* filename, GLTraceHeader& header)
+{
+    FILE* file = fopen(filename, "rb");
+    if (!file)
+    {
+        LOG_ERROR("Failed to open %s", filename);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    gTrace.resize(size > 0 ? (size_t)size : 0);
+    size_t read = fread(gTrace.data(), 1, gTrace.size(), file);
+    fclose(file);
+
+    if (read != gTrace.size() || gTrace.size() < sizeof(header))
+    {
+        LOG_ERROR("Failed to read %s", filename);
+        return false;
+    }
+    memcpy(&header, gTrace.data(), sizeof(header));
+    if (header.Magic != GL_TRACE_MAGIC || header.Version != GL_TRACE_VERSION)
+    {
+        LOG_ERROR("%s is not a version %u GL trace", filename, GL_TRACE_VERSION);
+        return false;
+    }
+    LOG_INFO("Loaded %s (%zu KB, %ux%u)", filename, gTrace.size() / 1024, header.Width, header.Height);
+    return true;
+}
+
+
+// Runs the next command; returns its opcode, or -1 if the trace is damaged
+int UExecute(GLTraceReader& reader, GLFWwindow* window)
+{
+    int op = reader.U8();
+    switch (op)
+    {
+    case OP_BeginFrame:
+        break;
+    case OP_EndFrame:
+        glfwSwapBuffers(window);
+        break;
+    case OP_MappedWrite:
+    {
+        GLuint buffer = reader.U32();
+        uint64_t offset = reader.U64();
+        uint64_t size = reader.U64();
+        const char* bytes = reader.Bytes((size_t)size);
+        auto mapping = gMappings.find(buffer);
+        if (bytes && mapping != gMappings.end())
+            memcpy(mapping->second + offset, bytes, (size_t)size);
+        break;
+    }
+
+    case OP_glActiveTexture: glActiveTexture(reader.U32()); break;
+    case OP_glAttachShader:
+    {
+        GLuint program = UName(gPrograms, reader.U32());
+        glAttachShader(program, UName(gShaders, reader.U32()));
+        break;
+    }
+    case OP_glBeginQuery:
+    {
+        GLenum target = reader.U32();
+        glBeginQuery(target, UName(gQueries, reader.U32()));
+        break;
+    }
+    case OP_glBindBuffer:
+    {
+        GLenum target = reader.U32();
+        glBindBuffer(target, UName(gBuffers, reader.U32()));
+        break;
+    }
+    case OP_glBindBufferBase:
+    {
+        GLenum target = reader.U32();
+        GLuint index = reader.U32();
+        glBindBufferBase(target, index, UName(gBuffers, reader.U32()));
+        break;
+    }
+    case OP_glBindTexture:
+    {
+        GLenum target = reader.U32();
+        glBindTexture(target, UName(gTextures, reader.U32()));
+        break;
+    }
+    case OP_glBindVertexArray: glBindVertexArray(UName(gVertexArrays, reader.U32())); break;
+    case OP_glBindVertexBuffer:
+    {
+        GLuint binding = reader.U32();
+        GLuint buffer = UName(gBuffers, reader.U32());
+        GLintptr offset = (GLintptr)reader.U64();
+        GLsizei stride = reader.I32();
+        glBindVertexBuffer(binding, buffer, offset, stride);
+        break;
+    }
+    case OP_glBlendFunc:
+    {
+        GLenum src = reader.U32();
+        glBlendFunc(src, reader.U32());
+        break;
+    }
+    case OP_glBufferData:
+    case OP_glBufferStorage:
+    {
+        GLenum target = reader.U32();
+        uint64_t size = reader.U64();
+        bool hasData = reader.U32() != 0;
+        GLenum usage = reader.U32();    // or the storage flags
+        const char* data = hasData ? reader.Bytes((size_t)size) : NULL;
+        if (op == OP_glBufferData)
+            glBufferData(target, (GLsizeiptr)size, data, usage);
+        else
+            glBufferStorage(target, (GLsizeiptr)size, data, usage);
+        break;
+    }
+    case OP_glClear: glClear(reader.U32()); break;
+    case OP_glClearColor:
+    {
+        float r = reader.F32(), g = reader.F32(), b = reader.F32(), a = reader.F32();
+        glClearColor(r, g, b, a);
+        break;
+    }
+    case OP_glClientWaitSync:
+    {
+        uint64_t sync = reader.U64();
+        GLbitfield flags = reader.U32();
+        GLuint64 timeout = reader.U64();
+        auto found = gSyncs.find(sync);
+        if (found != gSyncs.end())
+            glClientWaitSync(found->second, flags, timeout);
+        break;
+    }
+    case OP_glColorMask:
+    {
+        GLboolean r = (GLboolean)reader.U32(), g = (GLboolean)reader.U32(), b = (GLboolean)reader.U32(), a = (GLboolean)reader.U32();
+        glColorMask(r, g, b, a);
+        break;
+    }
+    case OP_glCompileShader: glCompileShader(UName(gShaders, reader.U32())); break;
+    case OP_glCreateProgram: gPrograms[reader.U32()] = glCreateProgram(); break;
+    case OP_glCreateShader:
+    {
+        GLenum type = reader.U32();
+        gShaders[reader.U32()] = glCreateShader(type);
+        break;
+    }
+    case OP_glCullFace: glCullFace(reader.U32()); break;
+    case OP_glDeleteBuffers: UDeleteNames(reader, gBuffers, glDeleteBuffers); break;
+    case OP_glDeleteProgram:
+    {
+        GLuint program = reader.U32();
+        glDeleteProgram(UName(gPrograms, program));
+        gPrograms.erase(program);
+        break;
+    }
+    case OP_glDeleteQueries: UDeleteNames(reader, gQueries, glDeleteQueries); break;
+    case OP_glDeleteSync:
+    {
+        uint64_t sync = reader.U64();
+        auto found = gSyncs.find(sync);
+        if (found != gSyncs.end())
+        {
+            glDeleteSync(found->second);
+            gSyncs.erase(found);
+        }
+        break;
+    }
+    case OP_glDeleteVertexArrays: UDeleteNames(reader, gVertexArrays, glDeleteVertexArrays); break;
+    case OP_glDepthFunc: glDepthFunc(reader.U32()); break;
+    case OP_glDepthMask: glDepthMask((GLboolean)reader.U32()); break;
+    case OP_glDisable: glDisable(reader.U32()); break;
+    case OP_glDrawArrays:
+    {
+        GLenum mode = reader.U32();
+        GLint first = reader.I32();
+        glDrawArrays(mode, first, reader.I32());
+        break;
+    }
+    case OP_glDrawElements:
+    {
+        GLenum mode = reader.U32();
+        GLsizei count = reader.I32();
+        GLenum type = reader.U32();
+        glDrawElements(mode, count, type, (const void*)(uintptr_t)reader.U64());
+        break;
+    }
+    case OP_glEnable: glEnable(reader.U32()); break;
+    case OP_glEnableVertexAttribArray: glEnableVertexAttribArray(reader.U32()); break;
+    case OP_glEndQuery: glEndQuery(reader.U32()); break;
+    case OP_glFenceSync:
+    {
+        GLenum condition = reader.U32();
+        GLbitfield flags = reader.U32();
+        gSyncs[reader.U64()] = glFenceSync(condition, flags);
+        break;
+    }
+    case OP_glGenBuffers: UGenNames(reader, gBuffers, glGenBuffers); break;
+    case OP_glGenerateMipmap: glGenerateMipmap(reader.U32()); break;
+    case OP_glGenQueries: UGenNames(reader, gQueries, glGenQueries); break;
+    case OP_glGenTextures: UGenNames(reader, gTextures, glGenTextures); break;
+    case OP_glGenVertexArrays: UGenNames(reader, gVertexArrays, glGenVertexArrays); break;
+    case OP_glGetInteger64v:
+    {
+        GLint64 values[16];
+        glGetInteger64v(reader.U32(), values);
+        break;
+    }
+    case OP_glGetProgramInfoLog:
+    case OP_glGetShaderInfoLog:
+    {
+        GLuint object = reader.U32();
+        GLsizei size = min(reader.I32(), 4096);
+        char log[4096];
+        if (op == OP_glGetProgramInfoLog)
+            glGetProgramInfoLog(UName(gPrograms, object), size, NULL, log);
+        else
+            glGetShaderInfoLog(UName(gShaders, object), size, NULL, log);
+        break;
+    }
+    case OP_glGetProgramiv:
+    case OP_glGetShaderiv:
+    {
+        GLuint object = reader.U32();
+        GLenum pname = reader.U32();
+        GLint values[4];
+        if (op == OP_glGetProgramiv)
+            glGetProgramiv(UName(gPrograms, object), pname, values);
+        else
+            glGetShaderiv(UName(gShaders, object), pname, values);
+        break;
+    }
+    case OP_glGetQueryObjectiv:
+    case OP_glGetQueryObjectui64v:
+    case OP_glGetQueryObjectuiv:
+    {
+        GLuint query = UName(gQueries, reader.U32());
+        GLenum pname = reader.U32();
+        GLuint64 value;
+        if (op == OP_glGetQueryObjectiv)
+            glGetQueryObjectiv(query, pname, (GLint*)&value);
+        else if (op == OP_glGetQueryObjectuiv)
+            glGetQueryObjectuiv(query, pname, (GLuint*)&value);
+        else
+            glGetQueryObjectui64v(query, pname, &value);
+        break;
+    }
+    case OP_glGetUniformLocation:
+    {
+        GLuint program = reader.U32();
+        GLint location = reader.I32();
+        uint32_t size = reader.U32();
+        const char* name = reader.Bytes(size);
+        if (name && location >= 0)
+            gUniformLocations[(uint64_t)program << 32 | (uint32_t)location] = glGetUniformLocation(UName(gPrograms, program), string(name, size).c_str());
+        break;
+    }
+    case OP_glLinkProgram: glLinkProgram(UName(gPrograms, reader.U32())); break;
+    case OP_glMapBufferRange:
+    {
+        GLenum target = reader.U32();
+        GLintptr offset = (GLintptr)reader.U64();
+        GLsizeiptr length = (GLsizeiptr)reader.U64();
+        GLbitfield access = reader.U32();
+        GLuint buffer = reader.U32();
+        gMappings[buffer] = (char*)glMapBufferRange(target, offset, length, access);
+        break;
+    }
+    case OP_glQueryCounter:
+    {
+        GLuint query = UName(gQueries, reader.U32());
+        glQueryCounter(query, reader.U32());
+        break;
+    }
+    case OP_glShaderSource:
+    {
+        GLuint shader = UName(gShaders, reader.U32());
+        GLint size = reader.I32();
+        const char* source = reader.Bytes(size);
+        if (source)
+            glShaderSource(shader, 1, &source, &size);
+        break;
+    }
+    case OP_glTexImage2D:
+    {
+        GLenum target = reader.U32();
+        GLint level = reader.I32();
+        GLint internalFormat = reader.I32();
+        GLsizei width = reader.I32();
+        GLsizei height = reader.I32();
+        GLint border = reader.I32();
+        GLenum format = reader.U32();
+        GLenum type = reader.U32();
+        uint64_t size = reader.U64();
+        const char* pixels = size ? reader.Bytes((size_t)size) : NULL;
+        glTexImage2D(target, level, internalFormat, width, height, border, format, type, pixels);
+        break;
+    }
+    case OP_glTexParameteri:
+    {
+        GLenum target = reader.U32();
+        GLenum pname = reader.U32();
+        glTexParameteri(target, pname, reader.I32());
+        break;
+    }
+    case OP_glUniform1f:
+    {
+        GLint location = ULocation(reader.I32());
+        glUniform1f(location, reader.F32());
+        break;
+    }
+    case OP_glUniform1i:
+    {
+        GLint location = ULocation(reader.I32());
+        glUniform1i(location, reader.I32());
+        break;
+    }
+    case OP_glUniform2fv:
+    {
+        GLint location = ULocation(reader.I32());
+        GLsizei count = reader.I32();
+        glUniform2fv(location, count, UFloats(reader, 2 * count));
+        break;
+    }
+    case OP_glUniform3f:
+    {
+        GLint location = ULocation(reader.I32());
+        float x = reader.F32(), y = reader.F32(), z = reader.F32();
+        glUniform3f(location, x, y, z);
+        break;
+    }
+    case OP_glUniformMatrix4fv:
+    {
+        GLint location = ULocation(reader.I32());
+        GLsizei count = reader.I32();
+        GLboolean transpose = (GLboolean)reader.U32();
+        glUniformMatrix4fv(location, count, transpose, UFloats(reader, 16 * count));
+        break;
+    }
+    case OP_glUnmapBuffer:
+    {
+        GLenum target = reader.U32();
+        gMappings.erase(reader.U32());
+        glUnmapBuffer(target);
+        break;
+    }
+    case OP_glUseProgram:
+        gCurrentProgram = reader.U32();
+        glUseProgram(UName(gPrograms, gCurrentProgram));
+        break;
+    case OP_glVertexAttribBinding:
+    {
+        GLuint attribute = reader.U32();
+        glVertexAttribBinding(attribute, reader.U32());
+        break;
+    }
+    case OP_glVertexAttribFormat:
+    {
+        GLuint attribute = reader.U32();
+        GLint size = reader.I32();
+        GLenum type = reader.U32();
+        GLboolean normalized = (GLboolean)reader.U32();
+        glVertexAttribFormat(attribute, size, type, normalized, reader.U32());
+        break;
+    }
+    case OP_glVertexAttribPointer:
+    {
+        GLuint index = reader.U32();
+        GLint size = reader.I32();
+        GLenum type = reader.U32();
+        GLboolean normalized = (GLboolean)reader.U32();
+        GLsizei stride = reader.I32();
+        glVertexAttribPointer(index, size, type, normalized, stride, (const void*)(uintptr_t)reader.U64());
+        break;
+    }
+    case OP_glViewport:
+    {
+        GLint x = reader.I32(), y = reader.I32();
+        GLsizei width = reader.I32(), height = reader.I32();
+        glViewport(x, y, width, height);
+        break;
+    }
+    case OP_glBindFramebuffer:
+    {
+        GLenum target = reader.U32();
+        glBindFramebuffer(target, UName(gFramebuffers, reader.U32()));
+        break;
+    }
+    case OP_glCheckFramebufferStatus: glCheckFramebufferStatus(reader.U32()); break;
+    case OP_glDeleteFramebuffers: UDeleteNames(reader, gFramebuffers, glDeleteFramebuffers); break;
+    case OP_glDeleteTextures: UDeleteNames(reader, gTextures, glDeleteTextures); break;
+    case OP_glFramebufferTexture2D:
+    {
+        GLenum target = reader.U32();
+        GLenum attachment = reader.U32();
+        GLenum textureTarget = reader.U32();
+        GLuint texture = UName(gTextures, reader.U32());
+        glFramebufferTexture2D(target, attachment, textureTarget, texture, reader.I32());
+        break;
+    }
+    case OP_glGenFramebuffers: UGenNames(reader, gFramebuffers, glGenFramebuffers); break;
+    case OP_glReadPixels:
+    {
+        GLint x = reader.I32();
+        GLint y = reader.I32();
+        GLsizei width = reader.I32();
+        GLsizei height = reader.I32();
+        GLenum format = reader.U32();
+        GLenum type = reader.U32();
+        glReadPixels(x, y, width, height, format, type, (void*)(uintptr_t)reader.U64());
+        break;
+    }
+    case OP_glClearBufferuiv:
+    {
+        GLenum buffer = reader.U32();
+        GLint drawBuffer = reader.I32();
+        GLuint value[4] = {};
+        for (int i = 0; i < (buffer == GL_COLOR ? 4 : 1); ++i)
+            value[i] = reader.U32();
+        glClearBufferuiv(buffer, drawBuffer, value);
+        break;
+    }
+    case OP_glDrawBuffers:
+    {
+        GLsizei n = reader.I32();
+        vector<GLenum> buffers(n > 0 ? n : 0);
+        for (GLenum& buffer : buffers)
+            buffer = reader.U32();
+        glDrawBuffers(n, buffers.data());
+        break;
+    }
+    case OP_glReadBuffer: glReadBuffer(reader.U32()); break;
+    case OP_glUniform1ui:
+    {
+        GLint location = ULocation(reader.I32());
+        glUniform1ui(location, reader.U32());
+        break;
+    }
+    case OP_glClearBufferfv:
+    {
+        GLenum buffer = reader.U32();
+        GLint drawBuffer = reader.I32();
+        GLfloat value[4] = {};
+        for (int i = 0; i < (buffer == GL_COLOR ? 4 : 1); ++i)
+            value[i] = reader.F32();
+        glClearBufferfv(buffer, drawBuffer, value);
+        break;
+    }
+    case OP_glBeginConditionalRender:
+    {
+        GLuint id = UName(gQueries, reader.U32());
+        glBeginConditionalRender(id, reader.U32());
+        break;
+    }
+    case OP_glEndConditionalRender: glEndConditionalRender(); break;
+    case OP_glTexImage3D:
+    {
+        GLenum target = reader.U32();
+        GLint level = reader.I32();
+        GLint internalFormat = reader.I32();
+        GLsizei width = reader.I32();
+        GLsizei height = reader.I32();
+        GLsizei depth = reader.I32();
+        GLint border = reader.I32();
+        GLenum format = reader.U32();
+        GLenum type = reader.U32();
+        uint64_t size = reader.U64();
+        const char* pixels = size ? reader.Bytes((size_t)size) : NULL;
+        glTexImage3D(target, level, internalFormat, width, height, depth, border, format, type, pixels);
+        break;
+    }
+    case OP_glTexSubImage2D:
+    {
+        GLenum target = reader.U32();
+        GLint level = reader.I32();
+        GLint x = reader.I32();
+        GLint y = reader.I32();
+        GLsizei width = reader.I32();
+        GLsizei height = reader.I32();
+        GLenum format = reader.U32();
+        GLenum type = reader.U32();
+        uint64_t size = reader.U64();
+        const char* pixels = size ? reader.Bytes((size_t)size) : NULL;
+        glTexSubImage2D(target, level, x, y, width, height, format, type, pixels);
+        break;
+    }
+    case OP_glTexSubImage3D:
+    {
+        GLenum target = reader.U32();
+        GLint level = reader.I32();
+        GLint x = reader.I32();
+        GLint y = reader.I32();
+        GLint z = reader.I32();
+        GLsizei width = reader.I32();
+        GLsizei height = reader.I32();
+        GLsizei depth = reader.I32();
+        GLenum format = reader.U32();
+        GLenum type = reader.U32();
+        uint64_t size = reader.U64();
+        const char* pixels = size ? reader.Bytes((size_t)size) : NULL;
+        glTexSubImage3D(target, level, x, y, z, width, height, depth, format, type, pixels);
+        break;
+    }
+
+    case OP_glUniform2f:
+    {
+        GLint location = ULocation(reader.I32());
+        float x = reader.F32(), y = reader.F32();
+        glUniform2f(location, x, y);
+        break;
+    }
+    case OP_glDispatchCompute:
+    {
+        GLuint x = reader.U32(), y = reader.U32(), z = reader.U32();
+        glDispatchCompute(x, y, z);
+        break;
+    }
+    case OP_glBindImageTexture:
+    {
+        GLuint unit = reader.U32();
+        GLuint texture = UName(gTextures, reader.U32());
+        GLint level = reader.I32();
+        GLboolean layered = (GLboolean)reader.U32();
+        GLint layer = reader.I32();
+        GLenum access = reader.U32();
+        glBindImageTexture(unit, texture, level, layered, layer, access, reader.U32());
+        break;
+    }
+    case OP_glMemoryBarrier: glMemoryBarrier(reader.U32()); break;
+    case OP_glUniform4fv:
+    {
+        GLint location = ULocation(reader.I32());
+        GLsizei count = reader.I32();
+        glUniform4fv(location, count, UFloats(reader, 4 * count));
+        break;
+    }
+    case OP_glGetTexImage:
+    {
+        GLenum target = reader.U32();
+        GLint level = reader.I32();
+        GLenum format = reader.U32();
+        GLenum type = reader.U32();
+        GLint width = 0, height = 0;
+        glGetTexLevelParameteriv(target, level, GL_TEXTURE_WIDTH, &width);
+        glGetTexLevelParameteriv(target, level, GL_TEXTURE_HEIGHT, &height);
+        vector<char> pixels(GLTraceImageSize(format, type, width, height));
+        if (!pixels.empty())
+            glGetTexImage(target, level, format, type, pixels.data());
+        break;
+    }
+    case OP_glCopyImageSubData:
+    {
+        GLuint source = UName(gTextures, reader.U32());
+        GLenum sourceTarget = reader.U32();
+        GLint sourceLevel = reader.I32();
+        GLint sourceX = reader.I32();
+        GLint sourceY = reader.I32();
+        GLint sourceZ = reader.I32();
+        GLuint destination = UName(gTextures, reader.U32());
+        GLenum destinationTarget = reader.U32();
+        GLint destinationLevel = reader.I32();
+        GLint destinationX = reader.I32();
+        GLint destinationY = reader.I32();
+        GLint destinationZ = reader.I32();
+        GLsizei width = reader.I32();
+        GLsizei height = reader.I32();
+        glCopyImageSubData(source, sourceTarget, sourceLevel, sourceX, sourceY, sourceZ, destination, destinationTarget,
+            destinationLevel, destinationX, destinationY, destinationZ, width, height, reader.I32());
+        break;
+    }
+    default:
+        LOG_ERROR("Unknown trace command %d at offset %zu", op, reader.Position() - 1);
+        return -1;
+    }
+
+    if (!reader.Ok())
+    {
+        LOG_ERROR("Trace ends in the middle of %s", GLTraceOpName(op));
+        return -1;
+    }
+    return op;
+}
+
+
+// The replay's name for an object the trace refers to; 0 stays 0
+GLuint UName(const unordered_map<GLuint, GLuint>& names, GLuint captured)
+{
+    auto found = names.find(captured);
+    return found != names.end() ? found->second : captured;
+}
+
+
+// The replay's location for a uniform of the program in use; -1 stays -1
+GLint ULocation(GLint captured)
+{
+    if (captured < 0)
+        return captured;
+    auto found = gUniformLocations.find((uint64_t)gCurrentProgram << 32 | (uint32_t)captured);
+    return found != gUniformLocations.end() ? found->second : captured;
+}
+
+
+void UGenNames(GLTraceReader& reader, unordered_map<GLuint, GLuint>& names, PFNGLGENBUFFERSPROC gen)
+{
+    GLsizei count = reader.I32();
+    const char* captured = reader.Bytes(sizeof(GLuint) * count);
+    if (!captured)
+        return;
+    vector<GLuint> created(count);
+    gen(count, created.data());
+    for (GLsizei i = 0; i < count; ++i)
+    {
+        GLuint name;
+        memcpy(&name, captured + sizeof(GLuint) * i, sizeof(GLuint));
+        names[name] = created[i];
+    }
+}
+
+
+void UDeleteNames(GLTraceReader& reader, unordered_map<GLuint, GLuint>& names, PFNGLDELETEBUFFERSPROC del)
+{
+    GLsizei count = reader.I32();
+    const char* captured = reader.Bytes(sizeof(GLuint) * count);
+    if (!captured)
+        return;
+    vector<GLuint> deleted(count);
+    for (GLsizei i = 0; i < count; ++i)
+    {
+        GLuint name;
+        memcpy(&name, captured + sizeof(GLuint) * i, sizeof(GLuint));
+        deleted[i] = UName(names, name);
+        names.erase(name);
+    }
+    del(count, deleted.data());
+}
+
+
+// Copies a float array out of the trace, which doesn't keep them aligned
+const GLfloat* UFloats(GLTraceReader& reader, size_t count)
+{
+    gUniformData.resize(count);
+    const char* bytes = reader.Bytes(sizeof(GLfloat) * count);
+    if (bytes)
+        memcpy(gUniformData.data(), bytes, sizeof(GLfloat) * count);
+    return gUniformData.data();
+}
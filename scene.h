@@ -0,0 +1,740 @@
+#pragma once
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtx/transform.hpp>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <type_traits>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "lod.h"
+#include "procmesh.h"
+
+// Scene content lives in two forms. The text scene file is for authoring: meshes, materials, lights and
+// instances, parsed into a SceneDescription. Baking turns a description into one flat binary file with
+// everything the renderer derives from it (bounds, level of detail chains) already computed, laid out so
+// that loading is a memory map plus a handful of pointer fixups, however many instances there are.
+
+
+// ---- authoring form ----
+
+struct SceneMeshSource
+{
+    std::string Name;
+    std::vector<GLfloat> Vertices;      // interleaved position, normal, texture coordinate
+    std::vector<GLushort> Indices;      // triangle list
+};
+
+struct SceneMaterialSource
+{
+    std::string Name;
+    std::string Texture;                // image path
+};
+
+struct SceneLight
+{
+    glm::vec3 Position;
+    glm::vec3 Color;
+    float Strength;
+};
+
+struct SceneInstanceSource
+{
+    uint32_t Mesh;                      // index into Meshes
+    uint32_t Material;                  // index into Materials
+    glm::mat4 Model;
+};
+
+struct SceneTerrainSource
+{
+    bool Present = false;
+    std::string Heightmap;              // terrain file path, see terrain.h
+    uint32_t Material = 0;
+    glm::mat4 Model = glm::mat4(1.0f);  // terrain space (x, y across, z up) to world
+};
+
+struct SceneWaterSource
+{
+    bool Present = false;
+    uint32_t Material = 0;
+    glm::vec2 Min = glm::vec2(0.0f);    // rectangle of the surface at rest
+    glm::vec2 Max = glm::vec2(0.0f);
+    float Height = 0.0f;
+    glm::mat4 Model = glm::mat4(1.0f);  // water space (x, y across, z up) to world
+};
+
+struct SceneEnvironmentSource
+{
+    bool Present = false;
+    std::string Image;                  // equirectangular HDR image path, see environment.h
+    float Intensity = 1.0f;
+    glm::mat4 Model = glm::mat4(1.0f);  // environment space (z up) to world
+};
+
+// Parsed text scene. The format is line based, # starts a comment:
+//   ambient r g b
+//   specular intensity
+//   light x y z  r g b  strength
+//   material <name> <texture path>
+//   mesh <name>                          followed by vertex, index and shape lines, up to "end"
+//     v x y z  nx ny nz  u v
+//     i a b c ...                        any number of indices, three per triangle overall
+//     box minX minY minZ maxX maxY maxZ
+//     cylinder x y z radius height segments             along z from the center of its base
+//     column x y z radius height flutes                 fluted, with a square plinth and top
+//     stairs x y z width depth height steps             from the min corner, climbing toward +y
+//     pediment x y z width depth height                 gable along x, from the min corner
+//   end
+//   instance <mesh> <material> [translate x y z] [rotate radians ax ay az] [scale x y z] ...
+//   terrain <heightmap path> <material> [transforms as for instances]      at most one
+//   water <material> minX minY maxX maxY height [transforms]               at most one, simulated
+//   environment <HDR image path> intensity [transforms]                    at most one, lights the scene
+// Transforms are multiplied together in the order written, so the last one applies first.
+struct SceneDescription
+{
+    static const int FLOATS_PER_VERTEX = 8;
+    static_assert(FLOATS_PER_VERTEX == MeshGenerator::FLOATS_PER_VERTEX, "generated shapes go straight into meshes");
+
+    glm::vec3 Ambient = glm::vec3(0.15f);
+    float SpecularIntensity = 0.8f;
+    std::vector<SceneLight> Lights;
+    std::vector<SceneMaterialSource> Materials;
+    std::vector<SceneMeshSource> Meshes;
+    std::vector<SceneInstanceSource> Instances;
+    SceneTerrainSource Terrain;
+    SceneWaterSource Water;
+    SceneEnvironmentSource Environment;
+    MeshGenerator Generator;            // builds the shapes inside meshes, each distinct one once
+    std::string Error;                  // "file:line: reason" after a failed Load
+    std::vector<std::string> Warnings;  // problems Load worked around, same form
+
+    bool Load(const std::string& path)
+    {
+        std::ifstream in(path);
+        if (!in)
+            return fail(path, 0, "can't open");
+
+        std::string line;
+        int lineNumber = 0;
+        SceneMeshSource* mesh = nullptr;   // while between "mesh" and "end"
+        while (std::getline(in, line))
+        {
+            ++lineNumber;
+            std::istringstream fields(line);
+            std::string keyword;
+            if (!(fields >> keyword) || keyword[0] == '#')
+                continue;
+
+            if (mesh)
+            {
+                if (keyword == "v")
+                {
+                    GLfloat v[FLOATS_PER_VERTEX];
+                    for (GLfloat& f : v)
+                        if (!(fields >> f))
+                            return fail(path, lineNumber, "vertex needs 8 numbers");
+                    mesh->Vertices.insert(mesh->Vertices.end(), v, v + FLOATS_PER_VERTEX);
+                }
+                else if (keyword == "i")
+                {
+                    unsigned int index;
+                    while (fields >> index)
+                    {
+                        if (index > 0xFFFF)
+                            return fail(path, lineNumber, "index doesn't fit 16 bits");
+                        mesh->Indices.push_back((GLushort)index);
+                    }
+                    if (!fields.eof())
+                        return fail(path, lineNumber, "index is not a number");
+                }
+                else if (keyword == "box" || keyword == "cylinder" || keyword == "column" || keyword == "stairs" || keyword == "pediment")
+                {
+                    if (!parseShape(keyword, fields, *mesh, path, lineNumber))
+                        return false;
+                }
+                else if (keyword == "end")
+                {
+                    if (mesh->Indices.size() % 3 != 0)
+                        return fail(path, lineNumber, "index count is not a multiple of 3");
+                    if (mesh->Vertices.empty())
+                        return fail(path, lineNumber, "mesh has no vertices");
+                    dropMissingVertices(*mesh, path, lineNumber);
+                    mesh = nullptr;
+                }
+                else
+                    return fail(path, lineNumber, "expected v, i, a shape or end inside a mesh");
+                continue;
+            }
+
+            if (keyword == "ambient")
+            {
+                if (!(fields >> Ambient.r >> Ambient.g >> Ambient.b))
+                    return fail(path, lineNumber, "ambient needs r g b");
+            }
+            else if (keyword == "specular")
+            {
+                if (!(fields >> SpecularIntensity))
+                    return fail(path, lineNumber, "specular needs an intensity");
+            }
+            else if (keyword == "light")
+            {
+                SceneLight light;
+                if (!(fields >> light.Position.x >> light.Position.y >> light.Position.z
+                    >> light.Color.r >> light.Color.g >> light.Color.b >> light.Strength))
+                    return fail(path, lineNumber, "light needs x y z r g b strength");
+                Lights.push_back(light);
+            }
+            else if (keyword == "material")
+            {
+                SceneMaterialSource material;
+                if (!(fields >> material.Name >> material.Texture))
+                    return fail(path, lineNumber, "material needs a name and a texture");
+                if (find(Materials, material.Name) >= 0)
+                    return fail(path, lineNumber, "material " + material.Name + " defined twice");
+                Materials.push_back(material);
+            }
+            else if (keyword == "mesh")
+            {
+                SceneMeshSource source;
+                if (!(fields >> source.Name))
+                    return fail(path, lineNumber, "mesh needs a name");
+                if (find(Meshes, source.Name) >= 0)
+                    return fail(path, lineNumber, "mesh " + source.Name + " defined twice");
+                Meshes.push_back(source);
+                mesh = &Meshes.back();
+            }
+            else if (keyword == "instance")
+            {
+                std::string meshName, materialName;
+                if (!(fields >> meshName >> materialName))
+                    return fail(path, lineNumber, "instance needs a mesh and a material");
+                SceneInstanceSource instance;
+                int meshIndex = find(Meshes, meshName), materialIndex = find(Materials, materialName);
+                if (meshIndex < 0)
+                    return fail(path, lineNumber, "unknown mesh " + meshName);
+                if (materialIndex < 0)
+                    return fail(path, lineNumber, "unknown material " + materialName);
+                instance.Mesh = (uint32_t)meshIndex;
+                instance.Material = (uint32_t)materialIndex;
+                if (!parseTransforms(fields, instance.Model, path, lineNumber))
+                    return false;
+                Instances.push_back(instance);
+            }
+            else if (keyword == "terrain")
+            {
+                std::string materialName;
+                if (Terrain.Present)
+                    return fail(path, lineNumber, "terrain defined twice");
+                if (!(fields >> Terrain.Heightmap >> materialName))
+                    return fail(path, lineNumber, "terrain needs a heightmap and a material");
+                int materialIndex = find(Materials, materialName);
+                if (materialIndex < 0)
+                    return fail(path, lineNumber, "unknown material " + materialName);
+                Terrain.Material = (uint32_t)materialIndex;
+                if (!parseTransforms(fields, Terrain.Model, path, lineNumber))
+                    return false;
+                Terrain.Present = true;
+            }
+            else if (keyword == "water")
+            {
+                std::string materialName;
+                if (Water.Present)
+                    return fail(path, lineNumber, "water defined twice");
+                if (!(fields >> materialName >> Water.Min.x >> Water.Min.y >> Water.Max.x >> Water.Max.y >> Water.Height))
+                    return fail(path, lineNumber, "water needs a material, a rectangle and a height");
+                if (!(Water.Min.x < Water.Max.x && Water.Min.y < Water.Max.y))
+                    return fail(path, lineNumber, "water rectangle is empty");
+                int materialIndex = find(Materials, materialName);
+                if (materialIndex < 0)
+                    return fail(path, lineNumber, "unknown material " + materialName);
+                Water.Material = (uint32_t)materialIndex;
+                if (!parseTransforms(fields, Water.Model, path, lineNumber))
+                    return false;
+                Water.Present = true;
+            }
+            else if (keyword == "environment")
+            {
+                if (Environment.Present)
+                    return fail(path, lineNumber, "environment defined twice");
+                if (!(fields >> Environment.Image >> Environment.Intensity))
+                    return fail(path, lineNumber, "environment needs an image and an intensity");
+                if (!(Environment.Intensity >= 0.0f))
+                    return fail(path, lineNumber, "environment intensity is negative");
+                if (!parseTransforms(fields, Environment.Model, path, lineNumber))
+                    return false;
+                Environment.Present = true;
+            }
+            else
+                return fail(path, lineNumber, "unknown keyword " + keyword);
+        }
+        if (mesh)
+            return fail(path, lineNumber, "mesh " + mesh->Name + " has no end");
+        return true;
+    }
+
+private:
+    template <class T>
+    static int find(const std::vector<T>& items, const std::string& name)
+    {
+        for (size_t i = 0; i < items.size(); ++i)
+            if (items[i].Name == name)
+                return (int)i;
+        return -1;
+    }
+
+    // the rest of the line as transforms, multiplied in order
+    bool parseTransforms(std::istringstream& fields, glm::mat4& model, const std::string& path, int lineNumber)
+    {
+        model = glm::mat4(1.0f);
+        std::string transform;
+        while (fields >> transform)
+        {
+            glm::vec3 v;
+            float angle = 0.0f;
+            if (transform == "rotate" && !(fields >> angle))
+                return fail(path, lineNumber, "rotate needs an angle and an axis");
+            if (!(fields >> v.x >> v.y >> v.z))
+                return fail(path, lineNumber, transform + " needs three numbers");
+            if (transform == "translate")
+                model *= glm::translate(v);
+            else if (transform == "rotate")
+                model *= glm::rotate(angle, v);
+            else if (transform == "scale")
+                model *= glm::scale(v);
+            else
+                return fail(path, lineNumber, "unknown transform " + transform);
+        }
+        return true;
+    }
+
+    // one generated shape line inside a mesh; the shape goes after the mesh's vertices so far
+    bool parseShape(const std::string& keyword, std::istringstream& fields, SceneMeshSource& mesh, const std::string& path, int lineNumber)
+    {
+        glm::vec3 position;
+        if (!(fields >> position.x >> position.y >> position.z))
+            return fail(path, lineNumber, keyword + " needs a position");
+
+        const ProceduralMesh* shape = nullptr;
+        float a = 0.0f, b = 0.0f, c = 0.0f;
+        int count = 0;
+        if (keyword == "box")
+        {
+            glm::vec3 max;
+            if (!(fields >> max.x >> max.y >> max.z) || !(max.x > position.x && max.y > position.y && max.z > position.z))
+                return fail(path, lineNumber, "box needs a min and a larger max corner");
+            shape = &Generator.Box(max - position);
+        }
+        else if (keyword == "cylinder")
+        {
+            if (!(fields >> a >> b >> count) || !(a > 0.0f && b > 0.0f)
+                || count < MeshGenerator::MIN_SEGMENTS || count > MeshGenerator::MAX_SEGMENTS)
+                return fail(path, lineNumber, "cylinder needs a radius, a height and 3 to 1024 segments");
+            shape = &Generator.Cylinder(a, b, count);
+        }
+        else if (keyword == "column")
+        {
+            if (!(fields >> a >> b >> count) || !(a > 0.0f && b > 0.0f) || count < 3 || count > MeshGenerator::MAX_FLUTES)
+                return fail(path, lineNumber, "column needs a radius, a height and 3 to 64 flutes");
+            shape = &Generator.Column(a, b, count);
+        }
+        else if (keyword == "stairs")
+        {
+            if (!(fields >> a >> b >> c >> count) || !(a > 0.0f && b > 0.0f && c > 0.0f) || count < 1 || count > MeshGenerator::MAX_STEPS)
+                return fail(path, lineNumber, "stairs need a width, a depth, a height and 1 to 64 steps");
+            shape = &Generator.Stairs(a, b, c, count);
+        }
+        else
+        {
+            if (!(fields >> a >> b >> c) || !(a > 0.0f && b > 0.0f && c > 0.0f))
+                return fail(path, lineNumber, "pediment needs a width, a depth and a height");
+            shape = &Generator.Pediment(a, b, c);
+        }
+
+        if (!MeshGenerator::Append(*shape, position, mesh.Vertices, mesh.Indices))
+            return fail(path, lineNumber, "mesh " + mesh.Name + " has more vertices than 16 bit indices reach");
+        return true;
+    }
+
+    // triangles indexing past the last vertex would read garbage on the GPU, so they are left out
+    void dropMissingVertices(SceneMeshSource& mesh, const std::string& path, int lineNumber)
+    {
+        size_t vertexCount = mesh.Vertices.size() / FLOATS_PER_VERTEX;
+        size_t kept = 0;
+        for (size_t i = 0; i < mesh.Indices.size(); i += 3)
+        {
+            if (mesh.Indices[i] >= vertexCount || mesh.Indices[i + 1] >= vertexCount || mesh.Indices[i + 2] >= vertexCount)
+                continue;
+            for (int k = 0; k < 3; ++k)
+                mesh.Indices[kept++] = mesh.Indices[i + k];
+        }
+        if (kept == mesh.Indices.size())
+            return;
+        Warnings.push_back(path + ":" + std::to_string(lineNumber) + ": mesh " + mesh.Name + ": dropped "
+            + std::to_string((mesh.Indices.size() - kept) / 3) + " triangles with indices past its vertices");
+        mesh.Indices.resize(kept);
+    }
+
+    bool fail(const std::string& path, int lineNumber, const std::string& reason)
+    {
+        Error = path + ":" + std::to_string(lineNumber) + ": " + reason;
+        return false;
+    }
+};
+
+
+// ---- baked form ----
+
+// An array inside the baked file. On disk it holds the byte offset from the start of the file; once the file
+// is mapped, Fixup turns that into a pointer in place
+template <class T>
+struct BakedArray
+{
+    union
+    {
+        uint64_t Offset;
+        T* Data;
+    };
+    uint64_t Count;
+
+    size_t size() const { return (size_t)Count; }
+    T* begin() const { return Data; }
+    T* end() const { return Data + Count; }
+    T& operator[](size_t i) const { return Data[i]; }
+
+    // false if the array would reach past the end of the file
+    bool Fixup(char* base, uint64_t fileSize)
+    {
+        if (Offset > fileSize || Count > (fileSize - Offset) / sizeof(T))
+            return false;
+        Data = (T*)(base + Offset);
+        return true;
+    }
+};
+
+struct BakedMesh
+{
+    BakedArray<GLfloat> Vertices;       // SceneDescription::FLOATS_PER_VERTEX floats each
+    BakedArray<GLushort> Indices;       // every level of detail, back to back
+    BakedArray<LODLevel> Levels;        // finest first
+    BakedArray<char> Name;              // NUL terminated
+    glm::vec3 BoundsMin, BoundsMax;     // object space
+    uint32_t VertexCount;
+};
+
+struct BakedMaterial
+{
+    BakedArray<char> Name;
+    BakedArray<char> Texture;
+};
+
+struct BakedInstance
+{
+    uint32_t Mesh;
+    uint32_t Material;
+    glm::mat4 Model;
+};
+
+struct BakedTerrain
+{
+    uint32_t Present;
+    uint32_t Material;
+    glm::mat4 Model;
+    BakedArray<char> Heightmap;         // NUL terminated path
+};
+
+struct BakedWater
+{
+    uint32_t Present;
+    uint32_t Material;
+    glm::vec2 Min;
+    glm::vec2 Max;
+    float Height;
+    glm::mat4 Model;
+};
+
+struct BakedEnvironment
+{
+    uint32_t Present;
+    float Intensity;
+    glm::mat4 Model;
+    BakedArray<char> Image;             // NUL terminated path
+};
+
+// Start of the file
+struct BakedScene
+{
+    static const uint32_t MAGIC = 0x424E4353;   // "SCNB"
+    // bump whenever any baked struct changes; an old bake is then rebuilt from the text
+    static const uint32_t VERSION = 4;
+
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t Size;                      // of the whole file
+    glm::vec3 Ambient;
+    float SpecularIntensity;
+    BakedArray<BakedMesh> Meshes;
+    BakedArray<BakedMaterial> Materials;
+    BakedArray<SceneLight> Lights;
+    BakedArray<BakedInstance> Instances;
+    BakedTerrain Terrain;
+    BakedWater Water;
+    BakedEnvironment Environment;
+};
+
+static_assert(std::is_trivially_copyable<BakedScene>::value && std::is_trivially_copyable<BakedMesh>::value
+    && std::is_trivially_copyable<BakedInstance>::value && std::is_trivially_copyable<LODLevel>::value,
+    "baked structs are written and mapped as raw bytes");
+
+
+// Writes the baked form of a description. Every derived value the renderer needs is computed here so loading
+// does none of it
+class SceneBaker
+{
+public:
+    static const int MAX_LOD_LEVELS = 4;
+
+    static bool Bake(const SceneDescription& scene, const std::string& path)
+    {
+        std::vector<char> out(sizeof(BakedScene));
+        BakedScene header = {};
+        header.Magic = BakedScene::MAGIC;
+        header.Version = BakedScene::VERSION;
+        header.Ambient = scene.Ambient;
+        header.SpecularIntensity = scene.SpecularIntensity;
+
+        // tables first, their entries are filled in as the arrays they point to are appended
+        std::vector<BakedMesh> meshes(scene.Meshes.size());
+        std::vector<BakedMaterial> materials(scene.Materials.size());
+        header.Meshes = Reserve<BakedMesh>(out, meshes.size());
+        header.Materials = Reserve<BakedMaterial>(out, materials.size());
+        header.Lights = Append(out, scene.Lights.data(), scene.Lights.size());
+
+        std::vector<BakedInstance> instances(scene.Instances.size());
+        for (size_t i = 0; i < instances.size(); ++i)
+            instances[i] = { scene.Instances[i].Mesh, scene.Instances[i].Material, scene.Instances[i].Model };
+        header.Instances = Append(out, instances.data(), instances.size());
+
+        header.Terrain.Present = scene.Terrain.Present;
+        header.Terrain.Material = scene.Terrain.Material;
+        header.Terrain.Model = scene.Terrain.Model;
+        header.Terrain.Heightmap = Append(out, scene.Terrain.Heightmap.c_str(), scene.Terrain.Heightmap.size() + 1);
+        header.Water = { scene.Water.Present, scene.Water.Material, scene.Water.Min, scene.Water.Max, scene.Water.Height, scene.Water.Model };
+        header.Environment.Present = scene.Environment.Present;
+        header.Environment.Intensity = scene.Environment.Intensity;
+        header.Environment.Model = scene.Environment.Model;
+        header.Environment.Image = Append(out, scene.Environment.Image.c_str(), scene.Environment.Image.size() + 1);
+
+        for (size_t i = 0; i < meshes.size(); ++i)
+        {
+            const SceneMeshSource& source = scene.Meshes[i];
+            BakedMesh& mesh = meshes[i];
+            size_t vertexCount = source.Vertices.size() / SceneDescription::FLOATS_PER_VERTEX;
+            mesh.VertexCount = (uint32_t)vertexCount;
+
+            mesh.BoundsMin = mesh.BoundsMax = glm::vec3(source.Vertices[0], source.Vertices[1], source.Vertices[2]);
+            for (size_t v = 1; v < vertexCount; ++v)
+            {
+                const GLfloat* p = &source.Vertices[v * SceneDescription::FLOATS_PER_VERTEX];
+                mesh.BoundsMin = glm::min(mesh.BoundsMin, glm::vec3(p[0], p[1], p[2]));
+                mesh.BoundsMax = glm::max(mesh.BoundsMax, glm::vec3(p[0], p[1], p[2]));
+            }
+
+            std::vector<GLushort> indices;
+            LODChain chain;
+            MeshSimplifier::BuildChain(source.Vertices.data(), vertexCount, SceneDescription::FLOATS_PER_VERTEX,
+                source.Indices.data(), source.Indices.size(), MAX_LOD_LEVELS, indices, chain);
+
+            mesh.Vertices = Append(out, source.Vertices.data(), source.Vertices.size());
+            mesh.Indices = Append(out, indices.data(), indices.size());
+            mesh.Levels = Append(out, chain.Levels.data(), chain.Levels.size());
+            mesh.Name = Append(out, source.Name.c_str(), source.Name.size() + 1);
+        }
+        for (size_t i = 0; i < materials.size(); ++i)
+        {
+            materials[i].Name = Append(out, scene.Materials[i].Name.c_str(), scene.Materials[i].Name.size() + 1);
+            materials[i].Texture = Append(out, scene.Materials[i].Texture.c_str(), scene.Materials[i].Texture.size() + 1);
+        }
+
+        header.Size = out.size();
+        memcpy(out.data(), &header, sizeof(header));
+        if (!meshes.empty())
+            memcpy(&out[header.Meshes.Offset], meshes.data(), meshes.size() * sizeof(BakedMesh));
+        if (!materials.empty())
+            memcpy(&out[header.Materials.Offset], materials.data(), materials.size() * sizeof(BakedMaterial));
+
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file)
+            return false;
+        fwrite(out.data(), 1, out.size(), file);
+        bool ok = !ferror(file);
+        return fclose(file) == 0 && ok;
+    }
+
+private:
+    // arrays start 16 byte aligned so mapped data can be read in place
+    template <class T>
+    static BakedArray<T> Reserve(std::vector<char>& out, size_t count)
+    {
+        out.resize((out.size() + 15) & ~(size_t)15);
+        BakedArray<T> array;
+        array.Offset = out.size();
+        array.Count = count;
+        out.resize(out.size() + count * sizeof(T));
+        return array;
+    }
+
+    template <class T>
+    static BakedArray<T> Append(std::vector<char>& out, const T* data, size_t count)
+    {
+        BakedArray<T> array = Reserve<T>(out, count);
+        if (count)
+            memcpy(&out[array.Offset], data, count * sizeof(T));
+        return array;
+    }
+};
+
+
+// A baked scene mapped into memory. The mapping is copy on write, so the fixups only dirty the pages of the
+// header and the mesh and material tables; vertex, index and instance data stay shared with the page cache
+// and are only read in as they are touched. The scene stays valid until Close
+class MappedScene
+{
+public:
+    ~MappedScene()
+    {
+        Close();
+    }
+
+    bool Open(const std::string& path)
+    {
+        Close();
+        if (!Map(path))
+            return false;
+
+        BakedScene* scene = (BakedScene*)base;
+        bool valid = size >= sizeof(BakedScene) && scene->Magic == BakedScene::MAGIC
+            && scene->Version == BakedScene::VERSION && scene->Size == size;
+        valid = valid && scene->Meshes.Fixup(base, size) && scene->Materials.Fixup(base, size)
+            && scene->Lights.Fixup(base, size) && scene->Instances.Fixup(base, size);
+        for (size_t i = 0; valid && i < scene->Meshes.size(); ++i)
+        {
+            BakedMesh& mesh = scene->Meshes[i];
+            valid = mesh.Vertices.Fixup(base, size) && mesh.Indices.Fixup(base, size)
+                && mesh.Levels.Fixup(base, size) && mesh.Name.Fixup(base, size)
+                && mesh.Vertices.size() == (size_t)mesh.VertexCount * SceneDescription::FLOATS_PER_VERTEX
+                && ValidMesh(mesh);
+        }
+        for (size_t i = 0; valid && i < scene->Materials.size(); ++i)
+            valid = scene->Materials[i].Name.Fixup(base, size) && scene->Materials[i].Texture.Fixup(base, size)
+                && Terminated(scene->Materials[i].Name) && Terminated(scene->Materials[i].Texture);
+        for (size_t i = 0; valid && i < scene->Instances.size(); ++i)
+            valid = scene->Instances[i].Mesh < scene->Meshes.size() && scene->Instances[i].Material < scene->Materials.size();
+        valid = valid && scene->Terrain.Heightmap.Fixup(base, size) && scene->Environment.Image.Fixup(base, size)
+            && Terminated(scene->Terrain.Heightmap) && Terminated(scene->Environment.Image)
+            && (!scene->Terrain.Present || scene->Terrain.Material < scene->Materials.size())
+            && (!scene->Water.Present || scene->Water.Material < scene->Materials.size());
+        if (!valid)
+        {
+            Close();
+            return false;
+        }
+        Scene = scene;
+        return true;
+    }
+
+    void Close()
+    {
+        Scene = nullptr;
+        if (!base)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(base);
+#else
+        munmap(base, size);
+#endif
+        base = nullptr;
+        size = 0;
+    }
+
+    const BakedScene* Scene = nullptr;
+
+private:
+    // strings are read with strlen, which must stop inside their array
+    static bool Terminated(const BakedArray<char>& text)
+    {
+        return text.size() > 0 && text[text.size() - 1] == '\0';
+    }
+
+    // a stale or damaged bake must not send the GPU past the mesh's indices or vertices. Checking every
+    // index reads them all in once, which the draws would do anyway
+    static bool ValidMesh(const BakedMesh& mesh)
+    {
+        if (mesh.VertexCount == 0 || mesh.Levels.size() == 0 || !Terminated(mesh.Name))
+            return false;
+        for (const LODLevel& level : mesh.Levels)
+            if (level.IndexOffset > mesh.Indices.size() || level.IndexCount > mesh.Indices.size() - level.IndexOffset)
+                return false;
+        for (GLushort index : mesh.Indices)
+            if (index >= mesh.VertexCount)
+                return false;
+        return true;
+    }
+
+    bool Map(const std::string& path)
+    {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER fileSize;
+        HANDLE mapping = NULL;
+        if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+            mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+        CloseHandle(file);
+        if (!mapping)
+            return false;
+        base = (char*)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+        CloseHandle(mapping);
+        size = base ? (uint64_t)fileSize.QuadPart : 0;
+#else
+        int file = open(path.c_str(), O_RDONLY);
+        if (file < 0)
+            return false;
+        struct stat info;
+        if (fstat(file, &info) != 0 || info.st_size <= 0)
+        {
+            ::close(file);
+            return false;
+        }
+        void* mapped = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+        ::close(file);
+        if (mapped == MAP_FAILED)
+            return false;
+        base = (char*)mapped;
+        size = (uint64_t)info.st_size;
+#endif
+        return base != nullptr;
+    }
+
+    char* base = nullptr;
+    uint64_t size = 0;
+};
+#endif
@@ -0,0 +1,637 @@
+#pragma once
+
+#ifndef SOFT_RAST_H
+#define SOFT_RAST_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "jobsystem.h"
+
+// RGBA texture with a full mip chain, sampled bilinearly from the nearest mip level with GL_MIRRORED_REPEAT
+// wrapping, the wrap mode UCreateTexture sets
+class SoftTexture
+{
+public:
+    // pixels are 3 or 4 channel rows, bottom row first, as handed to glTexImage2D
+    bool Create(const unsigned char* pixels, int width, int height, int channels)
+    {
+        if (channels != 3 && channels != 4)
+            return false;
+
+        levels.clear();
+        levels.push_back(Level{ width, height, std::vector<glm::vec4>((size_t)width * height) });
+        for (size_t i = 0; i < levels[0].Texels.size(); ++i)
+        {
+            const unsigned char* p = pixels + i * channels;
+            levels[0].Texels[i] = glm::vec4(p[0], p[1], p[2], channels == 4 ? p[3] : 255) / 255.0f;
+        }
+
+        // 2x2 box filter down to 1x1; odd sizes clamp the second texel
+        while (levels.back().Width > 1 || levels.back().Height > 1)
+        {
+            const Level& src = levels.back();
+            Level dst{ std::max(src.Width / 2, 1), std::max(src.Height / 2, 1), {} };
+            dst.Texels.resize((size_t)dst.Width * dst.Height);
+            for (int y = 0; y < dst.Height; ++y)
+            {
+                int y0 = std::min(y * 2, src.Height - 1), y1 = std::min(y * 2 + 1, src.Height - 1);
+                for (int x = 0; x < dst.Width; ++x)
+                {
+                    int x0 = std::min(x * 2, src.Width - 1), x1 = std::min(x * 2 + 1, src.Width - 1);
+                    dst.Texels[(size_t)y * dst.Width + x] = (src.At(x0, y0) + src.At(x1, y0) + src.At(x0, y1) + src.At(x1, y1)) * 0.25f;
+                }
+            }
+            levels.push_back(std::move(dst));
+        }
+        return true;
+    }
+
+    // lod is log2 of the texels covered by one pixel
+    glm::vec4 Sample(const glm::vec2& uv, float lod) const
+    {
+        if (levels.empty())
+            return glm::vec4(1.0f);
+
+        int index = std::min(std::max((int)std::floor(lod + 0.5f), 0), (int)levels.size() - 1);
+        const Level& level = levels[index];
+        float x = glm::clamp(uv.x * level.Width - 0.5f, -1.0e6f, 1.0e6f);
+        float y = glm::clamp(uv.y * level.Height - 0.5f, -1.0e6f, 1.0e6f);
+        float fx = std::floor(x), fy = std::floor(y);
+        float tx = x - fx, ty = y - fy;
+        int x0 = Mirror((int)fx, level.Width), x1 = Mirror((int)fx + 1, level.Width);
+        int y0 = Mirror((int)fy, level.Height), y1 = Mirror((int)fy + 1, level.Height);
+
+        glm::vec4 bottom = level.At(x0, y0) * (1.0f - tx) + level.At(x1, y0) * tx;
+        glm::vec4 top = level.At(x0, y1) * (1.0f - tx) + level.At(x1, y1) * tx;
+        return bottom * (1.0f - ty) + top * ty;
+    }
+
+    int Width() const { return levels.empty() ? 0 : levels[0].Width; }
+    int Height() const { return levels.empty() ? 0 : levels[0].Height; }
+
+private:
+    struct Level
+    {
+        int Width, Height;
+        std::vector<glm::vec4> Texels;
+
+        const glm::vec4& At(int x, int y) const { return Texels[(size_t)y * Width + x]; }
+    };
+
+    // 0 .. size-1, then back down, and so on in both directions
+    static int Mirror(int i, int size)
+    {
+        int period = size * 2;
+        i %= period;
+        if (i < 0)
+            i += period;
+        return i < size ? i : period - 1 - i;
+    }
+
+    std::vector<Level> levels;
+};
+
+
+// A light of the Phong model in sunFragmentShaderSource
+struct SoftLight
+{
+    glm::vec3 Position;
+    glm::vec3 Color;
+    float Strength;     // only scales the second light, as in the shader
+};
+
+// The uniforms of sunFragmentShaderSource
+struct SoftShading
+{
+    SoftLight Lights[2];
+    glm::vec3 AmbientStrength;
+    float SpecularIntensity;
+    glm::vec3 ViewPosition;
+    glm::vec2 UVScale;
+};
+
+// Interleaved position, normal and texture coordinate vertices with a triangle list, laid out like the
+// buffers UCreateMesh uploads
+struct SoftMesh
+{
+    static const int FLOATS_PER_VERTEX = 8;
+
+    const float* Vertices;
+    size_t VertexCount;
+    const uint16_t* Indices;
+    size_t IndexCount;
+};
+
+
+// Multithreaded tile based rasterizer for machines without a GPU. Render transforms the recorded draws,
+// clips against the near and far planes and bins the triangles into 64x64 pixel tiles; every tile is then
+// rasterized by one job, 8x8 pixel blocks at a time. A block is skipped when the triangle misses it or lies
+// behind the farthest depth already in it (a one level hierarchical depth buffer), and coverage and the
+// depth test run 8 pixels at a time with AVX2 when the compiler targets it. Surviving pixels are lit with the
+// same Phong model as the GL path.
+class SoftRasterizer
+{
+public:
+    static const int TILE_SIZE = 64;    // a multiple of BLOCK_SIZE
+    static const int BLOCK_SIZE = 8;    // one SIMD row wide
+
+    void Resize(int width, int height)
+    {
+        Width = width;
+        Height = height;
+        tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+        tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+        pitch = tilesX * TILE_SIZE;
+        blocksX = pitch / BLOCK_SIZE;
+
+        // padded to whole tiles, so rows of 8 never need bounds checks
+        size_t pixels = (size_t)pitch * tilesY * TILE_SIZE;
+        color.assign(pixels, 0);
+        depth.assign(pixels, 1.0f);
+        hiz.assign(pixels / (BLOCK_SIZE * BLOCK_SIZE), 1.0f);
+        for (Chunk& chunk : chunks)
+            chunk.Bins.assign((size_t)tilesX * tilesY, std::vector<uint32_t>());
+    }
+
+    // starts a frame: clears color and depth and forgets the previous frame's draws
+    void Clear(const glm::vec3& clearColor)
+    {
+        std::fill(color.begin(), color.end(), Pack(glm::vec4(clearColor, 1.0f)));
+        std::fill(depth.begin(), depth.end(), 1.0f);
+        std::fill(hiz.begin(), hiz.end(), 1.0f);
+        draws.clear();
+    }
+
+    // records a draw; the mesh data and texture must stay alive until Render returns
+    void Draw(const SoftMesh& mesh, const glm::mat4& model, const SoftTexture* texture)
+    {
+        draws.push_back(DrawCall{ mesh, model, texture, 0, 0 });
+    }
+
+    // transforms, bins and rasterizes every recorded draw
+    void Render(JobSystem& jobs, const glm::mat4& view, const glm::mat4& projection, const SoftShading& shading)
+    {
+        this->shading = shading;
+
+        uint32_t vertexCount = 0, triangleCount = 0;
+        for (DrawCall& draw : draws)
+        {
+            draw.FirstVertex = vertexCount;
+            draw.FirstTriangle = triangleCount;
+            vertexCount += (uint32_t)draw.Mesh.VertexCount;
+            triangleCount += (uint32_t)(draw.Mesh.IndexCount / 3);
+        }
+
+        // Vertex stage
+        vertices.resize(vertexCount);
+        const glm::mat4 viewProjection = projection * view;
+        jobs.ParallelFor((uint32_t)draws.size(), 1, [this, &viewProjection](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; ++i)
+                TransformVertices(draws[i], viewProjection);
+        });
+
+        // Setup and binning, in chunks that each bin into their own lists so tiles see triangles in submission order
+        uint32_t chunkCount = std::max(1u, std::min((uint32_t)MAX_CHUNKS, (triangleCount + 511) / 512));
+        uint32_t perChunk = (triangleCount + chunkCount - 1) / chunkCount;
+        if (chunks.size() < chunkCount)
+            chunks.resize(chunkCount);
+        for (uint32_t c = 0; c < chunks.size(); ++c)
+        {
+            chunks[c].Triangles.clear();
+            chunks[c].Bins.resize((size_t)tilesX * tilesY);
+            for (std::vector<uint32_t>& bin : chunks[c].Bins)
+                bin.clear();
+        }
+        jobs.ParallelFor(chunkCount, 1, [this, perChunk, triangleCount](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t c = begin; c < end; ++c)
+                SetupChunk(chunks[c], c * perChunk, std::min((c + 1) * perChunk, triangleCount));
+        });
+
+        // Raster stage, one tile per job
+        jobs.ParallelFor((uint32_t)(tilesX * tilesY), 1, [this](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t t = begin; t < end; ++t)
+                RasterizeTile(t);
+        });
+
+        Triangles = 0;
+        for (const Chunk& chunk : chunks)
+            Triangles += (unsigned int)chunk.Triangles.size();
+    }
+
+    // binary PPM, top row first
+    bool WritePPM(const char* path) const
+    {
+        FILE* file = fopen(path, "wb");
+        if (!file)
+            return false;
+
+        fprintf(file, "P6\n%d %d\n255\n", Width, Height);
+        std::vector<unsigned char> row((size_t)Width * 3);
+        for (int y = Height - 1; y >= 0; --y)
+        {
+            for (int x = 0; x < Width; ++x)
+            {
+                uint32_t c = color[(size_t)y * pitch + x];
+                row[x * 3] = c & 0xff;
+                row[x * 3 + 1] = (c >> 8) & 0xff;
+                row[x * 3 + 2] = (c >> 16) & 0xff;
+            }
+            fwrite(row.data(), 1, row.size(), file);
+        }
+        return fclose(file) == 0;
+    }
+
+    int Width = 0, Height = 0;
+    unsigned int Triangles = 0;     // triangles set up by the last Render, after clipping
+
+private:
+    static const int MAX_CHUNKS = 64;
+
+    struct DrawCall
+    {
+        SoftMesh Mesh;
+        glm::mat4 Model;
+        const SoftTexture* Texture;
+        uint32_t FirstVertex;
+        uint32_t FirstTriangle;
+    };
+
+    struct ClipVertex
+    {
+        glm::vec4 Clip;
+        glm::vec3 World;
+        glm::vec3 Normal;
+        glm::vec2 UV;
+    };
+
+    // Screen space triangle. Edge i is opposite vertex i and positive inside; every interpolated quantity is a
+    // plane q = a x + b y + c in window coordinates (attributes are divided by w for perspective correction)
+    struct Triangle
+    {
+        float A[3], B[3], C[3];
+        int TopLeft;                // bit i: pixels exactly on edge i belong to this triangle
+        glm::vec3 Z;
+        glm::vec3 InvW;
+        glm::vec3 Attributes[8];    // world position, normal, uv, all over w
+        float MinZ;
+        int MinX, MinY, MaxX, MaxY;
+        const SoftTexture* Texture;
+    };
+
+    struct Chunk
+    {
+        std::vector<Triangle> Triangles;
+        std::vector<std::vector<uint32_t>> Bins;    // per tile, indices into Triangles
+    };
+
+    void TransformVertices(const DrawCall& draw, const glm::mat4& viewProjection)
+    {
+        const glm::mat3 normalMatrix = glm::mat3(glm::transpose(glm::inverse(draw.Model)));
+        for (size_t v = 0; v < draw.Mesh.VertexCount; ++v)
+        {
+            const float* src = draw.Mesh.Vertices + v * SoftMesh::FLOATS_PER_VERTEX;
+            glm::vec4 world = draw.Model * glm::vec4(src[0], src[1], src[2], 1.0f);
+            ClipVertex& out = vertices[draw.FirstVertex + v];
+            out.Clip = viewProjection * world;
+            out.World = glm::vec3(world);
+            out.Normal = normalMatrix * glm::vec3(src[3], src[4], src[5]);
+            out.UV = glm::vec2(src[6], src[7]);
+        }
+    }
+
+    void SetupChunk(Chunk& chunk, uint32_t begin, uint32_t end)
+    {
+        size_t d = 0;
+        while (d + 1 < draws.size() && draws[d + 1].FirstTriangle <= begin)
+            ++d;
+
+        for (uint32_t t = begin; t < end; ++t)
+        {
+            while (t >= draws[d].FirstTriangle + draws[d].Mesh.IndexCount / 3)
+                ++d;
+            const DrawCall& draw = draws[d];
+            const uint16_t* index = draw.Mesh.Indices + (t - draw.FirstTriangle) * 3;
+            if (index[0] >= draw.Mesh.VertexCount || index[1] >= draw.Mesh.VertexCount || index[2] >= draw.Mesh.VertexCount)
+                continue;
+
+            ClipVertex polygon[8] = { vertices[draw.FirstVertex + index[0]], vertices[draw.FirstVertex + index[1]], vertices[draw.FirstVertex + index[2]] };
+            int count = 3;
+            bool inside = true;
+            for (int i = 0; i < 3; ++i)
+                inside = inside && polygon[i].Clip.z >= -polygon[i].Clip.w && polygon[i].Clip.z <= polygon[i].Clip.w;
+            if (!inside)
+            {
+                ClipVertex scratch[8];
+                count = ClipPolygon(polygon, count, scratch, 1.0f);     // near, z >= -w
+                count = ClipPolygon(scratch, count, polygon, -1.0f);    // far, z <= w
+            }
+
+            for (int i = 1; i + 1 < count; ++i)
+                SetupTriangle(chunk, polygon[0], polygon[i], polygon[i + 1], draw.Texture);
+        }
+    }
+
+    // Sutherland-Hodgman against the plane w + side * z >= 0
+    static int ClipPolygon(const ClipVertex* in, int count, ClipVertex* out, float side)
+    {
+        int written = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            const ClipVertex& a = in[i];
+            const ClipVertex& b = in[(i + 1) % count];
+            float da = a.Clip.w + side * a.Clip.z;
+            float db = b.Clip.w + side * b.Clip.z;
+            if (da >= 0.0f)
+                out[written++] = a;
+            if ((da >= 0.0f) != (db >= 0.0f))
+            {
+                float t = da / (da - db);
+                ClipVertex& v = out[written++];
+                v.Clip = a.Clip + (b.Clip - a.Clip) * t;
+                v.World = a.World + (b.World - a.World) * t;
+                v.Normal = a.Normal + (b.Normal - a.Normal) * t;
+                v.UV = a.UV + (b.UV - a.UV) * t;
+            }
+        }
+        return written;
+    }
+
+    void SetupTriangle(Chunk& chunk, const ClipVertex& v0, const ClipVertex& v1, const ClipVertex& v2, const SoftTexture* texture)
+    {
+        const ClipVertex* v[3] = { &v0, &v1, &v2 };
+        float x[3], y[3], z[3], invW[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            if (v[i]->Clip.w <= 0.0f)
+                return;
+            invW[i] = 1.0f / v[i]->Clip.w;
+            x[i] = (v[i]->Clip.x * invW[i] * 0.5f + 0.5f) * Width;
+            y[i] = (v[i]->Clip.y * invW[i] * 0.5f + 0.5f) * Height;
+            z[i] = v[i]->Clip.z * invW[i] * 0.5f + 0.5f;
+        }
+
+        float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        if (!(std::fabs(area) > 0.0f) || !std::isfinite(area))
+            return;
+
+        Triangle tri;
+        tri.MinX = std::max((int)std::floor(std::min({ x[0], x[1], x[2] })), 0);
+        tri.MinY = std::max((int)std::floor(std::min({ y[0], y[1], y[2] })), 0);
+        tri.MaxX = std::min((int)std::ceil(std::max({ x[0], x[1], x[2] })), Width - 1);
+        tri.MaxY = std::min((int)std::ceil(std::max({ y[0], y[1], y[2] })), Height - 1);
+        if (tri.MinX > tri.MaxX || tri.MinY > tri.MaxY)
+            return;
+
+        // No face culling, as in the GL path: flip clockwise triangles so the inside is positive
+        float sign = area > 0.0f ? 1.0f : -1.0f;
+        tri.TopLeft = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            int a = (i + 1) % 3, b = (i + 2) % 3;
+            tri.A[i] = sign * (y[a] - y[b]);
+            tri.B[i] = sign * (x[b] - x[a]);
+            tri.C[i] = -(tri.A[i] * x[a] + tri.B[i] * y[a]);
+            if (tri.A[i] > 0.0f || (tri.A[i] == 0.0f && tri.B[i] > 0.0f))
+                tri.TopLeft |= 1 << i;
+        }
+
+        float invArea = 1.0f / std::fabs(area);
+        auto plane = [&tri, invArea](float q0, float q1, float q2)
+        {
+            return glm::vec3((tri.A[0] * q0 + tri.A[1] * q1 + tri.A[2] * q2) * invArea,
+                (tri.B[0] * q0 + tri.B[1] * q1 + tri.B[2] * q2) * invArea,
+                (tri.C[0] * q0 + tri.C[1] * q1 + tri.C[2] * q2) * invArea);
+        };
+        tri.Z = plane(z[0], z[1], z[2]);
+        tri.InvW = plane(invW[0], invW[1], invW[2]);
+        for (int k = 0; k < 3; ++k)
+        {
+            tri.Attributes[k] = plane(v0.World[k] * invW[0], v1.World[k] * invW[1], v2.World[k] * invW[2]);
+            tri.Attributes[3 + k] = plane(v0.Normal[k] * invW[0], v1.Normal[k] * invW[1], v2.Normal[k] * invW[2]);
+        }
+        for (int k = 0; k < 2; ++k)
+            tri.Attributes[6 + k] = plane(v0.UV[k] * invW[0], v1.UV[k] * invW[1], v2.UV[k] * invW[2]);
+        tri.MinZ = std::min({ z[0], z[1], z[2] });
+        tri.Texture = texture;
+
+        // Bin into every tile the bounding box touches, unless an edge leaves the whole tile outside
+        uint32_t index = (uint32_t)chunk.Triangles.size();
+        bool binned = false;
+        for (int ty = tri.MinY / TILE_SIZE; ty <= tri.MaxY / TILE_SIZE; ++ty)
+        {
+            for (int tx = tri.MinX / TILE_SIZE; tx <= tri.MaxX / TILE_SIZE; ++tx)
+            {
+                if (EdgesMissRect(tri, tx * TILE_SIZE, ty * TILE_SIZE, TILE_SIZE))
+                    continue;
+                chunk.Bins[(size_t)ty * tilesX + tx].push_back(index);
+                binned = true;
+            }
+        }
+        if (binned)
+            chunk.Triangles.push_back(tri);
+    }
+
+    // true if some edge is negative at every pixel center of the size x size square at (x, y)
+    static bool EdgesMissRect(const Triangle& tri, int x, int y, int size)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            float px = x + 0.5f + (tri.A[i] > 0.0f ? size - 1 : 0);
+            float py = y + 0.5f + (tri.B[i] > 0.0f ? size - 1 : 0);
+            if (tri.A[i] * px + tri.B[i] * py + tri.C[i] < 0.0f)
+                return true;
+        }
+        return false;
+    }
+
+    void RasterizeTile(uint32_t tile)
+    {
+        int tileX = (int)(tile % tilesX) * TILE_SIZE;
+        int tileY = (int)(tile / tilesX) * TILE_SIZE;
+        for (const Chunk& chunk : chunks)
+        {
+            if (chunk.Bins.empty())
+                continue;
+            for (uint32_t index : chunk.Bins[tile])
+                RasterizeTriangle(chunk.Triangles[index], tileX, tileY);
+        }
+    }
+
+    void RasterizeTriangle(const Triangle& tri, int tileX, int tileY)
+    {
+        int x0 = std::max(tri.MinX, tileX) & ~(BLOCK_SIZE - 1);
+        int y0 = std::max(tri.MinY, tileY) & ~(BLOCK_SIZE - 1);
+        int x1 = std::min(tri.MaxX, tileX + TILE_SIZE - 1);
+        int y1 = std::min(tri.MaxY, tileY + TILE_SIZE - 1);
+
+        for (int by = y0; by <= y1; by += BLOCK_SIZE)
+        {
+            for (int bx = x0; bx <= x1; bx += BLOCK_SIZE)
+            {
+                float& blockFarthest = hiz[(size_t)(by / BLOCK_SIZE) * blocksX + bx / BLOCK_SIZE];
+                if (tri.MinZ >= blockFarthest || EdgesMissRect(tri, bx, by, BLOCK_SIZE))
+                    continue;
+
+                bool wrote = false;
+                for (int row = 0; row < BLOCK_SIZE; ++row)
+                {
+                    int y = by + row;
+                    float* depthRow = &depth[(size_t)y * pitch + bx];
+                    int mask = CoverAndTest(tri, bx, y, depthRow);
+                    for (int i = 0; mask; ++i, mask >>= 1)
+                    {
+                        if (!(mask & 1))
+                            continue;
+                        color[(size_t)y * pitch + bx + i] = Pack(Shade(tri, bx + i + 0.5f, y + 0.5f));
+                        wrote = true;
+                    }
+                }
+
+                if (wrote)
+                {
+                    float farthest = 0.0f;
+                    for (int row = 0; row < BLOCK_SIZE; ++row)
+                    {
+                        const float* depthRow = &depth[(size_t)(by + row) * pitch + bx];
+                        for (int i = 0; i < BLOCK_SIZE; ++i)
+                            farthest = std::max(farthest, depthRow[i]);
+                    }
+                    blockFarthest = farthest;
+                }
+            }
+        }
+    }
+
+    // Coverage and GL_LESS depth test of 8 pixels starting at (x, y); writes the passing depths and
+    // returns them as a bit mask
+    static int CoverAndTest(const Triangle& tri, int x, int y, float* depthRow)
+    {
+#if defined(__AVX2__)
+        const __m256 px = _mm256_add_ps(_mm256_set1_ps(x + 0.5f), _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f));
+        const __m256 py = _mm256_set1_ps(y + 0.5f);
+        const __m256 zero = _mm256_setzero_ps();
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int i = 0; i < 3; ++i)
+        {
+            __m256 e = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(tri.A[i]), px),
+                _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(tri.B[i]), py), _mm256_set1_ps(tri.C[i])));
+            __m256 edge = (tri.TopLeft & (1 << i)) ? _mm256_cmp_ps(e, zero, _CMP_GE_OQ) : _mm256_cmp_ps(e, zero, _CMP_GT_OQ);
+            inside = _mm256_and_ps(inside, edge);
+        }
+        if (_mm256_movemask_ps(inside) == 0)
+            return 0;
+
+        __m256 z = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(tri.Z.x), px),
+            _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(tri.Z.y), py), _mm256_set1_ps(tri.Z.z)));
+        __m256 d = _mm256_loadu_ps(depthRow);
+        __m256 pass = _mm256_and_ps(inside, _mm256_cmp_ps(z, d, _CMP_LT_OQ));
+        int mask = _mm256_movemask_ps(pass);
+        if (mask)
+            _mm256_storeu_ps(depthRow, _mm256_blendv_ps(d, z, pass));
+        return mask;
+#else
+        int mask = 0;
+        float py = y + 0.5f;
+        for (int i = 0; i < BLOCK_SIZE; ++i)
+        {
+            float px = x + i + 0.5f;
+            bool inside = true;
+            for (int e = 0; e < 3 && inside; ++e)
+            {
+                float value = tri.A[e] * px + tri.B[e] * py + tri.C[e];
+                inside = (tri.TopLeft & (1 << e)) ? value >= 0.0f : value > 0.0f;
+            }
+            float z = tri.Z.x * px + tri.Z.y * py + tri.Z.z;
+            if (inside && z < depthRow[i])
+            {
+                depthRow[i] = z;
+                mask |= 1 << i;
+            }
+        }
+        return mask;
+#endif
+    }
+
+    // sunFragmentShaderSource for one pixel
+    glm::vec4 Shade(const Triangle& tri, float x, float y) const
+    {
+        auto at = [x, y](const glm::vec3& plane) { return plane.x * x + plane.y * y + plane.z; };
+        float w = 1.0f / at(tri.InvW);
+        glm::vec3 position(at(tri.Attributes[0]) * w, at(tri.Attributes[1]) * w, at(tri.Attributes[2]) * w);
+        glm::vec3 normal(at(tri.Attributes[3]) * w, at(tri.Attributes[4]) * w, at(tri.Attributes[5]) * w);
+        glm::vec2 uv(at(tri.Attributes[6]) * w, at(tri.Attributes[7]) * w);
+
+        glm::vec4 textureColor(1.0f);
+        if (tri.Texture)
+        {
+            // Screen space derivatives of the perspective correct uv pick the mip level
+            glm::vec2 dx((tri.Attributes[6].x - uv.x * tri.InvW.x) * w, (tri.Attributes[7].x - uv.y * tri.InvW.x) * w);
+            glm::vec2 dy((tri.Attributes[6].y - uv.x * tri.InvW.y) * w, (tri.Attributes[7].y - uv.y * tri.InvW.y) * w);
+            glm::vec2 texels((float)tri.Texture->Width() * shading.UVScale.x, (float)tri.Texture->Height() * shading.UVScale.y);
+            dx = dx * texels;
+            dy = dy * texels;
+            float rho2 = std::max(glm::dot(dx, dx), glm::dot(dy, dy));
+            float lod = rho2 > 0.0f ? 0.5f * std::log2(rho2) : 0.0f;
+            textureColor = tri.Texture->Sample(uv * shading.UVScale, lod);
+        }
+
+        const SoftLight& light1 = shading.Lights[0];
+        const SoftLight& light2 = shading.Lights[1];
+        auto highlight = [](float x)
+        {
+            // pow(x, 16.0), the shader's highlightSize, by repeated squaring. Below 0.01 the result is under
+            // 1e-32 and would only slow the squaring down with denormals, so it is flushed like a GPU would
+            if (x < 0.01f)
+                return 0.0f;
+            x *= x; x *= x; x *= x;
+            return x * x;
+        };
+
+        glm::vec3 norm = glm::normalize(normal);
+        glm::vec3 viewDir = glm::normalize(shading.ViewPosition - position);
+
+        glm::vec3 ambient = shading.AmbientStrength * light1.Color;
+        glm::vec3 lightDirection = glm::normalize(light1.Position - position);
+        glm::vec3 diffuse = std::max(glm::dot(norm, lightDirection), 0.0f) * light1.Color;
+        float specularComponent = highlight(std::max(glm::dot(viewDir, glm::reflect(-lightDirection, norm)), 0.0f));
+        glm::vec3 specular = shading.SpecularIntensity * specularComponent * light1.Color;
+
+        ambient += light2.Strength * (shading.AmbientStrength * light2.Color);
+        lightDirection = glm::normalize(light2.Position - position);
+        diffuse += light2.Strength * (std::max(glm::dot(norm, lightDirection), 0.0f) * light2.Color);
+        specularComponent = highlight(std::max(glm::dot(viewDir, glm::reflect(-lightDirection, norm)), 0.0f));
+        specular += light2.Strength * (shading.SpecularIntensity * specularComponent * light2.Color);
+
+        return glm::vec4((ambient + diffuse + specular) * glm::vec3(textureColor), 1.0f);
+    }
+
+    static uint32_t Pack(const glm::vec4& c)
+    {
+        auto channel = [](float v) { return (uint32_t)(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f); };
+        return channel(c.r) | channel(c.g) << 8 | channel(c.b) << 16 | channel(c.a) << 24;
+    }
+
+    int tilesX = 0, tilesY = 0;
+    int pitch = 0;
+    int blocksX = 0;
+    std::vector<uint32_t> color;
+    std::vector<float> depth;
+    std::vector<float> hiz;         // farthest depth in each 8x8 block
+    std::vector<DrawCall> draws;
+    std::vector<ClipVertex> vertices;
+    std::vector<Chunk> chunks;
+    SoftShading shading;
+};
+#endif
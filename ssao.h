@@ -0,0 +1,183 @@
+#pragma once
+
+#ifndef SSAO_H
+#define SSAO_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+#include "glstate.h"
+
+// Screen space ambient occlusion at half resolution. The occlusion program reads the scene's depth after the
+// prepass, rebuilds each pixel's view space position and normal from it, and estimates how much of the
+// hemisphere around the normal the nearby depth samples block (the scalable ambient obscurance estimator, a
+// spiral of samples within Radius world units). Its target is RG16F, occlusion in r and the pixel's linear
+// depth in g, so the blur and upsampling after it can keep to surfaces at the same depth.
+//
+// With Temporal on, the sample spiral turns every frame and each pixel blends in its own result from last
+// frame, reprojected through last frame's camera and dropped where the depth no longer matches (disocclusion).
+// That history is kept here, copied from the occlusion target after every frame, since frame graph targets
+// don't outlive the frame.
+//
+// Blur runs twice, across then up, weighting the neighbors by their depth. The lit programs upsample the
+// result themselves, from the four half resolution texels around each pixel (see the sun fragment shader).
+class AmbientOcclusion
+{
+public:
+    static const int DEPTH_UNIT = 0;
+    static const int HISTORY_UNIT = 1;
+    static const int OCCLUSION_UNIT = 7;        // where the lit programs read the result
+    static constexpr float GOLDEN_ANGLE = 2.39996323f;
+
+    float Radius = 0.6f;                // world units
+    float Intensity = 1.0f;
+    float HistoryWeight = 0.85f;        // share of last frame's result where it is still valid
+    bool Temporal = true;
+
+    void Create(GLuint occlusionProgram, GLuint blurProgram, GLState& state)
+    {
+        this->occlusionProgram = occlusionProgram;
+        this->blurProgram = blurProgram;
+
+        state.UseProgram(occlusionProgram);
+        glUniform1i(glGetUniformLocation(occlusionProgram, "depth"), DEPTH_UNIT);
+        glUniform1i(glGetUniformLocation(occlusionProgram, "history"), HISTORY_UNIT);
+        projectionLocation = glGetUniformLocation(occlusionProgram, "projection");
+        inverseProjectionLocation = glGetUniformLocation(occlusionProgram, "inverseProjection");
+        renderSizeLocation = glGetUniformLocation(occlusionProgram, "renderSize");
+        radiusLocation = glGetUniformLocation(occlusionProgram, "radius");
+        intensityLocation = glGetUniformLocation(occlusionProgram, "intensity");
+        rotationLocation = glGetUniformLocation(occlusionProgram, "rotation");
+        useHistoryLocation = glGetUniformLocation(occlusionProgram, "useHistory");
+        toPreviousViewLocation = glGetUniformLocation(occlusionProgram, "toPreviousView");
+        previousProjectionLocation = glGetUniformLocation(occlusionProgram, "previousProjection");
+        historyWeightLocation = glGetUniformLocation(occlusionProgram, "historyWeight");
+
+        state.UseProgram(blurProgram);
+        glUniform1i(glGetUniformLocation(blurProgram, "occlusion"), 0);
+        directionLocation = glGetUniformLocation(blurProgram, "direction");
+        maxTexelLocation = glGetUniformLocation(blurProgram, "maxTexel");
+
+        // the passes are fullscreen triangles from gl_VertexID, but a draw still needs a vertex array bound
+        glGenVertexArrays(1, &emptyVAO);
+        created = true;
+    }
+
+    void Destroy()
+    {
+        if (!created)
+            return;
+        glDeleteTextures(1, &history);
+        glDeleteVertexArrays(1, &emptyVAO);
+        history = 0;
+        created = false;
+    }
+
+    bool Created() const
+    {
+        return created;
+    }
+
+    // draws the occlusion into the bound target (texture target, targetSize texels) at half of renderSize,
+    // the part of depth the scene was drawn into, then keeps it as next frame's history
+    void Draw(GLuint depth, GLuint target, const glm::ivec2& targetSize, const glm::ivec2& renderSize,
+        const glm::mat4& view, const glm::mat4& projection, GLState& state)
+    {
+        glm::ivec2 size(std::max(1, renderSize.x / 2), std::max(1, renderSize.y / 2));
+        if (targetSize.x != historySize.x || targetSize.y != historySize.y)
+            CreateHistory(targetSize, state);
+
+        // last frame's result only lines up if it was drawn at the same resolution
+        bool useHistory = Temporal && historyValid && size.x == historyRenderSize.x && size.y == historyRenderSize.y;
+        glm::mat4 toPreviousView = previousView * glm::inverse(view);
+
+        state.UseProgram(occlusionProgram);
+        state.BindTexture(DEPTH_UNIT, GL_TEXTURE_2D, depth);
+        state.BindTexture(HISTORY_UNIT, GL_TEXTURE_2D, history);
+        glm::mat4 inverseProjection = glm::inverse(projection);
+        glUniformMatrix4fv(projectionLocation, 1, GL_FALSE, glm::value_ptr(projection));
+        glUniformMatrix4fv(inverseProjectionLocation, 1, GL_FALSE, glm::value_ptr(inverseProjection));
+        glUniform2f(renderSizeLocation, (float)renderSize.x, (float)renderSize.y);
+        glUniform1f(radiusLocation, Radius);
+        glUniform1f(intensityLocation, Intensity);
+        glUniform1f(rotationLocation, Temporal ? rotation : 0.0f);
+        glUniform1i(useHistoryLocation, useHistory);
+        glUniformMatrix4fv(toPreviousViewLocation, 1, GL_FALSE, glm::value_ptr(toPreviousView));
+        glUniformMatrix4fv(previousProjectionLocation, 1, GL_FALSE, glm::value_ptr(previousProjection));
+        glUniform1f(historyWeightLocation, HistoryWeight);
+        state.BindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        if (Temporal)
+            glCopyImageSubData(target, GL_TEXTURE_2D, 0, 0, 0, 0, history, GL_TEXTURE_2D, 0, 0, 0, 0, size.x, size.y, 1);
+        historyValid = Temporal;
+        historyRenderSize = size;
+        previousView = view;
+        previousProjection = projection;
+        rotation = std::fmod(rotation + GOLDEN_ANGLE, 6.2831853f);
+    }
+
+    // one direction of the depth aware blur, from source into the bound target; renderSize as for Draw
+    void Blur(GLuint source, const glm::ivec2& direction, const glm::ivec2& renderSize, GLState& state)
+    {
+        glm::ivec2 maxTexel(std::max(1, renderSize.x / 2) - 1, std::max(1, renderSize.y / 2) - 1);
+        state.UseProgram(blurProgram);
+        state.BindTexture(0, GL_TEXTURE_2D, source);
+        glUniform2f(directionLocation, (float)direction.x, (float)direction.y);
+        glUniform2f(maxTexelLocation, (float)maxTexel.x, (float)maxTexel.y);
+        state.BindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    // forgets the history, for when the frames before the next one don't draw the occlusion
+    void Reset()
+    {
+        historyValid = false;
+    }
+
+private:
+    void CreateHistory(const glm::ivec2& size, GLState& state)
+    {
+        if (!history)
+            glGenTextures(1, &history);
+        state.BindTexture(HISTORY_UNIT, GL_TEXTURE_2D, history);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, size.x, size.y, 0, GL_RG, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        historySize = size;
+        historyValid = false;
+    }
+
+    GLuint occlusionProgram = 0;
+    GLuint blurProgram = 0;
+    GLuint history = 0;
+    GLuint emptyVAO = 0;
+    bool created = false;
+
+    glm::ivec2 historySize = glm::ivec2(0, 0);
+    glm::ivec2 historyRenderSize = glm::ivec2(0, 0);   // of the occlusion kept in history
+    bool historyValid = false;
+    glm::mat4 previousView = glm::mat4(1.0f);
+    glm::mat4 previousProjection = glm::mat4(1.0f);
+    float rotation = 0.0f;              // of the sample spiral, radians
+
+    GLint projectionLocation = -1;
+    GLint inverseProjectionLocation = -1;
+    GLint renderSizeLocation = -1;
+    GLint radiusLocation = -1;
+    GLint intensityLocation = -1;
+    GLint rotationLocation = -1;
+    GLint useHistoryLocation = -1;
+    GLint toPreviousViewLocation = -1;
+    GLint previousProjectionLocation = -1;
+    GLint historyWeightLocation = -1;
+    GLint directionLocation = -1;
+    GLint maxTexelLocation = -1;
+};
+#endif
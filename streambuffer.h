@@ -0,0 +1,107 @@
+#pragma once
+
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <GL/glew.h>
+
+#include <cstddef>
+
+// Ring allocator over a persistently mapped buffer for data written by the CPU every frame (instance data,
+// particles, debug lines). The storage is created once with glBufferStorage and stays mapped, so streaming
+// never reallocates with glBufferData. The ring is split into one region per frame in flight, and each
+// region is fenced with glFenceSync when the frame is submitted; BeginFrame waits on that fence before the
+// region is written again, so the driver never has to synchronize implicitly.
+class StreamBuffer
+{
+public:
+    static const int FRAMES_IN_FLIGHT = 3;
+
+    struct Allocation
+    {
+        void* Pointer;          // where the CPU writes the data
+        GLintptr Offset;        // byte offset of the data inside Buffer
+    };
+
+    // bytesPerFrame is the most data a single frame may stream
+    bool Create(GLsizeiptr bytesPerFrame)
+    {
+        regionSize = (bytesPerFrame + 255) & ~(GLsizeiptr)255;
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+        glGenBuffers(1, &Buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, Buffer);
+        glBufferStorage(GL_COPY_WRITE_BUFFER, regionSize * FRAMES_IN_FLIGHT, NULL, flags);
+        mapped = (char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, regionSize * FRAMES_IN_FLIGHT, flags);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        return mapped != nullptr;
+    }
+
+    void Destroy()
+    {
+        for (GLsync& fence : fences)
+        {
+            if (fence)
+                glDeleteSync(fence);
+            fence = 0;
+        }
+        if (Buffer)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, Buffer);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            glDeleteBuffers(1, &Buffer);
+        }
+        Buffer = 0;
+        mapped = nullptr;
+    }
+
+    // waits until the GPU is done with this frame's region (normally it already is) and rewinds into it
+    void BeginFrame()
+    {
+        GLsync& fence = fences[region];
+        if (fence)
+        {
+            GLbitfield waitFlags = 0;
+            while (glClientWaitSync(fence, waitFlags, 1000000) == GL_TIMEOUT_EXPIRED)
+            {
+                waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+                ++Stalls;
+            }
+            glDeleteSync(fence);
+            fence = 0;
+        }
+        head = 0;
+    }
+
+    // fences the region after the frame's draws have been issued and moves on to the next one
+    void EndFrame()
+    {
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        region = (region + 1) % FRAMES_IN_FLIGHT;
+    }
+
+    // reserves bytes in this frame's region; Pointer is null when the region is full
+    Allocation Allocate(GLsizeiptr bytes, GLsizeiptr alignment = 16)
+    {
+        GLsizeiptr start = (head + alignment - 1) / alignment * alignment;
+        if (start + bytes > regionSize)
+            return { nullptr, 0 };
+
+        head = start + bytes;
+        GLintptr offset = region * regionSize + start;
+        return { mapped + offset, offset };
+    }
+
+    GLuint Buffer = 0;
+    unsigned int Stalls = 0;    // times BeginFrame had to wait for the GPU
+
+private:
+    char* mapped = nullptr;
+    GLsizeiptr regionSize = 0;
+    GLsizeiptr head = 0;
+    int region = 0;
+    GLsync fences[FRAMES_IN_FLIGHT] = {};
+};
+#endif
@@ -0,0 +1,203 @@
+#pragma once
+
+#ifndef TAA_H
+#define TAA_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+
+#include "glstate.h"
+
+// Temporal anti-aliasing that doubles as the upscaler. Every frame the projection moves by a different
+// subpixel offset (a Halton sequence over JITTER_PHASES frames), so over a few frames each window pixel
+// gathers samples from many points inside it, and from more than one render pixel when the scene is drawn
+// below the window's resolution.
+//
+// The velocity pass turns the scene's depth into each pixel's motion on screen since last frame: the point
+// is rebuilt through the jittered view-projection the scene was drawn with and projected through this and
+// last frame's unjittered ones, so the jitter itself never shows up as motion. The objects don't move, so
+// the camera's motion is all of it. Each pixel takes the motion of the nearest surface around it, which
+// keeps the edges of foreground objects from dragging the background's history along.
+//
+// The resolve then runs at the window's resolution. It fetches last frame's result where the pixel was,
+// clips it to the range of colors the current frame has around the pixel (which rejects history that went
+// stale through disocclusion or shading changes) and blends the current sample in by how close it landed to
+// the pixel's center. Its target is copied into the history kept here, since frame graph targets don't
+// outlive the frame.
+class TemporalAntiAliasing
+{
+public:
+    static const int COLOR_UNIT = 0;
+    static const int VELOCITY_UNIT = 1;
+    static const int HISTORY_UNIT = 2;
+    static const int DEPTH_UNIT = 0;            // for the velocity pass
+    static const int JITTER_PHASES = 16;
+    static constexpr float RENDER_SCALE = 0.75f;    // of the window per axis, with dynamic resolution off
+    static constexpr float SHARPNESS = 0.4f;    // for the upscale pass after the resolve
+
+    float Blend = 0.1f;                 // share of the current frame where its sample lands on the pixel
+
+    void Create(GLuint velocityProgram, GLuint resolveProgram, GLState& state)
+    {
+        this->velocityProgram = velocityProgram;
+        this->resolveProgram = resolveProgram;
+
+        state.UseProgram(velocityProgram);
+        glUniform1i(glGetUniformLocation(velocityProgram, "depth"), DEPTH_UNIT);
+        inverseViewProjectionLocation = glGetUniformLocation(velocityProgram, "inverseViewProjection");
+        viewProjectionLocation = glGetUniformLocation(velocityProgram, "viewProjection");
+        previousViewProjectionLocation = glGetUniformLocation(velocityProgram, "previousViewProjection");
+        velocityRenderSizeLocation = glGetUniformLocation(velocityProgram, "renderSize");
+
+        state.UseProgram(resolveProgram);
+        glUniform1i(glGetUniformLocation(resolveProgram, "sceneColor"), COLOR_UNIT);
+        glUniform1i(glGetUniformLocation(resolveProgram, "velocity"), VELOCITY_UNIT);
+        glUniform1i(glGetUniformLocation(resolveProgram, "history"), HISTORY_UNIT);
+        renderSizeLocation = glGetUniformLocation(resolveProgram, "renderSize");
+        outputSizeLocation = glGetUniformLocation(resolveProgram, "outputSize");
+        jitterLocation = glGetUniformLocation(resolveProgram, "jitter");
+        blendLocation = glGetUniformLocation(resolveProgram, "blend");
+        useHistoryLocation = glGetUniformLocation(resolveProgram, "useHistory");
+
+        // the passes are fullscreen triangles from gl_VertexID, but a draw still needs a vertex array bound
+        glGenVertexArrays(1, &emptyVAO);
+        created = true;
+    }
+
+    void Destroy()
+    {
+        if (!created)
+            return;
+        glDeleteTextures(1, &history);
+        glDeleteVertexArrays(1, &emptyVAO);
+        history = 0;
+        created = false;
+    }
+
+    bool Created() const
+    {
+        return created;
+    }
+
+    // starts a frame drawn at renderSize with the camera's view and projection; returns the projection to
+    // draw the scene with, moved by this frame's jitter
+    glm::mat4 BeginFrame(const glm::mat4& view, const glm::mat4& projection, const glm::ivec2& renderSize)
+    {
+        // offsets within the pixel, -0.5 to 0.5 in render pixels
+        int phase = frameIndex++ % JITTER_PHASES + 1;
+        jitter = glm::vec2(Halton(phase, 2) - 0.5f, Halton(phase, 3) - 0.5f);
+
+        previousViewProjection = historyValid ? viewProjection : projection * view;
+        viewProjection = projection * view;
+
+        // a translation in normalized device coordinates after the projection moves the image the same
+        // number of pixels whether the projection is perspective or orthographic
+        glm::vec3 offset(2.0f * jitter.x / renderSize.x, 2.0f * jitter.y / renderSize.y, 0.0f);
+        jitteredProjection = glm::translate(glm::mat4(1.0f), offset) * projection;
+        jitteredInverse = glm::inverse(jitteredProjection * view);
+        return jitteredProjection;
+    }
+
+    // screen space motion since last frame of the scene drawn into the lower left renderSize pixels of
+    // depth, into the bound target (RG16F, in texture coordinates of the rendered part)
+    void DrawVelocity(GLuint depth, const glm::ivec2& renderSize, GLState& state)
+    {
+        state.UseProgram(velocityProgram);
+        state.BindTexture(DEPTH_UNIT, GL_TEXTURE_2D, depth);
+        glUniformMatrix4fv(inverseViewProjectionLocation, 1, GL_FALSE, glm::value_ptr(jitteredInverse));
+        glUniformMatrix4fv(viewProjectionLocation, 1, GL_FALSE, glm::value_ptr(viewProjection));
+        glUniformMatrix4fv(previousViewProjectionLocation, 1, GL_FALSE, glm::value_ptr(previousViewProjection));
+        glUniform2f(velocityRenderSizeLocation, (float)renderSize.x, (float)renderSize.y);
+        state.BindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    // blends the scene color (and its velocity, both in their lower left renderSize pixels) with the
+    // history into the bound target (texture target, RGBA16F at outputSize), then keeps the result
+    void Resolve(GLuint color, GLuint velocity, GLuint target, const glm::ivec2& renderSize,
+        const glm::ivec2& outputSize, GLState& state)
+    {
+        if (outputSize.x != historySize.x || outputSize.y != historySize.y)
+            CreateHistory(outputSize, state);
+
+        state.UseProgram(resolveProgram);
+        state.BindTexture(COLOR_UNIT, GL_TEXTURE_2D, color);
+        state.BindTexture(VELOCITY_UNIT, GL_TEXTURE_2D, velocity);
+        state.BindTexture(HISTORY_UNIT, GL_TEXTURE_2D, history);
+        glUniform2f(renderSizeLocation, (float)renderSize.x, (float)renderSize.y);
+        glUniform2f(outputSizeLocation, (float)outputSize.x, (float)outputSize.y);
+        glUniform2f(jitterLocation, jitter.x, jitter.y);
+        glUniform1f(blendLocation, Blend);
+        glUniform1i(useHistoryLocation, historyValid);
+        state.BindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        glCopyImageSubData(target, GL_TEXTURE_2D, 0, 0, 0, 0, history, GL_TEXTURE_2D, 0, 0, 0, 0, outputSize.x, outputSize.y, 1);
+        historyValid = true;
+    }
+
+    // forgets the history, for when the frames before the next one aren't resolved
+    void Reset()
+    {
+        historyValid = false;
+    }
+
+private:
+    // radical inverse of index in base, 0 to 1
+    static float Halton(int index, int base)
+    {
+        float result = 0.0f;
+        float fraction = 1.0f;
+        while (index > 0)
+        {
+            fraction /= base;
+            result += fraction * (index % base);
+            index /= base;
+        }
+        return result;
+    }
+
+    void CreateHistory(const glm::ivec2& size, GLState& state)
+    {
+        if (!history)
+            glGenTextures(1, &history);
+        state.BindTexture(HISTORY_UNIT, GL_TEXTURE_2D, history);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, size.x, size.y, 0, GL_RGBA, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        historySize = size;
+        historyValid = false;
+    }
+
+    GLuint velocityProgram = 0;
+    GLuint resolveProgram = 0;
+    GLuint history = 0;
+    GLuint emptyVAO = 0;
+    bool created = false;
+
+    glm::ivec2 historySize = glm::ivec2(0, 0);
+    bool historyValid = false;
+    int frameIndex = 0;
+    glm::vec2 jitter = glm::vec2(0.0f);        // this frame's, in render pixels
+    glm::mat4 viewProjection = glm::mat4(1.0f);             // unjittered
+    glm::mat4 previousViewProjection = glm::mat4(1.0f);     // unjittered, of the frame in history
+    glm::mat4 jitteredProjection = glm::mat4(1.0f);
+    glm::mat4 jitteredInverse = glm::mat4(1.0f);            // of the jittered view-projection
+
+    GLint inverseViewProjectionLocation = -1;
+    GLint viewProjectionLocation = -1;
+    GLint previousViewProjectionLocation = -1;
+    GLint velocityRenderSizeLocation = -1;
+    GLint renderSizeLocation = -1;
+    GLint outputSizeLocation = -1;
+    GLint jitterLocation = -1;
+    GLint blendLocation = -1;
+    GLint useHistoryLocation = -1;
+};
+#endif
@@ -0,0 +1,767 @@
+#pragma once
+
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+#include "glstate.h"
+#include "logger.h"
+
+// Heightmap terrain, stored on disk as square tiles of 16 bit heights plus a coarse overview of the whole
+// map taken every OverviewStep samples. Terrain space has x and y across the map and z up; Terrain::Model
+// places it in the world.
+//
+// File layout, every array starting on an 8 byte boundary:
+//   TerrainFileHeader
+//   TilesPerSide^2 pairs of (min, max) heights, one per tile, row by row
+//   the overview, (TilesPerSide * TileSize / OverviewStep + 1)^2 samples
+//   the tiles, row by row, each (TileSize + 1)^2 samples; tiles repeat their neighbours' edge samples
+// Image rows are padded to an even number of samples so they start 4 byte aligned, which is what
+// glTexSubImage expects by default.
+struct TerrainFileHeader
+{
+    static const uint32_t MAGIC = 0x52524554;   // "TERR"
+    static const uint32_t VERSION = 1;
+
+    uint32_t Magic;
+    uint32_t Version;
+    uint32_t TilesPerSide;
+    uint32_t TileSize;              // quads along a tile edge
+    uint32_t OverviewStep;          // samples between overview samples
+    float Spacing;                  // terrain units between samples
+    float HeightMin, HeightMax;     // what 0 and 65535 stand for
+    uint64_t RangesOffset;
+    uint64_t OverviewOffset;
+    uint64_t TilesOffset;
+
+    int TileSamples() const { return (int)TileSize + 1; }
+    int OverviewSamples() const { return (int)(TilesPerSide * TileSize / OverviewStep) + 1; }
+    float Size() const { return TilesPerSide * TileSize * Spacing; }
+
+    static int PaddedRow(int samples) { return (samples + 1) & ~1; }
+    size_t TileBytes() const { return (size_t)PaddedRow(TileSamples()) * TileSamples() * sizeof(uint16_t); }
+};
+
+
+// Generates a terrain file: rolling fractal hills, flattened to height 0 around the origin where the scene
+// stands. Runs once, when the file named by the scene doesn't exist yet
+class TerrainBaker
+{
+public:
+    static const int TILES_PER_SIDE = 16;
+    static const int TILE_SIZE = 128;
+    static const int OVERVIEW_STEP = 8;
+
+    static bool Bake(const std::string& path)
+    {
+        TerrainFileHeader header = {};
+        header.Magic = TerrainFileHeader::MAGIC;
+        header.Version = TerrainFileHeader::VERSION;
+        header.TilesPerSide = TILES_PER_SIDE;
+        header.TileSize = TILE_SIZE;
+        header.OverviewStep = OVERVIEW_STEP;
+        header.Spacing = 1.0f;
+        header.HeightMin = -20.0f;
+        header.HeightMax = 180.0f;
+
+        // the whole map at full resolution, centered on the origin
+        int samples = TILES_PER_SIDE * TILE_SIZE + 1;
+        float half = header.Size() * 0.5f;
+        std::vector<uint16_t> heights((size_t)samples * samples);
+        for (int y = 0; y < samples; ++y)
+        {
+            for (int x = 0; x < samples; ++x)
+            {
+                float px = x * header.Spacing - half, py = y * header.Spacing - half;
+                float hills = Fractal(px / 400.0f, py / 400.0f) * 150.0f - 15.0f;
+                float r = std::sqrt(px * px + py * py);
+                float t = std::min(std::max((r - FLAT_RADIUS) / (HILLS_RADIUS - FLAT_RADIUS), 0.0f), 1.0f);
+                float height = hills * t * t * (3.0f - 2.0f * t);
+                float value = (height - header.HeightMin) / (header.HeightMax - header.HeightMin);
+                heights[(size_t)y * samples + x] = (uint16_t)(std::min(std::max(value, 0.0f), 1.0f) * 65535.0f + 0.5f);
+            }
+        }
+
+        std::vector<char> out(sizeof(TerrainFileHeader));
+        auto align = [&out] { out.resize((out.size() + 7) & ~(size_t)7); return (uint64_t)out.size(); };
+
+        header.RangesOffset = align();
+        for (int ty = 0; ty < TILES_PER_SIDE; ++ty)
+        {
+            for (int tx = 0; tx < TILES_PER_SIDE; ++tx)
+            {
+                uint16_t range[2] = { 65535, 0 };
+                for (int y = 0; y <= TILE_SIZE; ++y)
+                {
+                    for (int x = 0; x <= TILE_SIZE; ++x)
+                    {
+                        uint16_t h = heights[(size_t)(ty * TILE_SIZE + y) * samples + tx * TILE_SIZE + x];
+                        range[0] = std::min(range[0], h);
+                        range[1] = std::max(range[1], h);
+                    }
+                }
+                Append(out, range, sizeof(range));
+            }
+        }
+
+        header.OverviewOffset = align();
+        int overview = header.OverviewSamples();
+        std::vector<uint16_t> row(TerrainFileHeader::PaddedRow(std::max(overview, header.TileSamples())), 0);
+        for (int y = 0; y < overview; ++y)
+        {
+            for (int x = 0; x < overview; ++x)
+                row[x] = heights[(size_t)y * OVERVIEW_STEP * samples + x * OVERVIEW_STEP];
+            Append(out, row.data(), TerrainFileHeader::PaddedRow(overview) * sizeof(uint16_t));
+        }
+
+        header.TilesOffset = align();
+        int tileSamples = header.TileSamples();
+        for (int ty = 0; ty < TILES_PER_SIDE; ++ty)
+        {
+            for (int tx = 0; tx < TILES_PER_SIDE; ++tx)
+            {
+                for (int y = 0; y < tileSamples; ++y)
+                {
+                    const uint16_t* source = &heights[(size_t)(ty * TILE_SIZE + y) * samples + tx * TILE_SIZE];
+                    std::copy(source, source + tileSamples, row.begin());
+                    row[tileSamples] = row[tileSamples - 1];
+                    Append(out, row.data(), TerrainFileHeader::PaddedRow(tileSamples) * sizeof(uint16_t));
+                }
+            }
+        }
+        memcpy(out.data(), &header, sizeof(header));
+
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file)
+            return false;
+        fwrite(out.data(), 1, out.size(), file);
+        bool ok = !ferror(file);
+        return fclose(file) == 0 && ok;
+    }
+
+private:
+    static constexpr float FLAT_RADIUS = 24.0f;     // the scene's ground plane reaches about 21 units out
+    static constexpr float HILLS_RADIUS = 90.0f;    // full height from here on
+
+    static void Append(std::vector<char>& out, const void* data, size_t size)
+    {
+        const char* bytes = (const char*)data;
+        out.insert(out.end(), bytes, bytes + size);
+    }
+
+    static float Lattice(int x, int y)
+    {
+        uint32_t h = (uint32_t)x * 374761393u + (uint32_t)y * 668265263u;
+        h = (h ^ (h >> 13)) * 1274126177u;
+        return (float)((h ^ (h >> 16)) & 0xFFFF) / 65535.0f;
+    }
+
+    // smoothly interpolated value noise, 0 to 1
+    static float Noise(float x, float y)
+    {
+        int ix = (int)std::floor(x), iy = (int)std::floor(y);
+        float fx = x - ix, fy = y - iy;
+        fx = fx * fx * (3.0f - 2.0f * fx);
+        fy = fy * fy * (3.0f - 2.0f * fy);
+        float a = Lattice(ix, iy), b = Lattice(ix + 1, iy);
+        float c = Lattice(ix, iy + 1), d = Lattice(ix + 1, iy + 1);
+        return (a + (b - a) * fx) + ((c + (d - c) * fx) - (a + (b - a) * fx)) * fy;
+    }
+
+    static float Fractal(float x, float y)
+    {
+        float sum = 0.0f, amplitude = 0.5f, total = 0.0f;
+        for (int octave = 0; octave < 7; ++octave)
+        {
+            sum += Noise(x, y) * amplitude;
+            total += amplitude;
+            amplitude *= 0.5f;
+            x = x * 2.03f + 17.0f;
+            y = y * 2.03f - 31.0f;
+        }
+        return sum / total;
+    }
+};
+
+
+// Renders a terrain file with continuous distance dependent level of detail (CDLOD). A quadtree over the map
+// picks, every frame, nodes that all draw the same GRID x GRID vertex grid: leaves at full resolution near the
+// camera, each level up covering twice the area at half the density and reaching twice as far. Near the far
+// end of its range a level's odd vertices slide onto the next level's grid (geomorphing), so levels meet
+// without cracks and never pop.
+//
+// Heights come from textures the vertex shader samples. The overview is always resident; the full resolution
+// tiles the finer levels need are read from disk by a loader thread, as the camera approaches them, into a
+// fixed texture array of RESIDENT_TILES layers that recycles the least recently needed tile. Nodes whose tile
+// isn't in yet use the overview meanwhile. Memory is therefore fixed however large the map, and the vertex
+// count is bounded by MAX_NODES.
+//
+// Everything but the loader thread belongs to the thread that owns the GL context.
+class Terrain
+{
+public:
+    static const int GRID = 32;                 // quads along a node edge
+    static const int RESIDENT_TILES = 48;
+    static const int UPLOADS_PER_FRAME = 2;
+    static const int MAX_NODES = 512;
+    static constexpr float LEAF_RANGE = 80.0f;  // leaves are drawn up to here, every coarser level twice as far
+    static constexpr float MORPH_START = 0.7f;  // how far into its distance band a level starts to morph
+
+    glm::mat4 Model = glm::mat4(1.0f);          // terrain space to world
+
+    ~Terrain()
+    {
+        StopLoader();
+    }
+
+    // reads the header, tile ranges and overview; false if the file is missing or not a terrain file
+    bool Open(const std::string& filename)
+    {
+        FILE* file = fopen(filename.c_str(), "rb");
+        if (!file)
+            return false;
+        bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.Magic == TerrainFileHeader::MAGIC
+            && header.Version == TerrainFileHeader::VERSION && header.TilesPerSide > 0 && header.TileSize > 0
+            && header.OverviewStep > 0 && header.TileSize % header.OverviewStep == 0;
+        if (valid)
+        {
+            size_t tiles = (size_t)header.TilesPerSide * header.TilesPerSide;
+            int overviewSamples = header.OverviewSamples();
+            ranges.resize(tiles * 2);
+            overview.resize((size_t)TerrainFileHeader::PaddedRow(overviewSamples) * overviewSamples);
+            valid = fseek(file, (long)header.RangesOffset, SEEK_SET) == 0
+                && fread(ranges.data(), sizeof(uint16_t), ranges.size(), file) == ranges.size()
+                && fseek(file, (long)header.OverviewOffset, SEEK_SET) == 0
+                && fread(overview.data(), sizeof(uint16_t), overview.size(), file) == overview.size()
+                && fseek(file, (long)(header.TilesOffset + tiles * header.TileBytes() - 1), SEEK_SET) == 0
+                && fgetc(file) != EOF;
+        }
+        fclose(file);
+        if (!valid)
+            return false;
+
+        path = filename;
+        origin = glm::vec2(-header.Size() * 0.5f);
+        levelCount = 1;
+        while (GRID * header.Spacing * (1 << (levelCount - 1)) < header.Size())
+            ++levelCount;
+        detailLevels = 0;
+        while (detailLevels < levelCount && (1 << detailLevels) < (int)header.OverviewStep)
+            ++detailLevels;
+        return true;
+    }
+
+    // creates the textures and the node grid and starts the loader; program draws the terrain
+    void Create(GLuint program, GLState& state)
+    {
+        int overviewSamples = header.OverviewSamples();
+        glGenTextures(1, &overviewTexture);
+        state.BindTexture(OVERVIEW_UNIT, GL_TEXTURE_2D, overviewTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, overviewSamples, overviewSamples, 0, GL_RED, GL_UNSIGNED_SHORT, overview.data());
+        SetSampling(GL_TEXTURE_2D);
+        overview.clear();
+        overview.shrink_to_fit();
+
+        int tileSamples = header.TileSamples();
+        glGenTextures(1, &tileTexture);
+        state.BindTexture(TILES_UNIT, GL_TEXTURE_2D_ARRAY, tileTexture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R16, tileSamples, tileSamples, RESIDENT_TILES, 0, GL_RED, GL_UNSIGNED_SHORT, NULL);
+        SetSampling(GL_TEXTURE_2D_ARRAY);
+
+        // grid vertices 0 to 1 across the node; the indices go quadrant by quadrant, so a node can draw any of
+        // its quarters with one range each
+        std::vector<GLfloat> vertices;
+        for (int y = 0; y <= GRID; ++y)
+        {
+            for (int x = 0; x <= GRID; ++x)
+            {
+                vertices.push_back((GLfloat)x / GRID);
+                vertices.push_back((GLfloat)y / GRID);
+            }
+        }
+        std::vector<GLushort> indices;
+        for (int quadrant = 0; quadrant < 4; ++quadrant)
+        {
+            int x0 = (quadrant & 1) * GRID / 2, y0 = (quadrant >> 1) * GRID / 2;
+            for (int y = y0; y < y0 + GRID / 2; ++y)
+            {
+                for (int x = x0; x < x0 + GRID / 2; ++x)
+                {
+                    GLushort corner = (GLushort)(y * (GRID + 1) + x);
+                    GLushort quad[6] = { corner, (GLushort)(corner + 1), (GLushort)(corner + GRID + 2),
+                        (GLushort)(corner + GRID + 2), (GLushort)(corner + GRID + 1), corner };
+                    indices.insert(indices.end(), quad, quad + 6);
+                }
+            }
+        }
+        glGenVertexArrays(1, &gridVAO);
+        state.BindVertexArray(gridVAO);
+        glGenBuffers(2, gridBuffers);
+        glBindBuffer(GL_ARRAY_BUFFER, gridBuffers[0]);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gridBuffers[1]);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), 0);
+        glEnableVertexAttribArray(0);
+        state.BindVertexArray(0);
+
+        this->program = program;
+        modelLocation = glGetUniformLocation(program, "model");
+        cameraLocation = glGetUniformLocation(program, "cameraPosition");
+        nodeOriginLocation = glGetUniformLocation(program, "nodeOrigin");
+        nodeSizeLocation = glGetUniformLocation(program, "nodeSize");
+        morphRangeLocation = glGetUniformLocation(program, "morphRange");
+        tileLayerLocation = glGetUniformLocation(program, "tileLayer");
+        tileOriginLocation = glGetUniformLocation(program, "tileOrigin");
+        state.UseProgram(program);
+        glUniform1f(glGetUniformLocation(program, "gridSize"), (float)GRID);
+        glUniform1f(glGetUniformLocation(program, "spacing"), header.Spacing);
+        glUniform1f(glGetUniformLocation(program, "tileSamples"), (float)tileSamples);
+        glUniform1f(glGetUniformLocation(program, "overviewStep"), (float)header.OverviewStep);
+        glUniform1f(glGetUniformLocation(program, "overviewSamples"), (float)overviewSamples);
+        glUniform2f(glGetUniformLocation(program, "terrainOrigin"), origin.x, origin.y);
+        glUniform2f(glGetUniformLocation(program, "heightRange"), header.HeightMin, header.HeightMax);
+        glUniform1i(glGetUniformLocation(program, "overview"), OVERVIEW_UNIT);
+        glUniform1i(glGetUniformLocation(program, "tiles"), TILES_UNIT);
+
+        size_t tiles = (size_t)header.TilesPerSide * header.TilesPerSide;
+        tileLayers.assign(tiles, -1);
+        tileQueued.assign(tiles, false);
+        layerTiles.assign(RESIDENT_TILES, -1);
+        layerUsed.assign(RESIDENT_TILES, 0);
+
+        loaderRunning = true;
+        loader = std::thread([this] { Load(); });
+    }
+
+    void Destroy()
+    {
+        StopLoader();
+        glDeleteTextures(1, &overviewTexture);
+        glDeleteTextures(1, &tileTexture);
+        glDeleteBuffers(2, gridBuffers);
+        glDeleteVertexArrays(1, &gridVAO);
+        overviewTexture = tileTexture = gridVAO = 0;
+    }
+
+    bool Created() const
+    {
+        return gridVAO != 0;
+    }
+
+    // streams tiles for a camera at cameraPosition (world space): uploads what the loader finished, within the
+    // per frame budget, and asks for the tiles the finer levels will need next
+    void Update(const glm::vec3& cameraPosition, GLState& state)
+    {
+        ++frame;
+        glm::vec3 camera = glm::vec3(glm::inverse(Model) * glm::vec4(cameraPosition, 1.0f));
+
+        // every tile a detail level node can be selected in, nearest first
+        float radius = detailLevels > 0 ? Range(detailLevels - 1) : 0.0f;
+        float tileWorld = header.TileSize * header.Spacing;
+        std::vector<std::pair<float, int>> wanted;
+        for (int ty = 0; ty < (int)header.TilesPerSide; ++ty)
+        {
+            for (int tx = 0; tx < (int)header.TilesPerSide; ++tx)
+            {
+                int tile = ty * header.TilesPerSide + tx;
+                glm::vec3 boxMin(origin.x + tx * tileWorld, origin.y + ty * tileWorld, Height(ranges[tile * 2]));
+                glm::vec3 boxMax(boxMin.x + tileWorld, boxMin.y + tileWorld, Height(ranges[tile * 2 + 1]));
+                float distance = BoxDistance(boxMin, boxMax, camera);
+                if (distance > radius)
+                    continue;
+                if (tileLayers[tile] >= 0)
+                    layerUsed[tileLayers[tile]] = frame;
+                else
+                    wanted.push_back({ distance, tile });
+            }
+        }
+        std::sort(wanted.begin(), wanted.end());
+
+        std::vector<LoadedTile> arrived;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (int i = 0; i < UPLOADS_PER_FRAME && !loaded.empty(); ++i)
+            {
+                tileQueued[loaded.front().Tile] = false;
+                arrived.push_back(std::move(loaded.front()));
+                loaded.pop_front();
+            }
+            // requests no longer wanted are dropped and the rest queued again, nearest first. A tile keeps its
+            // flag while the loader reads it, so it isn't asked for twice
+            for (int tile : requests)
+                tileQueued[tile] = false;
+            requests.clear();
+            for (const std::pair<float, int>& request : wanted)
+            {
+                if (requests.size() >= (size_t)RESIDENT_TILES)
+                    break;
+                if (!tileQueued[request.second])
+                {
+                    requests.push_back(request.second);
+                    tileQueued[request.second] = true;
+                }
+            }
+        }
+        wake.notify_one();
+
+        for (LoadedTile& tile : arrived)
+        {
+            if (tile.Samples.empty())
+                continue;
+            int layer = FreeLayer();
+            if (layer < 0)
+                continue;       // every layer is needed this frame; the tile will be asked for again
+            if (layerTiles[layer] >= 0)
+                tileLayers[layerTiles[layer]] = -1;
+            layerTiles[layer] = tile.Tile;
+            layerUsed[layer] = frame;
+            tileLayers[tile.Tile] = layer;
+            state.BindTexture(TILES_UNIT, GL_TEXTURE_2D_ARRAY, tileTexture);
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, header.TileSamples(), header.TileSamples(), 1,
+                GL_RED, GL_UNSIGNED_SHORT, tile.Samples.data());
+        }
+    }
+
+    // selects and draws the nodes for this frame. planes are the world space frustum planes (normals
+    // inward); view, projection and lighting uniforms of the program are the caller's
+    void Draw(GLState& state, const glm::vec4 planes[6], const glm::vec3& cameraPosition)
+    {
+        // the planes in terrain space: dot(plane, Model * p) == dot(transpose(Model) * plane, p)
+        glm::mat4 toTerrain = glm::transpose(Model);
+        for (int i = 0; i < 6; ++i)
+            localPlanes[i] = toTerrain * planes[i];
+        camera = glm::vec3(glm::inverse(Model) * glm::vec4(cameraPosition, 1.0f));
+
+        nodes.clear();
+        SelectNode(origin.x, origin.y, header.Size(), levelCount - 1);
+
+        state.UseProgram(program);
+        state.BindTexture(OVERVIEW_UNIT, GL_TEXTURE_2D, overviewTexture);
+        state.BindTexture(TILES_UNIT, GL_TEXTURE_2D_ARRAY, tileTexture);
+        state.BindVertexArray(gridVAO);
+        glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(Model));
+        glUniform3f(cameraLocation, camera.x, camera.y, camera.z);
+
+        Triangles = 0;
+        const int quadrantIndices = GRID * GRID / 4 * 6;
+        for (const Node& node : nodes)
+        {
+            float end = Range(node.Level), start = node.Level > 0 ? Range(node.Level - 1) : 0.0f;
+            glUniform2f(nodeOriginLocation, node.Origin.x, node.Origin.y);
+            glUniform1f(nodeSizeLocation, node.Size);
+            glUniform2f(morphRangeLocation, start + (end - start) * MORPH_START, end);
+            glUniform1i(tileLayerLocation, node.Layer);
+            glUniform2f(tileOriginLocation, node.TileOrigin.x, node.TileOrigin.y);
+
+            // adjacent quadrants are adjacent in the index buffer, so each run is one draw
+            for (int quadrant = 0; quadrant < 4;)
+            {
+                if (!(node.Quadrants & (1 << quadrant)))
+                {
+                    ++quadrant;
+                    continue;
+                }
+                int first = quadrant;
+                while (quadrant < 4 && (node.Quadrants & (1 << quadrant)))
+                    ++quadrant;
+                GLsizei count = (quadrant - first) * quadrantIndices;
+                glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_SHORT, (const void*)(first * quadrantIndices * sizeof(GLushort)));
+                Triangles += count / 3;
+            }
+        }
+        Nodes = (int)nodes.size();
+    }
+
+    int ResidentTiles() const
+    {
+        return (int)std::count_if(layerTiles.begin(), layerTiles.end(), [](int tile) { return tile >= 0; });
+    }
+
+    // texture memory, which doesn't depend on the size of the map beyond the overview
+    size_t ResidentBytes() const
+    {
+        size_t overviewSamples = (size_t)header.OverviewSamples() * header.OverviewSamples();
+        size_t tileSamples = (size_t)header.TileSamples() * header.TileSamples();
+        return (overviewSamples + tileSamples * RESIDENT_TILES) * sizeof(uint16_t);
+    }
+
+    float Size() const
+    {
+        return header.Size();
+    }
+
+    // the whole terrain as one mesh from the overview, for renderers without the streaming path (softrast.h).
+    // Every step-th sample is used, so the vertices fit 16 bit indices; they hold terrain space position,
+    // normal and texture coordinate the way the terrain vertex shader computes them
+    void BuildOverviewMesh(std::vector<float>& vertices, std::vector<uint16_t>& indices) const
+    {
+        int samples = header.OverviewSamples();
+        int row = TerrainFileHeader::PaddedRow(samples);
+        int step = 1;
+        while (((samples - 1) / step + 1) * ((samples - 1) / step + 1) > 65536)
+            ++step;
+        int side = (samples - 1) / step + 1;
+        float spacing = header.Spacing * header.OverviewStep * step;
+        auto height = [&](int x, int y)
+        {
+            x = std::min(std::max(x, 0), side - 1) * step;
+            y = std::min(std::max(y, 0), side - 1) * step;
+            return Height(overview[(size_t)y * row + x]);
+        };
+
+        vertices.clear();
+        indices.clear();
+        vertices.reserve((size_t)side * side * 8);
+        for (int y = 0; y < side; ++y)
+        {
+            for (int x = 0; x < side; ++x)
+            {
+                glm::vec2 position = origin + glm::vec2((float)x, (float)y) * spacing;
+                float slopeX = height(x + 1, y) - height(x - 1, y);
+                float slopeY = height(x, y + 1) - height(x, y - 1);
+                glm::vec3 normal = glm::normalize(glm::vec3(-slopeX, -slopeY, 2.0f * spacing));
+                float vertex[8] = { position.x, position.y, height(x, y), normal.x, normal.y, normal.z,
+                    position.x / 30.0f, position.y / 30.0f };
+                vertices.insert(vertices.end(), vertex, vertex + 8);
+            }
+        }
+        indices.reserve((size_t)(side - 1) * (side - 1) * 6);
+        for (int y = 0; y + 1 < side; ++y)
+        {
+            for (int x = 0; x + 1 < side; ++x)
+            {
+                uint16_t corner = (uint16_t)(y * side + x);
+                uint16_t quad[6] = { corner, (uint16_t)(corner + 1), (uint16_t)(corner + side + 1),
+                    (uint16_t)(corner + side + 1), (uint16_t)(corner + side), corner };
+                indices.insert(indices.end(), quad, quad + 6);
+            }
+        }
+    }
+
+    int Nodes = 0;              // drawn last frame
+    GLuint Triangles = 0;
+
+private:
+    static const int OVERVIEW_UNIT = 1;
+    static const int TILES_UNIT = 2;
+
+    struct Node
+    {
+        glm::vec2 Origin;
+        float Size;
+        int Level;
+        int Quadrants;          // bit per quarter to draw, x then y
+        int Layer;              // tile layer with the node's heights, -1 for the overview
+        glm::vec2 TileOrigin;
+    };
+
+    struct LoadedTile
+    {
+        int Tile;
+        std::vector<uint16_t> Samples;  // empty if the read failed
+    };
+
+    static void SetSampling(GLenum target)
+    {
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    // how far from the camera nodes of a level are drawn; the top level covers everything
+    float Range(int level) const
+    {
+        return level >= levelCount - 1 ? 1e30f : LEAF_RANGE * (float)(1 << level);
+    }
+
+    float Height(uint16_t value) const
+    {
+        return header.HeightMin + (header.HeightMax - header.HeightMin) * value / 65535.0f;
+    }
+
+    static float BoxDistance(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec3& point)
+    {
+        glm::vec3 nearest = glm::clamp(point, boxMin, boxMax);
+        return glm::length(point - nearest);
+    }
+
+    bool BoxInFrustum(const glm::vec3& boxMin, const glm::vec3& boxMax) const
+    {
+        for (const glm::vec4& plane : localPlanes)
+        {
+            glm::vec3 corner(plane.x >= 0.0f ? boxMax.x : boxMin.x, plane.y >= 0.0f ? boxMax.y : boxMin.y,
+                plane.z >= 0.0f ? boxMax.z : boxMin.z);
+            if (plane.x * corner.x + plane.y * corner.y + plane.z * corner.z + plane.w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    // height bounds of a node, from the ranges of the tiles it covers
+    void NodeHeights(float x, float y, float size, float& low, float& high) const
+    {
+        float tileWorld = header.TileSize * header.Spacing;
+        int last = (int)header.TilesPerSide - 1;
+        int tx0 = std::min((int)((x - origin.x) / tileWorld), last);
+        int ty0 = std::min((int)((y - origin.y) / tileWorld), last);
+        int tiles = std::max((int)(size / tileWorld), 1);
+        uint16_t minimum = 65535, maximum = 0;
+        for (int ty = ty0; ty < std::min(ty0 + tiles, last + 1); ++ty)
+        {
+            for (int tx = tx0; tx < std::min(tx0 + tiles, last + 1); ++tx)
+            {
+                int tile = ty * header.TilesPerSide + tx;
+                minimum = std::min(minimum, ranges[tile * 2]);
+                maximum = std::max(maximum, ranges[tile * 2 + 1]);
+            }
+        }
+        low = Height(minimum);
+        high = Height(maximum);
+    }
+
+    // CDLOD selection. False if the node is beyond its level's range, so its parent covers the area instead
+    bool SelectNode(float x, float y, float size, int level)
+    {
+        float low, high;
+        NodeHeights(x, y, size, low, high);
+        glm::vec3 boxMin(x, y, low), boxMax(x + size, y + size, high);
+        float distance = BoxDistance(boxMin, boxMax, camera);
+        if (distance > Range(level))
+            return false;
+        if (!BoxInFrustum(boxMin, boxMax))
+            return true;        // covered, nothing to draw
+
+        int quadrants = 15;
+        if (level > 0 && distance <= Range(level - 1))
+        {
+            float half = size * 0.5f;
+            quadrants = 0;
+            for (int quadrant = 0; quadrant < 4; ++quadrant)
+                if (!SelectNode(x + (quadrant & 1) * half, y + (quadrant >> 1) * half, half, level - 1))
+                    quadrants |= 1 << quadrant;
+        }
+        if (quadrants == 0 || nodes.size() >= (size_t)MAX_NODES)
+            return true;
+
+        Node node = { glm::vec2(x, y), size, level, quadrants, -1, glm::vec2(0.0f) };
+        if (level < detailLevels)
+        {
+            // nodes this fine never span more than one tile
+            float tileWorld = header.TileSize * header.Spacing;
+            int tx = (int)((x - origin.x) / tileWorld), ty = (int)((y - origin.y) / tileWorld);
+            node.Layer = tileLayers[ty * header.TilesPerSide + tx];
+            node.TileOrigin = origin + glm::vec2(tx * tileWorld, ty * tileWorld);
+        }
+        nodes.push_back(node);
+        return true;
+    }
+
+    // least recently needed layer that no node wants this frame, -1 if there is none
+    int FreeLayer() const
+    {
+        int best = -1;
+        for (int layer = 0; layer < RESIDENT_TILES; ++layer)
+        {
+            if (layerTiles[layer] < 0)
+                return layer;
+            if (layerUsed[layer] != frame && (best < 0 || layerUsed[layer] < layerUsed[best]))
+                best = layer;
+        }
+        return best;
+    }
+
+    void StopLoader()
+    {
+        if (!loader.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            loaderRunning = false;
+        }
+        wake.notify_one();
+        loader.join();
+    }
+
+    // ---- loader thread ----
+
+    void Load()
+    {
+        FILE* file = fopen(path.c_str(), "rb");
+        size_t samples = header.TileBytes() / sizeof(uint16_t);
+        while (true)
+        {
+            LoadedTile tile;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return !loaderRunning || !requests.empty(); });
+                if (!loaderRunning)
+                    break;
+                tile.Tile = requests.front();
+                requests.pop_front();
+            }
+
+            tile.Samples.resize(samples);
+            long offset = (long)(header.TilesOffset + (uint64_t)tile.Tile * header.TileBytes());
+            if (!file || fseek(file, offset, SEEK_SET) != 0 || fread(tile.Samples.data(), sizeof(uint16_t), samples, file) != samples)
+            {
+                LOG_ERROR("Terrain: failed to read tile %d of %s", tile.Tile, path.c_str());
+                tile.Samples.clear();
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            loaded.push_back(std::move(tile));
+        }
+        if (file)
+            fclose(file);
+    }
+
+    TerrainFileHeader header = {};
+    std::string path;
+    std::vector<uint16_t> ranges;       // min and max per tile
+    std::vector<uint16_t> overview;     // until it is uploaded
+    glm::vec2 origin;                   // terrain space corner of the map
+    int levelCount = 1;
+    int detailLevels = 0;               // levels finer than the overview, drawn from tiles
+
+    std::vector<int> tileLayers;        // per tile, -1 when not resident
+    std::vector<bool> tileQueued;       // requested, loading or loaded but not yet taken; guarded by mutex
+    std::vector<int> layerTiles;        // per layer, -1 when free
+    std::vector<unsigned int> layerUsed;
+    unsigned int frame = 0;
+
+    std::vector<Node> nodes;
+    glm::vec4 localPlanes[6];
+    glm::vec3 camera;
+
+    GLuint program = 0;
+    GLuint overviewTexture = 0, tileTexture = 0;
+    GLuint gridVAO = 0;
+    GLuint gridBuffers[2] = { 0, 0 };
+    GLint modelLocation = -1, cameraLocation = -1, nodeOriginLocation = -1, nodeSizeLocation = -1;
+    GLint morphRangeLocation = -1, tileLayerLocation = -1, tileOriginLocation = -1;
+
+    std::thread loader;
+    std::mutex mutex;                   // guards the queues and tileQueued
+    std::condition_variable wake;
+    std::deque<int> requests;
+    std::deque<LoadedTile> loaded;
+    bool loaderRunning = false;
+};
+#endif
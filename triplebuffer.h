@@ -0,0 +1,60 @@
+#pragma once
+
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+
+// Lock-free handoff of whole values from one producer thread to one consumer thread. The producer fills its
+// own buffer and publishes it, the consumer takes the most recently published one; the third buffer sits in
+// between, so neither side ever waits for the other or sees a half written value. A value the consumer never
+// picked up is overwritten by the next one (check Pending first if every value matters).
+template <class T>
+class TripleBuffer
+{
+public:
+    // producer: the buffer to fill; it keeps whatever was in it two publishes ago, so reuse its storage
+    T& WriteBuffer()
+    {
+        return buffers[back];
+    }
+
+    // producer: hands the write buffer over and gets the spare one back in its place
+    void Publish()
+    {
+        int previous = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+        back = previous & INDEX;
+    }
+
+    // consumer: switches ReadBuffer to the newest published value; false if nothing new was published
+    bool Consume()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        int previous = middle.exchange(front, std::memory_order_acq_rel);
+        front = previous & INDEX;
+        return true;
+    }
+
+    // consumer: the value taken by the last successful Consume
+    const T& ReadBuffer() const
+    {
+        return buffers[front];
+    }
+
+    // either side: a published value is waiting for the consumer
+    bool Pending() const
+    {
+        return (middle.load(std::memory_order_acquire) & FRESH) != 0;
+    }
+
+private:
+    static const int INDEX = 3;
+    static const int FRESH = 4;
+
+    T buffers[3];
+    int back = 0;                               // producer only
+    alignas(64) std::atomic<int> middle{ 1 };   // index of the spare buffer plus the FRESH bit
+    alignas(64) int front = 2;                  // consumer only
+};
+#endif
@@ -0,0 +1,677 @@
+#pragma once
+
+#ifndef VTEXTURE_H
+#define VTEXTURE_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+#include "glstate.h"
+#include "logger.h"
+#include "renderqueue.h"
+
+// Virtual texture page file: the image resampled to a power of two square and its mip chain down to a single
+// page, cut into PageSize x PageSize pages. Every page is stored with Border texels of its neighbours around
+// it, wrapped the way GL_MIRRORED_REPEAT wraps at the image edges, so bilinear filtering across a page edge
+// reads the right texels wherever the neighbour page ended up in the cache.
+//
+// File layout: the header, then the pages level by level from the finest, each level row by row, each page
+// SlotSize()^2 RGBA8 texels.
+struct VirtualTextureFileHeader
+{
+    static const uint32_t MAGIC = 0x58455456;   // "VTEX"
+    static const uint32_t VERSION = 1;
+
+    uint32_t Magic;
+    uint32_t Version;
+    uint32_t Size;              // texels along a side of the finest level
+    uint32_t Levels;
+    uint32_t PageSize;
+    uint32_t Border;
+    uint64_t PagesOffset;
+
+    int PagesPerSide(int level) const { return std::max(1, (int)(Size / PageSize) >> level); }
+    int SlotSize() const { return (int)(PageSize + Border * 2); }
+    size_t PageBytes() const { return (size_t)SlotSize() * SlotSize() * 4; }
+
+    // pages stored before the given page
+    uint64_t PageIndex(int level, int x, int y) const
+    {
+        uint64_t index = 0;
+        for (int finer = 0; finer < level; ++finer)
+            index += (uint64_t)PagesPerSide(finer) * PagesPerSide(finer);
+        return index + (uint64_t)y * PagesPerSide(level) + x;
+    }
+};
+
+
+// Writes the page file of an RGBA8 image, bottom row first like the textures GL gets
+class VirtualTextureBaker
+{
+public:
+    static bool Bake(const unsigned char* image, int width, int height, int pageSize, int border, const std::string& path)
+    {
+        VirtualTextureFileHeader header = {};
+        header.Magic = VirtualTextureFileHeader::MAGIC;
+        header.Version = VirtualTextureFileHeader::VERSION;
+        header.Size = (uint32_t)pageSize;
+        while (header.Size < (uint32_t)width || header.Size < (uint32_t)height)
+            header.Size *= 2;
+        header.Levels = 1;
+        while ((header.Size >> (header.Levels - 1)) > (uint32_t)pageSize)
+            ++header.Levels;
+        header.PageSize = (uint32_t)pageSize;
+        header.Border = (uint32_t)border;
+        header.PagesOffset = sizeof(header);
+
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file)
+            return false;
+        fwrite(&header, sizeof(header), 1, file);
+
+        // the finest level, stretched bilinearly to the square
+        int size = (int)header.Size;
+        std::vector<unsigned char> level((size_t)size * size * 4);
+        for (int y = 0; y < size; ++y)
+        {
+            float sy = std::min(std::max((y + 0.5f) * height / size - 0.5f, 0.0f), (float)(height - 1));
+            int y0 = (int)sy, y1 = std::min(y0 + 1, height - 1);
+            float fy = sy - y0;
+            for (int x = 0; x < size; ++x)
+            {
+                float sx = std::min(std::max((x + 0.5f) * width / size - 0.5f, 0.0f), (float)(width - 1));
+                int x0 = (int)sx, x1 = std::min(x0 + 1, width - 1);
+                float fx = sx - x0;
+                for (int c = 0; c < 4; ++c)
+                {
+                    float a = image[((size_t)y0 * width + x0) * 4 + c], b = image[((size_t)y0 * width + x1) * 4 + c];
+                    float d = image[((size_t)y1 * width + x0) * 4 + c], e = image[((size_t)y1 * width + x1) * 4 + c];
+                    float value = (a + (b - a) * fx) + ((d + (e - d) * fx) - (a + (b - a) * fx)) * fy;
+                    level[((size_t)y * size + x) * 4 + c] = (unsigned char)(value + 0.5f);
+                }
+            }
+        }
+
+        int slot = header.SlotSize();
+        std::vector<unsigned char> page(header.PageBytes());
+        for (int l = 0; l < (int)header.Levels; ++l)
+        {
+            int pages = header.PagesPerSide(l);
+            for (int py = 0; py < pages; ++py)
+            {
+                for (int px = 0; px < pages; ++px)
+                {
+                    for (int y = 0; y < slot; ++y)
+                    {
+                        int sy = Mirror(py * pageSize + y - border, size);
+                        for (int x = 0; x < slot; ++x)
+                        {
+                            int sx = Mirror(px * pageSize + x - border, size);
+                            memcpy(&page[((size_t)y * slot + x) * 4], &level[((size_t)sy * size + sx) * 4], 4);
+                        }
+                    }
+                    fwrite(page.data(), 1, page.size(), file);
+                }
+            }
+
+            // 2x2 box filter to the next level
+            int half = size / 2;
+            for (int y = 0; y < half; ++y)
+                for (int x = 0; x < half; ++x)
+                    for (int c = 0; c < 4; ++c)
+                    {
+                        int sum = level[((size_t)(y * 2) * size + x * 2) * 4 + c] + level[((size_t)(y * 2) * size + x * 2 + 1) * 4 + c]
+                            + level[((size_t)(y * 2 + 1) * size + x * 2) * 4 + c] + level[((size_t)(y * 2 + 1) * size + x * 2 + 1) * 4 + c];
+                        level[((size_t)y * half + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+                    }
+            size = half;
+        }
+
+        bool ok = !ferror(file);
+        return fclose(file) == 0 && ok;
+    }
+
+private:
+    // texel coordinate wrapped like GL_MIRRORED_REPEAT
+    static int Mirror(int x, int size)
+    {
+        int period = size * 2;
+        x = ((x % period) + period) % period;
+        return x < size ? x : period - 1 - x;
+    }
+};
+
+
+// Virtual textures: only the pages of each texture that are on screen, at the detail they are seen at, are in
+// video memory. All of them share one physical page cache, a texture of SLOT_SIZE square slots whose count
+// follows the screen's resolution rather than the size of the textures.
+//
+// Each texture has a page table, an RGBA8 texture with one texel per page and a mip level per texture level,
+// holding the slot its page is in (r, g) and whether it is resident (a). The scene shader picks a level from
+// the texture coordinate derivatives and walks up the page table's levels until it finds a resident page, so
+// a page that hasn't arrived yet shows a blurrier version of itself; the single page of the coarsest level is
+// always resident.
+//
+// What is needed comes from a feedback pass at 1/FEEDBACK_SCALE of the resolution that writes the page and
+// level every pixel wants. It is read back without waiting, like the object picker, and the pages missing are
+// read from the page files by a loader thread, coarse first, then uploaded a few per frame into free slots or
+// the least recently needed one.
+//
+// Everything but the loader thread belongs to the thread that owns the GL context.
+class VirtualTextureCache
+{
+public:
+    static const int PAGE_SIZE = 128;           // texels, must match the shaders
+    static const int BORDER = 1;                // enough for bilinear filtering
+    static const int SLOT_SIZE = PAGE_SIZE + BORDER * 2;
+    static const int MAX_TEXTURES = 15;         // the feedback encoding has 4 bits for the texture
+    static const int FEEDBACK_SCALE = 8;
+    static const int MAX_READBACKS = 3;
+    static const int UPLOADS_PER_FRAME = 8;
+    static const int MIN_SLOTS = 64;
+    static const int MAX_SLOTS = 1024;          // a 32x32 slot grid, 66 MB
+    static constexpr float SCREENS_OF_PAGES = 4.0f;  // slots per page worth of pixels on screen
+    static const int CACHE_UNIT = 3;
+
+    ~VirtualTextureCache()
+    {
+        StopLoader();
+    }
+
+    // adds the texture in a page file, giving its page table; false if the file is missing, from another
+    // version or doesn't match the shaders' page size. Every texture is opened before Create
+    bool Open(const std::string& path, GLuint& table, GLState& state)
+    {
+        if (textures.size() >= (size_t)MAX_TEXTURES)
+            return false;
+        Texture texture;
+        texture.Path = path;
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file)
+            return false;
+        VirtualTextureFileHeader& header = texture.Header;
+        bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.Magic == VirtualTextureFileHeader::MAGIC
+            && header.Version == VirtualTextureFileHeader::VERSION && header.PageSize == PAGE_SIZE && header.Border == BORDER
+            && header.Levels > 0 && header.Levels <= 12 && (header.Size >> (header.Levels - 1)) == PAGE_SIZE;
+        if (valid)
+        {
+            // the coarsest page stays in memory, to put back whenever the cache is recreated
+            int coarsest = header.Levels - 1;
+            texture.Coarsest.resize(header.PageBytes());
+            valid = fseek(file, (long)(header.PagesOffset + header.PageIndex(coarsest, 0, 0) * header.PageBytes()), SEEK_SET) == 0
+                && fread(texture.Coarsest.data(), 1, texture.Coarsest.size(), file) == texture.Coarsest.size();
+        }
+        fclose(file);
+        if (!valid)
+            return false;
+
+        glGenTextures(1, &texture.Table);
+        state.BindTexture(0, GL_TEXTURE_2D, texture.Table);
+        for (int level = 0; level < (int)header.Levels; ++level)
+        {
+            int pages = header.PagesPerSide(level);
+            std::vector<GLuint> empty((size_t)pages * pages, 0);
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, pages, pages, 0, GL_RGBA, GL_UNSIGNED_BYTE, empty.data());
+            texture.Slots.push_back(std::vector<int>((size_t)pages * pages, -1));
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header.Levels - 1);
+        texture.Dirty.assign(header.Levels, false);
+        table = texture.Table;
+        textures.push_back(std::move(texture));
+        return true;
+    }
+
+    // sceneProgram samples the virtual textures, feedbackProgram draws the feedback; both use the page table
+    // on unit 0. The cache is sized for a width x height screen
+    void Create(GLuint sceneProgram, GLuint feedbackProgram, int width, int height, GLState& state)
+    {
+        this->feedbackProgram = feedbackProgram;
+        state.UseProgram(sceneProgram);
+        glUniform1i(glGetUniformLocation(sceneProgram, "virtualTexture"), GL_TRUE);
+        glUniform1i(glGetUniformLocation(sceneProgram, "pageCache"), CACHE_UNIT);
+        state.UseProgram(feedbackProgram);
+        glUniform1i(glGetUniformLocation(feedbackProgram, "pageTable"), 0);
+        glUniform1f(glGetUniformLocation(feedbackProgram, "lodBias"), -std::log2((float)FEEDBACK_SCALE));
+        feedbackModelLocation = glGetUniformLocation(feedbackProgram, "model");
+        feedbackTextureLocation = glGetUniformLocation(feedbackProgram, "textureIndex");
+
+        glGenTextures(1, &cache);
+        glGenBuffers(MAX_READBACKS, readbacks);
+        glGenFramebuffers(1, &readFramebuffer);
+        Resize(width, height, state);
+
+        loaderRunning = true;
+        loader = std::thread([this] { Load(); });
+    }
+
+    void Destroy()
+    {
+        StopLoader();
+        for (int i = 0; i < MAX_READBACKS; ++i)
+        {
+            if (fences[i])
+                glDeleteSync(fences[i]);
+            fences[i] = 0;
+        }
+        glDeleteBuffers(MAX_READBACKS, readbacks);
+        glDeleteFramebuffers(1, &readFramebuffer);
+        glDeleteTextures(1, &cache);
+        for (Texture& texture : textures)
+            glDeleteTextures(1, &texture.Table);
+        textures.clear();
+        cache = 0;
+    }
+
+    bool Created() const
+    {
+        return cache != 0;
+    }
+
+    // sizes the cache for a width x height screen. A different slot count recreates it empty but for the
+    // coarsest pages, and everything on screen streams in again
+    void Resize(int width, int height, GLState& state)
+    {
+        float screenPages = (float)width * height / (PAGE_SIZE * PAGE_SIZE);
+        int wanted = std::min(std::max((int)std::ceil(screenPages * SCREENS_OF_PAGES), MIN_SLOTS), MAX_SLOTS);
+        int side = (int)std::ceil(std::sqrt((float)wanted));
+        if (side == slotsPerSide)
+            return;
+
+        slotsPerSide = side;
+        state.BindTexture(CACHE_UNIT, GL_TEXTURE_2D, cache);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, side * SLOT_SIZE, side * SLOT_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        slots.assign((size_t)side * side, Slot());
+        for (Texture& texture : textures)
+        {
+            for (std::vector<int>& level : texture.Slots)
+                std::fill(level.begin(), level.end(), -1);
+            std::fill(texture.Dirty.begin(), texture.Dirty.end(), true);
+        }
+        for (size_t t = 0; t < textures.size(); ++t)
+        {
+            int coarsest = textures[t].Header.Levels - 1;
+            Place((int)t, coarsest, 0, 0, (int)t, textures[t].Coarsest.data(), state);
+            slots[t].Pinned = true;
+        }
+        UploadTables(state);
+    }
+
+    // takes in the newest finished feedback, asks the loader for what it is missing and uploads what the
+    // loader has read, within the per frame budget
+    void Update(GLState& state)
+    {
+        std::vector<uint32_t> wanted;
+        if (PollFeedback(wanted))
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            // requests no longer wanted are dropped and the rest queued again, coarse first. A page keeps its
+            // flag while the loader reads it, so it isn't asked for twice
+            for (uint32_t request : requests)
+                queued.erase(request);
+            requests.clear();
+            for (uint32_t request : wanted)
+            {
+                if (requests.size() >= slots.size())
+                    break;
+                if (queued.insert(request).second)
+                    requests.push_back(request);
+            }
+            Waiting = requests.size();
+        }
+        wake.notify_one();
+
+        std::vector<LoadedPage> arrived;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (int i = 0; i < UPLOADS_PER_FRAME && !loaded.empty(); ++i)
+            {
+                queued.erase(loaded.front().Page);
+                arrived.push_back(std::move(loaded.front()));
+                loaded.pop_front();
+            }
+        }
+
+        Uploads = 0;
+        for (LoadedPage& page : arrived)
+        {
+            int t, level, x, y;
+            Decode(page.Page, t, level, x, y);
+            if (page.Texels.empty() || textures[t].Slots[level][y * textures[t].Header.PagesPerSide(level) + x] >= 0)
+                continue;
+            int slot = FreeSlot();
+            if (slot < 0)
+                continue;       // every slot is needed on screen; the page will be asked for again
+            Place(t, level, x, y, slot, page.Texels.data(), state);
+            ++Uploads;
+        }
+        UploadTables(state);
+    }
+
+    // draws the page and level every pixel needs into the bound R32UI target (cleared to 0, nothing),
+    // with the queue's opaque draws seen through view. The viewport is the caller's, at 1/FEEDBACK_SCALE of
+    // the scene's
+    void DrawFeedback(const RenderQueue& queue, GLState& state, const glm::mat4& view, const glm::mat4& projection, const glm::vec2& uvScale)
+    {
+        state.UseProgram(feedbackProgram);
+        glUniformMatrix4fv(glGetUniformLocation(feedbackProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(feedbackProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        glUniform2fv(glGetUniformLocation(feedbackProgram, "uvScale"), 1, glm::value_ptr(uvScale));
+        for (const DrawItem& item : queue.Items)
+        {
+            int t = Index(item.Texture);
+            if (t < 0)
+                continue;
+            state.BindTexture(0, GL_TEXTURE_2D, item.Texture);
+            glUniformMatrix4fv(feedbackModelLocation, 1, GL_FALSE, glm::value_ptr(item.Model));
+            glUniform1ui(feedbackTextureLocation, (GLuint)t + 1);
+            state.BindVertexArray(item.VAO);
+            glDrawElements(GL_TRIANGLES, item.IndexCount, GL_UNSIGNED_SHORT, (const void*)item.IndexOffset);
+        }
+    }
+
+    // queues a read of the lower left width x height of the feedback texture. The texture goes on a read
+    // framebuffer of the cache's own, which is left bound for reading. Skipped while every readback is in
+    // flight
+    void ReadFeedback(GLuint feedback, int width, int height)
+    {
+        if (pendingReads == MAX_READBACKS)
+            return;
+        int slot = (firstRead + pendingReads) % MAX_READBACKS;
+        size_t bytes = (size_t)width * height * sizeof(GLuint);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, feedback, 0);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readbacks[slot]);
+        if (readbackBytes[slot] < bytes)
+        {
+            glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+            readbackBytes[slot] = bytes;
+        }
+        glReadPixels(0, 0, width, height, GL_RED_INTEGER, GL_UNSIGNED_INT, (void*)0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        readPixels[slot] = width * height;
+        fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        ++pendingReads;
+    }
+
+    GLuint Cache() const { return cache; }
+    int Slots() const { return (int)slots.size(); }
+    size_t CacheBytes() const { return slots.size() * SLOT_SIZE * SLOT_SIZE * 4; }
+
+    int ResidentPages() const
+    {
+        int resident = 0;
+        for (const Slot& slot : slots)
+            resident += slot.Texture >= 0;
+        return resident;
+    }
+
+    int Uploads = 0;            // pages uploaded this frame
+    int FeedbackPages = 0;      // different pages the last feedback asked for
+    size_t Waiting = 0;         // pages queued for the loader at the last feedback
+
+private:
+    struct Texture
+    {
+        std::string Path;
+        VirtualTextureFileHeader Header;
+        GLuint Table = 0;
+        std::vector<std::vector<int>> Slots;    // per level, per page: its slot, -1 when not resident
+        std::vector<bool> Dirty;                // per level, page table texels to upload
+        std::vector<unsigned char> Coarsest;
+    };
+
+    struct Slot
+    {
+        int Texture = -1;       // -1 when free
+        int Level = 0, X = 0, Y = 0;
+        unsigned int Used = 0;  // feedback that last needed the page
+        bool Pinned = false;
+    };
+
+    struct LoadedPage
+    {
+        uint32_t Page;
+        std::vector<unsigned char> Texels;  // empty if the read failed
+    };
+
+    // pages are named like the feedback writes them: texture + 1, level, y and x in 4, 4, 12 and 12 bits
+    static uint32_t Encode(int texture, int level, int x, int y)
+    {
+        return (uint32_t)(texture + 1) << 28 | (uint32_t)level << 24 | (uint32_t)y << 12 | (uint32_t)x;
+    }
+
+    static void Decode(uint32_t page, int& texture, int& level, int& x, int& y)
+    {
+        texture = (int)(page >> 28) - 1;
+        level = (int)(page >> 24) & 0xF;
+        y = (int)(page >> 12) & 0xFFF;
+        x = (int)page & 0xFFF;
+    }
+
+    int Index(GLuint table) const
+    {
+        for (size_t t = 0; t < textures.size(); ++t)
+            if (textures[t].Table == table)
+                return (int)t;
+        return -1;
+    }
+
+    // the oldest finished feedback turned into the pages to load, coarse first, with every resident page it
+    // needs, its coarser fallbacks included, marked as used. False if no feedback has come back since
+    bool PollFeedback(std::vector<uint32_t>& wanted)
+    {
+        if (pendingReads == 0)
+            return false;
+        GLenum status = glClientWaitSync(fences[firstRead], 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED)
+            return false;
+        glDeleteSync(fences[firstRead]);
+        fences[firstRead] = 0;
+
+        std::vector<uint32_t> pages;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readbacks[firstRead]);
+        const GLuint* values = (const GLuint*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, readPixels[firstRead] * sizeof(GLuint), GL_MAP_READ_BIT);
+        if (values)
+        {
+            for (int i = 0; i < readPixels[firstRead]; ++i)
+                if (values[i])
+                    pages.push_back(values[i]);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        firstRead = (firstRead + 1) % MAX_READBACKS;
+        --pendingReads;
+        if (status == GL_WAIT_FAILED || !values)
+            return false;
+
+        std::sort(pages.begin(), pages.end());
+        pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+        FeedbackPages = (int)pages.size();
+        ++frame;
+        for (uint32_t page : pages)
+        {
+            int t, level, x, y;
+            Decode(page, t, level, x, y);
+            if (t < 0 || t >= (int)textures.size() || level >= (int)textures[t].Header.Levels)
+                continue;
+            const Texture& texture = textures[t];
+            for (; level < (int)texture.Header.Levels; ++level, x >>= 1, y >>= 1)
+            {
+                int pagesPerSide = texture.Header.PagesPerSide(level);
+                if (x >= pagesPerSide || y >= pagesPerSide)
+                    break;
+                int slot = texture.Slots[level][y * pagesPerSide + x];
+                if (slot >= 0)
+                    slots[slot].Used = frame;
+                else
+                    wanted.push_back(Encode(t, level, x, y));
+            }
+        }
+        std::sort(wanted.begin(), wanted.end(), [](uint32_t a, uint32_t b)
+        {
+            uint32_t levelA = (a >> 24) & 0xF, levelB = (b >> 24) & 0xF;
+            return levelA != levelB ? levelA > levelB : a < b;
+        });
+        wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+        return true;
+    }
+
+    // a free slot, else the least recently needed one that the last feedback didn't need; -1 if there is none
+    int FreeSlot() const
+    {
+        int best = -1;
+        for (int slot = 0; slot < (int)slots.size(); ++slot)
+        {
+            if (slots[slot].Texture < 0)
+                return slot;
+            if (!slots[slot].Pinned && slots[slot].Used != frame && (best < 0 || slots[slot].Used < slots[best].Used))
+                best = slot;
+        }
+        return best;
+    }
+
+    // uploads a page into slot, evicting whatever was there
+    void Place(int t, int level, int x, int y, int slot, const unsigned char* texels, GLState& state)
+    {
+        Slot& target = slots[slot];
+        if (target.Texture >= 0)
+        {
+            Texture& evicted = textures[target.Texture];
+            evicted.Slots[target.Level][target.Y * evicted.Header.PagesPerSide(target.Level) + target.X] = -1;
+            evicted.Dirty[target.Level] = true;
+        }
+        target.Texture = t;
+        target.Level = level;
+        target.X = x;
+        target.Y = y;
+        target.Used = frame;
+        textures[t].Slots[level][y * textures[t].Header.PagesPerSide(level) + x] = slot;
+        textures[t].Dirty[level] = true;
+
+        state.BindTexture(CACHE_UNIT, GL_TEXTURE_2D, cache);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % slotsPerSide) * SLOT_SIZE, (slot / slotsPerSide) * SLOT_SIZE, SLOT_SIZE, SLOT_SIZE,
+            GL_RGBA, GL_UNSIGNED_BYTE, texels);
+    }
+
+    // page table levels whose pages came or went, whole; they are a few KB at most
+    void UploadTables(GLState& state)
+    {
+        std::vector<GLuint> entries;
+        for (Texture& texture : textures)
+        {
+            for (int level = 0; level < (int)texture.Header.Levels; ++level)
+            {
+                if (!texture.Dirty[level])
+                    continue;
+                texture.Dirty[level] = false;
+                int pages = texture.Header.PagesPerSide(level);
+                entries.assign((size_t)pages * pages, 0);
+                for (size_t page = 0; page < entries.size(); ++page)
+                {
+                    int slot = texture.Slots[level][page];
+                    if (slot >= 0)  // r, g: the slot's column and row, a: resident
+                        entries[page] = (GLuint)(slot % slotsPerSide) | (GLuint)(slot / slotsPerSide) << 8 | 0xFF000000u;
+                }
+                state.BindTexture(0, GL_TEXTURE_2D, texture.Table);
+                glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, pages, pages, GL_RGBA, GL_UNSIGNED_BYTE, entries.data());
+            }
+        }
+    }
+
+    void StopLoader()
+    {
+        if (!loader.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            loaderRunning = false;
+        }
+        wake.notify_one();
+        loader.join();
+    }
+
+    // ---- loader thread ----
+
+    void Load()
+    {
+        std::vector<FILE*> files(textures.size(), nullptr);
+        while (true)
+        {
+            LoadedPage page;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return !loaderRunning || !requests.empty(); });
+                if (!loaderRunning)
+                    break;
+                page.Page = requests.front();
+                requests.pop_front();
+            }
+
+            int t, level, x, y;
+            Decode(page.Page, t, level, x, y);
+            const Texture& texture = textures[t];
+            if (!files[t])
+                files[t] = fopen(texture.Path.c_str(), "rb");
+            page.Texels.resize(texture.Header.PageBytes());
+            long offset = (long)(texture.Header.PagesOffset + texture.Header.PageIndex(level, x, y) * texture.Header.PageBytes());
+            if (!files[t] || fseek(files[t], offset, SEEK_SET) != 0 || fread(page.Texels.data(), 1, page.Texels.size(), files[t]) != page.Texels.size())
+            {
+                LOG_ERROR("Virtual texture: failed to read page %d,%d of level %d of %s", x, y, level, texture.Path.c_str());
+                page.Texels.clear();
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            loaded.push_back(std::move(page));
+        }
+        for (FILE* file : files)
+            if (file)
+                fclose(file);
+    }
+
+    std::vector<Texture> textures;      // fixed once the loader runs
+    std::vector<Slot> slots;
+    int slotsPerSide = 0;
+    unsigned int frame = 0;             // feedbacks taken in
+    GLuint cache = 0;
+
+    GLuint feedbackProgram = 0;
+    GLint feedbackModelLocation = -1, feedbackTextureLocation = -1;
+    GLuint readbacks[MAX_READBACKS] = {};
+    size_t readbackBytes[MAX_READBACKS] = {};
+    int readPixels[MAX_READBACKS] = {};
+    GLsync fences[MAX_READBACKS] = {};
+    GLuint readFramebuffer = 0;
+    int firstRead = 0;                  // oldest readback in flight
+    int pendingReads = 0;
+
+    std::thread loader;
+    std::mutex mutex;                   // guards the queues and queued
+    std::condition_variable wake;
+    std::deque<uint32_t> requests;
+    std::deque<LoadedPage> loaded;
+    std::unordered_set<uint32_t> queued;    // requested, loading or loaded but not yet taken
+    bool loaderRunning = false;
+};
+#endif
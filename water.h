@@ -0,0 +1,226 @@
+#pragma once
+
+#ifndef WATER_H
+#define WATER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "glstate.h"
+
+// A rectangle of water whose waves are simulated and drawn entirely on the GPU. The surface is a heightfield
+// of cells solving the wave equation, one compute shader invocation per cell and step, ping-ponging between
+// two RG32F textures that hold each cell's height now (r) and one step earlier (g). The vertex shader builds
+// the surface grid from gl_VertexID and reads its heights and slopes from the current texture, so there is
+// no vertex buffer and nothing per vertex on the CPU. The cell count is fixed, so a larger pool costs the
+// same and just gets coarser cells.
+//
+// Steps are fixed length and the edges reflect waves back, like the walls of a pool. Raindrops keep the
+// surface moving; the CPU only picks where they fall.
+//
+// The surface reflects a mirror image of the scene rendered separately (see Reflection and Plane), which the
+// fragment shader reads at the pixel's screen position, offset by the wave slope.
+class Water
+{
+public:
+    static const int MAX_CELLS = 256;           // along the longer side of the rectangle
+    static const int WORK_GROUP = 8;            // local size of the simulation shader in x and y
+    static const int MAX_STEPS_PER_FRAME = 4;   // after a stall the simulation slows down rather than catching up
+    static const int HEIGHTS_UNIT = 8;          // past the terrain's and the lit programs' units, so binding
+    static const int REFLECTION_UNIT = 9;       // these never swaps a texture out from under the terrain
+    static constexpr float TIMESTEP = 1.0f / 60.0f;
+    static constexpr float MAX_COURANT = 0.45f; // (speed * step / cell)^2 has to stay below 0.5 to be stable
+
+    glm::mat4 Model = glm::mat4(1.0f);  // water space (x, y across, z up) to world
+    float WaveSpeed = 1.5f;             // units per second
+    float Damping = 0.995f;             // per step
+    float DropInterval = 0.3f;          // seconds between raindrops
+    float DropStrength = 0.04f;         // height added at the center of a drop
+    float DropRadius = 2.5f;            // in cells
+
+    // simulateProgram is the compute shader, drawProgram draws the surface. min, max and height are in water
+    // space
+    void Create(GLuint simulateProgram, GLuint drawProgram, const glm::vec2& min, const glm::vec2& max, float height, GLState& state)
+    {
+        this->simulateProgram = simulateProgram;
+        this->drawProgram = drawProgram;
+        this->height = height;
+        origin = min;
+
+        // square cells as near as the rectangle allows, vertices on both edges
+        glm::vec2 size = max - min;
+        float longer = std::max(size.x, size.y);
+        columns = size.x >= size.y ? MAX_CELLS : std::max(2, (int)std::lround(size.x / longer * (MAX_CELLS - 1)) + 1);
+        rows = size.y > size.x ? MAX_CELLS : std::max(2, (int)std::lround(size.y / longer * (MAX_CELLS - 1)) + 1);
+        cellSize = glm::vec2(size.x / (columns - 1), size.y / (rows - 1));
+
+        std::vector<GLfloat> still((size_t)columns * rows * 2, 0.0f);
+        glGenTextures(2, textures);
+        for (GLuint texture : textures)
+        {
+            state.BindTexture(HEIGHTS_UNIT, GL_TEXTURE_2D, texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, columns, rows, 0, GL_RG, GL_FLOAT, still.data());
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+
+        // the grid comes from gl_VertexID, but a draw still needs a vertex array bound
+        glGenVertexArrays(1, &emptyVAO);
+
+        state.UseProgram(drawProgram);
+        glUniform1i(glGetUniformLocation(drawProgram, "heights"), HEIGHTS_UNIT);
+        glUniform1i(glGetUniformLocation(drawProgram, "reflection"), REFLECTION_UNIT);
+        glUniform2f(glGetUniformLocation(drawProgram, "cells"), (float)columns, (float)rows);
+        glUniform2f(glGetUniformLocation(drawProgram, "waterOrigin"), origin.x, origin.y);
+        glUniform2f(glGetUniformLocation(drawProgram, "cellSize"), cellSize.x, cellSize.y);
+        glUniform1f(glGetUniformLocation(drawProgram, "waterHeight"), height);
+        drawModelLocation = glGetUniformLocation(drawProgram, "model");
+        reflectionScaleLocation = glGetUniformLocation(drawProgram, "reflectionScale");
+        reflectionMaxLocation = glGetUniformLocation(drawProgram, "reflectionMax");
+
+        courantLocation = glGetUniformLocation(simulateProgram, "courant");
+        dampingLocation = glGetUniformLocation(simulateProgram, "damping");
+        dropLocation = glGetUniformLocation(simulateProgram, "drop");
+        dropRadiusLocation = glGetUniformLocation(simulateProgram, "dropRadius");
+        created = true;
+    }
+
+    void Destroy()
+    {
+        if (!created)
+            return;
+        glDeleteTextures(2, textures);
+        glDeleteVertexArrays(1, &emptyVAO);
+        created = false;
+    }
+
+    bool Created() const
+    {
+        return created;
+    }
+
+    // advances the simulation by the fixed steps that fit in deltaTime, carrying the remainder to the next
+    // frame
+    void Simulate(float deltaTime, GLState& state)
+    {
+        pending = std::min(pending + deltaTime, MAX_STEPS_PER_FRAME * TIMESTEP);
+        Steps = 0;
+        if (pending < TIMESTEP)
+            return;
+
+        // slow the waves down rather than blow up when the cells get small
+        float cell = std::min(cellSize.x, cellSize.y);
+        float courant = std::min(WaveSpeed * WaveSpeed * TIMESTEP * TIMESTEP / (cell * cell), MAX_COURANT);
+
+        state.UseProgram(simulateProgram);
+        glUniform1f(courantLocation, courant);
+        glUniform1f(dampingLocation, Damping);
+        glUniform1f(dropRadiusLocation, DropRadius);
+        for (; pending >= TIMESTEP; pending -= TIMESTEP)
+        {
+            untilDrop -= TIMESTEP;
+            if (untilDrop <= 0.0f)
+            {
+                std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+                glUniform3f(dropLocation, unit(random) * (columns - 1), unit(random) * (rows - 1), DropStrength * (0.5f + unit(random)));
+                untilDrop += DropInterval * (0.5f + unit(random));
+            }
+            else
+                glUniform3f(dropLocation, 0.0f, 0.0f, 0.0f);
+
+            glBindImageTexture(0, textures[current], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG32F);
+            glBindImageTexture(1, textures[1 - current], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG32F);
+            glDispatchCompute((columns + WORK_GROUP - 1) / WORK_GROUP, (rows + WORK_GROUP - 1) / WORK_GROUP, 1);
+            // the next step reads the result as an image, the surface as a texture
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+            current = 1 - current;
+            ++Steps;
+        }
+    }
+
+    // draws the surface with the draw program, whose view, projection and lighting uniforms are the
+    // caller's, as is the water material's texture on unit 0. reflection holds the mirror image in its
+    // lower left reflectionSize pixels, drawn at reflectionSize / viewportSize of the scene's resolution
+    void Draw(GLState& state, GLuint reflection, const glm::ivec2& reflectionSize, const glm::ivec2& reflectionTextureSize,
+        const glm::ivec2& viewportSize)
+    {
+        state.UseProgram(drawProgram);
+        state.BindTexture(HEIGHTS_UNIT, GL_TEXTURE_2D, textures[current]);
+        state.BindTexture(REFLECTION_UNIT, GL_TEXTURE_2D, reflection);
+        glUniformMatrix4fv(drawModelLocation, 1, GL_FALSE, glm::value_ptr(Model));
+
+        // gl_FragCoord to texture coordinates of the reflection, kept half a texel inside what was drawn
+        glm::vec2 texelSize = 1.0f / glm::vec2(reflectionTextureSize);
+        glm::vec2 scale = glm::vec2(reflectionSize) / glm::vec2(viewportSize) * texelSize;
+        glm::vec2 maxUV = glm::vec2(reflectionSize) * texelSize - texelSize * 0.5f;
+        glUniform2fv(reflectionScaleLocation, 1, glm::value_ptr(scale));
+        glUniform2fv(reflectionMaxLocation, 1, glm::value_ptr(maxUV));
+
+        state.BindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, Triangles() * 3);
+    }
+
+    // world space plane of the surface at rest, normal up (out of the water), as (normal, distance)
+    glm::vec4 Plane() const
+    {
+        glm::vec3 point = glm::vec3(Model * glm::vec4(0.0f, 0.0f, height, 1.0f));
+        glm::vec3 normal = glm::normalize(glm::mat3(glm::transpose(glm::inverse(Model))) * glm::vec3(0.0f, 0.0f, 1.0f));
+        return glm::vec4(normal, -glm::dot(normal, point));
+    }
+
+    // mirrors world space across the surface at rest. The view times this sees the reflected scene
+    glm::mat4 Reflection() const
+    {
+        glm::vec4 plane = Plane();
+        glm::vec3 n = glm::vec3(plane);
+        glm::mat4 mirror(1.0f);
+        for (int column = 0; column < 3; ++column)
+        {
+            for (int row = 0; row < 3; ++row)
+                mirror[column][row] -= 2.0f * n[row] * n[column];
+            mirror[3][column] = -2.0f * plane.w * n[column];
+        }
+        return mirror;
+    }
+
+    int Columns() const { return columns; }
+    int Rows() const { return rows; }
+    GLsizei Triangles() const { return (columns - 1) * (rows - 1) * 2; }
+
+    int Steps = 0;  // simulation steps run this frame
+
+private:
+    GLuint simulateProgram = 0;
+    GLuint drawProgram = 0;
+    GLuint textures[2] = { 0, 0 };
+    int current = 0;                    // texture with the latest step
+    GLuint emptyVAO = 0;
+    bool created = false;
+
+    glm::vec2 origin = glm::vec2(0.0f);
+    glm::vec2 cellSize = glm::vec2(1.0f);
+    float height = 0.0f;
+    int columns = 2;
+    int rows = 2;
+
+    float pending = 0.0f;               // simulation time not yet stepped
+    float untilDrop = 0.0f;
+    std::minstd_rand random;
+
+    GLint drawModelLocation = -1;
+    GLint reflectionScaleLocation = -1;
+    GLint reflectionMaxLocation = -1;
+    GLint courantLocation = -1;
+    GLint dampingLocation = -1;
+    GLint dropLocation = -1;
+    GLint dropRadiusLocation = -1;
+};
+#endif